@@ -0,0 +1,28 @@
+// Allocation through an optional MO_Allocator, a null allocator means the
+// c runtime. Memory returned by mem_alloc is always zeroed.
+
+static void*
+mem_alloc(MO_Allocator* allocator, size_t size) {
+	if(!allocator) return calloc(1, size);
+	void* result = allocator->alloc(allocator->user, size);
+	if(result) memset(result, 0, size);
+	return result;
+}
+
+static void
+mem_free(MO_Allocator* allocator, void* ptr, size_t size) {
+	if(!ptr) return;
+	if(!allocator) {
+		free(ptr);
+	} else {
+		allocator->free(allocator->user, ptr, size);
+	}
+}
+
+static char*
+mem_strdup(MO_Allocator* allocator, const char* str) {
+	size_t length = strlen(str);
+	char* result = mem_alloc(allocator, length + 1);
+	memcpy(result, str, length);
+	return result;
+}
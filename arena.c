@@ -0,0 +1,115 @@
+// Block arena for AST nodes.
+//
+// Memory is handed out zeroed and is only released all at once by
+// mop_arena_free, which makes discarding a whole parse a single call.
+
+#define ARENA_DEFAULT_BLOCK_SIZE (64 * 1024)
+
+typedef struct Arena_Block_t {
+	struct Arena_Block_t* next;
+	size_t                capacity;
+	size_t                used;
+} Arena_Block;
+
+struct MO_Arena_t {
+	Arena_Block*  blocks; // the block being filled is the first one
+	size_t        block_size;
+	MO_Allocator* allocator;
+};
+
+static void*
+arena_alloc(MO_Arena* arena, size_t size) {
+	size = (size + 7) & ~(size_t)7;
+
+	Arena_Block* block = arena->blocks;
+	if(!block || block->used + size > block->capacity) {
+		size_t capacity = MAX(arena->block_size, size);
+		block = mem_alloc(arena->allocator, sizeof(Arena_Block) + capacity);
+		block->capacity = capacity;
+		block->next = arena->blocks;
+		arena->blocks = block;
+	}
+
+	void* result = (u8*)(block + 1) + block->used;
+	block->used += size;
+	return result;
+}
+
+// Where the arena stood, see arena_reset
+typedef struct {
+	Arena_Block* block;
+	size_t       used;
+} Arena_Mark;
+
+static Arena_Mark
+arena_mark(MO_Arena* arena) {
+	Arena_Mark mark = { arena->blocks, (arena->blocks) ? arena->blocks->used : 0 };
+	return mark;
+}
+
+// Gives back everything allocated since mark was taken. Blocks merged in since
+// then are not allowed.
+static void
+arena_reset(MO_Arena* arena, Arena_Mark mark) {
+	while(arena->blocks != mark.block) {
+		Arena_Block* next = arena->blocks->next;
+		mem_free(arena->allocator, arena->blocks, sizeof(Arena_Block) + arena->blocks->capacity);
+		arena->blocks = next;
+	}
+	if(mark.block) {
+		// handed out zeroed again
+		memset((u8*)(mark.block + 1) + mark.used, 0, mark.block->used - mark.used);
+		mark.block->used = mark.used;
+	}
+}
+
+// Bytes taken from the allocator, block headers included.
+static size_t
+arena_bytes(MO_Arena* arena) {
+	size_t bytes = sizeof(MO_Arena);
+	for(Arena_Block* block = arena->blocks; block; block = block->next)
+		bytes += sizeof(Arena_Block) + block->capacity;
+	return bytes;
+}
+
+// Moves every block of src into dst and frees src. Blocks keep their
+// addresses, so nodes allocated in src stay valid. Both arenas must use the
+// same allocator.
+static void
+arena_merge(MO_Arena* dst, MO_Arena* src) {
+	if(!src) return;
+
+	Arena_Block* last = src->blocks;
+	if(last) {
+		while(last->next) last = last->next;
+		if(dst->blocks) {
+			// keep filling the current block of dst
+			last->next = dst->blocks->next;
+			dst->blocks->next = src->blocks;
+		} else {
+			dst->blocks = src->blocks;
+		}
+	}
+	mem_free(src->allocator, src, sizeof(MO_Arena));
+}
+
+MO_Arena*
+mop_arena_new(size_t block_size, MO_Allocator* allocator) {
+	MO_Arena* arena = mem_alloc(allocator, sizeof(MO_Arena));
+	arena->block_size = (block_size) ? block_size : ARENA_DEFAULT_BLOCK_SIZE;
+	arena->allocator = allocator;
+	return arena;
+}
+
+void
+mop_arena_free(MO_Arena* arena) {
+	if(!arena) return;
+
+	Arena_Block* block = arena->blocks;
+	while(block) {
+		Arena_Block* next = block->next;
+		mem_free(arena->allocator, block, sizeof(Arena_Block) + block->capacity);
+		block = next;
+	}
+	mem_free(arena->allocator, arena, sizeof(MO_Arena));
+}
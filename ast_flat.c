@@ -0,0 +1,170 @@
+// Flat, index based AST layout.
+//
+// Nodes are stored in pre-order in a single array, every node records the
+// index one past the end of its subtree, so the first child of node i is
+// i + 1 (when i + 1 < next) and siblings are reached by following next.
+// Tokens are referenced by their index in the lexer token array and the
+// only large payload (type specifiers and qualifiers) lives in a side table.
+
+static u16
+flat_node_op(MO_Ast* node) {
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+			return (u16)node->expression_binary.bo;
+		case MO_AST_EXPRESSION_CHAIN:
+			return (u16)node->expression_chain.bo;
+		case MO_AST_EXPRESSION_UNARY:
+			return (u16)node->expression_unary.uo;
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+			return (u16)node->expression_postfix_unary.po;
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:
+			return (u16)node->expression_postfix_binary.po;
+		case MO_AST_EXPRESSION_SIZEOF:
+			return (u16)node->expression_sizeof.is_type_name;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+			return (u16)node->direct_abstract_decl.type;
+		case MO_AST_PARAMETER_LIST:
+			return (u16)node->parameter_list.is_vararg;
+		default: break;
+	}
+	return 0;
+}
+
+static MO_Token*
+flat_node_token(MO_Ast* node) {
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_EXPRESSION_PRIMARY_CONSTANT:
+		case MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL:
+		case MO_AST_CONSTANT_FLOATING_POINT:
+		case MO_AST_CONSTANT_INTEGER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_CONSTANT_CHARACTER:
+			return node->expression_primary.data;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+			return node->direct_abstract_decl.name;
+		case MO_AST_ENUMERATOR:
+			return node->enumerator.enum_constant;
+		case MO_AST_TYPE_INFO: {
+			switch(node->specifier_qualifier.kind) {
+				case MO_TYPE_ALIAS: return node->specifier_qualifier.alias;
+				case MO_TYPE_ENUM: return node->specifier_qualifier.enum_name;
+				case MO_TYPE_STRUCT:
+				case MO_TYPE_UNION: return node->specifier_qualifier.struct_name;
+				default: break;
+			}
+		} break;
+		default: break;
+	}
+	return 0;
+}
+
+static u32
+flat_push_type_info(MO_Flat_Ast* flat, MO_Ast* node) {
+	MO_Flat_Type_Info info = {0};
+	info.kind = (u8)node->specifier_qualifier.kind;
+	info.qualifiers = (u8)node->specifier_qualifier.qualifiers;
+	info.storage_class = (u8)node->specifier_qualifier.storage_class;
+	if(node->specifier_qualifier.kind == MO_TYPE_PRIMITIVE) {
+		for(s32 i = 0; i < ARRAY_LENGTH(info.primitive); ++i)
+			info.primitive[i] = (u8)node->specifier_qualifier.primitive[i];
+	}
+
+	if(!flat->type_infos) flat->type_infos = array_new_with(MO_Flat_Type_Info, flat->allocator);
+	array_push(flat->type_infos, info);
+	flat->type_info_count = (int)array_length(flat->type_infos);
+
+	return (u32)(flat->type_info_count - 1);
+}
+
+static u32
+flat_push_node(MO_Flat_Ast* flat, MO_Ast* node, s32 slot) {
+	MO_Flat_Node n = {0};
+	n.kind = (u8)node->kind;
+	n.slot = (u32)slot;
+	n.op = flat_node_op(node);
+	n.token = MO_FLAT_NONE;
+	n.payload = MO_FLAT_NONE;
+
+	MO_Token* t = flat_node_token(node);
+	if(t) n.token = (u32)(t - flat->tokens);
+	if(node->kind == MO_AST_TYPE_INFO) n.payload = flat_push_type_info(flat, node);
+	if(node->kind == MO_AST_LAZY_BODY) {
+		// token range of the unparsed body
+		n.token = (u32)node->lazy_body.begin;
+		n.payload = (u32)node->lazy_body.end;
+	}
+
+	array_push(flat->nodes, n);
+	flat->count = (int)array_length(flat->nodes);
+
+	return (u32)(flat->count - 1);
+}
+
+typedef struct {
+	MO_Ast* node;
+	s32     next_slot;
+	s32     slot_count;
+	u32     index;
+} Flat_Frame;
+
+// Appends the tree at root to flat and returns the index of its root node,
+// several trees can be appended to the same flat ast as long as they share
+// the token array.
+static u32
+ast_flatten(MO_Flat_Ast* flat, MO_Ast* root) {
+	if(!root) return MO_FLAT_NONE;
+	if(!flat->nodes) flat->nodes = array_new_with(MO_Flat_Node, flat->allocator);
+
+	Flat_Frame* stack = array_new_with(Flat_Frame, flat->allocator);
+
+	u32 root_index = flat_push_node(flat, root, 0);
+	Flat_Frame root_frame = { root, 0, ast_child_count(root), root_index };
+	array_push(stack, root_frame);
+
+	while(array_length(stack) > 0) {
+		Flat_Frame* top = &stack[array_length(stack) - 1];
+
+		if(top->next_slot < top->slot_count) {
+			s32 slot = top->next_slot++;
+			MO_Ast* child = ast_child(top->node, slot);
+			if(!child) continue;
+
+			Flat_Frame frame = { child, 0, ast_child_count(child), flat_push_node(flat, child, slot) };
+			array_push(stack, frame);
+		} else {
+			flat->nodes[top->index].next = (u32)flat->count;
+			array_length(stack)--;
+		}
+	}
+
+	array_free(stack);
+	return root_index;
+}
+
+int
+mop_ast_flatten(MO_Flat_Ast* flat, MO_Token* tokens, struct MO_Ast_t* root) {
+	if(!flat->tokens) flat->tokens = tokens;
+	assert(flat->tokens == tokens);
+	return (int)ast_flatten(flat, root);
+}
+
+void
+mop_flat_free(MO_Flat_Ast* flat) {
+	if(flat->nodes) array_free(flat->nodes);
+	if(flat->type_infos) array_free(flat->type_infos);
+	flat->nodes = 0;
+	flat->type_infos = 0;
+	flat->count = 0;
+	flat->type_info_count = 0;
+}
@@ -0,0 +1,254 @@
+// Generic traversal over MO_Ast trees.
+//
+// Children are enumerated by slot, a slot is the position of the child in
+// its parent, optional children that are absent return 0 for their slot.
+// The walker keeps its own stack on the heap so that very deep trees
+// (long left-recursive operator chains) never touch the C stack.
+
+static s32
+ast_list_length(void* list) {
+	return (list) ? (s32)array_length(list) : 0;
+}
+
+static s32
+ast_child_count(MO_Ast* node) {
+	if(!node) return 0;
+
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_EXPRESSION_PRIMARY_CONSTANT:
+		case MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL:
+		case MO_AST_EXPRESSION_CONDITIONAL:
+		case MO_AST_CONSTANT_FLOATING_POINT:
+		case MO_AST_CONSTANT_INTEGER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_CONSTANT_CHARACTER:
+		case MO_AST_DIRECT_DECLARATOR:
+			return 0;
+
+		case MO_AST_EXPRESSION_UNARY:
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+		case MO_AST_EXPRESSION_SIZEOF:
+		case MO_AST_TYPE_STRUCT_DECLARATOR:
+		case MO_AST_ENUMERATOR:
+			return 1;
+
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_ARGUMENT_LIST:
+		case MO_AST_EXPRESSION_CAST:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:
+		case MO_AST_TYPE_NAME:
+		case MO_AST_TYPE_POINTER:
+		case MO_AST_TYPE_ABSTRACT_DECLARATOR:
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+		case MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD:
+		case MO_AST_PARAMETER_DECLARATION:
+		case MO_AST_STRUCT_DECLARATION:
+		case MO_AST_INIT_DECLARATOR:
+			return 2;
+
+		case MO_AST_EXPRESSION_TERNARY:
+		case MO_AST_FUNCTION_DEFINITION:
+			return 3;
+
+		case MO_AST_TYPE_INFO: {
+			switch(node->specifier_qualifier.kind) {
+				case MO_TYPE_STRUCT:
+				case MO_TYPE_UNION:
+				case MO_TYPE_ENUM:
+					return 1;
+				default: return 0;
+			}
+		}
+
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST:
+			return ast_list_length(node->struct_declarator_list.list);
+		case MO_AST_ENUMERATOR_LIST:
+			return ast_list_length(node->enumerator_list.list);
+		case MO_AST_PARAMETER_LIST:
+			return ast_list_length(node->parameter_list.param_decl);
+		case MO_AST_STRUCT_DECLARATION_LIST:
+			return ast_list_length(node->struct_declaration_list.list);
+		case MO_AST_DECLARATION:
+			return 1 + ast_list_length(node->declaration.init_declarators);
+		case MO_AST_INITIALIZER_LIST:
+			return ast_list_length(node->initializer_list.list);
+		case MO_AST_TRANSLATION_UNIT:
+			return ast_list_length(node->translation_unit.list);
+		case MO_AST_EXPRESSION_CHAIN:
+			return ast_list_length(node->expression_chain.operands);
+
+		default: break;
+	}
+	return 0;
+}
+
+static MO_Ast*
+ast_child(MO_Ast* node, s32 slot) {
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_UNARY:
+			return node->expression_unary.expr;
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+			return node->expression_postfix_unary.expr;
+		case MO_AST_EXPRESSION_SIZEOF:
+			return (node->expression_sizeof.is_type_name) ? node->expression_sizeof.type : node->expression_sizeof.expr;
+		case MO_AST_TYPE_STRUCT_DECLARATOR:
+			return node->struct_declarator.declarator;
+		case MO_AST_ENUMERATOR:
+			return node->enumerator.const_expr;
+
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+			return (slot == 0) ? node->expression_binary.left : node->expression_binary.right;
+		case MO_AST_EXPRESSION_ARGUMENT_LIST:
+			return (slot == 0) ? node->expression_argument_list.expr : node->expression_argument_list.next;
+		case MO_AST_EXPRESSION_CAST:
+			return (slot == 0) ? node->expression_cast.type_name : node->expression_cast.expression;
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:
+			return (slot == 0) ? node->expression_postfix_binary.left : node->expression_postfix_binary.right;
+		case MO_AST_TYPE_NAME:
+			return (slot == 0) ? node->type_name.qualifiers_specifiers : node->type_name.abstract_declarator;
+		case MO_AST_TYPE_POINTER:
+			return (slot == 0) ? node->pointer.qualifiers : node->pointer.next;
+		case MO_AST_TYPE_ABSTRACT_DECLARATOR:
+			return (slot == 0) ? node->abstract_type_decl.pointer : node->abstract_type_decl.direct_abstract_decl;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+			return (slot == 0) ? node->direct_abstract_decl.left_opt : node->direct_abstract_decl.right_opt;
+		case MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD:
+			return (slot == 0) ? node->struct_declarator_bitfield.declarator : node->struct_declarator_bitfield.const_expr;
+		case MO_AST_PARAMETER_DECLARATION:
+			return (slot == 0) ? node->parameter_decl.decl_specifiers : node->parameter_decl.declarator;
+		case MO_AST_STRUCT_DECLARATION:
+			return (slot == 0) ? node->struct_declaration.spec_qual : node->struct_declaration.struct_decl_list;
+		case MO_AST_INIT_DECLARATOR:
+			return (slot == 0) ? node->init_declarator.declarator : node->init_declarator.initializer;
+		case MO_AST_DECLARATION:
+			return (slot == 0) ? node->declaration.decl_specifiers : node->declaration.init_declarators[slot - 1];
+
+		case MO_AST_FUNCTION_DEFINITION: {
+			switch(slot) {
+				case 0: return node->function_definition.decl_specifiers;
+				case 1: return node->function_definition.declarator;
+				default: return node->function_definition.body;
+			}
+		}
+
+		case MO_AST_EXPRESSION_TERNARY: {
+			switch(slot) {
+				case 0: return node->expression_ternary.condition;
+				case 1: return node->expression_ternary.case_true;
+				default: return node->expression_ternary.case_false;
+			}
+		}
+
+		case MO_AST_TYPE_INFO: {
+			if(node->specifier_qualifier.kind == MO_TYPE_ENUM)
+				return node->specifier_qualifier.enumerator_list;
+			return node->specifier_qualifier.struct_desc;
+		}
+
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST:
+			return node->struct_declarator_list.list[slot];
+		case MO_AST_ENUMERATOR_LIST:
+			return (MO_Ast*)node->enumerator_list.list[slot];
+		case MO_AST_PARAMETER_LIST:
+			return node->parameter_list.param_decl[slot];
+		case MO_AST_STRUCT_DECLARATION_LIST:
+			return node->struct_declaration_list.list[slot];
+		case MO_AST_INITIALIZER_LIST:
+			return node->initializer_list.list[slot];
+		case MO_AST_TRANSLATION_UNIT:
+			return node->translation_unit.list[slot];
+		case MO_AST_EXPRESSION_CHAIN:
+			return node->expression_chain.operands[slot];
+
+		default: break;
+	}
+	return 0;
+}
+
+typedef struct {
+	MO_Ast* node;
+	s32     next_slot;
+	s32     slot_count;
+} Walk_Frame;
+
+static MO_Walk_Action
+ast_walk(MO_Ast* root, MO_Walk_Callback pre, MO_Walk_Callback post, void* user) {
+	if(!root) return MO_WALK_CONTINUE;
+
+	MO_Walk_Action action = MO_WALK_CONTINUE;
+	Walk_Frame* stack = array_new(Walk_Frame);
+
+	if(pre) action = pre(root, 0, 0, user);
+	if(action == MO_WALK_STOP) {
+		array_free(stack);
+		return MO_WALK_STOP;
+	}
+
+	Walk_Frame root_frame = { root, 0, (action == MO_WALK_SKIP_CHILDREN) ? 0 : ast_child_count(root) };
+	array_push(stack, root_frame);
+
+	while(array_length(stack) > 0) {
+		s32 depth = (s32)array_length(stack);
+		Walk_Frame* top = &stack[depth - 1];
+
+		if(top->next_slot < top->slot_count) {
+			MO_Ast* parent = top->node;
+			MO_Ast* child = ast_child(parent, top->next_slot++);
+			if(!child) continue;
+
+			action = (pre) ? pre(child, parent, depth, user) : MO_WALK_CONTINUE;
+			if(action == MO_WALK_STOP) break;
+
+			// skipped nodes still get their post callback, they just have no children to visit
+			Walk_Frame frame = { child, 0, (action == MO_WALK_SKIP_CHILDREN) ? 0 : ast_child_count(child) };
+			array_push(stack, frame);
+		} else {
+			MO_Ast* node = top->node;
+			array_length(stack)--;
+			MO_Ast* parent = (array_length(stack) > 0) ? stack[array_length(stack) - 1].node : 0;
+
+			action = (post) ? post(node, parent, depth - 1, user) : MO_WALK_CONTINUE;
+			if(action == MO_WALK_STOP) break;
+		}
+	}
+
+	array_free(stack);
+	return (action == MO_WALK_STOP) ? MO_WALK_STOP : MO_WALK_CONTINUE;
+}
+
+MO_Walk_Action
+mop_ast_walk(struct MO_Ast_t* root, MO_Walk_Callback pre, MO_Walk_Callback post, void* user) {
+	return ast_walk(root, pre, post, user);
+}
+
+int
+mop_ast_child_count(struct MO_Ast_t* node) {
+	return ast_child_count(node);
+}
+
+struct MO_Ast_t*
+mop_ast_child(struct MO_Ast_t* node, int slot) {
+	if(slot < 0 || slot >= ast_child_count(node)) return 0;
+	return ast_child(node, slot);
+}
@@ -0,0 +1,140 @@
+// Parsing of many small expressions at once, see mop_parse_expression_batch.
+//
+// The inputs are copied back to back into one nul separated buffer and lexed
+// into one token array, each one closed by its own EOF token, so an
+// expression can never read into the next one. The trees go to one arena;
+// with several threads every worker parses into its own arena, which is
+// merged into the batch's afterwards.
+
+typedef struct {
+	Lexer                lexer; // shares the batch's tokens
+	MO_Expression_Batch* batch;
+	volatile s32*        next;
+	s32                  step;
+} Batch_Worker;
+
+static void
+batch_parse_range(Lexer* lexer, MO_Expression_Batch* batch, s32 first, s32 last) {
+	for(s32 i = first; i < last; ++i) {
+		lexer->index = batch->first_token[i];
+		// every expression gets the whole depth limit
+		lexer->parser_flags &= ~PARSER_FLAG_DEPTH_EXCEEDED;
+		MO_Parser_Result r = parse_expression(lexer);
+		// the whole input has to be the expression, not cut by a /* comment
+		Token* end = lexer_peek(lexer);
+		if(r.status == MO_PARSER_STATUS_OK && (end->type != MO_TOKEN_EOF || (end->flags & MO_TOKEN_FLAG_UNTERMINATED)))
+			r.status = MO_PARSER_STATUS_FATAL;
+		batch->statuses[i] = (u8)r.status;
+		batch->roots[i] = (r.status == MO_PARSER_STATUS_OK) ? r.node : 0;
+	}
+}
+
+static void
+batch_worker_proc(void* arg) {
+	Batch_Worker* w = (Batch_Worker*)arg;
+	u64 trace = mop_trace_begin();
+	while(true) {
+		s32 first = atomic_add_s32(w->next, w->step);
+		if(first >= w->batch->count) break;
+		batch_parse_range(&w->lexer, w->batch, first, MIN(first + w->step, w->batch->count));
+	}
+	mop_trace_end("parse expression batch worker", 0, trace);
+}
+
+void
+mop_expression_batch_free(MO_Expression_Batch* batch) {
+	MO_Allocator* allocator = batch->allocator;
+	if(batch->tokens) array_free(batch->tokens);
+	if(batch->matching) array_free(batch->matching);
+	mem_free(allocator, batch->first_token, batch->count * sizeof(int));
+	mem_free(allocator, batch->roots, batch->count * sizeof(MO_Ast*));
+	mem_free(allocator, batch->statuses, batch->count);
+	mem_free(allocator, batch->text, batch->text_length);
+	// the child arrays of list nodes come from the allocator
+	if(batch->arena) parse_release_nodes(batch->arena, (Arena_Mark){0});
+	mop_arena_free(batch->arena);
+
+	MO_Typedef_Table* typedefs = batch->typedefs;
+	memset(batch, 0, sizeof(*batch));
+	batch->allocator = allocator;
+	batch->typedefs = typedefs;
+}
+
+int
+mop_parse_expression_batch(MO_Expression_Batch* batch, const char** strs, const int* lens, int n, int thread_count) {
+	u64 trace = mop_trace_begin();
+	mop_expression_batch_free(batch);
+	if(n <= 0) return 0;
+
+	MO_Allocator* allocator = batch->allocator;
+	batch->count = n;
+	batch->first_token = mem_alloc(allocator, n * sizeof(int));
+	batch->roots = mem_alloc(allocator, n * sizeof(MO_Ast*));
+	batch->statuses = mem_alloc(allocator, n);
+	batch->arena = mop_arena_new(0, allocator);
+
+	Lexer lexer = {0};
+	lexer.allocator = allocator;
+	lexer.typedefs = batch->typedefs;
+	lexer.parser_flags = PARSER_FLAG_TYPEDEFS_FROZEN;
+	// the lexer needs every input nul terminated, lens may cut strings short
+	size_t text_length = 0;
+	for(s32 i = 0; i < n; ++i) {
+		s32 length = (lens && lens[i] >= 0) ? lens[i] : (s32)strlen(strs[i]);
+		batch->first_token[i] = length; // until the inputs are lexed
+		text_length += length + 1;
+	}
+	batch->text = mem_alloc(allocator, text_length);
+	batch->text_length = text_length;
+
+	char* at = batch->text;
+	s32* open_groups = array_new_with(s32, allocator);
+	for(s32 i = 0; i < n; ++i) {
+		s32 length = batch->first_token[i];
+		memcpy(at, strs[i], length); // the allocation is zeroed, the terminator is already there
+		batch->first_token[i] = lexer_append(&lexer, at, length, &open_groups);
+		at += length + 1;
+	}
+	array_free(open_groups);
+	batch->tokens = lexer.tokens;
+	batch->matching = lexer.matching;
+
+	if(thread_count <= 0) thread_count = platform_cpu_count();
+	thread_count = MAX(1, MIN(thread_count, n));
+
+	if(thread_count == 1) {
+		lexer.arena = batch->arena;
+		batch_parse_range(&lexer, batch, 0, n);
+	} else {
+		Thread* threads = mem_alloc(allocator, thread_count * sizeof(Thread));
+		Batch_Worker* workers = mem_alloc(allocator, thread_count * sizeof(Batch_Worker));
+		volatile s32 next = 0;
+		for(s32 t = 0; t < thread_count; ++t) {
+			Batch_Worker* w = &workers[t];
+			w->lexer = lexer;
+			w->lexer.arena = mop_arena_new(0, allocator);
+			w->batch = batch;
+			w->next = &next;
+			w->step = MAX(1, n / (thread_count * 16));
+		}
+
+		// the calling thread is worker 0
+		for(s32 t = 1; t < thread_count; ++t) {
+			if(!thread_start(&threads[t], batch_worker_proc, &workers[t])) threads[t].proc = 0;
+		}
+		batch_worker_proc(&workers[0]);
+		for(s32 t = 1; t < thread_count; ++t) {
+			if(threads[t].proc) thread_join(&threads[t]);
+		}
+		for(s32 t = 0; t < thread_count; ++t)
+			arena_merge(batch->arena, workers[t].lexer.arena);
+
+		mem_free(allocator, workers, thread_count * sizeof(Batch_Worker));
+		mem_free(allocator, threads, thread_count * sizeof(Thread));
+	}
+
+	int failed = 0;
+	for(s32 i = 0; i < n; ++i) failed += (batch->statuses[i] != MO_PARSER_STATUS_OK);
+	mop_trace_end("parse expression batch", 0, trace);
+	return failed;
+}
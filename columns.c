@@ -0,0 +1,453 @@
+// Evaluation of a program over columns of rows, see mop_program_eval_columns.
+//
+// The bytecode runs once per block of rows with every VM register holding a
+// value per row, so each instruction is one loop over the block. Binary
+// operators go through kernels, AVX2 for the common ones when the cpu has it.
+//
+// && || and ?: keep their jumps, which only ever go forward. A block carries
+// a mask of the rows that are still executing: a jump moves the rows that
+// take it to a mask pending at its target, where they rejoin, and results
+// computed while some rows are inactive are blended in so the inactive rows
+// keep their values. Division by 0 and out of range indices only count for
+// active rows.
+//
+// Registers point at their values: a block of their own, or the rows of a
+// column directly when the block only loads it.
+
+#define COLUMN_BLOCK 1024
+
+typedef void (*Column_Kernel)(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n);
+
+typedef struct {
+	const Vm_Register* value; // the block's values
+	Vm_Register*       own;   // COLUMN_BLOCK values
+} Column_Register;
+
+// Scalar kernels, b_step is 0 when b is a constant
+
+#define INT_OP(NAME, EXPR) \
+	static void \
+	column_##NAME##_I(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		for(s32 i = 0; i < n; ++i) { s64 x = a[i].i, y = b[i * b_step].i; d[i].i = EXPR; } \
+	}
+VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) \
+	static void \
+	column_##NAME##_F(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		for(s32 i = 0; i < n; ++i) { r64 x = a[i].f, y = b[i * b_step].f; d[i].f = EXPR; } \
+	}
+VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) \
+	static void \
+	column_##NAME##_F(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		for(s32 i = 0; i < n; ++i) { r64 x = a[i].f, y = b[i * b_step].f; d[i].i = EXPR; } \
+	}
+VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+
+#define COLUMN_UNARY_OPS \
+	UNARY_OP(I2F,    d[i].f = (r64)a[i].i) \
+	UNARY_OP(F2I,    d[i].i = (s64)a[i].f) \
+	UNARY_OP(NEG_I,  d[i].i = (s64)(0 - (u64)a[i].i)) \
+	UNARY_OP(NEG_F,  d[i].f = -a[i].f) \
+	UNARY_OP(NOT_I,  d[i].i = ~a[i].i) \
+	UNARY_OP(LNOT_I, d[i].i = (a[i].i == 0)) \
+	UNARY_OP(LNOT_F, d[i].i = (a[i].f == 0.0)) \
+	UNARY_OP(BOOL_I, d[i].i = (a[i].i != 0)) \
+	UNARY_OP(BOOL_F, d[i].i = (a[i].f != 0.0))
+
+#define UNARY_OP(NAME, STMT) \
+	static void \
+	column_##NAME(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		for(s32 i = 0; i < n; ++i) STMT; \
+	}
+COLUMN_UNARY_OPS
+#undef UNARY_OP
+
+#if LEXER_SIMD
+// AVX2 kernels of the operators with 64 bit lanes, x and y are the operands.
+// The rows after the last full vector go to the scalar kernel.
+#define COLUMN_AVX2_INT_OPS \
+	AVX2_INT_OP(ADD_I, _mm256_add_epi64(x, y)) \
+	AVX2_INT_OP(SUB_I, _mm256_sub_epi64(x, y)) \
+	AVX2_INT_OP(AND_I, _mm256_and_si256(x, y)) \
+	AVX2_INT_OP(OR_I,  _mm256_or_si256(x, y)) \
+	AVX2_INT_OP(XOR_I, _mm256_xor_si256(x, y)) \
+	AVX2_INT_OP(EQ_I,  _mm256_and_si256(_mm256_cmpeq_epi64(x, y), one)) \
+	AVX2_INT_OP(NE_I,  _mm256_andnot_si256(_mm256_cmpeq_epi64(x, y), one)) \
+	AVX2_INT_OP(GT_I,  _mm256_and_si256(_mm256_cmpgt_epi64(x, y), one)) \
+	AVX2_INT_OP(LT_I,  _mm256_and_si256(_mm256_cmpgt_epi64(y, x), one)) \
+	AVX2_INT_OP(GE_I,  _mm256_andnot_si256(_mm256_cmpgt_epi64(y, x), one)) \
+	AVX2_INT_OP(LE_I,  _mm256_andnot_si256(_mm256_cmpgt_epi64(x, y), one))
+
+#define COLUMN_AVX2_FLOAT_OPS \
+	AVX2_FLOAT_OP(ADD_F, _mm256_add_pd(x, y)) \
+	AVX2_FLOAT_OP(SUB_F, _mm256_sub_pd(x, y)) \
+	AVX2_FLOAT_OP(MUL_F, _mm256_mul_pd(x, y)) \
+	AVX2_FLOAT_OP(DIV_F, _mm256_div_pd(x, y))
+
+// ordered predicates are false for NaN like C's < and ==, != is unordered
+#define COLUMN_AVX2_FLOAT_COMPARE_OPS \
+	AVX2_FLOAT_COMPARE_OP(LT_F, _CMP_LT_OQ) \
+	AVX2_FLOAT_COMPARE_OP(LE_F, _CMP_LE_OQ) \
+	AVX2_FLOAT_COMPARE_OP(GT_F, _CMP_GT_OQ) \
+	AVX2_FLOAT_COMPARE_OP(GE_F, _CMP_GE_OQ) \
+	AVX2_FLOAT_COMPARE_OP(EQ_F, _CMP_EQ_OQ) \
+	AVX2_FLOAT_COMPARE_OP(NE_F, _CMP_NEQ_UQ)
+
+#define AVX2_INT_OP(NAME, VEC) \
+	LEXER_TARGET("avx2") static void \
+	column_##NAME##_avx2(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		const __m256i one = _mm256_set1_epi64x(1); \
+		__m256i y = _mm256_set1_epi64x(b->i); \
+		s32 i = 0; \
+		for(; i + 4 <= n; i += 4) { \
+			__m256i x = _mm256_loadu_si256((const __m256i*)(a + i)); \
+			if(b_step) y = _mm256_loadu_si256((const __m256i*)(b + i)); \
+			_mm256_storeu_si256((__m256i*)(d + i), VEC); \
+		} \
+		(void)one; \
+		column_##NAME(d + i, a + i, b + i * b_step, b_step, n - i); \
+	}
+COLUMN_AVX2_INT_OPS
+#undef AVX2_INT_OP
+
+#define AVX2_FLOAT_OP(NAME, VEC) \
+	LEXER_TARGET("avx2") static void \
+	column_##NAME##_avx2(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		__m256d y = _mm256_set1_pd(b->f); \
+		s32 i = 0; \
+		for(; i + 4 <= n; i += 4) { \
+			__m256d x = _mm256_loadu_pd((const double*)(a + i)); \
+			if(b_step) y = _mm256_loadu_pd((const double*)(b + i)); \
+			_mm256_storeu_pd((double*)(d + i), VEC); \
+		} \
+		column_##NAME(d + i, a + i, b + i * b_step, b_step, n - i); \
+	}
+COLUMN_AVX2_FLOAT_OPS
+#undef AVX2_FLOAT_OP
+
+#define AVX2_FLOAT_COMPARE_OP(NAME, PREDICATE) \
+	LEXER_TARGET("avx2") static void \
+	column_##NAME##_avx2(Vm_Register* d, const Vm_Register* a, const Vm_Register* b, s32 b_step, s32 n) { \
+		const __m256i one = _mm256_set1_epi64x(1); \
+		__m256d y = _mm256_set1_pd(b->f); \
+		s32 i = 0; \
+		for(; i + 4 <= n; i += 4) { \
+			__m256d x = _mm256_loadu_pd((const double*)(a + i)); \
+			if(b_step) y = _mm256_loadu_pd((const double*)(b + i)); \
+			__m256i mask = _mm256_castpd_si256(_mm256_cmp_pd(x, y, PREDICATE)); \
+			_mm256_storeu_si256((__m256i*)(d + i), _mm256_and_si256(mask, one)); \
+		} \
+		column_##NAME(d + i, a + i, b + i * b_step, b_step, n - i); \
+	}
+COLUMN_AVX2_FLOAT_COMPARE_OPS
+#undef AVX2_FLOAT_COMPARE_OP
+#endif
+
+// Masks hold 0 or -1 per row so they combine with values like any other bits.
+// Masks are random more often than not, nothing here branches on a row.
+
+// Copies the active rows of from to d and the others of inactive
+static void
+column_blend_scalar(Vm_Register* d, const Vm_Register* from, const Vm_Register* inactive, const s64* active, s32 n) {
+	for(s32 i = 0; i < n; ++i) d[i].i = (from[i].i & active[i]) | (inactive[i].i & ~active[i]);
+}
+
+// Moves the active rows where a is not 0 (jump_on 1) or 0 (jump_on 0) to pending,
+// returns how many moved
+static s32
+column_split_scalar(s64* active, s64* pending, const Vm_Register* a, s64 jump_on, s32 n) {
+	s32 taken = 0;
+	for(s32 i = 0; i < n; ++i) {
+		s64 t = active[i] & -(s64)((a[i].i != 0) == jump_on);
+		pending[i] |= t;
+		active[i] &= ~t;
+		taken -= (s32)t;
+	}
+	return taken;
+}
+
+// Moves pending back to active, returns how many rows are active
+static s32
+column_merge_scalar(s64* active, s64* pending, s32 n) {
+	s32 count = 0;
+	for(s32 i = 0; i < n; ++i) {
+		active[i] |= pending[i];
+		pending[i] = 0;
+		count -= (s32)active[i];
+	}
+	return count;
+}
+
+#if LEXER_SIMD
+LEXER_TARGET("avx2") static void
+column_blend_avx2(Vm_Register* d, const Vm_Register* from, const Vm_Register* inactive, const s64* active, s32 n) {
+	s32 i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256d m = _mm256_loadu_pd((const double*)(active + i));
+		__m256d x = _mm256_loadu_pd((const double*)(from + i));
+		__m256d y = _mm256_loadu_pd((const double*)(inactive + i));
+		_mm256_storeu_pd((double*)(d + i), _mm256_blendv_pd(y, x, m));
+	}
+	column_blend_scalar(d + i, from + i, inactive + i, active + i, n - i);
+}
+
+LEXER_TARGET("avx2") static s32
+column_split_avx2(s64* active, s64* pending, const Vm_Register* a, s64 jump_on, s32 n) {
+	// rows with a == 0 jump for JZ, the others for JNZ
+	const __m256i invert = _mm256_set1_epi64x(jump_on ? -1 : 0);
+	const __m256i zero = _mm256_setzero_si256();
+	s32 taken = 0;
+	s32 i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256i m = _mm256_loadu_si256((const __m256i*)(active + i));
+		__m256i is_zero = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i*)(a + i)), zero);
+		__m256i t = _mm256_and_si256(m, _mm256_xor_si256(is_zero, invert));
+		__m256i p = _mm256_loadu_si256((const __m256i*)(pending + i));
+		_mm256_storeu_si256((__m256i*)(pending + i), _mm256_or_si256(p, t));
+		_mm256_storeu_si256((__m256i*)(active + i), _mm256_andnot_si256(t, m));
+		taken += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(t)));
+	}
+	return taken + column_split_scalar(active + i, pending + i, a + i, jump_on, n - i);
+}
+
+LEXER_TARGET("avx2") static s32
+column_merge_avx2(s64* active, s64* pending, s32 n) {
+	s32 count = 0;
+	s32 i = 0;
+	for(; i + 4 <= n; i += 4) {
+		__m256i m = _mm256_or_si256(_mm256_loadu_si256((const __m256i*)(active + i)), _mm256_loadu_si256((const __m256i*)(pending + i)));
+		_mm256_storeu_si256((__m256i*)(active + i), m);
+		_mm256_storeu_si256((__m256i*)(pending + i), _mm256_setzero_si256());
+		count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+	}
+	return count + column_merge_scalar(active + i, pending + i, n - i);
+}
+#endif
+
+// By register form of the operator, 0 for the instructions handled by the evaluator
+static Column_Kernel column_kernels[VM_OP_COUNT];
+static void (*column_blend)(Vm_Register* d, const Vm_Register* from, const Vm_Register* inactive, const s64* active, s32 n) = column_blend_scalar;
+static s32  (*column_split)(s64* active, s64* pending, const Vm_Register* a, s64 jump_on, s32 n) = column_split_scalar;
+static s32  (*column_merge)(s64* active, s64* pending, s32 n) = column_merge_scalar;
+
+// Every thread picks the same kernels, so racing on the first call is harmless.
+static void
+column_kernels_init() {
+	static volatile bool initialized = false;
+	if(initialized) return;
+#define INT_OP(NAME, EXPR) column_kernels[VM_##NAME##_I] = column_##NAME##_I;
+	VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) column_kernels[VM_##NAME##_F] = column_##NAME##_F;
+	VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) column_kernels[VM_##NAME##_F] = column_##NAME##_F;
+	VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+#define UNARY_OP(NAME, STMT) column_kernels[VM_##NAME] = column_##NAME;
+	COLUMN_UNARY_OPS
+#undef UNARY_OP
+#if LEXER_SIMD
+	if(cpu_has_avx2()) {
+#define AVX2_INT_OP(NAME, VEC) column_kernels[VM_##NAME] = column_##NAME##_avx2;
+		COLUMN_AVX2_INT_OPS
+#undef AVX2_INT_OP
+#define AVX2_FLOAT_OP(NAME, VEC) column_kernels[VM_##NAME] = column_##NAME##_avx2;
+		COLUMN_AVX2_FLOAT_OPS
+#undef AVX2_FLOAT_OP
+#define AVX2_FLOAT_COMPARE_OP(NAME, PREDICATE) column_kernels[VM_##NAME] = column_##NAME##_avx2;
+		COLUMN_AVX2_FLOAT_COMPARE_OPS
+#undef AVX2_FLOAT_COMPARE_OP
+		column_blend = column_blend_avx2;
+		column_split = column_split_avx2;
+		column_merge = column_merge_avx2;
+	}
+#endif
+	initialized = true;
+}
+
+typedef struct {
+	Column_Register* regs;
+	Vm_Register*     scratch; // results while some rows are inactive
+	s64*             active;  // -1 for the rows executing
+	s32              active_count;
+	s32              n;       // rows in the block
+} Column_Block;
+
+// Where an instruction writing dst puts its values
+static Vm_Register*
+column_target(Column_Block* b, s32 dst) {
+	return (b->active_count == b->n) ? b->regs[dst].own : b->scratch;
+}
+
+// Makes the values written to column_target(b, dst) the values of dst
+static void
+column_commit(Column_Block* b, s32 dst) {
+	Column_Register* r = &b->regs[dst];
+	if(b->active_count != b->n) column_blend(r->own, b->scratch, r->value, b->active, b->n);
+	r->value = r->own;
+}
+
+MO_Eval_Status
+mop_program_eval_columns(const MO_Program* program, const void* const* columns, long long row_count, void* result) {
+	column_kernels_init();
+
+	MO_Allocator* allocator = program->allocator;
+	s32 code_length = program->code_length;
+	const Vm_Instruction* code = program->code;
+	const Vm_Register* k = program->constants;
+	Vm_Register* out = (Vm_Register*)result;
+
+	Column_Block b = {0};
+	b.regs = mem_alloc(allocator, program->register_count * sizeof(Column_Register));
+	Vm_Register* storage = mem_alloc(allocator, (program->register_count + 1) * COLUMN_BLOCK * sizeof(Vm_Register));
+	for(s32 r = 0; r < program->register_count; ++r) {
+		b.regs[r].own = storage + r * COLUMN_BLOCK;
+		b.regs[r].value = b.regs[r].own;
+	}
+	b.scratch = storage + program->register_count * COLUMN_BLOCK;
+	b.active = mem_alloc(allocator, COLUMN_BLOCK * sizeof(s64));
+
+	// rows waiting at each jump target
+	s64** pending = mem_alloc(allocator, code_length * sizeof(s64*));
+	bool* has_pending = mem_alloc(allocator, code_length * sizeof(bool));
+	for(s32 pc = 0; pc < code_length; ++pc) {
+		Vm_Op op = (Vm_Op)code[pc].op;
+		if((op == VM_JMP || op == VM_JZ || op == VM_JNZ) && !pending[code[pc].imm])
+			pending[code[pc].imm] = mem_alloc(allocator, COLUMN_BLOCK * sizeof(s64));
+	}
+
+	MO_Eval_Status status = MO_EVAL_OK;
+	for(s64 row = 0; row < row_count && status == MO_EVAL_OK; row += COLUMN_BLOCK) {
+		b.n = (s32)MIN((s64)COLUMN_BLOCK, row_count - row);
+		memset(b.active, 0xff, b.n * sizeof(s64));
+		b.active_count = b.n;
+
+		for(s32 pc = 0; pc < code_length && status == MO_EVAL_OK; ++pc) {
+			const Vm_Instruction* in = &code[pc];
+			if(has_pending[pc]) {
+				b.active_count = column_merge(b.active, pending[pc], b.n);
+				has_pending[pc] = false;
+			}
+			if(b.active_count == 0) continue;
+
+			bool full = (b.active_count == b.n);
+			Vm_Op op = (Vm_Op)in->op;
+			switch(op) {
+				case VM_MOV: {
+					const Vm_Register* src = b.regs[in->a].value;
+					if(full && src != b.regs[in->a].own) {
+						b.regs[in->dst].value = src; // a column, never written
+					} else {
+						memcpy(column_target(&b, in->dst), src, b.n * sizeof(Vm_Register));
+						column_commit(&b, in->dst);
+					}
+				} break;
+				case VM_CONST: {
+					Vm_Register* d = column_target(&b, in->dst);
+					for(s32 i = 0; i < b.n; ++i) d[i] = k[in->imm];
+					column_commit(&b, in->dst);
+				} break;
+				case VM_LOAD: {
+					const Vm_Register* src = (const Vm_Register*)columns[in->imm] + row;
+					if(full) {
+						b.regs[in->dst].value = src;
+					} else {
+						Column_Register* r = &b.regs[in->dst];
+						column_blend(r->own, src, r->value, b.active, b.n);
+						r->value = r->own;
+					}
+				} break;
+				case VM_INDEX: {
+					const MO_Value* array = (const MO_Value*)columns[in->imm];
+					const Vm_Register* data = (const Vm_Register*)array->array.data;
+					const Vm_Register* index = b.regs[in->a].value;
+					u64 count = (u64)array->array.count;
+					Vm_Register* d = column_target(&b, in->dst);
+					Vm_Register zero = {0};
+					// an empty array has no data at all, only inactive rows get past it
+					if(count == 0) {
+						for(s32 i = 0; i < b.n && status == MO_EVAL_OK; ++i) {
+							if(b.active[i]) status = MO_EVAL_INDEX_OUT_OF_RANGE;
+							else d[i] = zero;
+						}
+					} else {
+						// inactive rows load nothing, their index may be anything
+						for(s32 i = 0; i < b.n && status == MO_EVAL_OK; ++i) {
+							u64 at = (u64)index[i].i;
+							if(!b.active[i]) d[i] = zero;
+							else if(at < count) d[i] = data[at];
+							else status = MO_EVAL_INDEX_OUT_OF_RANGE;
+						}
+					}
+					column_commit(&b, in->dst);
+				} break;
+				case VM_TRUNC: {
+					const Vm_Register* a = b.regs[in->a].value;
+					Vm_Register* d = column_target(&b, in->dst);
+					for(s32 i = 0; i < b.n; ++i) d[i].i = vm_truncate(a[i].i, in->imm, in->b);
+					column_commit(&b, in->dst);
+				} break;
+				case VM_DIV_I:
+				case VM_DIV_IK:
+				case VM_MOD_I:
+				case VM_MOD_IK: {
+					bool k_form = (op == VM_DIV_IK || op == VM_MOD_IK);
+					bool is_div = (op == VM_DIV_I || op == VM_DIV_IK);
+					const Vm_Register* a = b.regs[in->a].value;
+					const Vm_Register* y = k_form ? &k[in->imm] : b.regs[in->b].value;
+					s32 step = k_form ? 0 : 1;
+					Vm_Register* d = column_target(&b, in->dst);
+					for(s32 i = 0; i < b.n; ++i) {
+						s64 x = a[i].i, divisor = b.active[i] ? y[i * step].i : 1;
+						if(divisor == 0) {
+							status = MO_EVAL_DIVISION_BY_ZERO;
+							break;
+						}
+						if(is_div) d[i].i = (divisor == -1) ? (s64)(0 - (u64)x) : x / divisor;
+						else d[i].i = (divisor == -1) ? 0 : x % divisor;
+					}
+					column_commit(&b, in->dst);
+				} break;
+				case VM_JMP:
+					for(s32 i = 0; i < b.n; ++i) pending[in->imm][i] |= b.active[i];
+					has_pending[in->imm] = true;
+					memset(b.active, 0, b.n * sizeof(s64));
+					b.active_count = 0;
+					break;
+				case VM_JZ:
+				case VM_JNZ: {
+					const Vm_Register* a = b.regs[in->a].value;
+					s32 taken = column_split(b.active, pending[in->imm], a, op == VM_JNZ, b.n);
+					if(taken) has_pending[in->imm] = true;
+					b.active_count -= taken;
+				} break;
+				case VM_RET: {
+					const Vm_Register* a = b.regs[in->a].value;
+					if(full) memcpy(out + row, a, b.n * sizeof(Vm_Register));
+					else column_blend(out + row, a, out + row, b.active, b.n);
+				} break;
+				default: {
+					// kernels, K forms follow their register form
+					bool k_form = vm_k_form(op);
+					Vm_Op kernel = k_form ? (Vm_Op)(op - 1) : op;
+					const Vm_Register* y = k_form ? &k[in->imm] : b.regs[in->b].value;
+					column_kernels[kernel](column_target(&b, in->dst), b.regs[in->a].value, y, k_form ? 0 : 1, b.n);
+					column_commit(&b, in->dst);
+				} break;
+			}
+		}
+	}
+
+	for(s32 pc = 0; pc < code_length; ++pc) mem_free(allocator, pending[pc], COLUMN_BLOCK * sizeof(s64));
+	mem_free(allocator, pending, code_length * sizeof(s64*));
+	mem_free(allocator, has_pending, code_length * sizeof(bool));
+	mem_free(allocator, b.active, COLUMN_BLOCK * sizeof(s64));
+	mem_free(allocator, storage, (program->register_count + 1) * COLUMN_BLOCK * sizeof(Vm_Register));
+	mem_free(allocator, b.regs, program->register_count * sizeof(Column_Register));
+	return status;
+}
@@ -0,0 +1,35 @@
+// Doc comments of declarations, struct members and enumerators, see
+// MO_PARSER_FLAG_COMMENTS.
+//
+// The lexer keeps each comment with the index of the token that follows it
+// and flags that token, so the parser only looks at lexer->comments for
+// tokens that have comments in front of them. A node takes the last comment
+// on lines of its own in front of its first token as its leading doc, and a
+// comment that follows it on the same line as its trailing doc.
+
+// Index of the first comment in front of token or a later one
+static s32
+comments_from(Lexer* lexer, s32 token) {
+	s32 low = 0;
+	s32 high = (s32)array_length(lexer->comments);
+	while(low < high) {
+		s32 mid = (low + high) / 2;
+		if(lexer->comments[mid].token < token) low = mid + 1;
+		else high = mid;
+	}
+	return low;
+}
+
+// begin is the first token of the node, end the token after it, past the ; or ,
+// that closes it
+static void
+parse_doc(Lexer* lexer, MO_Doc* doc, s32 begin, s32 end) {
+	if(lexer->tokens[begin].flags & MO_TOKEN_FLAG_COMMENTED) {
+		MO_Comment* c = &lexer->comments[comments_from(lexer, begin + 1) - 1];
+		if(c->flags & MO_COMMENT_FLAG_OWN_LINE) doc->leading = c;
+	}
+	if(end > begin && (lexer->tokens[end].flags & MO_TOKEN_FLAG_COMMENTED)) {
+		MO_Comment* c = &lexer->comments[comments_from(lexer, end)];
+		if(!(c->flags & MO_COMMENT_FLAG_OWN_LINE)) doc->trailing = c;
+	}
+}
@@ -20,6 +20,12 @@ typedef int bool;
 #define ARRAY_SIZE(N) sizeof(N)
 #define ARRAY_LENGTH(N) (sizeof(N) / sizeof(*(N)))
 
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 #define true 1
 #define false 0
 
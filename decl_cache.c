@@ -0,0 +1,898 @@
+// Trees of top-level declarations kept on disk from one run to the next, see
+// mop_decl_cache_open.
+//
+// mop_parse_translation_unit finds the end of each declaration where the
+// parallel parse would cut and hashes it on the way: the type and bytes of its
+// tokens, whether an identifier among them is a typedef name at that point,
+// and the flags and depth limit that change what the parser makes of it.
+// Bodies the parser skips, those of functions and with
+// MO_PARSER_FLAG_LAZY_BODIES those of structs, unions and enums, go in with
+// their length only, as the tree holds nothing else of them, and an entry is
+// only stored when its lazy bodies are exactly the ranges left out. A
+// declaration found under its hash is rebuilt from the layout of ast_flat.c,
+// with token indices relative to its first token, and the typedef names it
+// declares are added as parse_declaration would. The others are parsed and
+// stored.
+//
+// The file is a header, an open addressing table of slots and the flat nodes
+// of every entry after it, mapped shared so the parse writes straight to it.
+// A tree stored again under its key takes the place of the old one when it
+// fits, the bytes it leaves behind are counted, and the table is started over
+// when three quarters of the slots are taken or when those bytes are half of
+// what the trees take.
+// A second, independent hash and the token count guard against collisions.
+// The first time an entry is rebuilt, its bytes are summed and checked to be
+// a tree, so a file left half written or written by someone else costs a
+// parse but never reads out of the mapping and never rebuilds the wrong tree.
+// A flock keeps other processes out while the file is open.
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#define DECL_CACHE_MAGIC   0x3165686361636c64ull // "dlcache1"
+#define DECL_CACHE_VERSION 2
+#define DECL_CACHE_ENTRIES 65536
+// room for trees in a new file and the least a full one grows by
+#define DECL_CACHE_DATA    (1 << 20)
+
+typedef struct {
+	u64 magic;
+	u32 version;
+	u32 node_size;  // sizeof(MO_Flat_Node), a file of another layout is started over
+	u32 slot_count; // power of two
+	u32 entries;
+	u32 open;       // set while a process has the file, a file found open was not closed
+	u32 reserved;
+	u64 used;       // bytes of the data area that hold trees
+	u64 stale;      // of those, the bytes no slot points at any more
+} Decl_Cache_Header;
+
+typedef struct {
+	u64 key;        // 0 for an empty slot
+	u64 check;
+	u64 offset;     // of the nodes in the data area, the type infos follow them
+	u32 tokens;
+	u32 nodes;
+	u32 type_infos;
+	u32 sum;        // of the bytes of nodes and type infos, see decl_cache_sum
+} Decl_Cache_Slot;
+
+typedef struct {
+	u64 key;
+	u64 check;
+} Decl_Cache_Hash;
+
+typedef struct {
+	u32 index;
+	s32 last_slot;
+	s32 slot_count; // of a node with fixed slots
+} Decl_Cache_Check;
+
+typedef struct {
+	MO_Ast* node;
+	u32     next;
+} Decl_Cache_Frame;
+
+struct MO_Decl_Cache_t {
+	MO_Allocator*       allocator;
+	int                 fd;
+	u8*                 map;
+	size_t              size;   // of the file and the mapping
+	MO_Decl_Cache_Stats stats;
+	MO_Flat_Ast         flat;   // the tree being stored
+	Decl_Chunk*         skips;  // the bodies decl_cache_scan left out, begin and end as in MO_Ast_Lazy_Body
+	s32*                groups; // scratch space of decl_cache_scan, decl_cache_valid and decl_cache_build
+	Decl_Cache_Check*   checks;
+	Decl_Cache_Frame*   frames;
+	u8*                 checked; // per slot, its tree passed decl_cache_valid or was stored since the file was opened
+};
+
+static Decl_Cache_Header*
+decl_cache_header(MO_Decl_Cache* cache) {
+	return (Decl_Cache_Header*)cache->map;
+}
+
+static Decl_Cache_Slot*
+decl_cache_slots(MO_Decl_Cache* cache) {
+	return (Decl_Cache_Slot*)(cache->map + sizeof(Decl_Cache_Header));
+}
+
+static size_t
+decl_cache_data_offset(u32 slot_count) {
+	return sizeof(Decl_Cache_Header) + (size_t)slot_count * sizeof(Decl_Cache_Slot);
+}
+
+static u8*
+decl_cache_data(MO_Decl_Cache* cache) {
+	return cache->map + decl_cache_data_offset(decl_cache_header(cache)->slot_count);
+}
+
+static size_t
+decl_cache_data_size(MO_Decl_Cache* cache) {
+	return cache->size - decl_cache_data_offset(decl_cache_header(cache)->slot_count);
+}
+
+// Sizes the file and maps it anew, the old mapping stays when that fails.
+static bool
+decl_cache_map(MO_Decl_Cache* cache, size_t size) {
+	// blocks are taken now, a full disk is not found out by a write to the mapping
+	if(size > cache->size && posix_fallocate(cache->fd, 0, (off_t)size) != 0)
+		return false;
+	void* map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if(map == MAP_FAILED)
+		return false;
+	if(cache->map) munmap(cache->map, cache->size);
+	cache->map = map;
+	cache->size = size;
+	return true;
+}
+
+static void
+decl_cache_clear(MO_Decl_Cache* cache) {
+	Decl_Cache_Header* header = decl_cache_header(cache);
+	memset(decl_cache_slots(cache), 0, header->slot_count * sizeof(Decl_Cache_Slot));
+	memset(cache->checked, 0, header->slot_count);
+	header->entries = 0;
+	header->used = 0;
+	header->stale = 0;
+}
+
+static bool
+decl_cache_usable(Decl_Cache_Header* header, size_t size) {
+	if(header->magic != DECL_CACHE_MAGIC || header->version != DECL_CACHE_VERSION ||
+		header->node_size != sizeof(MO_Flat_Node) || header->open)
+		return false;
+	if(header->slot_count == 0 || (header->slot_count & (header->slot_count - 1)) != 0)
+		return false;
+	size_t data = decl_cache_data_offset(header->slot_count);
+	return data <= size && header->used <= size - data && header->stale <= header->used &&
+		header->entries < header->slot_count;
+}
+
+// Returns the slot of key or the empty one it goes to, 0 when the table has
+// neither, which only a damaged file does.
+static Decl_Cache_Slot*
+decl_cache_find(MO_Decl_Cache* cache, u64 key) {
+	Decl_Cache_Slot* slots = decl_cache_slots(cache);
+	u32 mask = decl_cache_header(cache)->slot_count - 1;
+	u32 slot = (u32)key & mask;
+	for(u32 i = 0; i <= mask; ++i, slot = (slot + 1) & mask) {
+		if(slots[slot].key == key || slots[slot].key == 0)
+			return &slots[slot];
+	}
+	return 0;
+}
+
+static void
+decl_cache_mix(Decl_Cache_Hash* hash, u64 word) {
+	hash->key = ((hash->key << 23 | hash->key >> 41) ^ word) * 0x9e3779b97f4a7c15ull;
+	hash->check = ((hash->check << 31 | hash->check >> 33) ^ word) * 0xff51afd7ed558ccdull;
+}
+
+// Catches entries whose bytes changed after they were stored, which may still
+// be trees, just not the ones the hash was taken of.
+static u32
+decl_cache_sum(const u8* data, size_t length) {
+	u64 sum = length;
+	for(size_t i = 0; i < length; i += 8) {
+		u64 word = 0;
+		memcpy(&word, data + i, MIN(length - i, 8));
+		sum = ((sum << 27 | sum >> 37) ^ word) * 0x9e3779b97f4a7c15ull;
+	}
+	return (u32)(sum >> 32);
+}
+
+// A { the parser hands to parse_lazy_body when it gets there, if the
+// declaration is what it looks like
+static bool
+decl_cache_lazy_open(Lexer* lexer, s32 begin, s32 open) {
+	Token* tokens = lexer->tokens;
+	if(!(lexer->parser_flags & MO_PARSER_FLAG_LAZY_BODIES)) return false;
+	s32 keyword = open - 1;
+	if(keyword > begin && tokens[keyword].type == MO_TOKEN_IDENTIFIER) keyword--;
+	if(keyword < begin) return false;
+	switch(tokens[keyword].type) {
+		case MO_TOKEN_KEYWORD_STRUCT:
+		case MO_TOKEN_KEYWORD_UNION:
+		case MO_TOKEN_KEYWORD_ENUM:
+			return true;
+		default: return false;
+	}
+}
+
+// Finds where the declaration at begin ends, by the rules of
+// split_top_level_declarations, and hashes it. False when it runs into an
+// unbalanced group, which the parser reports.
+static bool
+decl_cache_scan(MO_Decl_Cache* cache, Lexer* lexer, s32 begin, Decl_Chunk* chunk, Decl_Cache_Hash* hash) {
+	Token* tokens = lexer->tokens;
+	s32* groups = cache->groups; // where the open groups close
+	array_clear(groups);
+	array_clear(cache->skips);
+
+	// everything but the tokens that changes the tree
+	u64 seed = (lexer->parser_flags & (MO_PARSER_FLAG_LAZY_BODIES | MO_PARSER_FLAG_FLATTEN_CHAINS)) |
+		(u64)(u32)lexer->max_depth << 8;
+	// two multiply and rotate hashes with their own constants, the key gets a
+	// final mix as its low bits pick the slot
+	hash->key = seed ^ 0x243f6a8885a308d3ull;
+	hash->check = seed ^ 0x13198a2e03707344ull;
+
+	bool found = false;
+	s32 i = begin;
+	while(!found) {
+		Token* t = &tokens[i];
+		if(t->type == MO_TOKEN_EOF) {
+			chunk->end = i;
+			break;
+		}
+
+		u64 head = (u64)t->type | (u64)(u32)t->length << 32;
+		if(t->type == MO_TOKEN_IDENTIFIER && typedef_table_contains(lexer->typedefs, t->data, t->length))
+			head |= 1ull << 31;
+		decl_cache_mix(hash, head);
+		// the bytes eight at a time
+		const u8* data = t->data;
+		for(s32 left = t->length; left > 0; left -= 8, data += 8) {
+			u64 word = 0;
+			if(data + 8 <= lexer->stream_end) {
+				// little endian, the bytes past the token are masked off
+				memcpy(&word, data, 8);
+				if(left < 8) word &= ((u64)1 << (8 * left)) - 1;
+			} else {
+				memcpy(&word, data, MIN(left, 8));
+			}
+			decl_cache_mix(hash, word);
+		}
+
+		while(array_length(groups) > 0 && groups[array_length(groups) - 1] == i)
+			array_length(groups)--;
+		switch(t->type) {
+			case '(': case '[': case '{': {
+				s32 close = lexer_match_delimiter(lexer, i);
+				if(close == -1) {
+					cache->groups = groups;
+					return false;
+				}
+				bool function = t->type == '{' && array_length(groups) == 0 && i > begin && tokens[i - 1].type == ')';
+				if(function || (t->type == '{' && decl_cache_lazy_open(lexer, begin, i))) {
+					Decl_Chunk body = { i + 1, close };
+					array_push(cache->skips, body);
+					decl_cache_mix(hash, (u64)(close - i));
+					if(function) {
+						chunk->end = close + 1;
+						found = true;
+					}
+					// the } is hashed like any other token
+					i = close;
+					continue;
+				}
+				array_push(groups, close);
+			} break;
+			case ';':
+				if(array_length(groups) == 0) {
+					chunk->end = i + 1;
+					found = true;
+				}
+				break;
+			default: break;
+		}
+		++i;
+	}
+	cache->groups = groups;
+	chunk->begin = begin;
+
+	hash->key ^= hash->key >> 29;
+	hash->key *= 0xbf58476d1ce4e5b9ull;
+	hash->key ^= hash->key >> 32;
+	if(!hash->key) hash->key = 1;
+	return chunk->end > begin;
+}
+
+static bool
+decl_cache_is_list(MO_Node_Kind kind) {
+	switch(kind) {
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST:
+		case MO_AST_ENUMERATOR_LIST:
+		case MO_AST_PARAMETER_LIST:
+		case MO_AST_STRUCT_DECLARATION_LIST:
+		case MO_AST_INITIALIZER_LIST:
+		case MO_AST_TRANSLATION_UNIT:
+		case MO_AST_EXPRESSION_CHAIN:
+			return true;
+		default: return false;
+	}
+}
+
+// The binary kind join_binary turns into a chain for operator bo
+static MO_Node_Kind
+decl_cache_chain_kind(MO_Binary_Operator bo) {
+	switch((s32)bo) {
+		case '+': return MO_AST_EXPRESSION_ADDITIVE;
+		case '*': return MO_AST_EXPRESSION_MULTIPLICATIVE;
+		case '&': return MO_AST_EXPRESSION_AND;
+		case '|': return MO_AST_EXPRESSION_INCLUSIVE_OR;
+		case '^': return MO_AST_EXPRESSION_EXCLUSIVE_OR;
+		case MO_TOKEN_LOGIC_AND: return MO_AST_EXPRESSION_LOGICAL_AND;
+		case MO_TOKEN_LOGIC_OR: return MO_AST_EXPRESSION_LOGICAL_OR;
+		default: return MO_AST_KIND_COUNT;
+	}
+}
+
+// Checks that the nodes are a declaration decl_cache_build can rebuild: the
+// subtrees nest, every child has a slot its parent has, in order, list
+// entries have no gaps and tokens and type infos are in range.
+static bool
+decl_cache_valid(MO_Decl_Cache* cache, const MO_Flat_Node* nodes, u32 count,
+	const MO_Flat_Type_Info* infos, u32 info_count, u32 tokens)
+{
+	if(count == 0 || nodes[0].next != count ||
+		(nodes[0].kind != MO_AST_DECLARATION && nodes[0].kind != MO_AST_FUNCTION_DEFINITION))
+		return false;
+
+	Decl_Cache_Check* stack = cache->checks;
+	array_clear(stack);
+	bool valid = true;
+	for(u32 i = 0; i < count && valid; ++i) {
+		const MO_Flat_Node* n = &nodes[i];
+		valid = false;
+		if(n->kind >= MO_AST_KIND_COUNT || n->next <= i || n->next > count)
+			break;
+		if(n->kind == MO_AST_LAZY_BODY) {
+			if(n->token > n->payload || n->payload >= tokens) break;
+		} else if(n->token != MO_FLAT_NONE && n->token >= tokens) {
+			break;
+		}
+		if(n->kind == MO_AST_TYPE_INFO && (n->payload >= info_count || infos[n->payload].kind > MO_TYPE_ALIAS))
+			break;
+		if(n->kind == MO_AST_EXPRESSION_CHAIN && decl_cache_chain_kind((MO_Binary_Operator)n->op) == MO_AST_KIND_COUNT)
+			break;
+
+		while(array_length(stack) > 0 && nodes[stack[array_length(stack) - 1].index].next <= i)
+			array_length(stack)--;
+		if(i > 0) {
+			if(array_length(stack) == 0) break;
+			Decl_Cache_Check* parent = &stack[array_length(stack) - 1];
+			const MO_Flat_Node* p = &nodes[parent->index];
+			s32 slot = n->slot;
+			if(n->next > p->next) break;
+			if(decl_cache_is_list((MO_Node_Kind)p->kind)) {
+				if(slot != parent->last_slot + 1) break;
+			} else if(p->kind == MO_AST_DECLARATION) {
+				// decl_specifiers, then the init declarators in order
+				if(slot != parent->last_slot + 1 && !(parent->last_slot == -1 && slot == 1)) break;
+			} else if(slot <= parent->last_slot || slot >= parent->slot_count) {
+				break;
+			}
+			parent->last_slot = slot;
+		}
+
+		Decl_Cache_Check c = { i, -1, 0 };
+		if(n->next > i + 1 && !decl_cache_is_list((MO_Node_Kind)n->kind) && n->kind != MO_AST_DECLARATION) {
+			MO_Ast probe = {0};
+			probe.kind = (MO_Node_Kind)n->kind;
+			if(n->kind == MO_AST_TYPE_INFO) probe.specifier_qualifier.kind = (MO_Type_Kind)infos[n->payload].kind;
+			c.slot_count = ast_child_count(&probe);
+		}
+		array_push(stack, c);
+		valid = true;
+	}
+	cache->checks = stack;
+	return valid;
+}
+
+static MO_Ast*
+decl_cache_node(Lexer* lexer, s32 base, const MO_Flat_Node* n, const MO_Flat_Type_Info* infos) {
+	MO_Ast* node = allocate_node(lexer, (MO_Node_Kind)n->kind);
+	Token* t = (n->token != MO_FLAT_NONE) ? &lexer->tokens[base + n->token] : 0;
+
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+			node->expression_binary.bo = (MO_Binary_Operator)n->op;
+			break;
+		case MO_AST_EXPRESSION_CHAIN:
+			node->expression_chain.bo = (MO_Binary_Operator)n->op;
+			node->expression_chain.operator_kind = decl_cache_chain_kind(node->expression_chain.bo);
+			break;
+		case MO_AST_EXPRESSION_UNARY:
+			node->expression_unary.uo = (MO_Unary_Operator)n->op;
+			break;
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+			node->expression_postfix_unary.po = (MO_Postfix_Operator)n->op;
+			break;
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:
+			node->expression_postfix_binary.po = (MO_Postfix_Operator)n->op;
+			break;
+		case MO_AST_EXPRESSION_SIZEOF:
+			node->expression_sizeof.is_type_name = n->op != 0;
+			break;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+			node->direct_abstract_decl.type = (MO_Direct_Abstract_Decl_Type)n->op;
+			node->direct_abstract_decl.name = t;
+			break;
+		case MO_AST_PARAMETER_LIST:
+			node->parameter_list.is_vararg = n->op != 0;
+			break;
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_EXPRESSION_PRIMARY_CONSTANT:
+		case MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL:
+		case MO_AST_CONSTANT_FLOATING_POINT:
+		case MO_AST_CONSTANT_INTEGER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_CONSTANT_CHARACTER:
+			node->expression_primary.data = t;
+			break;
+		case MO_AST_ENUMERATOR:
+			node->enumerator.enum_constant = t;
+			break;
+		case MO_AST_TYPE_INFO: {
+			const MO_Flat_Type_Info* info = &infos[n->payload];
+			MO_Ast_Specifier_Qualifier* sq = &node->specifier_qualifier;
+			sq->kind = (MO_Type_Kind)info->kind;
+			sq->qualifiers = info->qualifiers;
+			sq->storage_class = info->storage_class;
+			switch(sq->kind) {
+				case MO_TYPE_PRIMITIVE:
+					for(s32 i = 0; i < ARRAY_LENGTH(info->primitive); ++i)
+						sq->primitive[i] = (MO_Type_Primitive)info->primitive[i];
+					break;
+				case MO_TYPE_ALIAS: sq->alias = t; break;
+				case MO_TYPE_ENUM: sq->enum_name = t; break;
+				case MO_TYPE_STRUCT:
+				case MO_TYPE_UNION: sq->struct_name = t; break;
+				default: break;
+			}
+		} break;
+		case MO_AST_LAZY_BODY:
+			node->lazy_body.begin = base + (s32)n->token;
+			node->lazy_body.end = base + (s32)n->payload;
+			break;
+		case MO_AST_INITIALIZER_LIST:
+			// {} has a list without entries
+			node->initializer_list.list = array_new_with(MO_Ast*, lexer->allocator);
+			break;
+		default: break;
+	}
+	return node;
+}
+
+// The inverse of ast_child
+static void
+decl_cache_set_child(Lexer* lexer, MO_Ast* node, s32 slot, MO_Ast* child) {
+	MO_Ast*** list = 0;
+	switch(node->kind) {
+		case MO_AST_EXPRESSION_UNARY:
+			node->expression_unary.expr = child; return;
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+			node->expression_postfix_unary.expr = child; return;
+		case MO_AST_EXPRESSION_SIZEOF:
+			// type and expr share their place
+			node->expression_sizeof.expr = child; return;
+		case MO_AST_TYPE_STRUCT_DECLARATOR:
+			node->struct_declarator.declarator = child; return;
+		case MO_AST_ENUMERATOR:
+			node->enumerator.const_expr = child; return;
+
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+			if(slot == 0) node->expression_binary.left = child;
+			else node->expression_binary.right = child;
+			return;
+		case MO_AST_EXPRESSION_ARGUMENT_LIST:
+			if(slot == 0) node->expression_argument_list.expr = child;
+			else node->expression_argument_list.next = child;
+			return;
+		case MO_AST_EXPRESSION_CAST:
+			if(slot == 0) node->expression_cast.type_name = child;
+			else node->expression_cast.expression = child;
+			return;
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:
+			if(slot == 0) node->expression_postfix_binary.left = child;
+			else node->expression_postfix_binary.right = child;
+			return;
+		case MO_AST_TYPE_NAME:
+			if(slot == 0) node->type_name.qualifiers_specifiers = child;
+			else node->type_name.abstract_declarator = child;
+			return;
+		case MO_AST_TYPE_POINTER:
+			if(slot == 0) node->pointer.qualifiers = child;
+			else node->pointer.next = child;
+			return;
+		case MO_AST_TYPE_ABSTRACT_DECLARATOR:
+			if(slot == 0) node->abstract_type_decl.pointer = child;
+			else node->abstract_type_decl.direct_abstract_decl = child;
+			return;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:
+			if(slot == 0) node->direct_abstract_decl.left_opt = child;
+			else node->direct_abstract_decl.right_opt = child;
+			return;
+		case MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD:
+			if(slot == 0) node->struct_declarator_bitfield.declarator = child;
+			else node->struct_declarator_bitfield.const_expr = child;
+			return;
+		case MO_AST_PARAMETER_DECLARATION:
+			if(slot == 0) node->parameter_decl.decl_specifiers = child;
+			else node->parameter_decl.declarator = child;
+			return;
+		case MO_AST_STRUCT_DECLARATION:
+			if(slot == 0) node->struct_declaration.spec_qual = child;
+			else node->struct_declaration.struct_decl_list = child;
+			return;
+		case MO_AST_INIT_DECLARATOR:
+			if(slot == 0) node->init_declarator.declarator = child;
+			else node->init_declarator.initializer = child;
+			return;
+		case MO_AST_DECLARATION:
+			if(slot == 0) {
+				node->declaration.decl_specifiers = child;
+				return;
+			}
+			list = &node->declaration.init_declarators;
+			break;
+
+		case MO_AST_FUNCTION_DEFINITION: {
+			switch(slot) {
+				case 0: node->function_definition.decl_specifiers = child; return;
+				case 1: node->function_definition.declarator = child; return;
+				default: node->function_definition.body = child; return;
+			}
+		}
+		case MO_AST_EXPRESSION_TERNARY: {
+			switch(slot) {
+				case 0: node->expression_ternary.condition = child; return;
+				case 1: node->expression_ternary.case_true = child; return;
+				default: node->expression_ternary.case_false = child; return;
+			}
+		}
+		case MO_AST_TYPE_INFO:
+			if(node->specifier_qualifier.kind == MO_TYPE_ENUM) node->specifier_qualifier.enumerator_list = child;
+			else node->specifier_qualifier.struct_desc = child;
+			return;
+
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST: list = &node->struct_declarator_list.list; break;
+		case MO_AST_ENUMERATOR_LIST:             list = (MO_Ast***)&node->enumerator_list.list; break;
+		case MO_AST_PARAMETER_LIST:              list = &node->parameter_list.param_decl; break;
+		case MO_AST_STRUCT_DECLARATION_LIST:     list = &node->struct_declaration_list.list; break;
+		case MO_AST_INITIALIZER_LIST:            list = &node->initializer_list.list; break;
+		case MO_AST_TRANSLATION_UNIT:            list = &node->translation_unit.list; break;
+		case MO_AST_EXPRESSION_CHAIN:            list = &node->expression_chain.operands; break;
+		default: return;
+	}
+	if(!*list) *list = array_new_with(MO_Ast*, lexer->allocator);
+	array_push(*list, child);
+}
+
+// Rebuilds the nodes decl_cache_valid accepted, base is the index of the
+// first token of the declaration.
+static MO_Ast*
+decl_cache_build(MO_Decl_Cache* cache, Lexer* lexer, s32 base, const MO_Flat_Node* nodes, u32 count,
+	const MO_Flat_Type_Info* infos)
+{
+	Decl_Cache_Frame* stack = cache->frames;
+	array_clear(stack);
+	MO_Ast* root = 0;
+	for(u32 i = 0; i < count; ++i) {
+		while(array_length(stack) > 0 && stack[array_length(stack) - 1].next <= i)
+			array_length(stack)--;
+		MO_Ast* node = decl_cache_node(lexer, base, &nodes[i], infos);
+		if(array_length(stack) > 0) decl_cache_set_child(lexer, stack[array_length(stack) - 1].node, nodes[i].slot, node);
+		else root = node;
+		Decl_Cache_Frame frame = { node, nodes[i].next };
+		array_push(stack, frame);
+	}
+	cache->frames = stack;
+	return root;
+}
+
+static MO_Ast*
+decl_cache_lookup(MO_Decl_Cache* cache, Lexer* lexer, Decl_Chunk chunk, Decl_Cache_Hash hash) {
+	Decl_Cache_Slot* slot = decl_cache_find(cache, hash.key);
+	u32 tokens = (u32)(chunk.end - chunk.begin);
+	if(!slot || slot->key != hash.key || slot->check != hash.check || slot->tokens != tokens) {
+		cache->stats.misses++;
+		return 0;
+	}
+
+	u64 used = decl_cache_header(cache)->used;
+	u64 node_bytes = (u64)slot->nodes * sizeof(MO_Flat_Node);
+	u64 info_bytes = (u64)slot->type_infos * sizeof(MO_Flat_Type_Info);
+	if((slot->offset & 7) != 0 || slot->offset > used || node_bytes + info_bytes > used - slot->offset) {
+		cache->stats.misses++;
+		return 0;
+	}
+	const MO_Flat_Node* nodes = (const MO_Flat_Node*)(decl_cache_data(cache) + slot->offset);
+	const MO_Flat_Type_Info* infos = (const MO_Flat_Type_Info*)((const u8*)nodes + node_bytes);
+	// the lock keeps other writers out, a tree checked once stays good
+	u8* checked = &cache->checked[slot - decl_cache_slots(cache)];
+	if(!*checked && (slot->sum != decl_cache_sum((const u8*)nodes, node_bytes + info_bytes) ||
+		!decl_cache_valid(cache, nodes, slot->nodes, infos, slot->type_infos, tokens))) {
+		cache->stats.misses++;
+		return 0;
+	}
+	*checked = 1;
+
+	cache->stats.hits++;
+	return decl_cache_build(cache, lexer, chunk.begin, nodes, slot->nodes, infos);
+}
+
+static MO_Walk_Action
+decl_cache_find_gap(MO_Ast* node, MO_Ast* parent, int depth, void* user) {
+	MO_Ast** list = parse_node_list(node);
+	for(u64 i = 0; list && i < array_length(list); ++i) {
+		if(!list[i]) {
+			*(bool*)user = true;
+			return MO_WALK_STOP;
+		}
+	}
+	return MO_WALK_CONTINUE;
+}
+
+static void
+decl_cache_store(MO_Decl_Cache* cache, Lexer* lexer, Decl_Chunk chunk, Decl_Cache_Hash hash, MO_Ast* node) {
+	// the flat layout leaves out missing children, which only a list would notice
+	bool gap = false;
+	ast_walk(node, decl_cache_find_gap, 0, &gap);
+	if(gap) return;
+
+	MO_Flat_Ast* flat = &cache->flat;
+	if(flat->nodes) array_clear(flat->nodes);
+	if(flat->type_infos) array_clear(flat->type_infos);
+	flat->count = 0;
+	flat->type_info_count = 0;
+	// token indices come out relative to the declaration
+	flat->tokens = lexer->tokens + chunk.begin;
+	ast_flatten(flat, node);
+
+	// the hash is only good for the tree when the bodies it left out are the
+	// ones the parser skipped
+	u64 lazy = 0;
+	for(s32 i = 0; i < flat->count; ++i) {
+		MO_Flat_Node* n = &flat->nodes[i];
+		if(n->kind != MO_AST_LAZY_BODY) continue;
+		bool skipped = false;
+		for(u64 k = 0; k < array_length(cache->skips) && !skipped; ++k)
+			skipped = cache->skips[k].begin == (s32)n->token && cache->skips[k].end == (s32)n->payload;
+		if(!skipped) return;
+		lazy++;
+		n->token -= (u32)chunk.begin;
+		n->payload -= (u32)chunk.begin;
+	}
+	if(lazy != array_length(cache->skips)) return;
+
+	// one the lookup turns down would be stored again on every run
+	u32 tokens = (u32)(chunk.end - chunk.begin);
+	if(!decl_cache_valid(cache, flat->nodes, (u32)flat->count, flat->type_infos, (u32)flat->type_info_count, tokens))
+		return;
+
+	Decl_Cache_Header* header = decl_cache_header(cache);
+	if(header->entries + 1 > header->slot_count / 4 * 3 ||
+		(header->used > DECL_CACHE_DATA && header->stale > header->used / 2))
+		decl_cache_clear(cache);
+
+	size_t node_bytes = flat->count * sizeof(MO_Flat_Node);
+	size_t info_bytes = flat->type_info_count * sizeof(MO_Flat_Type_Info);
+	size_t bytes = (node_bytes + info_bytes + 7) & ~(size_t)7;
+	Decl_Cache_Slot* slot = decl_cache_find(cache, hash.key);
+	if(!slot) return;
+
+	// the tree stored under the key before, the new one goes in its place
+	// when it fits
+	u64 old = 0;
+	if(slot->key == hash.key) {
+		old = ((u64)slot->nodes * sizeof(MO_Flat_Node) + (u64)slot->type_infos * sizeof(MO_Flat_Type_Info) + 7) & ~(u64)7;
+		if((slot->offset & 7) != 0 || slot->offset > header->used || old > header->used - slot->offset)
+			old = 0; // damaged, there is nothing to take over
+	}
+	bool reuse = bytes <= old;
+	if(!reuse) {
+		size_t data_size = decl_cache_data_size(cache);
+		if(header->used + bytes > data_size) {
+			size_t grown = MAX(data_size * 2, header->used + bytes + DECL_CACHE_DATA);
+			if(!decl_cache_map(cache, decl_cache_data_offset(header->slot_count) + grown))
+				return;
+			header = decl_cache_header(cache);
+			slot = decl_cache_find(cache, hash.key);
+		}
+	}
+
+	u64 offset = reuse ? slot->offset : header->used;
+	u8* data = decl_cache_data(cache) + offset;
+	memcpy(data, flat->nodes, node_bytes);
+	if(info_bytes) memcpy(data + node_bytes, flat->type_infos, info_bytes);
+
+	// a run cut short leaves at worst an entry decl_cache_valid turns down
+	if(slot->key == 0) header->entries++;
+	slot->check = hash.check;
+	slot->offset = offset;
+	slot->tokens = tokens;
+	slot->nodes = (u32)flat->count;
+	slot->type_infos = (u32)flat->type_info_count;
+	slot->sum = decl_cache_sum(data, node_bytes + info_bytes);
+	slot->key = hash.key;
+	cache->checked[slot - decl_cache_slots(cache)] = 1;
+	if(reuse) {
+		header->stale += old - bytes;
+	} else {
+		header->stale += old;
+		header->used += bytes;
+	}
+	cache->stats.stores++;
+}
+
+// translation-unit as parse_translation_unit parses it, with every top-level
+// declaration looked up in lexer->decl_cache first
+static MO_Parser_Result
+parse_translation_unit_cached(Lexer* lexer) {
+	MO_Decl_Cache* cache = lexer->decl_cache;
+	MO_Parser_Result res = {0};
+	MO_Ast** list = array_new_with(MO_Ast*, lexer->allocator);
+
+	while(lexer_peek(lexer)->type != MO_TOKEN_EOF) {
+		if(lexer_peek(lexer)->type == ';') {
+			// stray ; at file scope
+			lexer_next(lexer);
+			continue;
+		}
+		// a rebuilt declaration does not go through the rules that stop the parse
+		if(lexer->parser_flags & (PARSER_FLAG_LIMIT_EXCEEDED | PARSER_FLAG_DEPTH_EXCEEDED)) {
+			res = parse_limit_error(lexer);
+			break;
+		}
+
+		Decl_Chunk chunk = {0};
+		Decl_Cache_Hash hash = {0};
+		bool cached = decl_cache_scan(cache, lexer, lexer->index, &chunk, &hash);
+		if(cached) {
+			MO_Ast* node = decl_cache_lookup(cache, lexer, chunk, hash);
+			if(node) {
+				if(node->kind == MO_AST_DECLARATION) declaration_add_typedefs(lexer, node);
+				lexer->index = chunk.end;
+				if(lexer->poll) parse_limits_poll(lexer);
+				array_push(list, node);
+				continue;
+			}
+		}
+
+		MO_Parser_Result decl = parse_declaration(lexer);
+		if(decl.status == MO_PARSER_STATUS_FATAL) {
+			res = decl;
+			break;
+		}
+		// the parser ends a declaration where the scan does, but for broken ones
+		if(cached && lexer->index == chunk.end && !(lexer->parser_flags & (PARSER_FLAG_LIMIT_EXCEEDED | PARSER_FLAG_DEPTH_EXCEEDED)))
+			decl_cache_store(cache, lexer, chunk, hash, decl.node);
+		array_push(list, decl.node);
+	}
+
+	if(res.status == MO_PARSER_STATUS_FATAL) {
+		array_free(list);
+		return res;
+	}
+	res.node = allocate_node(lexer, MO_AST_TRANSLATION_UNIT);
+	res.node->translation_unit.list = list;
+	return res;
+}
+
+MO_Decl_Cache*
+mop_decl_cache_open(const char* path, int max_entries, MO_Allocator* allocator) {
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if(fd < 0)
+		return 0;
+	struct stat st;
+	if(flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0) {
+		close(fd);
+		return 0;
+	}
+
+	MO_Decl_Cache* cache = mem_alloc(allocator, sizeof(MO_Decl_Cache));
+	cache->allocator = allocator;
+	cache->fd = fd;
+	cache->size = (size_t)st.st_size;
+	if(cache->size >= sizeof(Decl_Cache_Header)) {
+		void* map = mmap(0, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		cache->map = (map != MAP_FAILED) ? map : 0;
+	}
+
+	if(!cache->map || !decl_cache_usable(decl_cache_header(cache), cache->size)) {
+		// a new file, or one there is nothing to take from
+		if(cache->map) munmap(cache->map, cache->size);
+		cache->map = 0;
+		cache->size = 0;
+		u32 slot_count = 1024;
+		u64 wanted = (max_entries > 0) ? (u64)max_entries : DECL_CACHE_ENTRIES;
+		while(slot_count / 4 * 3 < wanted && slot_count < (1u << 30)) slot_count *= 2;
+		if(ftruncate(fd, 0) != 0 || !decl_cache_map(cache, decl_cache_data_offset(slot_count) + DECL_CACHE_DATA)) {
+			close(fd);
+			mem_free(allocator, cache, sizeof(MO_Decl_Cache));
+			return 0;
+		}
+		Decl_Cache_Header* header = decl_cache_header(cache);
+		header->magic = DECL_CACHE_MAGIC;
+		header->version = DECL_CACHE_VERSION;
+		header->node_size = sizeof(MO_Flat_Node);
+		header->slot_count = slot_count;
+	}
+	decl_cache_header(cache)->open = 1;
+	cache->checked = mem_alloc(allocator, decl_cache_header(cache)->slot_count);
+
+	cache->flat.allocator = allocator;
+	cache->skips = array_new_with(Decl_Chunk, allocator);
+	cache->groups = array_new_with(s32, allocator);
+	cache->checks = array_new_with(Decl_Cache_Check, allocator);
+	cache->frames = array_new_with(Decl_Cache_Frame, allocator);
+	return cache;
+}
+
+void
+mop_decl_cache_close(MO_Decl_Cache* cache) {
+	if(!cache) return;
+	Decl_Cache_Header* header = decl_cache_header(cache);
+	header->open = 0;
+	// the room left for more trees is not kept
+	u32 slot_count = header->slot_count;
+	size_t size = decl_cache_data_offset(slot_count) + header->used;
+	munmap(cache->map, cache->size);
+	ftruncate(cache->fd, (off_t)size);
+	close(cache->fd); // and the lock with it
+
+	mop_flat_free(&cache->flat);
+	array_free(cache->skips);
+	array_free(cache->groups);
+	array_free(cache->checks);
+	array_free(cache->frames);
+	mem_free(cache->allocator, cache->checked, slot_count);
+	mem_free(cache->allocator, cache, sizeof(MO_Decl_Cache));
+}
+
+MO_Decl_Cache_Stats
+mop_decl_cache_stats(MO_Decl_Cache* cache) {
+	MO_Decl_Cache_Stats stats = cache->stats;
+	stats.entries = decl_cache_header(cache)->entries;
+	stats.bytes = decl_cache_header(cache)->used;
+	return stats;
+}
+
+#else
+
+static MO_Parser_Result
+parse_translation_unit_cached(Lexer* lexer) {
+	return parse_translation_unit(lexer);
+}
+
+MO_Decl_Cache*
+mop_decl_cache_open(const char* path, int max_entries, MO_Allocator* allocator) {
+	return 0; // no shared file mappings
+}
+
+void
+mop_decl_cache_close(MO_Decl_Cache* cache) {
+}
+
+MO_Decl_Cache_Stats
+mop_decl_cache_stats(MO_Decl_Cache* cache) {
+	MO_Decl_Cache_Stats stats = {0};
+	return stats;
+}
+
+#endif
@@ -0,0 +1,397 @@
+// x86-64 machine code for programs, see mop_program_jit.
+//
+// Each bytecode instruction is lowered on its own to a fixed sequence, so the
+// JIT is a single pass over the bytecode with the jumps patched at the end.
+// The VM registers are a frame of 8 byte slots on the stack, loaded into
+// scratch registers by the instruction that uses them. Integer division by 0
+// and out of range indices jump to stubs that return the status.
+//
+// The generated function is a leaf with the signature of Vm_Native in the
+// System V calling convention:
+//     rdi values, rsi result, r8 constants (moved from rdx), rsp the frame,
+//     rax rcx rdx xmm0 xmm1 scratch
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#define JIT_RAX 0
+#define JIT_RCX 1
+#define JIT_RDX 2
+#define JIT_RSP 4
+#define JIT_RSI 6
+#define JIT_RDI 7
+#define JIT_R8  8
+
+// condition codes, the low nibble of jcc and setcc
+#define JIT_CC_AE 0x3
+#define JIT_CC_E  0x4
+#define JIT_CC_NE 0x5
+#define JIT_CC_A  0x7
+#define JIT_CC_P  0xA
+#define JIT_CC_NP 0xB
+#define JIT_CC_L  0xC
+#define JIT_CC_GE 0xD
+#define JIT_CC_LE 0xE
+#define JIT_CC_G  0xF
+
+typedef struct {
+	s32 at;     // offset of the rel32
+	s32 target; // bytecode index, or -status for the stub returning it
+} Jit_Fixup;
+
+typedef struct {
+	u8*        code;   // light_array
+	s32*       labels; // code offset of every bytecode instruction
+	s32        stubs[MO_EVAL_INDEX_OUT_OF_RANGE + 1]; // code offset of the stub returning each status
+	Jit_Fixup* fixups; // light_array
+	s32        frame;  // bytes of the register frame
+} Jit;
+
+static void
+jit_bytes(Jit* j, const char* bytes, s32 length) {
+	for(s32 i = 0; i < length; ++i) array_push(j->code, (u8)bytes[i]);
+}
+
+static void
+jit_u32(Jit* j, u32 value) {
+	for(s32 i = 0; i < 4; ++i) array_push(j->code, (u8)(value >> (i * 8)));
+}
+
+#define JIT_EMIT(J, BYTES) jit_bytes((J), (BYTES), sizeof(BYTES) - 1)
+
+// prefix op reg, [base + disp32], with REX.W when wide
+static void
+jit_mem(Jit* j, u8 prefix, bool wide, const char* op, s32 op_length, s32 reg, s32 base, s32 disp) {
+	if(prefix) array_push(j->code, prefix);
+	u8 rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((base & 8) ? 1 : 0);
+	if(rex != 0x40) array_push(j->code, rex);
+	jit_bytes(j, op, op_length);
+	array_push(j->code, (u8)(0x80 | ((reg & 7) << 3) | (base & 7)));
+	if((base & 7) == JIT_RSP) array_push(j->code, 0x24);
+	jit_u32(j, (u32)disp);
+}
+
+// the operand is base, disp as given by JIT_SLOT, JIT_CONSTANT and JIT_VALUE
+#define JIT_MEM(J, PREFIX, WIDE, OP, REG, ...) jit_mem((J), (PREFIX), (WIDE), (OP), sizeof(OP) - 1, (REG), __VA_ARGS__)
+
+// Memory operand of a VM register, a constant or a binding
+#define JIT_SLOT(R)       JIT_RSP, (s32)((R) * sizeof(Vm_Register))
+#define JIT_CONSTANT(K)   JIT_R8, (s32)((K) * sizeof(Vm_Register))
+#define JIT_VALUE(V, OFF) JIT_RDI, (s32)((V) * sizeof(MO_Value) + (OFF))
+
+static void
+jit_load(Jit* j, s32 reg, s32 base, s32 disp) {
+	JIT_MEM(j, 0, true, "\x8B", reg, base, disp); // mov reg, [base + disp]
+}
+
+static void
+jit_store(Jit* j, s32 reg, s32 dst) {
+	JIT_MEM(j, 0, true, "\x89", reg, JIT_SLOT(dst)); // mov [rsp + dst], reg
+}
+
+static void
+jit_jump(Jit* j, const char* op, s32 op_length, s32 target) {
+	jit_bytes(j, op, op_length);
+	Jit_Fixup f = { (s32)array_length(j->code), target };
+	array_push(j->code, 0); array_push(j->code, 0); array_push(j->code, 0); array_push(j->code, 0);
+	array_push(j->fixups, f);
+}
+
+static void
+jit_jcc(Jit* j, s32 cc, s32 target) {
+	u8 op[2] = { 0x0F, (u8)(0x80 | cc) };
+	jit_jump(j, (const char*)op, 2, target);
+}
+
+static void
+jit_setcc(Jit* j, s32 cc, s32 reg) {
+	u8 op[3] = { 0x0F, (u8)(0x90 | cc), (u8)(0xC0 | reg) };
+	jit_bytes(j, (const char*)op, 3);
+}
+
+// short forward jump, patched by jit_here
+static s32
+jit_short_jump(Jit* j, u8 op) {
+	array_push(j->code, op);
+	array_push(j->code, 0);
+	return (s32)array_length(j->code) - 1;
+}
+
+static void
+jit_here(Jit* j, s32 at) {
+	j->code[at] = (u8)(array_length(j->code) - (at + 1));
+}
+
+// base and displacement of the right operand, a register or for the K forms a constant
+static void
+jit_right(Vm_Instruction* in, bool k_form, s32* base, s32* disp) {
+	if(k_form) {
+		*base = JIT_R8;
+		*disp = in->imm * (s32)sizeof(Vm_Register);
+	} else {
+		*base = JIT_RSP;
+		*disp = in->b * (s32)sizeof(Vm_Register);
+	}
+}
+
+static bool
+jit_instruction(Jit* j, Vm_Instruction* in) {
+	Vm_Op op = (Vm_Op)in->op;
+	// K forms follow their register form
+	bool k_form = vm_k_form(op);
+	if(k_form) op = (Vm_Op)(op - 1);
+	s32 rb, rd; // right operand
+	jit_right(in, k_form, &rb, &rd);
+
+	switch(op) {
+		case VM_MOV:
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_CONST:
+			jit_load(j, JIT_RAX, JIT_CONSTANT(in->imm));
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_LOAD:
+			jit_load(j, JIT_RAX, JIT_VALUE(in->imm, 0));
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_INDEX:
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			JIT_MEM(j, 0, true, "\x3B", JIT_RAX, JIT_VALUE(in->imm, offsetof(MO_Value, array.count))); // cmp rax, count
+			jit_jcc(j, JIT_CC_AE, -MO_EVAL_INDEX_OUT_OF_RANGE);                                       // unsigned, so < 0 too
+			jit_load(j, JIT_RCX, JIT_VALUE(in->imm, offsetof(MO_Value, array.data)));
+			JIT_EMIT(j, "\x48\x8B\x04\xC1"); // mov rax, [rcx + rax * 8]
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_I2F:
+			JIT_MEM(j, 0xF2, true, "\x0F\x2A", 0, JIT_SLOT(in->a));    // cvtsi2sd xmm0, a
+			JIT_MEM(j, 0xF2, false, "\x0F\x11", 0, JIT_SLOT(in->dst)); // movsd dst, xmm0
+			break;
+		case VM_F2I:
+			JIT_MEM(j, 0xF2, true, "\x0F\x2C", JIT_RAX, JIT_SLOT(in->a)); // cvttsd2si rax, a
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_TRUNC: {
+			u8 shift = (u8)(64 - in->imm);
+			u8 shl[4] = { 0x48, 0xC1, 0xE0, shift };
+			u8 shr[4] = { 0x48, 0xC1, (u8)(in->b ? 0xE8 : 0xF8), shift }; // shr or sar
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			jit_bytes(j, (const char*)shl, 4);
+			jit_bytes(j, (const char*)shr, 4);
+			jit_store(j, JIT_RAX, in->dst);
+		} break;
+		case VM_NEG_I:
+		case VM_NOT_I:
+		case VM_NEG_F:
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			if(op == VM_NEG_I) JIT_EMIT(j, "\x48\xF7\xD8");          // neg rax
+			else if(op == VM_NOT_I) JIT_EMIT(j, "\x48\xF7\xD0");     // not rax
+			else JIT_EMIT(j, "\x48\x0F\xBA\xF8\x3F");                // btc rax, 63
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_LNOT_I:
+		case VM_BOOL_I:
+			JIT_EMIT(j, "\x31\xC9");                                 // xor ecx, ecx
+			JIT_MEM(j, 0, true, "\x83", 7, JIT_SLOT(in->a));         // cmp qword a, 0
+			array_push(j->code, 0);
+			jit_setcc(j, (op == VM_LNOT_I) ? JIT_CC_E : JIT_CC_NE, JIT_RCX);
+			jit_store(j, JIT_RCX, in->dst);
+			break;
+		case VM_LNOT_F:
+		case VM_BOOL_F:
+			// a NaN is not equal to 0
+			JIT_EMIT(j, "\x66\x0F\x57\xC9\x31\xC9\x31\xD2");         // xorpd xmm1, xmm1; xor ecx, ecx; xor edx, edx
+			JIT_MEM(j, 0x66, false, "\x0F\x2E", 1, JIT_SLOT(in->a)); // ucomisd xmm1, a
+			if(op == VM_LNOT_F) {
+				jit_setcc(j, JIT_CC_E, JIT_RCX);
+				jit_setcc(j, JIT_CC_NP, JIT_RDX);
+				JIT_EMIT(j, "\x21\xD1");                             // and ecx, edx
+			} else {
+				jit_setcc(j, JIT_CC_NE, JIT_RCX);
+				jit_setcc(j, JIT_CC_P, JIT_RDX);
+				JIT_EMIT(j, "\x09\xD1");                             // or ecx, edx
+			}
+			jit_store(j, JIT_RCX, in->dst);
+			break;
+		case VM_DIV_I:
+		case VM_MOD_I: {
+			jit_load(j, JIT_RCX, rb, rd);
+			JIT_EMIT(j, "\x48\x85\xC9");                             // test rcx, rcx
+			jit_jcc(j, JIT_CC_E, -MO_EVAL_DIVISION_BY_ZERO);
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			JIT_EMIT(j, "\x48\x83\xF9\xFF");                         // cmp rcx, -1
+			s32 to_divide = jit_short_jump(j, 0x75);                 // jne
+			// x / -1 overflows idiv for the smallest value
+			if(op == VM_DIV_I) JIT_EMIT(j, "\x48\xF7\xD8");          // neg rax
+			else JIT_EMIT(j, "\x31\xC0");                            // xor eax, eax
+			s32 to_store = jit_short_jump(j, 0xEB);                  // jmp
+			jit_here(j, to_divide);
+			JIT_EMIT(j, "\x48\x99\x48\xF7\xF9");                     // cqo; idiv rcx
+			if(op == VM_MOD_I) JIT_EMIT(j, "\x48\x89\xD0");          // mov rax, rdx
+			jit_here(j, to_store);
+			jit_store(j, JIT_RAX, in->dst);
+		} break;
+
+		case VM_ADD_I:
+		case VM_SUB_I:
+		case VM_AND_I:
+		case VM_OR_I:
+		case VM_XOR_I:
+		case VM_MUL_I: {
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			switch(op) {
+				case VM_ADD_I: JIT_MEM(j, 0, true, "\x03", JIT_RAX, rb, rd); break;
+				case VM_SUB_I: JIT_MEM(j, 0, true, "\x2B", JIT_RAX, rb, rd); break;
+				case VM_AND_I: JIT_MEM(j, 0, true, "\x23", JIT_RAX, rb, rd); break;
+				case VM_OR_I:  JIT_MEM(j, 0, true, "\x0B", JIT_RAX, rb, rd); break;
+				case VM_XOR_I: JIT_MEM(j, 0, true, "\x33", JIT_RAX, rb, rd); break;
+				default:       JIT_MEM(j, 0, true, "\x0F\xAF", JIT_RAX, rb, rd); break; // imul
+			}
+			jit_store(j, JIT_RAX, in->dst);
+		} break;
+		case VM_SHL_I:
+		case VM_SHR_I:
+			// the count is taken modulo 64 like the VM does
+			jit_load(j, JIT_RCX, rb, rd);
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			if(op == VM_SHL_I) JIT_EMIT(j, "\x48\xD3\xE0");          // shl rax, cl
+			else JIT_EMIT(j, "\x48\xD3\xF8");                        // sar rax, cl
+			jit_store(j, JIT_RAX, in->dst);
+			break;
+		case VM_LT_I:
+		case VM_LE_I:
+		case VM_GT_I:
+		case VM_GE_I:
+		case VM_EQ_I:
+		case VM_NE_I: {
+			s32 cc = (op == VM_LT_I) ? JIT_CC_L : (op == VM_LE_I) ? JIT_CC_LE : (op == VM_GT_I) ? JIT_CC_G :
+				(op == VM_GE_I) ? JIT_CC_GE : (op == VM_EQ_I) ? JIT_CC_E : JIT_CC_NE;
+			JIT_EMIT(j, "\x31\xC9");                                 // xor ecx, ecx
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			JIT_MEM(j, 0, true, "\x3B", JIT_RAX, rb, rd);            // cmp rax, b
+			jit_setcc(j, cc, JIT_RCX);
+			jit_store(j, JIT_RCX, in->dst);
+		} break;
+
+		case VM_ADD_F:
+		case VM_SUB_F:
+		case VM_MUL_F:
+		case VM_DIV_F: {
+			JIT_MEM(j, 0xF2, false, "\x0F\x10", 0, JIT_SLOT(in->a)); // movsd xmm0, a
+			switch(op) {
+				case VM_ADD_F: JIT_MEM(j, 0xF2, false, "\x0F\x58", 0, rb, rd); break;
+				case VM_SUB_F: JIT_MEM(j, 0xF2, false, "\x0F\x5C", 0, rb, rd); break;
+				case VM_MUL_F: JIT_MEM(j, 0xF2, false, "\x0F\x59", 0, rb, rd); break;
+				default:       JIT_MEM(j, 0xF2, false, "\x0F\x5E", 0, rb, rd); break;
+			}
+			JIT_MEM(j, 0xF2, false, "\x0F\x11", 0, JIT_SLOT(in->dst));
+		} break;
+		case VM_LT_F:
+		case VM_LE_F:
+		case VM_GT_F:
+		case VM_GE_F:
+		case VM_EQ_F:
+		case VM_NE_F: {
+			// ucomisd sets the flags of an unsigned compare, and PF for NaN, which
+			// makes a and ae false; < and <= compare the operands swapped
+			JIT_EMIT(j, "\x31\xC9\x31\xD2");                         // xor ecx, ecx; xor edx, edx
+			if(op == VM_LT_F || op == VM_LE_F) {
+				JIT_MEM(j, 0xF2, false, "\x0F\x10", 0, rb, rd);
+				JIT_MEM(j, 0x66, false, "\x0F\x2E", 0, JIT_SLOT(in->a));
+			} else {
+				JIT_MEM(j, 0xF2, false, "\x0F\x10", 0, JIT_SLOT(in->a));
+				JIT_MEM(j, 0x66, false, "\x0F\x2E", 0, rb, rd);
+			}
+			switch(op) {
+				case VM_LT_F: case VM_GT_F: jit_setcc(j, JIT_CC_A, JIT_RCX); break;
+				case VM_LE_F: case VM_GE_F: jit_setcc(j, JIT_CC_AE, JIT_RCX); break;
+				case VM_EQ_F:
+					jit_setcc(j, JIT_CC_E, JIT_RCX);
+					jit_setcc(j, JIT_CC_NP, JIT_RDX);
+					JIT_EMIT(j, "\x21\xD1");                         // and ecx, edx
+					break;
+				default:
+					jit_setcc(j, JIT_CC_NE, JIT_RCX);
+					jit_setcc(j, JIT_CC_P, JIT_RDX);
+					JIT_EMIT(j, "\x09\xD1");                         // or ecx, edx
+					break;
+			}
+			jit_store(j, JIT_RCX, in->dst);
+		} break;
+
+		case VM_JMP:
+			jit_jump(j, "\xE9", 1, in->imm);
+			break;
+		case VM_JZ:
+		case VM_JNZ:
+			JIT_MEM(j, 0, true, "\x83", 7, JIT_SLOT(in->a));         // cmp qword a, 0
+			array_push(j->code, 0);
+			jit_jcc(j, (op == VM_JZ) ? JIT_CC_E : JIT_CC_NE, in->imm);
+			break;
+		case VM_RET:
+			jit_load(j, JIT_RAX, JIT_SLOT(in->a));
+			JIT_MEM(j, 0, true, "\x89", JIT_RAX, JIT_RSI, 0);        // mov [rsi], rax
+			JIT_EMIT(j, "\x31\xC0");                                 // xor eax, eax
+			JIT_EMIT(j, "\x48\x81\xC4"); jit_u32(j, (u32)j->frame);  // add rsp, frame
+			JIT_EMIT(j, "\xC3");
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
+static void
+jit_stub(Jit* j, MO_Eval_Status status) {
+	j->stubs[status] = (s32)array_length(j->code);
+	JIT_EMIT(j, "\xB8"); jit_u32(j, (u32)status);               // mov eax, status
+	JIT_EMIT(j, "\x48\x81\xC4"); jit_u32(j, (u32)j->frame);      // add rsp, frame
+	JIT_EMIT(j, "\xC3");
+}
+
+int
+mop_program_jit(MO_Program* program) {
+	if(program->native) return 1;
+
+	Jit j = {0};
+	j.code = array_new_with(u8, program->allocator);
+	j.fixups = array_new_with(Jit_Fixup, program->allocator);
+	j.labels = mem_alloc(program->allocator, program->code_length * sizeof(s32));
+	j.frame = (s32)((program->register_count * sizeof(Vm_Register) + 15) & ~(size_t)15);
+
+	JIT_EMIT(&j, "\x49\x89\xD0");                                   // mov r8, rdx
+	JIT_EMIT(&j, "\x48\x81\xEC"); jit_u32(&j, (u32)j.frame);        // sub rsp, frame
+
+	bool ok = true;
+	for(s32 i = 0; i < program->code_length && ok; ++i) {
+		j.labels[i] = (s32)array_length(j.code);
+		ok = jit_instruction(&j, &program->code[i]);
+	}
+	if(ok) {
+		jit_stub(&j, MO_EVAL_DIVISION_BY_ZERO);
+		jit_stub(&j, MO_EVAL_INDEX_OUT_OF_RANGE);
+		for(s32 i = 0; i < array_length(j.fixups); ++i) {
+			Jit_Fixup f = j.fixups[i];
+			s32 target = (f.target >= 0) ? j.labels[f.target] : j.stubs[-f.target];
+			u32 rel = (u32)(target - (f.at + 4));
+			memcpy(j.code + f.at, &rel, 4);
+		}
+		program->native_size = array_length(j.code);
+		program->native = (Vm_Native)platform_code_new(j.code, program->native_size);
+		if(!program->native) program->native_size = 0;
+	}
+
+	mem_free(program->allocator, j.labels, program->code_length * sizeof(s32));
+	array_free(j.code);
+	array_free(j.fixups);
+	return program->native != 0;
+}
+
+#else
+
+int
+mop_program_jit(MO_Program* program) {
+	return 0;
+}
+
+#endif
@@ -2,16 +2,56 @@
 #include "light_array.h"
 #include <string.h>
 
+// Character classes, one lookup per byte instead of range compares
+enum {
+    CHAR_DIGIT  = (1 << 0),
+    CHAR_HEX    = (1 << 1),
+    CHAR_LETTER = (1 << 2),
+    CHAR_IDENT  = (1 << 3), // letters, digits and _
+    CHAR_SPACE  = (1 << 4), // blanks other than new line
+};
+
+static const u8 char_class[256] = {
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x10, 0x10, 0x10, 0x00, 0x00, // 00
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 10
+    0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 20
+    0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 30
+    0x00, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, // 40
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x08, // 50
+    0x00, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0e, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, // 60
+    0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x0c, 0x00, 0x00, 0x00, 0x00, 0x00, // 70
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 80
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // 90
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // a0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // b0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // c0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // d0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // e0
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, // f0
+};
+
 static bool
 is_letter(char c) {
-	return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z');
+	return char_class[(u8)c] & CHAR_LETTER;
 }
 
 static bool
 is_number(char c) {
-	return c >= '0' && c <= '9';
+	return char_class[(u8)c] & CHAR_DIGIT;
+}
+
+static bool
+is_hex_digit(char c) {
+	return char_class[(u8)c] & CHAR_HEX;
+}
+
+static bool
+is_identifier_char(char c) {
+	return char_class[(u8)c] & CHAR_IDENT;
 }
 
+#include "lexer_simd.c"
+
 static bool
 string_equal_token(const char* s, Token* t) {
     s32 i = 0;
@@ -102,35 +142,145 @@ match_keyword(Token* t) {
     }
 }
 
+// u U | l L | ll LL | ul UL | ull ULL suffixes, returns the offset from the
+// signed int literal token type: INT, L, LL, U, UL, ULL.
+static s32
+integer_suffix(u8** ptr, u32* flags) {
+    u8* at = *ptr;
+    bool uns = false;
+    s32 long_count = 0;
+
+    if(*at == 'u' || *at == 'U') {
+        ++at;
+        uns = true;
+    }
+    if(*at == 'l') {
+        ++at; ++long_count;
+        if(*at == 'l') {
+            ++at; ++long_count;
+        }
+    } else if(*at == 'L') {
+        ++at; ++long_count;
+        if(*at == 'L') {
+            ++at; ++long_count;
+        }
+    }
+    if(!uns && (*at == 'u' || *at == 'U')) {
+        ++at;
+        uns = true;
+    }
+
+    *ptr = at;
+    if(uns) *flags |= MO_TOKEN_FLAG_UNSIGNED_SUFFIX;
+    if(long_count == 1) *flags |= MO_TOKEN_FLAG_LONG_SUFFIX;
+    if(long_count == 2) *flags |= MO_TOKEN_FLAG_LONG_LONG_SUFFIX;
+    return (uns) ? (MO_TOKEN_INT_U_LITERAL - MO_TOKEN_INT_LITERAL) + long_count : long_count;
+}
+
+// Decimal digit runs are converted 8 bytes at a time (SWAR), the loads are
+// little endian and never go past the end of the stream.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LEXER_SWAR_DIGITS 0
+#else
+#define LEXER_SWAR_DIGITS 1
+#endif
+
+static bool
+swar_is_eight_digits(u64 v) {
+    return (((v & 0xF0F0F0F0F0F0F0F0ULL) |
+        (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+static u64
+swar_eight_digits_value(u64 v) {
+    v -= 0x3030303030303030ULL;
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+        (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return v;
+}
+
+// Accumulates the decimal digits at *ptr into value, sets overflow when the
+// value does not fit in 64 bits. Returns the number of digits consumed.
+static s32
+decimal_digits(u8** ptr, u8* end, u64* value, bool* overflow) {
+    u8* at = *ptr;
+    u64 v = *value;
+
+#if LEXER_SWAR_DIGITS
+    while(end - at >= 8) {
+        u64 chunk;
+        memcpy(&chunk, at, sizeof(chunk));
+        if(!swar_is_eight_digits(chunk)) break;
+        u64 digits = swar_eight_digits_value(chunk);
+        if(v > (0xFFFFFFFFFFFFFFFFULL - digits) / 100000000ULL) *overflow = true;
+        v = v * 100000000ULL + digits;
+        at += 8;
+    }
+#endif
+    while(is_number(*at)) {
+        u64 d = *at - '0';
+        if(v > 1844674407370955161ULL || (v == 1844674407370955161ULL && d > 5)) *overflow = true;
+        v = v * 10 + d;
+        ++at;
+    }
+
+    s32 count = (s32)(at - *ptr);
+    *ptr = at;
+    *value = v;
+    return count;
+}
+
+// see platform.c
+static double platform_strtod(const char* str);
+
+static const double exact_powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
 static Token
-token_number(u8* at, s32 line, s32 column) {
+token_number(u8* at, u8* end, s32 line, s32 column) {
     Token r = {0};
     r.line = line;
     r.column = column;
     r.data = at;
 
     bool floating = false;
+    bool overflow = false;
+    u64  mantissa = 0;
+    s32  exponent = 0;
+
+    decimal_digits(&at, end, &mantissa, &overflow);
+    if(*at == '.') {
+        floating = true;
+        ++at;
+        exponent = -decimal_digits(&at, end, &mantissa, &overflow);
+    }
 
-    while(true) {
-        if(*at == '.' && floating == false) { 
-            floating = true;
-            ++at;
-            continue;
-        } else if(is_number(*at)) {
-            ++at;
-        } else {
-            break;
+    // e suffix
+    if((*at == 'e' || *at == 'E') &&
+        (is_number(at[1]) || ((at[1] == '-' || at[1] == '+') && is_number(at[2]))))
+    {
+        floating = true;
+        ++at;
+        bool negative = (*at == '-');
+        if(*at == '-' || *at == '+') ++at;
+        s32 e = 0;
+        for(; is_number(*at); ++at) {
+            if(e < 100000) e = e * 10 + (*at - '0');
         }
+        exponent += (negative) ? -e : e;
     }
 
     if(floating) {
-        // e suffix
-        if(*at == 'e' || *at == 'E') {
-            ++at;
-            if(*at == '-' || *at == '+') {
-                ++at;
-            }
-            while(is_number(*at)) ++at;
+        // exact when both the mantissa and the power of ten are exact doubles,
+        // everything else is left to strtod to get the rounding right
+        if(!overflow && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+            double d = (double)mantissa;
+            r.float_value = (exponent < 0) ? d / exact_powers_of_ten[-exponent] : d * exact_powers_of_ten[exponent];
+        } else {
+            r.float_value = platform_strtod((const char*)r.data);
         }
 
         // f | F L suffixes
@@ -142,45 +292,177 @@ token_number(u8* at, s32 line, s32 column) {
             ++at;
         } else {
             r.type = MO_TOKEN_DOUBLE_LITERAL;
-            ++at;
         }
     } else {
-        bool uns = false;
-        s32 long_count = 0;
-        // u U | l L | ll LL | ul UL | ull ULL suffixes
-        if(*at == 'u' || *at == 'U') {
-            ++at;
-            uns = true;
-        }
-        if(*at == 'l') {
-            ++at; ++long_count;
-            if(*at == 'l') {
-                ++at; ++long_count;
-            }
-        }
-        if(*at == 'L') {
-            ++at; ++long_count;
-            if(*at == 'L') {
-                ++at; ++long_count;
-            }
-        }
-        if(uns) {
-            r.type = MO_TOKEN_INT_U_LITERAL + long_count;
-        } else {
-            r.type = MO_TOKEN_INT_LITERAL + long_count;
-        }
+        r.int_value = mantissa;
+        r.type = MO_TOKEN_INT_LITERAL + integer_suffix(&at, &r.flags);
     }
 
+    if(overflow && !floating) r.flags |= MO_TOKEN_FLAG_LITERAL_OVERFLOW;
     r.length = at - r.data;
 
     return r;
 }
 
+// Skips a string or character literal starting at the opening quote,
+// returns one past the closing quote or the NUL that ends the stream.
+static u8*
+token_quoted(u8* at, u8* end, u8 quote) {
+    at++; // skip opening quote
+    while(true) {
+        at = scan_quoted(at, end, quote);
+        if(*at != '\\') break;
+
+        // the escaped character is skipped with the backslash
+        at++;
+        if(*at == 0) break;
+        if(*at == 'x') {
+            // up to two hex digits
+            if(is_hex_digit(at[1])) {
+                at++;
+                if(is_hex_digit(at[1])) at++;
+            } else {
+                //printf("invalid escape sequence '\\x%c", *at);
+            }
+        }
+        at++;
+    }
+    // TODO(psv): error unterminated literal and empty character constant
+    if(*at == quote) at++; // skip closing quote
+    return at;
+}
+
+// 0123.5 and 017e3 are decimal floating literals, not octal integers
 static bool
-is_hex_digit(char c) {
-	return (is_number(c) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F'));
+octal_is_float(u8* at) {
+    while(is_number(*at)) ++at;
+    return *at == '.' || *at == 'e' || *at == 'E';
 }
 
+// Operators are recognized by comparing up to three characters at once
+// against the candidates for their first character, longest first. The
+// single character operator always ends the list, so the scan stops there.
+#define OPERATOR_TEXT(a, b, c) ((u32)(a) | ((u32)(b) << 8) | ((u32)(c) << 16))
+#define ASSIGN MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR
+
+typedef struct {
+    u32           text;
+    s32           length;
+    MO_Token_Type type;
+    u32           flags;
+} Operator;
+
+static const Operator operators[] = {
+    { OPERATOR_TEXT('<', '<', '='), 3, MO_TOKEN_SHL_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('<', '=', 0),   2, MO_TOKEN_LESS_EQUAL, 0 },
+    { OPERATOR_TEXT('<', '<', 0),   2, MO_TOKEN_BITSHIFT_LEFT, 0 },
+    { OPERATOR_TEXT('<', 0, 0),     1, '<', 0 },
+    { OPERATOR_TEXT('>', '>', '='), 3, MO_TOKEN_SHR_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('>', '=', 0),   2, MO_TOKEN_GREATER_EQUAL, 0 },
+    { OPERATOR_TEXT('>', '>', 0),   2, MO_TOKEN_BITSHIFT_RIGHT, 0 },
+    { OPERATOR_TEXT('>', 0, 0),     1, '>', 0 },
+    { OPERATOR_TEXT('!', '=', 0),   2, MO_TOKEN_NOT_EQUAL, 0 },
+    { OPERATOR_TEXT('!', 0, 0),     1, '!', 0 },
+    { OPERATOR_TEXT('|', '=', 0),   2, MO_TOKEN_OR_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('|', '|', 0),   2, MO_TOKEN_LOGIC_OR, 0 },
+    { OPERATOR_TEXT('|', 0, 0),     1, '|', 0 },
+    { OPERATOR_TEXT('=', '=', 0),   2, MO_TOKEN_EQUAL_EQUAL, 0 },
+    { OPERATOR_TEXT('=', 0, 0),     1, '=', ASSIGN },
+    { OPERATOR_TEXT('/', '=', 0),   2, MO_TOKEN_DIV_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('/', 0, 0),     1, '/', 0 },
+    { OPERATOR_TEXT('&', '=', 0),   2, MO_TOKEN_AND_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('&', '&', 0),   2, MO_TOKEN_LOGIC_AND, 0 },
+    { OPERATOR_TEXT('&', 0, 0),     1, '&', 0 },
+    { OPERATOR_TEXT('+', '=', 0),   2, MO_TOKEN_PLUS_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('+', '+', 0),   2, MO_TOKEN_PLUS_PLUS, 0 },
+    { OPERATOR_TEXT('+', 0, 0),     1, '+', 0 },
+    { OPERATOR_TEXT('-', '=', 0),   2, MO_TOKEN_MINUS_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('-', '-', 0),   2, MO_TOKEN_MINUS_MINUS, 0 },
+    { OPERATOR_TEXT('-', '>', 0),   2, MO_TOKEN_ARROW, 0 },
+    { OPERATOR_TEXT('-', 0, 0),     1, '-', 0 },
+    { OPERATOR_TEXT('%', '=', 0),   2, MO_TOKEN_MOD_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('%', 0, 0),     1, '%', 0 },
+    { OPERATOR_TEXT('*', '=', 0),   2, MO_TOKEN_TIMES_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('*', 0, 0),     1, '*', 0 },
+    { OPERATOR_TEXT('^', '=', 0),   2, MO_TOKEN_XOR_EQUAL, ASSIGN },
+    { OPERATOR_TEXT('^', 0, 0),     1, '^', 0 },
+};
+
+// index of the first candidate in operators for each operator character
+static const u8 operator_start[128] = {
+    ['<'] = 0,  ['>'] = 4,  ['!'] = 8,  ['|'] = 10, ['='] = 13, ['/'] = 15,
+    ['&'] = 17, ['+'] = 20, ['-'] = 23, ['%'] = 27, ['*'] = 29, ['^'] = 31,
+};
+
+#undef ASSIGN
+#undef OPERATOR_TEXT
+
+static const Operator*
+match_operator(u8* at) {
+    u32 text = at[0];
+    if(at[1]) text |= ((u32)at[1] << 8) | ((u32)at[2] << 16);
+
+    const Operator* op = &operators[operator_start[at[0]]];
+    while(true) {
+        u32 mask = 0xffffffu >> (8 * (3 - op->length));
+        if((text & mask) == op->text) return op;
+        ++op;
+    }
+}
+
+// What token_next does with the first character of a token
+enum {
+    LEX_EOF,
+    LEX_IDENTIFIER,
+    LEX_NUMBER,
+    LEX_DOT,
+    LEX_CHAR,
+    LEX_STRING,
+    LEX_OPERATOR,
+    LEX_SINGLE, // single character token
+};
+
+#define E LEX_EOF
+#define I LEX_IDENTIFIER
+#define N LEX_NUMBER
+#define D LEX_DOT
+#define C LEX_CHAR
+#define S LEX_STRING
+#define O LEX_OPERATOR
+#define X LEX_SINGLE
+static const u8 char_dispatch[256] = {
+    E, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 00
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 10
+    X, O, S, X, X, O, O, C, X, X, O, O, X, O, D, O, // 20
+    N, N, N, N, N, N, N, N, N, N, X, X, O, O, O, X, // 30
+    X, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, // 40
+    I, I, I, I, I, I, I, I, I, I, I, X, X, X, O, I, // 50
+    X, I, I, I, I, I, I, I, I, I, I, I, I, I, I, I, // 60
+    I, I, I, I, I, I, I, I, I, I, I, X, O, X, X, X, // 70
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 80
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // 90
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // a0
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // b0
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // c0
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // d0
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // e0
+    X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, X, // f0
+};
+#undef E
+#undef I
+#undef N
+#undef D
+#undef C
+#undef S
+#undef O
+#undef X
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LEXER_COMPUTED_GOTO 1
+#else
+#define LEXER_COMPUTED_GOTO 0
+#endif
+
 static Token
 token_next(Lexer* lexer) {
 	u8* at = lexer->stream + lexer->index;
@@ -191,389 +473,220 @@ token_next(Lexer* lexer) {
 	r.line = (s32)lexer->line;
 	r.column = (s32)lexer->column;
 
-	switch (*at) {
-		case 0: return (Token) { 0 };
+#if LEXER_COMPUTED_GOTO
+    static void* dispatch[] = {
+        &&lex_eof, &&lex_identifier, &&lex_number, &&lex_dot,
+        &&lex_char, &&lex_string, &&lex_operator, &&lex_single,
+    };
+    goto *dispatch[char_dispatch[*at]];
+#else
+    switch(char_dispatch[*at]) {
+        case LEX_EOF:        goto lex_eof;
+        case LEX_IDENTIFIER: goto lex_identifier;
+        case LEX_NUMBER:     goto lex_number;
+        case LEX_DOT:        goto lex_dot;
+        case LEX_CHAR:       goto lex_char;
+        case LEX_STRING:     goto lex_string;
+        case LEX_OPERATOR:   goto lex_operator;
+        default:             goto lex_single;
+    }
+#endif
 
-        case '<':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_LESS_EQUAL;
-                ++at;
-            } else if(*at == '<') {
-                ++at;
-                if(*at == '=') {
-                    r.type = MO_TOKEN_SHL_EQUAL;
-                } else {
-                    r.type = MO_TOKEN_BITSHIFT_LEFT;
-                }
-            } else {
-                r.type = '<';
-            }
-            r.length = at - r.data;
-        }break;
-        case '>':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_GREATER_EQUAL;
-                ++at;
-            } else if(*at == '>') {
-                ++at;
-                if(*at == '=') {
-                    r.type = MO_TOKEN_SHR_EQUAL;
-                } else {
-                    r.type = MO_TOKEN_BITSHIFT_RIGHT;
-                }
-            } else {
-                r.type = '>';
-            }
-            r.length = at - r.data;
-        }break;
-        case '!':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_NOT_EQUAL;
-                ++at;
-            } else {
-                r.type = '!';
-            }
-            r.length = at - r.data;
-        }break;
-        case '|':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_OR_EQUAL;
-                ++at;
-            } else if(*at == '|') {
-                r.type = MO_TOKEN_LOGIC_OR;
-                ++at;
-            } else {
-                r.type = '|';
-            }
-            r.length = at - r.data;
-        }break;
-        case '=':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_EQUAL_EQUAL;
-                ++at;
-            } else {
-                r.type = '=';
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-            }
-            r.length = at - r.data;
-        }break;
-        case '/':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_DIV_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else {
-                r.type = '/';
-            }
-            r.length = at - r.data;
-        }break;
-		case '&': {
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_AND_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else if(*at == '&') {
-                r.type = MO_TOKEN_LOGIC_AND;
-                ++at;
-            } else {
-                r.type = '&';
-            }
-            r.length = at - r.data;
-        }break;
-        case '+':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_PLUS_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else if(*at == '+') {
-                r.type = MO_TOKEN_PLUS_PLUS;
-                ++at;
-            } else {
-                r.type = '+';
-            }
-            r.length = at - r.data;
-        }break; 
-        case '-':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_MINUS_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else if(*at == '-') {
-                r.type = MO_TOKEN_MINUS_MINUS;
-                ++at;
-            } else if(*at == '>') {
-                r.type = MO_TOKEN_ARROW;
-                ++at;
-            } else {
-                r.type = '-';
-            }
-            r.length = at - r.data;
-        }break;
-		case '~':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_NOT_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else {
-                r.type = '~';
-            }
-            r.length = at - r.data;
-        }break;
-		case '%':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_MOD_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else {
-                r.type = '%';
-            }
-            r.length = at - r.data;
-        }break;
-        case '*': {
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_TIMES_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
-                ++at;
-            } else {
-                r.type = '*';
-            }
-            r.length = at - r.data;
-        }break;
-        case '^':{
-            ++at;
-            if(*at == '=') {
-                r.type = MO_TOKEN_XOR_EQUAL;
-                r.flags |= MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
+lex_eof:
+    return (Token) { 0 };
+
+lex_operator: {
+        const Operator* op = match_operator(at);
+        r.type = op->type;
+        r.flags = op->flags;
+        r.length = op->length;
+        goto done;
+    }
+
+lex_single:
+    r.type = *at;
+    r.length = 1;
+    goto done;
+
+lex_identifier:
+    at = scan_identifier(at + 1, lexer->stream_end);
+    r.type = MO_TOKEN_IDENTIFIER;
+    r.length = at - r.data;
+    match_keyword(&r);
+    goto done;
+
+lex_dot:
+    if(!is_number(at[1])) {
+        r.type = '.';
+        r.length = 1;
+    } else {
+        // float starting with .
+        r = token_number(at, lexer->stream_end, lexer->line, lexer->column);
+    }
+    goto done;
+
+lex_char: {
+        // TODO(psv): Implement Long suffix  L' c-char-sequence '
+        r.type = MO_TOKEN_CHAR_LITERAL;
+        at = token_quoted(at, lexer->stream_end, '\'');
+        r.length = at - r.data;
+        goto done;
+    }
+
+lex_string: {
+        r.type = MO_TOKEN_STRING_LITERAL;
+        at = token_quoted(at, lexer->stream_end, '"');
+        r.length = at - r.data;
+        goto done;
+    }
+
+lex_number: {
+        // the radix is kept in the token type, suffixes only set flags
+        u64 value = 0;
+        u64 top = 0; // bits shifted out of the value
+        if (*at == '0' && (at[1] == 'x' || at[1] == 'X')) {
+            // hex
+            at += 2;
+            while (*at && is_hex_digit(*at)) {
+                u64 d = (*at <= '9') ? (*at - '0') : ((*at | 0x20) - 'a' + 10);
+                top |= value >> 60;
+                value = (value << 4) | d;
                 ++at;
-            } else {
-                r.type = '^';
             }
-            r.length = at - r.data;
-        }break;
-
-        case '\'': {
-			// TODO(psv): Implement Long suffix  L' c-char-sequence '
-            r.type = MO_TOKEN_CHAR_LITERAL;
-            at++;
-            if (*at == '\'') {
-                at++;
-                // TODO(psv): empty character constant error
-            } else if(*at == '\\') {
-                ++at;
-                switch (*at) {
-                    case 'a':
-                    case 'b':
-                    case 'f':
-                    case 'n':
-                    case 'r':
-                    case 't':
-                    case 'v':
-                    case 'e':
-                    case '\\':
-                    case '\'':
-                    case '"':
-                    case '?':
-                        at++;
-                        break;
-                    case 0:
-                        break;
-                    case 'x':
-                        at++;
-                        if (is_hex_digit(*at) || is_number(*at)) {
-                            at++;
-                            if (is_hex_digit(*at) || is_number(*at)) {
-                                at++;
-                            }
-                        } else {
-                            //printf("invalid escape sequence '\\x%c", *at);
-                        }
-                    default: {
-                        //printf("invalid escape sequence '\\x%c", *at);
-                    }break;
-                }
-                if(*at != '\'') {
-                    //printf("expected end of character literal");
-                }
-                ++at;
-            } else {
+            r.type = MO_TOKEN_INT_HEX_LITERAL;
+        } else if(*at == '0' && is_number(at[1]) && !octal_is_float(at)) {
+            // octal
+            at += 1;
+            while(*at >= '0' && *at <= '7') {
+                top |= value >> 61;
+                value = (value << 3) | (u64)(*at - '0');
                 ++at;
             }
-            if(*at != '\'') {
-                // TODO(psv): error invalid character literal
-            } else {
-                ++at;
+            if(is_number(*at)) {
+                // 8 and 9 stay in the token so it is not read as two numbers
+                r.flags |= MO_TOKEN_FLAG_INVALID_DIGIT;
+                while(is_number(*at)) ++at;
             }
-            r.length = at - r.data;
-        } break;
-
-        case '.': {
-            if(!is_number(at[1])) {
-                r.type = *at;
-                r.length = 1;
+            r.type = MO_TOKEN_INT_OCT_LITERAL;
+        } else if(*at == '0' && (at[1] == 'b' || at[1] == 'B')) {
+            // binary
+            at += 2;
+            while(*at && (*at == '1' || *at == '0')) {
+                top |= value >> 63;
+                value = (value << 1) | (u64)(*at - '0');
                 ++at;
-                break;
             }
+            r.type = MO_TOKEN_INT_BIN_LITERAL;
+        } else {
+            r = token_number(at, lexer->stream_end, lexer->line, lexer->column);
+            goto done;
         }
+        integer_suffix(&at, &r.flags);
+        r.int_value = value;
+        if(top) r.flags |= MO_TOKEN_FLAG_LITERAL_OVERFLOW;
+        r.length = at - r.data;
+        goto done;
+    }
 
-		// Token string
-		case '"': {
-			r.type = MO_TOKEN_STRING_LITERAL;
-			at++;	// skip "
-
-			for (; *at != '"'; ++at) {
-				if (*at == 0) {
-					break;
-				} else if (*at == '\\') {
-					at++;
-					if (*at == '"') {
-						at++;
-					} else {
-						switch (*at) {
-						case 'a':
-						case 'b':
-						case 'f':
-						case 'n':
-						case 'r':
-						case 't':
-						case 'v':
-						case 'e':
-						case '\\':
-						case '\'':
-						case '"':
-						case '?':
-							break;
-						case 0:
-							break;
-						case 'x':
-							at++;
-							if (is_hex_digit(*at) || is_number(*at)) {
-								at++;
-								if (is_hex_digit(*at) || is_number(*at)) {
-									at++;
-								}
-							} else {
-								//printf("invalid escape sequence '\\x%c", *at);
-							}
-						default: {
-							//printf("invalid escape sequence '\\x%c", *at);
-						}break;
-						}
-					}
-				}
-			}
-			at++; // skip "
-			r.length = at - r.data;
-		} break;
-
-		default: {
-            if(*at == '.') {
-                // float starting with .
-                r = token_number(at, lexer->line, lexer->column);
-                break;
-            } else if (is_number(*at)) {
-				if (*at == '0' && at[1] == 'x') {
-					// hex
-					at += 2;
-					while (*at && is_hex_digit(*at)) {
-						++at;
-					}
-					r.type = MO_TOKEN_INT_HEX_LITERAL;
-                } else if(*at == '0' && is_number(at[1])) {
-                    // octal
-                    at += 1;
-                    while(*at && is_number(*at)) {
-                        ++at;
-                    }
-                    r.type = MO_TOKEN_INT_OCT_LITERAL;
-                } else if(*at == '0' && at[1] == 'b') {
-                    // binary
-                    at += 2;
-                    while(*at && (*at == '1' || *at == '0')) {
-                        ++at;
-                    }
-                    r.type = MO_TOKEN_INT_BIN_LITERAL;
-				} else {
-					r = token_number(at, lexer->line, lexer->column);
-                    break;
-				}
-			} else if (is_letter(*at) || *at == '_') {
-                // identifier
-				for (; is_letter(*at) || is_number(*at) || *at == '_'; ++at);
-				r.type = MO_TOKEN_IDENTIFIER;
-
-                r.length = at - r.data;
-                match_keyword(&r);
-                break;
-			} else {
-				r.type = *at;
-			    r.length = 1;
-                ++at;
-			}
-			r.length = at - r.data;
-		} break;
-	}
-
+done:
 	lexer->stream += r.length;
 	lexer->column += r.length;
 	return r;
 }
 
+// Keeps the comment that starts at begin and ends at lexer->index, newlines are
+// those between it and the previous comment or token.
 static void
-lexer_eat_whitespace(Lexer* lexer) {
+lexer_keep_comment(Lexer* lexer, s32 begin, s32 line, s32 column, s32 token, u32 flags, s32 newlines) {
+    if(!lexer->comments) lexer->comments = array_new_with(MO_Comment, lexer->allocator);
+
+    MO_Comment* comments = lexer->comments;
+    s32 count = (s32)array_length(comments);
+    if(flags == MO_COMMENT_FLAG_OWN_LINE && count > 0 && newlines == 1 &&
+        comments[count - 1].token == token && comments[count - 1].flags == MO_COMMENT_FLAG_OWN_LINE)
+    {
+        // the next line of a block of // comments
+        comments[count - 1].length = (s32)(lexer->stream + lexer->index - comments[count - 1].data);
+        return;
+    }
+
+    MO_Comment comment = { lexer->stream + begin, lexer->index - begin, line, column, token, flags };
+    array_push(comments, comment);
+    lexer->comments = comments;
+}
+
+// Skips blanks and comments in front of the token with the given index, with
+// MO_PARSER_FLAG_COMMENTS the comments are kept. Returns the flags this gives
+// the token, MO_TOKEN_FLAG_COMMENTED if comments were kept and
+// MO_TOKEN_FLAG_UNTERMINATED if a /* comment ran into the end of the input.
+static u32
+lexer_eat_whitespace(Lexer* lexer, s32 token) {
+    u32  token_flags = 0;
+    bool line_start = lexer->column == 0;
+    s32  newlines = 0;
     while(true) {
         u8 c = lexer->stream[lexer->index];
-        if (c == ' ' ||
-		    c == '\t' ||
-		    c == '\v' ||
-		    c == '\f' ||
-		    c == '\r') 
-        {
+        if (char_class[c] & CHAR_SPACE) {
             lexer->index++;
             lexer->column++;
         } else if(c == '\n') {
             lexer->index++;
             lexer->line++;
             lexer->column = 0;
+            newlines++;
         } else {
+            s32 begin = lexer->index;
+            s32 line = lexer->line;
+            s32 column = lexer->column;
+            u32 flags = 0;
             if(c == '/' && lexer->stream[lexer->index + 1] == '/') {
                 // single line comment
                 lexer->index += 2;
 				while (lexer->stream[lexer->index] && lexer->stream[lexer->index] != '\n') {
 					lexer->index++;
 				}
-                lexer->line++;
-                lexer->column = 0;
+                // the newline is counted as a blank
             } else if(c == '/' && lexer->stream[lexer->index + 1] == '*') {
                 // multi line comment
                 lexer->index += 2;
+                lexer->column += 2;
                 u8* at = lexer->stream + lexer->index;
                 while(true) {
-                    if(*at == '*' && at[1] == '/') break;
+                    if(at >= lexer->stream_end || !*at) {
+                        // unterminated, what is left is the comment and the
+                        // EOF token takes its place for the error
+                        token_flags |= MO_TOKEN_FLAG_UNTERMINATED;
+                        lexer->line = line;
+                        lexer->column = column;
+                        break;
+                    }
+                    if(*at == '*' && at[1] == '/') {
+                        lexer->index += 2;
+                        lexer->column += 2;
+                        break;
+                    }
                     if(*at == '\n') {
                         lexer->line++;
                         lexer->column = 0;
+                    } else {
+                        lexer->column++;
                     }
                     ++at;
                     ++lexer->index;
                 }
-                lexer->index += 2;
+                flags = MO_COMMENT_FLAG_BLOCK;
             } else {
                 break;
             }
+            if(newlines > 0 || line_start) flags |= MO_COMMENT_FLAG_OWN_LINE;
+            if(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS) {
+                lexer_keep_comment(lexer, begin, line, column, token, flags, newlines);
+                token_flags |= MO_TOKEN_FLAG_COMMENTED;
+            }
+            newlines = 0;
         }
     }
+    return token_flags;
 }
 
 #include <stdio.h>
@@ -600,29 +713,115 @@ token_print(Token t) {
     }
 }
 
-static Token* 
-lexer_cstr(Lexer* lexer, char* str, s32 length, u32 flags) {
+// what a token takes, with its entry in matching
+#define LEXER_TOKEN_BYTES (sizeof(Token) + sizeof(s32))
+
+// Index of the token lexing stops at, one past what max_tokens and max_bytes
+// allow, lexing on is wasted once the parse is bound to fail.
+static s32
+lexer_token_cap(Lexer* lexer) {
+    s64 cap = 0x7fffffff;
+    if(lexer->max_tokens > 0) cap = lexer->max_tokens;
+    if(lexer->max_bytes > 0) cap = MIN(cap, (s64)(lexer->max_bytes / LEXER_TOKEN_BYTES));
+    return (s32)cap;
+}
+
+// Like lexer_append, but lines and columns count on from where the previous
+// string ended, for input that arrives in pieces.
+static s32
+lexer_continue(Lexer* lexer, char* str, s32 length, s32** open_groups) {
     lexer->stream = str;
+    lexer->stream_end = (u8*)str + length;
+    lexer->index = 0; // offset into the stream while lexing
+    lexer_simd_init();
 
-	Token* tokens = array_new(Token);
+    if(!lexer->tokens) {
+        lexer->tokens = array_new_with(Token, lexer->allocator);
+        lexer->matching = array_new_with(s32, lexer->allocator);
+    }
+	Token* tokens = lexer->tokens;
+    s32*   matching = lexer->matching;
+    s32    first = (s32)array_length(tokens);
+    s32    cap = lexer_token_cap(lexer);
+    array_length(*open_groups) = 0;
 
     while(true) {
-        lexer_eat_whitespace(lexer);
+        u32 flags = lexer_eat_whitespace(lexer, (s32)array_length(tokens));
         Token t = token_next(lexer);
+        t.flags |= flags;
+        if(flags & MO_TOKEN_FLAG_UNTERMINATED) {
+            // at the start of the comment, see lexer_eat_whitespace
+            t.line = lexer->line;
+            t.column = lexer->column;
+        }
 
         // push token
 		array_push(tokens, t);
 
+        // pair delimiters in the same pass, every token gets an entry
+        s32 index = (s32)array_length(tokens) - 1;
+        array_push(matching, -1);
+        switch(t.type) {
+            case '(': case '[': case '{':
+                array_push(*open_groups, index);
+                break;
+            case ')': case ']': case '}': {
+                if(array_length(*open_groups) == 0) break;
+                s32 open = (*open_groups)[array_length(*open_groups) - 1];
+                MO_Token_Type expected = (t.type == ')') ? '(' : (t.type == ']') ? '[' : '{';
+                if(tokens[open].type != expected) break; // mismatched, leave both unpaired
+                array_length(*open_groups)--;
+                matching[open] = index;
+                matching[index] = open;
+            } break;
+            default: break;
+        }
+
         if(t.type == MO_TOKEN_EOF) break;
+        if(index == cap) {
+            // the parse finds one token too many and stops
+            Token eof = {0};
+            eof.type = MO_TOKEN_EOF;
+            eof.line = lexer->line;
+            eof.column = lexer->column;
+            array_push(tokens, eof);
+            array_push(matching, -1);
+            break;
+        }
 
         // token_print(t);
 
     }
 
 	lexer->tokens = tokens;
+	lexer->matching = matching;
 	lexer->index = 0;
+    return first;
+}
 
-    return tokens;
+// Appends the tokens of str, which has to be nul terminated, up to and including
+// its EOF token to the lexer's token array and returns the index of the first
+// one. Resets the lexer's index. Delimiters only pair
+// within the same string. open_groups is scratch space kept by the caller so
+// that lexing many small strings does not allocate for each of them.
+static s32
+lexer_append(Lexer* lexer, char* str, s32 length, s32** open_groups) {
+    lexer->line = 0;
+    lexer->column = 0;
+    return lexer_continue(lexer, str, length, open_groups);
+}
+
+static Token* 
+lexer_cstr(Lexer* lexer, char* str, s32 length, u32 flags) {
+    s32* open_groups = array_new_with(s32, lexer->allocator);
+    lexer->tokens = 0;
+    lexer->matching = 0;
+    lexer->comments = 0;
+    lexer_append(lexer, str, length, &open_groups);
+    array_free(open_groups);
+
+	lexer->index = 0;
+    return lexer->tokens;
 }
 
 static void
@@ -630,9 +829,18 @@ lexer_rewind(Lexer* lexer, s32 count) {
     lexer->index -= count;
 }
 
+// see limits.c
+static void parse_limits_poll(Lexer* lexer);
+
+// The EOF token is never consumed, a parser that runs into the end of the
+// input keeps seeing it instead of reading past the token array.
 static Token* 
 lexer_next(Lexer* lexer) {
-	return &lexer->tokens[lexer->index++];
+	Token* t = &lexer->tokens[lexer->index];
+	if(t->type != MO_TOKEN_EOF) lexer->index++;
+	// 0 unless the parse has a clock or a cancel flag to look at
+	if(lexer->poll && --lexer->poll == 0) parse_limits_poll(lexer);
+	return t;
 }
 
 static Token*
@@ -645,6 +853,23 @@ lexer_peek_n(Lexer* lexer, s32 n) {
     return &lexer->tokens[lexer->index + n];
 }
 
+// Returns the index of the token that pairs with the delimiter at index,
+// -1 when it is not a delimiter or the group is unbalanced.
+static s32
+lexer_match_delimiter(Lexer* lexer, s32 index) {
+    return lexer->matching[index];
+}
+
+// Jumps over the balanced group that starts at the current token,
+// returns false and does not move when it is not closed.
+static bool
+lexer_skip_group(Lexer* lexer) {
+    s32 close = lexer->matching[lexer->index];
+    if(close < lexer->index) return false;
+    lexer->index = close + 1;
+    return true;
+}
+
 static const char* 
 token_to_str(Token* token) {
 	return token_type_to_str(token->type);
@@ -740,5 +965,20 @@ token_type_to_str(MO_Token_Type token_type) {
 
 MO_Token*
 mop_lexer_cstr(MO_Lexer* lexer, char* str, int length) {
-    return lexer_cstr((Lexer*)lexer, str, length, 0);
-}
\ No newline at end of file
+    unsigned long long trace = mop_trace_begin();
+    MO_Token* tokens = lexer_cstr((Lexer*)lexer, str, length, 0);
+    mop_trace_end("lex", lexer->filename, trace);
+    return tokens;
+}
+
+int
+mop_lexer_match(MO_Lexer* lexer, int index) {
+    // the parser only asks about tokens it has, callers may ask about any
+    if(!lexer->matching || index < 0 || index >= (int)array_length(lexer->tokens)) return -1;
+    return lexer_match_delimiter((Lexer*)lexer, index);
+}
+
+int
+mop_lexer_comment_count(MO_Lexer* lexer) {
+    return (lexer->comments) ? (int)array_length(lexer->comments) : 0;
+}
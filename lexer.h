@@ -10,6 +10,8 @@ static Token* lexer_next(Lexer* lexer);
 static Token* lexer_peek(Lexer* lexer);
 static Token* lexer_peek_n(Lexer* lexer, s32 n);
 static void   lexer_rewind(Lexer* lexer, s32 count);
+static s32    lexer_match_delimiter(Lexer* lexer, s32 index);
+static bool   lexer_skip_group(Lexer* lexer);
 static void   lexer_free(Lexer* lexer);
 
 static const char* token_to_str(Token* token);
@@ -0,0 +1,161 @@
+// Vectorized scanners for identifier runs and quoted literals.
+//
+// Every scanner takes the current position and the end of the stream and
+// returns the first byte that stops the run, or end. Vector loads are only
+// issued while a full vector fits before end, the tail is always scalar.
+// The implementation is picked once at runtime: AVX2, SSE4.2, or scalar.
+
+typedef u8* (*Scan_Identifier_Proc)(u8* at, u8* end);
+typedef u8* (*Scan_Quoted_Proc)(u8* at, u8* end, u8 quote);
+
+// first byte that is not a letter, digit or _
+static u8*
+scan_identifier_scalar(u8* at, u8* end) {
+    while(at < end && is_identifier_char(*at)) ++at;
+    return at;
+}
+
+// first quote, backslash or NUL
+static u8*
+scan_quoted_scalar(u8* at, u8* end, u8 quote) {
+    while(at < end && *at != quote && *at != '\\' && *at != 0) ++at;
+    return at;
+}
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define LEXER_SIMD 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define LEXER_TARGET(x)
+#else
+#define LEXER_TARGET(x) __attribute__((target(x)))
+#endif
+#else
+#define LEXER_SIMD 0
+#endif
+
+#if LEXER_SIMD
+static s32
+lowest_bit(u32 mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (s32)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+LEXER_TARGET("sse4.2") static u8*
+scan_identifier_sse42(u8* at, u8* end) {
+    // pairs of inclusive ranges, the rest of the register is zero so the
+    // set is 8 bytes long
+    const __m128i ranges = _mm_setr_epi8('a', 'z', 'A', 'Z', '0', '9', '_', '_', 0, 0, 0, 0, 0, 0, 0, 0);
+    while(end - at >= 16) {
+        __m128i data = _mm_loadu_si128((const __m128i*)at);
+        // first byte outside of the ranges, a NUL counts as outside
+        s32 index = _mm_cmpistri(ranges, data, _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_NEGATIVE_POLARITY | _SIDD_LEAST_SIGNIFICANT);
+        if(index < 16) return at + index;
+        at += 16;
+    }
+    return scan_identifier_scalar(at, end);
+}
+
+LEXER_TARGET("sse4.2") static u8*
+scan_quoted_sse42(u8* at, u8* end, u8 quote) {
+    const __m128i set = _mm_setr_epi8((char)quote, '\\', 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+    while(end - at >= 16) {
+        __m128i data = _mm_loadu_si128((const __m128i*)at);
+        s32 index = _mm_cmpistri(set, data, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT);
+        if(index < 16) return at + index;
+        // no match before a NUL in this block, the NUL ends the run
+        if(_mm_cmpistrz(set, data, _SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY)) break;
+        at += 16;
+    }
+    return scan_quoted_scalar(at, end, quote);
+}
+
+LEXER_TARGET("avx2") static u8*
+scan_identifier_avx2(u8* at, u8* end) {
+    // signed compares, bytes >= 0x80 are negative and never match
+    const __m256i lower_a = _mm256_set1_epi8('a' - 1);
+    const __m256i lower_z = _mm256_set1_epi8('z' + 1);
+    const __m256i digit_0 = _mm256_set1_epi8('0' - 1);
+    const __m256i digit_9 = _mm256_set1_epi8('9' + 1);
+    const __m256i case_bit = _mm256_set1_epi8(0x20);
+    const __m256i underscore = _mm256_set1_epi8('_');
+    while(end - at >= 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i*)at);
+        __m256i lower = _mm256_or_si256(data, case_bit);
+        __m256i letter = _mm256_and_si256(_mm256_cmpgt_epi8(lower, lower_a), _mm256_cmpgt_epi8(lower_z, lower));
+        __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(data, digit_0), _mm256_cmpgt_epi8(digit_9, data));
+        __m256i ident = _mm256_or_si256(_mm256_or_si256(letter, digit), _mm256_cmpeq_epi8(data, underscore));
+        u32 stop = ~(u32)_mm256_movemask_epi8(ident);
+        if(stop) return at + lowest_bit(stop);
+        at += 32;
+    }
+    return scan_identifier_scalar(at, end);
+}
+
+LEXER_TARGET("avx2") static u8*
+scan_quoted_avx2(u8* at, u8* end, u8 quote) {
+    const __m256i q = _mm256_set1_epi8((char)quote);
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i zero = _mm256_setzero_si256();
+    while(end - at >= 32) {
+        __m256i data = _mm256_loadu_si256((const __m256i*)at);
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(data, q), _mm256_cmpeq_epi8(data, backslash)),
+            _mm256_cmpeq_epi8(data, zero));
+        u32 mask = (u32)_mm256_movemask_epi8(hit);
+        if(mask) return at + lowest_bit(mask);
+        at += 32;
+    }
+    return scan_quoted_scalar(at, end, quote);
+}
+
+static bool
+cpu_has_sse42() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+static bool
+cpu_has_avx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if(!osxsave || (_xgetbv(0) & 6) != 6) return false; // ymm state saved by the os
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+static Scan_Identifier_Proc scan_identifier = scan_identifier_scalar;
+static Scan_Quoted_Proc     scan_quoted = scan_quoted_scalar;
+
+// Every thread picks the same procedures, so racing on the first call is harmless.
+static void
+lexer_simd_init() {
+    static volatile bool initialized = false;
+    if(initialized) return;
+#if LEXER_SIMD
+    if(cpu_has_avx2()) {
+        scan_identifier = scan_identifier_avx2;
+        scan_quoted = scan_quoted_avx2;
+    } else if(cpu_has_sse42()) {
+        scan_identifier = scan_identifier_sse42;
+        scan_quoted = scan_quoted_sse42;
+    }
+#endif
+    initialized = true;
+}
@@ -16,6 +16,22 @@
     void* realloc(void* ptr, size_t new_size)
     void  free(void* block)
     void* memcpy(void* dest, void* src, size_t count)
+    void* memset(void* dest, int ch, size_t count)
+
+    ----------------------------------------------------------------------------------
+
+    Allocators:
+    array_new_with(T, allocator) creates an array whose memory comes from the given allocator,
+    every later push, allocate and free of that array goes through it as well. The allocator
+    type is Light_Array_Allocator unless LIGHT_ARRAY_ALLOCATOR is defined before including
+    this file, in which case it must name a struct type with the same members:
+
+    void* (*alloc)(void* user, size_t size)
+    void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size)
+    void  (*free)(void* user, void* ptr, size_t size)
+    void* user
+
+    Arrays created by array_new use the c runtime functions above.
 
     ----------------------------------------------------------------------------------
 
@@ -62,7 +78,18 @@
 #include <string.h>
 #endif
 
+#if !defined(LIGHT_ARRAY_ALLOCATOR)
 typedef struct {
+    void* (*alloc)(void* user, size_t size);
+    void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size);
+    void  (*free)(void* user, void* ptr, size_t size);
+    void* user;
+} Light_Array_Allocator;
+#define LIGHT_ARRAY_ALLOCATOR Light_Array_Allocator
+#endif
+
+typedef struct {
+    LIGHT_ARRAY_ALLOCATOR* allocator; /* 0 for the c runtime */
     size_t capacity;
     size_t length;
 } Dynamic_ArrayBase;
@@ -77,29 +104,61 @@ typedef struct {
 /* gets the capacity currently allocated of the array, that is, the array won't grow while the capacity isn't reached. */
 #define array_capacity(A) array_base(A)->capacity
 
+static void* array_dyn_allocate(size_t size, LIGHT_ARRAY_ALLOCATOR* allocator) {
+    Dynamic_ArrayBase* res;
+    if(allocator) {
+        res = (Dynamic_ArrayBase*)allocator->alloc(allocator->user, size);
+        memset(res, 0, size);
+    } else {
+        res = (Dynamic_ArrayBase*)calloc(1, size);
+    }
+    res->allocator = allocator;
+    res->capacity = 1;
+    return (void*)(res + 1);
+}
+
+/* grows the array to hold capacity elements of elem_size bytes, returns the new address of the array. */
+static void* array_dyn_grow(void* array, size_t elem_size, size_t capacity) {
+    Dynamic_ArrayBase* base = (Dynamic_ArrayBase*)array - 1;
+    size_t old_size = sizeof(Dynamic_ArrayBase) + elem_size * base->capacity;
+    size_t new_size = sizeof(Dynamic_ArrayBase) + elem_size * capacity;
+    if(base->allocator) {
+        base = (Dynamic_ArrayBase*)base->allocator->realloc(base->allocator->user, base, old_size, new_size);
+    } else {
+        base = (Dynamic_ArrayBase*)realloc(base, new_size);
+    }
+    base->capacity = capacity;
+    return (void*)(base + 1);
+}
+
+static void array_dyn_free(void* array, size_t elem_size) {
+    Dynamic_ArrayBase* base = (Dynamic_ArrayBase*)array - 1;
+    if(base->allocator) {
+        base->allocator->free(base->allocator->user, base, sizeof(Dynamic_ArrayBase) + elem_size * base->capacity);
+    } else {
+        free(base);
+    }
+}
+
 #if defined(__cplusplus)
 /* creates a new array of type T */
-#define array_new(T) (T*)((char*)&(((Dynamic_ArrayBase*)calloc(1, sizeof(Dynamic_ArrayBase) + sizeof(T)))->capacity = 1) + sizeof(Dynamic_ArrayBase))
+#define array_new(T) (T*)array_dyn_allocate(sizeof(T) + sizeof(Dynamic_ArrayBase), 0)
+/* creates a new array of type T that allocates from the given allocator */
+#define array_new_with(T, Allocator) (T*)array_dyn_allocate(sizeof(T) + sizeof(Dynamic_ArrayBase), (Allocator))
 #else
-static void* array_dyn_allocate(size_t size) {
-    void* res = calloc(1, size);
-    ((Dynamic_ArrayBase*)res)->capacity = 1;
-    return (void*)((char*)res + sizeof(Dynamic_ArrayBase));
-}
-#define array_new(T) array_dyn_allocate(sizeof(T) + sizeof(Dynamic_ArrayBase))
+#define array_new(T) array_dyn_allocate(sizeof(T) + sizeof(Dynamic_ArrayBase), 0)
+#define array_new_with(T, Allocator) array_dyn_allocate(sizeof(T) + sizeof(Dynamic_ArrayBase), (Allocator))
 #endif
 
 /* given an array created by array_new and a value (rvalue) of the base type of the array, puts that value in the last
    position of the current array, it allocates memory automatically when the capacity is reached. The policy to allocate
    is exponential (doubles every allocation). */
 #define array_push(A, V) ((array_length(A) == array_capacity(A)) \
-    ? *((void**)&(A)) = (void*)((Dynamic_ArrayBase*)realloc((Dynamic_ArrayBase*)(A) - 1, sizeof(Dynamic_ArrayBase) + sizeof(*(A)) * array_capacity(A) * 2) + 1), \
-    array_capacity(A) = array_capacity(A) * 2 : 0, \
+    ? *((void**)&(A)) = array_dyn_grow((A), sizeof(*(A)), array_capacity(A) * 2) : 0, \
     (A)[array_length(A)++] = (V))
 
 #define array_allocate(A, V) ((array_length(A) + (V) >= array_capacity(A)) \
-    ? *((void**)&(A)) = (void*)((Dynamic_ArrayBase*)realloc((Dynamic_ArrayBase*)(A) - 1, sizeof(Dynamic_ArrayBase) + sizeof(*(A)) * (array_length(A) + (V))) + 1), \
-    array_capacity(A) = (array_length(A) + (V)) : 0)
+    ? *((void**)&(A)) = array_dyn_grow((A), sizeof(*(A)), array_length(A) + (V)) : 0)
 
 /* inserts into a given array A the value V (rvalue of type of the array) in the index I and pushes every value after
    the index forward in the array. */
@@ -109,7 +168,7 @@ static void* array_dyn_allocate(size_t size) {
 #define array_pop(A) (array_length(A) > 0) ? (A)[--array_length(A)] : 0
 
 /* frees the memory of the array, the array pointer becomes invalid. */
-#define array_free(A) free(array_base(A))
+#define array_free(A) array_dyn_free((A), sizeof(*(A)))
 
 /* clears the array but keeps the current capacity, that is, keeps the memory allocated. */
 #define array_clear(A) array_length(A) = 0
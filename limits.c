@@ -0,0 +1,183 @@
+// Budgets of a single parse, see max_tokens in MO_Lexer.
+//
+// Each check sits where the work is done and costs a compare: lexing stops a
+// token past the budget, allocate_node counts against node_limit and
+// lexer_next counts down to a look at the clock and the cancel flag. What
+// trips first is kept in lexer->limit, and from then on every rule wrapper and
+// the parse stack fail at once, so the parse unwinds without doing any more
+// work. The public entry points put parse_limits_begin and parse_limits_end
+// around the parse, the latter turns the failure into MO_PARSER_STATUS_LIMIT
+// and gives back the nodes the parse made.
+
+// tokens taken between two looks at the clock and the cancel flag
+#define PARSE_POLL_TOKENS 1024
+// Set once a budget ran out, until the next parse_limits_begin
+#define PARSER_FLAG_LIMIT_EXCEEDED (1u << 29)
+// Set once the depth limit was hit, until the next parse_limits_begin. The
+// rules that still recurse, some of which take a failure as the end of a list,
+// may lose the error on the way out, parse_limits_end brings it back.
+#define PARSER_FLAG_DEPTH_EXCEEDED (1u << 30)
+
+typedef struct {
+	Arena_Mark arena;       // the nodes made since belong to the parse
+	bool       release;     // the nodes are in the arena and can be given back
+	size_t     arena_bytes; // the arena's size at the start, with lexer->memory set
+	size_t     node_bytes;  // the node bytes lexer->memory had counted at the mark
+} Parse_Mark;
+
+static void
+parse_limit_hit(Lexer* lexer, MO_Parser_Limit limit) {
+	if(!lexer->limit) lexer->limit = limit;
+	lexer->parser_flags |= PARSER_FLAG_LIMIT_EXCEEDED;
+}
+
+static void
+parse_limits_poll(Lexer* lexer) {
+	lexer->poll = PARSE_POLL_TOKENS;
+	if(lexer->cancel && *lexer->cancel)
+		parse_limit_hit(lexer, MO_LIMIT_CANCELLED);
+	else if(lexer->deadline && platform_time_ns() >= lexer->deadline)
+		parse_limit_hit(lexer, MO_LIMIT_TIME);
+}
+
+// allocate_node went past node_limit, which covers both nodes and bytes
+static void
+parse_limits_node(Lexer* lexer) {
+	bool nodes = lexer->max_nodes > 0 && lexer->node_count > lexer->max_nodes;
+	parse_limit_hit(lexer, (nodes) ? MO_LIMIT_NODES : MO_LIMIT_BYTES);
+}
+
+static MO_Parser_Result parser_depth_error(Lexer* lexer);
+
+static MO_Parser_Result
+parse_limit_error(Lexer* lexer) {
+	MO_Parser_Result res = {0};
+	res.status = MO_PARSER_STATUS_FATAL;
+	switch(lexer->limit) {
+		case MO_LIMIT_TOKENS:
+			sprintf(parser_error_buffer, "%s: Parse stopped: more than %d tokens\n", lexer->filename, lexer->max_tokens);
+			break;
+		case MO_LIMIT_NODES:
+			sprintf(parser_error_buffer, "%s: Parse stopped: more than %d nodes\n", lexer->filename, lexer->max_nodes);
+			break;
+		case MO_LIMIT_BYTES:
+			sprintf(parser_error_buffer, "%s: Parse stopped: more than %llu bytes\n", lexer->filename, (unsigned long long)lexer->max_bytes);
+			break;
+		case MO_LIMIT_TIME:
+			sprintf(parser_error_buffer, "%s: Parse stopped: took longer than %u ms\n", lexer->filename, lexer->max_milliseconds);
+			break;
+		case MO_LIMIT_CANCELLED:
+			sprintf(parser_error_buffer, "%s: Parse stopped: cancelled\n", lexer->filename);
+			break;
+		default:
+			sprintf(parser_error_buffer, "%s: Parse stopped\n", lexer->filename);
+			break;
+	}
+	res.error_message = parser_error_buffer;
+	return res;
+}
+
+// The child array of a list node, 0 for other kinds
+static MO_Ast**
+parse_node_list(MO_Ast* node) {
+	MO_Ast** list = 0;
+	switch(node->kind) {
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST: list = node->struct_declarator_list.list; break;
+		case MO_AST_ENUMERATOR_LIST:             list = (MO_Ast**)node->enumerator_list.list; break;
+		case MO_AST_PARAMETER_LIST:              list = node->parameter_list.param_decl; break;
+		case MO_AST_STRUCT_DECLARATION_LIST:     list = node->struct_declaration_list.list; break;
+		case MO_AST_DECLARATION:                 list = node->declaration.init_declarators; break;
+		case MO_AST_INITIALIZER_LIST:            list = node->initializer_list.list; break;
+		case MO_AST_TRANSLATION_UNIT:            list = node->translation_unit.list; break;
+		case MO_AST_EXPRESSION_CHAIN:            list = node->expression_chain.operands; break;
+		default: break;
+	}
+	return list;
+}
+
+static void
+parse_free_lists(MO_Ast* node) {
+	MO_Ast** list = parse_node_list(node);
+	if(list) array_free(list);
+}
+
+// Frees the lists of the nodes made in arena since mark and gives the nodes
+// back. Nothing but nodes may have been allocated there since.
+static void
+parse_release_nodes(MO_Arena* arena, Arena_Mark mark) {
+	size_t size = (sizeof(MO_Ast) + 7) & ~(size_t)7; // as arena_alloc rounds
+	for(Arena_Block* block = arena->blocks; block; block = block->next) {
+		size_t at = (block == mark.block) ? mark.used : 0;
+		for(; at + size <= block->used; at += size)
+			parse_free_lists((MO_Ast*)((u8*)(block + 1) + at));
+		if(block == mark.block) break;
+	}
+	arena_reset(arena, mark);
+}
+
+// Gives back the nodes made since mark, they no longer count as used.
+static void
+parse_release_since(Lexer* lexer, Parse_Mark* mark) {
+	parse_release_nodes(lexer->arena, mark->arena);
+	if(lexer->memory) lexer->memory->parts[MO_MEMORY_NODES].used = mark->node_bytes;
+	// it may point at what was given back
+	if(lexer->memo) memo_clear(lexer->memo);
+}
+
+static Parse_Mark
+parse_limits_begin(Lexer* lexer) {
+	Parse_Mark mark = {0};
+	lexer->parser_flags &= ~(PARSER_FLAG_LIMIT_EXCEEDED | PARSER_FLAG_DEPTH_EXCEEDED);
+	lexer->limit = MO_LIMIT_NONE;
+	lexer->node_count = 0;
+	lexer->node_limit = 0;
+	lexer->poll = 0;
+	lexer->deadline = 0;
+	if(!lexer->max_tokens && !lexer->max_nodes && !lexer->max_bytes && !lexer->max_milliseconds && !lexer->cancel)
+		return mark;
+
+	if(!lexer->arena) lexer->arena = mop_arena_new(0, lexer->allocator);
+	mark.arena = arena_mark(lexer->arena);
+	mark.release = true;
+
+	// lexing stopped a token past the budget, if it ran out
+	s32 tokens = (lexer->tokens) ? (s32)array_length(lexer->tokens) : 0;
+	size_t token_bytes = tokens * LEXER_TOKEN_BYTES;
+	if(lexer->max_tokens > 0 && tokens - 1 > lexer->max_tokens)
+		parse_limit_hit(lexer, MO_LIMIT_TOKENS);
+	else if(lexer->max_bytes > 0 && token_bytes > lexer->max_bytes)
+		parse_limit_hit(lexer, MO_LIMIT_BYTES);
+
+	// node_limit is one more than the nodes allowed, so that 0 is no limit and
+	// allocate_node needs a single unsigned compare
+	s64 nodes = (lexer->max_nodes > 0) ? lexer->max_nodes : 0x7ffffffe;
+	if(lexer->max_bytes > 0 && token_bytes <= lexer->max_bytes)
+		nodes = MIN(nodes, (s64)((lexer->max_bytes - token_bytes) / sizeof(MO_Ast)));
+	lexer->node_limit = (s32)nodes + 1;
+
+	if(lexer->max_milliseconds)
+		lexer->deadline = platform_time_ns() + (u64)lexer->max_milliseconds * 1000000ull;
+	if(lexer->deadline || lexer->cancel)
+		parse_limits_poll(lexer);
+	return mark;
+}
+
+// Turns a parse that ran out into MO_PARSER_STATUS_LIMIT, what the rules made of
+// the failure on the way out does not matter. The budget stays in force until the
+// next parse_limits_begin, a stream parses several declarations on one.
+static MO_Parser_Result
+parse_limits_end(Lexer* lexer, Parse_Mark* mark, MO_Parser_Result res) {
+	if(!(lexer->parser_flags & (PARSER_FLAG_LIMIT_EXCEEDED | PARSER_FLAG_DEPTH_EXCEEDED)))
+		return res;
+
+	if(!lexer->limit) lexer->limit = MO_LIMIT_DEPTH;
+	if(lexer->limit != MO_LIMIT_DEPTH)
+		res = parse_limit_error(lexer);
+	// hit here, a list rule may have taken the failure for its end and gone on
+	else if(lexer->parser_flags & PARSER_FLAG_DEPTH_EXCEEDED)
+		res = parser_depth_error(lexer);
+	res.status = MO_PARSER_STATUS_LIMIT;
+	res.node = 0;
+	if(mark->release) parse_release_since(lexer, mark);
+	return res;
+}
@@ -3,6 +3,13 @@
 //#include "parser.h"
 #include "common.h"
 #include "moparser.h"
+#include <string.h>
+#if !defined(_WIN32)
+#include <limits.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
 
 typedef struct {
     u8* data;
@@ -10,6 +17,7 @@ typedef struct {
 } File_Info;
 
 File_Info load_file(const char* filename) {
+    unsigned long long trace = mop_trace_begin();
     File_Info result = {0};
     FILE* f = fopen(filename, "rb");
 
@@ -26,28 +34,167 @@ File_Info load_file(const char* filename) {
     fread(result.data, result.size_bytes, 1, f);
 
     fclose(f);
+    mop_trace_end("load", filename, trace);
     return result;
 }
 
+#if !defined(_WIN32)
+static int send_all(int fd, const char* data, size_t length) {
+    while(length > 0) {
+        ssize_t n = send(fd, data, length, 0);
+        if(n <= 0) return 0;
+        data += n;
+        length -= n;
+    }
+    return 1;
+}
+
+// moparser --client <socket> [--rule unit|expression|typename] [--format ast|status] [--text] <file or text>
+// Sends one request to a moparser --serve and prints the answer, see server.c for the protocol.
+static int client_main(int argc, char** argv) {
+    const char* socket_path = argv[2];
+    const char* rule = "unit";
+    const char* format = "ast";
+    const char* source = "path";
+    const char* payload = 0;
+    for(int i = 3; i < argc; ++i) {
+        if(strcmp(argv[i], "--rule") == 0 && i + 1 < argc) rule = argv[++i];
+        else if(strcmp(argv[i], "--format") == 0 && i + 1 < argc) format = argv[++i];
+        else if(strcmp(argv[i], "--text") == 0) source = "text";
+        else payload = argv[i];
+    }
+    if(!payload) {
+        fprintf(stderr, "usage: %s --client <socket> [--rule unit|expression|typename] [--format ast|status] [--text] <file or text>\n", argv[0]);
+        return 2;
+    }
+
+    // the server has its own working directory
+    char resolved[PATH_MAX];
+    if(strcmp(source, "path") == 0 && realpath(payload, resolved)) payload = resolved;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "could not connect to %s\n", socket_path);
+        return 2;
+    }
+
+    char header[128];
+    int header_length = snprintf(header, sizeof(header), "%s %s %s %zu\n", source, rule, format, strlen(payload));
+    if(!send_all(fd, header, header_length) || !send_all(fd, payload, strlen(payload))) {
+        close(fd);
+        return 2;
+    }
+
+    // answer: <ok|error> <length>\n<payload>
+    FILE* in = fdopen(fd, "rb");
+    char status[16];
+    long length = 0;
+    if(!in || fscanf(in, "%15s %ld", status, &length) != 2 || fgetc(in) != '\n') {
+        fprintf(stderr, "bad answer from %s\n", socket_path);
+        return 2;
+    }
+    int ok = strcmp(status, "ok") == 0;
+    FILE* out = (ok) ? stdout : stderr;
+    char buffer[4096];
+    while(length > 0) {
+        size_t n = fread(buffer, 1, (length < (long)sizeof(buffer)) ? length : sizeof(buffer), in);
+        if(n == 0) break;
+        fwrite(buffer, 1, n, out);
+        length -= (long)n;
+    }
+    fclose(in);
+    return (ok) ? 0 : 1;
+}
+#endif
+
+static void print_declaration(MO_Lexer* lexer, struct MO_Ast_t* node, void* user) {
+    mop_print_ast(node);
+    printf("\n");
+    fflush(stdout);
+}
+
+// moparser --stream [file]
+// Feeds the file, or stdin, to the parser as it is read and prints every top-level
+// declaration as soon as it is complete.
+static int stream_main(int argc, char** argv) {
+    FILE* in = stdin;
+    MO_Lexer lexer = {0};
+    lexer.filename = "stdin";
+    if(argc >= 3) {
+        in = fopen(argv[2], "rb");
+        if(!in) {
+            fprintf(stderr, "could not open file %s\n", argv[2]);
+            return 2;
+        }
+        lexer.filename = argv[2];
+    }
+
+    MO_Memory_Report memory;
+    if(getenv("MOP_MEMORY")) lexer.memory = &memory;
+
+    MO_Stream* stream = mop_stream_begin(&lexer, print_declaration, 0);
+    MO_Parser_Result res = {0};
+    char buffer[4096];
+    size_t n;
+    while(res.status == MO_PARSER_STATUS_OK && (n = fread(buffer, 1, sizeof(buffer), in)) > 0)
+        res = mop_stream_feed(stream, buffer, (int)n);
+    // repeats the first error of the feeds
+    res = mop_stream_end(stream);
+    if(in != stdin) fclose(in);
+    if(lexer.memory) mop_memory_dump(lexer.memory);
+
+    if(res.status != MO_PARSER_STATUS_OK) {
+        fprintf(stderr, "%s", res.error_message);
+        return 1;
+    }
+    return 0;
+}
+
 int main(int argc, char** argv) {
-    File_Info finfo= { 0 };
-    if(argc < 2) {
-        finfo = load_file("./test/test.h");
-    } else {
-        finfo = load_file(argv[1]);
+#if !defined(_WIN32)
+    if(argc >= 3 && strcmp(argv[1], "--serve") == 0) {
+        if(mop_server_run(argv[2]) != 0) {
+            fprintf(stderr, "could not listen on %s\n", argv[2]);
+            return 1;
+        }
+        return 0;
     }
+    if(argc >= 3 && strcmp(argv[1], "--client") == 0)
+        return client_main(argc, argv);
+#endif
+    if(argc >= 2 && strcmp(argv[1], "--stream") == 0)
+        return stream_main(argc, argv);
+
+    // MOP_TRACE=out.json records a timeline of the run
+    const char* trace = getenv("MOP_TRACE");
+    if(trace) mop_trace_start(trace);
+
+    File_Info finfo= { 0 };
+    const char* filename = (argc < 2) ? "./test/test.h" : argv[1];
+    finfo = load_file(filename);
 
+    // MOP_MEMORY=1 prints what the parse holds
+    MO_Memory_Report memory;
     MO_Lexer lexer = {0};
+    lexer.filename = (char*)filename;
+    if(getenv("MOP_MEMORY")) lexer.memory = &memory;
     MO_Token* tokens = mop_lexer_cstr(&lexer, finfo.data, finfo.size_bytes);
 	MO_Parser_Result res = mop_parse_expression(&lexer);
 	//Parser_Result res = parse_type_name(&lexer);
 
-    if(res.status == MO_PARSER_STATUS_FATAL) {
+    if(res.status != MO_PARSER_STATUS_OK) {
         fprintf(stderr, "Error parsing");
         //fprintf(stderr, "%s", res.error_message);
     }
 
 	mop_print_ast(res.node);
+    if(lexer.memory) mop_memory_dump(lexer.memory);
+#if defined(MOP_INSTRUMENT)
+	mop_stats_dump();
+#endif
 
     return 0;
 }
\ No newline at end of file
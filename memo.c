@@ -0,0 +1,134 @@
+// Packrat memo table, see MO_Lexer.memo.
+//
+// Results of the rules enabled in the table are keyed on (rule, token index),
+// so a rule asked again at a position it was already evaluated at returns the
+// same result and skips to the same token. The table is direct mapped with a
+// fixed number of slots: an entry replaces whatever hashed to its slot, which
+// bounds the memory, and parses stay linear while the working set fits.
+//
+// Entries are only valid for the token array and the parser flags and depth
+// limit they were made with, they are dropped when the lexer is given new
+// tokens or parses with other settings. A rule's result at a position
+// cannot be changed by typedef names declared after it, so entries survive
+// typedef declarations.
+
+#define MEMO_DEFAULT_ENTRIES 4096
+// the parser flags that change what the rules make of the tokens
+#define MEMO_TREE_FLAGS (MO_PARSER_FLAG_FLATTEN_CHAINS | MO_PARSER_FLAG_LAZY_BODIES | MO_PARSER_FLAG_COMMENTS)
+
+typedef struct {
+	s32              index; // start token, -1 for an empty slot
+	s32              end;   // lexer index after the rule
+	s32              rule;  // Parser_Rule
+	MO_Parser_Result result; // error_message is owned by the entry
+} Memo_Entry;
+
+struct MO_Memo_t {
+	MO_Allocator* allocator;
+	Memo_Entry*   entries;
+	u32           mask;
+	u32           rules;  // MO_Memo_Rules
+	Token*        tokens; // the token array the entries belong to
+	u32           flags;  // and the MEMO_TREE_FLAGS they were made with
+	s32           max_depth;
+};
+
+static void
+memo_entry_release(MO_Memo* memo, Memo_Entry* e) {
+	if(e->result.error_message)
+		mem_free(memo->allocator, (void*)e->result.error_message, strlen(e->result.error_message) + 1);
+	e->result.error_message = 0;
+	e->index = -1;
+}
+
+static void
+memo_clear(MO_Memo* memo) {
+	for(u32 i = 0; i <= memo->mask; ++i) {
+		if(memo->entries[i].index != -1) memo_entry_release(memo, &memo->entries[i]);
+	}
+}
+
+static Memo_Entry*
+memo_slot(MO_Memo* memo, Parser_Rule rule, s32 index) {
+	u32 h = (u32)index * 2654435761u ^ (u32)rule * 0x27d4eb2fu;
+	h ^= h >> 15;
+	return &memo->entries[h & memo->mask];
+}
+
+// The memo belongs to the tokens and settings the lexer had when it was last
+// used.
+static MO_Memo*
+memo_get(Lexer* lexer, u32 flag) {
+	MO_Memo* memo = lexer->memo;
+	if(!memo || !(memo->rules & flag)) return 0;
+	u32 flags = lexer->parser_flags & MEMO_TREE_FLAGS;
+	if(memo->tokens != lexer->tokens || memo->flags != flags || memo->max_depth != lexer->max_depth) {
+		memo_clear(memo);
+		memo->tokens = lexer->tokens;
+		memo->flags = flags;
+		memo->max_depth = lexer->max_depth;
+	}
+	return memo;
+}
+
+static bool
+memo_lookup(Lexer* lexer, Parser_Rule rule, u32 flag, MO_Parser_Result* result) {
+	MO_Memo* memo = memo_get(lexer, flag);
+	if(!memo) return false;
+
+	Memo_Entry* e = memo_slot(memo, rule, lexer->index);
+	if(e->index != lexer->index || e->rule != (s32)rule) {
+		MOP_COUNT(COUNTER_MEMO_MISS);
+		return false;
+	}
+	MOP_COUNT(COUNTER_MEMO_HIT);
+
+	*result = e->result;
+	if(e->result.error_message) {
+		snprintf(parser_error_buffer, sizeof(parser_error_buffer), "%s", e->result.error_message);
+		result->error_message = parser_error_buffer;
+	}
+	lexer->index = e->end;
+	return true;
+}
+
+static void
+memo_store(Lexer* lexer, Parser_Rule rule, u32 flag, s32 start, MO_Parser_Result* result) {
+	MO_Memo* memo = memo_get(lexer, flag);
+	if(!memo) return;
+
+	Memo_Entry* e = memo_slot(memo, rule, start);
+	if(e->index != -1) {
+		MOP_COUNT(COUNTER_MEMO_EVICT);
+		memo_entry_release(memo, e);
+	}
+	e->index = start;
+	e->end = lexer->index;
+	e->rule = (s32)rule;
+	e->result = *result;
+	// the message lives in the per thread error buffer, keep a copy
+	if(result->error_message) e->result.error_message = mem_strdup(memo->allocator, result->error_message);
+}
+
+MO_Memo*
+mop_memo_new(unsigned int rules, int max_entries, MO_Allocator* allocator) {
+	u32 count = 1;
+	u32 wanted = (max_entries > 0) ? (u32)max_entries : MEMO_DEFAULT_ENTRIES;
+	while(count < wanted && count < (1u << 30)) count <<= 1;
+
+	MO_Memo* memo = mem_alloc(allocator, sizeof(MO_Memo));
+	memo->allocator = allocator;
+	memo->rules = rules;
+	memo->mask = count - 1;
+	memo->entries = mem_alloc(allocator, count * sizeof(Memo_Entry));
+	for(u32 i = 0; i < count; ++i) memo->entries[i].index = -1;
+	return memo;
+}
+
+void
+mop_memo_free(MO_Memo* memo) {
+	if(!memo) return;
+	memo_clear(memo);
+	mem_free(memo->allocator, memo->entries, (memo->mask + 1) * sizeof(Memo_Entry));
+	mem_free(memo->allocator, memo, sizeof(MO_Memo));
+}
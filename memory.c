@@ -0,0 +1,254 @@
+// Memory accounting of parses, see MO_Memory_Report.
+//
+// Nothing is counted unless lexer->memory is set, then allocate_node adds
+// every node to it and the peak follows as the nodes add up on top of the
+// tokens. What else the result holds, its lists and its message, is measured
+// once the parse is done, by walking the tree. Each finished report is also
+// added to a block of the thread, mop_memory_process sums the blocks the way
+// mop_stats_dump does, so a long running process can tell how much one parse
+// needs at most next to how much all of them made.
+
+typedef struct Memory_Block_t {
+	MO_Memory_Report       report;
+	struct Memory_Block_t* next;
+} Memory_Block;
+
+static Memory_Block* volatile memory_list;
+static THREAD_LOCAL Memory_Block* memory_thread;
+
+// Blocks are never freed so the totals survive the threads that made them.
+static Memory_Block*
+memory_block() {
+	if(memory_thread) return memory_thread;
+	Memory_Block* b = calloc(1, sizeof(Memory_Block));
+	do {
+		b->next = memory_list;
+	} while(!atomic_cas_ptr((void* volatile*)&memory_list, b->next, b));
+	memory_thread = b;
+	return b;
+}
+
+static void
+memory_use_add(MO_Memory_Use* dst, MO_Memory_Use* src) {
+	dst->reserved += src->reserved;
+	dst->used += src->used;
+	dst->peak = MAX(dst->peak, src->peak);
+}
+
+static void
+memory_report_add(MO_Memory_Report* dst, MO_Memory_Report* src) {
+	for(s32 i = 0; i < MO_MEMORY_PART_COUNT; ++i)
+		memory_use_add(&dst->parts[i], &src->parts[i]);
+	memory_use_add(&dst->total, &src->total);
+	for(s32 i = 0; i < MO_AST_KIND_COUNT; ++i)
+		dst->nodes[i] += src->nodes[i];
+	dst->parses += src->parses;
+}
+
+static void
+memory_peak(MO_Memory_Report* m) {
+	for(s32 i = 0; i < MO_MEMORY_PART_COUNT; ++i)
+		m->parts[i].peak = MAX(m->parts[i].peak, m->parts[i].reserved);
+	size_t reserved = 0;
+	for(s32 i = 0; i < MO_MEMORY_PART_COUNT; ++i)
+		reserved += m->parts[i].reserved;
+	m->total.peak = MAX(m->total.peak, reserved);
+}
+
+// The token store as the lexer holds it now
+static void
+memory_tokens(Lexer* lexer) {
+	MO_Memory_Use* use = &lexer->memory->parts[MO_MEMORY_TOKENS];
+	use->reserved = 0;
+	use->used = 0;
+	if(lexer->tokens) {
+		use->reserved += sizeof(Dynamic_ArrayBase) + array_capacity(lexer->tokens) * sizeof(Token);
+		use->used += array_length(lexer->tokens) * sizeof(Token);
+	}
+	if(lexer->matching) {
+		use->reserved += sizeof(Dynamic_ArrayBase) + array_capacity(lexer->matching) * sizeof(s32);
+		use->used += array_length(lexer->matching) * sizeof(s32);
+	}
+	if(lexer->comments) {
+		use->reserved += sizeof(Dynamic_ArrayBase) + array_capacity(lexer->comments) * sizeof(MO_Comment);
+		use->used += array_length(lexer->comments) * sizeof(MO_Comment);
+	}
+	memory_peak(lexer->memory);
+}
+
+static void
+memory_node(Lexer* lexer, MO_Node_Kind kind) {
+	MO_Memory_Report* m = lexer->memory;
+	MO_Memory_Use* use = &m->parts[MO_MEMORY_NODES];
+	m->nodes[kind]++;
+	use->used += sizeof(MO_Ast);
+	use->reserved += sizeof(MO_Ast);
+	if(use->reserved > use->peak) {
+		use->peak = use->reserved;
+		memory_peak(m);
+	}
+}
+
+// Nodes a worker of a parallel parse counted in its own report
+static void
+memory_nodes_add(MO_Memory_Report* dst, MO_Memory_Report* src) {
+	MO_Memory_Use* nodes = &dst->parts[MO_MEMORY_NODES];
+	nodes->reserved += src->parts[MO_MEMORY_NODES].reserved;
+	nodes->used += src->parts[MO_MEMORY_NODES].used;
+	nodes->peak += src->parts[MO_MEMORY_NODES].peak;
+	for(s32 i = 0; i < MO_AST_KIND_COUNT; ++i)
+		dst->nodes[i] += src->nodes[i];
+	memory_peak(dst);
+}
+
+static MO_Walk_Action
+memory_lists_visit(MO_Ast* node, MO_Ast* parent, int depth, void* user) {
+	MO_Memory_Use* use = (MO_Memory_Use*)user;
+	MO_Ast** list = parse_node_list(node);
+	if(list) {
+		use->reserved += sizeof(Dynamic_ArrayBase) + array_capacity(list) * sizeof(MO_Ast*);
+		use->used += array_length(list) * sizeof(MO_Ast*);
+	}
+	return MO_WALK_CONTINUE;
+}
+
+static void
+memory_lists(Lexer* lexer, MO_Ast* root) {
+	if(root) mop_ast_walk(root, memory_lists_visit, 0, &lexer->memory->parts[MO_MEMORY_LISTS]);
+	memory_peak(lexer->memory);
+}
+
+static void
+memory_begin(Lexer* lexer, Parse_Mark* mark) {
+	memset(lexer->memory, 0, sizeof(MO_Memory_Report));
+	lexer->memory->parses = 1;
+	mark->arena_bytes = (lexer->arena) ? arena_bytes(lexer->arena) : 0;
+	memory_tokens(lexer);
+}
+
+// Completes the report of a parse whose lists went in with memory_lists and adds
+// it to the process totals.
+static void
+memory_finish(Lexer* lexer, Parse_Mark* mark, MO_Parser_Result res) {
+	MO_Memory_Report* m = lexer->memory;
+	MO_Memory_Use* nodes = &m->parts[MO_MEMORY_NODES];
+	if(lexer->arena) {
+		// whole blocks the arena grew by, the nodes may fit in the ones it had,
+		// used already left out what a failed budget gave back
+		size_t bytes = arena_bytes(lexer->arena);
+		nodes->reserved = (bytes > mark->arena_bytes) ? bytes - mark->arena_bytes : 0;
+	}
+	if(res.error_message) {
+		size_t length = strlen(res.error_message) + 1;
+		m->parts[MO_MEMORY_DIAGNOSTICS].reserved = length;
+		m->parts[MO_MEMORY_DIAGNOSTICS].used = length;
+	}
+	m->total.reserved = 0;
+	m->total.used = 0;
+	for(s32 i = 0; i < MO_MEMORY_PART_COUNT; ++i) {
+		m->total.reserved += m->parts[i].reserved;
+		m->total.used += m->parts[i].used;
+	}
+	memory_peak(m);
+	memory_report_add(&memory_block()->report, m);
+}
+
+static void
+memory_end(Lexer* lexer, Parse_Mark* mark, MO_Parser_Result res) {
+	memory_lists(lexer, res.node);
+	memory_finish(lexer, mark, res);
+}
+
+// Bytes of its node a kind fills, the rest of sizeof(MO_Ast) is there for the
+// largest member of the union.
+static size_t
+memory_node_payload(MO_Node_Kind kind) {
+	MO_Ast n;
+	size_t size = 0;
+	switch(kind) {
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_EXPRESSION_PRIMARY_CONSTANT:
+		case MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL:
+		case MO_AST_CONSTANT_FLOATING_POINT:
+		case MO_AST_CONSTANT_INTEGER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_CONSTANT_CHARACTER:                size = sizeof(n.expression_primary); break;
+		case MO_AST_EXPRESSION_CONDITIONAL:
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:             size = sizeof(n.expression_binary); break;
+		case MO_AST_EXPRESSION_CHAIN:                  size = sizeof(n.expression_chain); break;
+		case MO_AST_EXPRESSION_ARGUMENT_LIST:          size = sizeof(n.expression_argument_list); break;
+		case MO_AST_EXPRESSION_UNARY:                  size = sizeof(n.expression_unary); break;
+		case MO_AST_EXPRESSION_CAST:                   size = sizeof(n.expression_cast); break;
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:          size = sizeof(n.expression_postfix_unary); break;
+		case MO_AST_EXPRESSION_POSTFIX_BINARY:         size = sizeof(n.expression_postfix_binary); break;
+		case MO_AST_EXPRESSION_TERNARY:                size = sizeof(n.expression_ternary); break;
+		case MO_AST_EXPRESSION_SIZEOF:                 size = sizeof(n.expression_sizeof); break;
+		case MO_AST_TYPE_NAME:                         size = sizeof(n.type_name); break;
+		case MO_AST_TYPE_INFO:                         size = sizeof(n.specifier_qualifier); break;
+		case MO_AST_TYPE_POINTER:                      size = sizeof(n.pointer); break;
+		case MO_AST_TYPE_ABSTRACT_DECLARATOR:          size = sizeof(n.abstract_type_decl); break;
+		case MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR:   size = sizeof(n.direct_abstract_decl); break;
+		case MO_AST_TYPE_STRUCT_DECLARATOR:            size = sizeof(n.struct_declarator); break;
+		case MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD:   size = sizeof(n.struct_declarator_bitfield); break;
+		case MO_AST_TYPE_STRUCT_DECLARATOR_LIST:       size = sizeof(n.struct_declarator_list); break;
+		case MO_AST_ENUMERATOR:                        size = sizeof(n.enumerator); break;
+		case MO_AST_ENUMERATOR_LIST:                   size = sizeof(n.enumerator_list); break;
+		case MO_AST_PARAMETER_LIST:                    size = sizeof(n.parameter_list); break;
+		case MO_AST_PARAMETER_DECLARATION:             size = sizeof(n.parameter_decl); break;
+		case MO_AST_STRUCT_DECLARATION:                size = sizeof(n.struct_declaration); break;
+		case MO_AST_STRUCT_DECLARATION_LIST:           size = sizeof(n.struct_declaration_list); break;
+		case MO_AST_DECLARATION:                       size = sizeof(n.declaration); break;
+		case MO_AST_INIT_DECLARATOR:                   size = sizeof(n.init_declarator); break;
+		case MO_AST_INITIALIZER_LIST:                  size = sizeof(n.initializer_list); break;
+		case MO_AST_FUNCTION_DEFINITION:               size = sizeof(n.function_definition); break;
+		case MO_AST_TRANSLATION_UNIT:                  size = sizeof(n.translation_unit); break;
+		case MO_AST_LAZY_BODY:                         size = sizeof(n.lazy_body); break;
+		default:                                       size = sizeof(n) - offsetof(MO_Ast, lazy_body); break;
+	}
+	return offsetof(MO_Ast, lazy_body) + size;
+}
+
+void
+mop_memory_process(MO_Memory_Report* report) {
+	memset(report, 0, sizeof(MO_Memory_Report));
+	for(Memory_Block* b = memory_list; b; b = b->next)
+		memory_report_add(report, &b->report);
+}
+
+void
+mop_memory_dump(const MO_Memory_Report* report) {
+	static const char* part_names[MO_MEMORY_PART_COUNT] = {
+		[MO_MEMORY_TOKENS] = "tokens",
+		[MO_MEMORY_NODES] = "nodes",
+		[MO_MEMORY_LISTS] = "lists",
+		[MO_MEMORY_DIAGNOSTICS] = "diagnostics",
+	};
+	fprintf(stderr, "%-36s %12s %12s %12s\n", "memory", "reserved", "used", "peak");
+	for(s32 i = 0; i < MO_MEMORY_PART_COUNT; ++i) {
+		const MO_Memory_Use* use = &report->parts[i];
+		fprintf(stderr, "%-36s %12llu %12llu %12llu\n", part_names[i],
+			(u64)use->reserved, (u64)use->used, (u64)use->peak);
+	}
+	fprintf(stderr, "%-36s %12llu %12llu %12llu\n", "total",
+		(u64)report->total.reserved, (u64)report->total.used, (u64)report->total.peak);
+	fprintf(stderr, "%-36s %12llu\n", "parses", report->parses);
+
+	// what a smaller node for a kind would save, the node is sizeof(MO_Ast) for all
+	fprintf(stderr, "\n%-36s %12s %12s %12s\n", "node kind", "allocated", "bytes", "bytes used");
+	for(s32 i = 0; i < MO_AST_KIND_COUNT; ++i) {
+		u64 count = report->nodes[i];
+		if(count == 0) continue;
+		fprintf(stderr, "%-36s %12llu %12llu %12llu\n", (node_kind_names[i]) ? node_kind_names[i] : "?",
+			count, count * (u64)sizeof(MO_Ast), count * (u64)memory_node_payload((MO_Node_Kind)i));
+	}
+}
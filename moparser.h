@@ -1,10 +1,19 @@
 #ifndef H_MOPARSER
 #define H_MOPARSER
 
+#include <stddef.h>
+
 typedef enum {
     MO_TOKEN_FLAG_KEYWORD             = (1 << 0),
     MO_TOKEN_FLAG_TYPE_KEYWORD        = (1 << 1),
     MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR = (1 << 2),
+    MO_TOKEN_FLAG_UNSIGNED_SUFFIX     = (1 << 3), // integer literal with a u or U suffix
+    MO_TOKEN_FLAG_LONG_SUFFIX         = (1 << 4), // integer literal with an l or L suffix
+    MO_TOKEN_FLAG_LONG_LONG_SUFFIX    = (1 << 5), // integer literal with an ll or LL suffix
+    MO_TOKEN_FLAG_LITERAL_OVERFLOW    = (1 << 6), // integer literal value does not fit in 64 bits
+    MO_TOKEN_FLAG_COMMENTED           = (1 << 7), // comments in front of it are in lexer->comments
+    MO_TOKEN_FLAG_INVALID_DIGIT       = (1 << 8), // octal literal with an 8 or 9, the value stops before it
+    MO_TOKEN_FLAG_UNTERMINATED        = (1 << 9), // EOF token the input ended on inside a /* comment
 } MO_Token_Flags;
 
 typedef enum {
@@ -98,26 +107,135 @@ typedef struct {
     unsigned char* data;
     int            length;
     unsigned int   flags;
+
+    // decoded value of numeric literals, long double literals are only
+    // decoded to double precision
+    union {
+        unsigned long long int_value;   // integer literals, wrapped if MO_TOKEN_FLAG_LITERAL_OVERFLOW
+        double             float_value; // floating literals
+    };
 } MO_Token;
 
 typedef enum {
 	MO_PARSER_STATUS_OK = 0,
 	MO_PARSER_STATUS_FATAL,
+	MO_PARSER_STATUS_LIMIT, // stopped at one of the limits of the lexer, lexer->limit says which
 } MO_Parser_Status;
 
+typedef enum {
+	MO_LIMIT_NONE = 0,
+	MO_LIMIT_DEPTH,
+	MO_LIMIT_TOKENS,
+	MO_LIMIT_NODES,
+	MO_LIMIT_BYTES,
+	MO_LIMIT_TIME,
+	MO_LIMIT_CANCELLED,
+} MO_Parser_Limit;
+
 typedef struct {
 	struct MO_Ast_t*    node;
 	MO_Parser_Status status;
 	const char*       error_message;
 } MO_Parser_Result;
 
+typedef enum {
+	MO_PARSER_FLAG_LAZY_BODIES = (1 << 0), // struct, union and enum bodies are only parsed by mop_ast_force
+	MO_PARSER_FLAG_FLATTEN_CHAINS = (1 << 1), // a + b + c and other chains of + * & | ^ && || are one MO_AST_EXPRESSION_CHAIN
+	MO_PARSER_FLAG_COMMENTS = (1 << 2), // set before lexing: comments are kept in lexer->comments and attached as MO_Doc
+} MO_Parser_Flags;
+
+typedef enum {
+	MO_COMMENT_FLAG_BLOCK    = (1 << 0), // /* */, otherwise // comments on consecutive lines of their own
+	MO_COMMENT_FLAG_OWN_LINE = (1 << 1), // nothing but blanks before it on its line
+} MO_Comment_Flags;
+
+// A comment where it is in the lexed text, nothing is copied. Valid as long as
+// the text is, for a stream only during the callback.
+typedef struct {
+	unsigned char* data;   // from its first / on, without the newline that ends a // comment
+	int            length;
+	int            line;
+	int            column;
+	int            token;  // index of the token that follows it
+	unsigned int   flags;  // MO_Comment_Flags
+} MO_Comment;
+
+// Every allocation made by the lexer and the parser for a given MO_Lexer goes
+// through its allocator when one is set, otherwise through the c runtime.
+// alloc does not need to return zeroed memory, free receives the size that
+// was requested for the block. When parsing in parallel the allocator is
+// called from several threads at once. alloc and realloc must not fail, the
+// parser has no way back from a 0 in the middle of a parse. To hold a parse to
+// a budget or a fixed region, set max_bytes in MO_Lexer below what the
+// allocator can give, the parse then stops with MO_PARSER_STATUS_LIMIT.
+typedef struct MO_Allocator_t {
+	void* (*alloc)(void* user, size_t size);
+	void* (*realloc)(void* user, void* ptr, size_t old_size, size_t new_size);
+	void  (*free)(void* user, void* ptr, size_t size);
+	void* user;
+} MO_Allocator;
+
+typedef struct MO_Arena_t         MO_Arena;
+typedef struct MO_Typedef_Table_t MO_Typedef_Table;
+typedef struct MO_Memo_t          MO_Memo;
+typedef struct MO_Memory_Report_t MO_Memory_Report;
+typedef struct MO_Decl_Cache_t    MO_Decl_Cache;
+
+// Rule families whose results a MO_Memo caches
+typedef enum {
+	MO_MEMO_SPECIFIERS          = (1 << 0), // declaration-specifiers, specifier-qualifier-list
+	MO_MEMO_TYPE_NAME           = (1 << 1), // type-name, pointer
+	MO_MEMO_CAST_EXPRESSION     = (1 << 2),
+	MO_MEMO_UNARY_EXPRESSION    = (1 << 3), // unary, postfix and primary expressions
+	MO_MEMO_BINARY_EXPRESSION   = (1 << 4), // multiplicative through logical-or
+	MO_MEMO_EXPRESSION          = (1 << 5), // expression, assignment, conditional, initializer, arguments
+	MO_MEMO_ALL                 = 0x3f,
+} MO_Memo_Rules;
+
 typedef struct {
     char*          filename;
     int            line;
     int            column;
     MO_Token*      tokens;
     unsigned char* stream;
+    unsigned char* stream_end;
     int            index;
+    int*           matching;     // for every token the index of its paired ( ) [ ] { }, or -1
+    MO_Comment*    comments;     // with MO_PARSER_FLAG_COMMENTS, in the order of the text, see mop_lexer_comment_count
+    unsigned int   parser_flags; // MO_Parser_Flags
+
+    MO_Allocator*     allocator; // 0 for the c runtime
+    MO_Arena*         arena;     // nodes are allocated here when set, otherwise from the allocator
+    MO_Typedef_Table* typedefs;  // typedef names, created by the first typedef declaration when 0
+    MO_Memo*          memo;      // packrat memo table, 0 for none, not used by parallel parses
+    MO_Memory_Report* memory;    // filled in by every parse when set, see MO_Memory_Report
+    MO_Decl_Cache*    decl_cache; // top-level declarations mop_parse_translation_unit parsed before, see mop_decl_cache_open
+
+    // Parentheses, casts, unary operators, ternaries, subscripts, calls and nested
+    // declarators each take one level, struct and enum bodies and braced
+    // initializers take 1024. Deeper input fails with a syntax error instead of
+    // exhausting memory or the stack. 0 for the default of 65536.
+    int               max_depth;
+
+    // Budget of a single parse, 0 for none. Lexing stops a token past max_tokens,
+    // max_bytes counts the tokens and the nodes. The clock and cancel are looked
+    // at every 1024 tokens, cancel may be set from any thread. A parse that runs
+    // out fails with MO_PARSER_STATUS_LIMIT and gives back the nodes it made, so
+    // with any of these set nodes go to lexer->arena, which is created when the
+    // lexer has none.
+    int               max_tokens;
+    int               max_nodes;
+    size_t            max_bytes;
+    unsigned int      max_milliseconds;
+    volatile int*     cancel;
+
+    // kept by the parser
+    int                depth;      // levels open right now
+    int                limit;      // MO_Parser_Limit the last parse stopped at
+    int                node_count; // nodes made by the last parse
+    int                node_limit;
+    int                poll;       // tokens until the clock and cancel are looked at
+    unsigned long long deadline;
 } MO_Lexer;
 
 
@@ -284,6 +402,20 @@ typedef enum {
 	// Declaration
 	MO_AST_STRUCT_DECLARATION,
 	MO_AST_STRUCT_DECLARATION_LIST,
+
+	MO_AST_DECLARATION,
+	MO_AST_INIT_DECLARATOR,
+	MO_AST_INITIALIZER_LIST,
+	MO_AST_FUNCTION_DEFINITION,
+	MO_AST_TRANSLATION_UNIT,
+
+	// Unparsed { } body, see MO_PARSER_FLAG_LAZY_BODIES
+	MO_AST_LAZY_BODY,
+
+	// Three or more operands of one associative operator, see MO_PARSER_FLAG_FLATTEN_CHAINS
+	MO_AST_EXPRESSION_CHAIN,
+
+	MO_AST_KIND_COUNT
 } MO_Node_Kind;
 
 typedef struct {
@@ -302,6 +434,14 @@ typedef struct {
 	struct MO_Ast_t* right;
 } MO_Ast_Expression_Binary;
 
+// Stands for the left-deep chain of operator_kind nodes it replaces, operands
+// combine left to right.
+typedef struct {
+	MO_Node_Kind       operator_kind; // MO_AST_EXPRESSION_ADDITIVE, ..._LOGICAL_OR
+	MO_Binary_Operator bo;
+	struct MO_Ast_t**  operands;
+} MO_Ast_Expression_Chain;
+
 typedef struct {
 	MO_Token* data;
 } MO_Ast_Expression_Primary;
@@ -381,9 +521,17 @@ typedef struct {
 	struct MO_Ast_t** list;
 } MO_Ast_Type_Struct_Declarator_List;
 
+// Doc comments of a node with MO_PARSER_FLAG_COMMENTS, they point into
+// lexer->comments, 0 for none.
+typedef struct {
+	MO_Comment* leading;  // the last comment right in front of the node, on lines of its own
+	MO_Comment* trailing; // a comment after the node on the line it ends, past its ; or ,
+} MO_Doc;
+
 typedef struct {
 	struct MO_Ast_t* spec_qual;
 	struct MO_Ast_t* struct_decl_list;
+	MO_Doc           doc;
 } MO_Ast_Struct_Declaration;
 
 typedef struct {
@@ -393,16 +541,49 @@ typedef struct {
 typedef struct {
 	MO_Token* enum_constant;
 	struct MO_Ast_t* const_expr;
+	MO_Doc    doc;
 } MO_Ast_Enumerator;
 
 typedef struct {
 	struct MO_Ast_Enumerator** list;
 } MO_Ast_Enumerator_List;
 
+typedef struct {
+	struct MO_Ast_t*  decl_specifiers;
+	struct MO_Ast_t** init_declarators; // 0 when there is no declarator
+	MO_Doc            doc;
+} MO_Ast_Declaration;
+
+typedef struct {
+	struct MO_Ast_t* declarator;
+	struct MO_Ast_t* initializer; // optional
+} MO_Ast_Init_Declarator;
+
+typedef struct {
+	struct MO_Ast_t** list;
+} MO_Ast_Initializer_List;
+
+typedef struct {
+	struct MO_Ast_t* decl_specifiers;
+	struct MO_Ast_t* declarator;
+	struct MO_Ast_t* body; // MO_AST_LAZY_BODY, statements are not parsed
+	MO_Doc           doc;
+} MO_Ast_Function_Definition;
+
+typedef struct {
+	struct MO_Ast_t** list;
+} MO_Ast_Translation_Unit;
+
+typedef struct {
+	int begin; // index of the first token after {
+	int end;   // index of the matching }
+} MO_Ast_Lazy_Body;
+
 typedef struct MO_Ast_t {
 	MO_Node_Kind kind;
 	union {
 		MO_Ast_Expression_Binary expression_binary;
+		MO_Ast_Expression_Chain expression_chain;
 		MO_Ast_Expression_Primary expression_primary;
 		MO_Ast_Expression_Cast expression_cast;
 		MO_Ast_Expression_Unary expression_unary;
@@ -425,14 +606,286 @@ typedef struct MO_Ast_t {
 		MO_Ast_Struct_Declaration struct_declaration;
 		MO_Ast_Enumerator enumerator;
 		MO_Ast_Enumerator_List enumerator_list;
+		MO_Ast_Declaration declaration;
+		MO_Ast_Init_Declarator init_declarator;
+		MO_Ast_Initializer_List initializer_list;
+		MO_Ast_Function_Definition function_definition;
+		MO_Ast_Translation_Unit translation_unit;
+		MO_Ast_Lazy_Body lazy_body;
 	};
 } MO_Ast;
 
+typedef enum {
+	MO_MEMORY_TOKENS = 0,  // token array with its delimiter pairs and comments
+	MO_MEMORY_NODES,
+	MO_MEMORY_LISTS,       // child arrays of the list nodes
+	MO_MEMORY_DIAGNOSTICS, // error message
+	MO_MEMORY_PART_COUNT
+} MO_Memory_Part;
+
+typedef struct {
+	size_t reserved; // taken from the allocator
+	size_t used;     // holding data, the rest is slack of arrays and arena blocks
+	size_t peak;     // most reserved at once during the parse, or by any one parse for the process
+} MO_Memory_Use;
+
+// What a parse holds once it is done. Nodes allocated one by one count
+// sizeof(MO_Ast) each, without what the allocator adds, nodes in an arena
+// reserve the blocks the parse added to it, which is 0 when they fit in the
+// blocks it had, and use sizeof(MO_Ast) each. Tokens are counted as they were when
+// the parse started, lists and diagnostics as they are in the result. The peak
+// of nodes and of the total is followed as nodes are made.
+struct MO_Memory_Report_t {
+	MO_Memory_Use      parts[MO_MEMORY_PART_COUNT];
+	MO_Memory_Use      total;
+	unsigned long long nodes[MO_AST_KIND_COUNT]; // made per kind, including those of failed alternatives
+	unsigned long long parses;
+};
+
+typedef enum {
+	MO_WALK_CONTINUE = 0,
+	MO_WALK_SKIP_CHILDREN, // do not visit the children of this node (pre callback only)
+	MO_WALK_STOP,          // abort the walk
+} MO_Walk_Action;
+
+// depth is 0 for the root, parent is 0 for the root
+typedef MO_Walk_Action (*MO_Walk_Callback)(struct MO_Ast_t* node, struct MO_Ast_t* parent, int depth, void* user);
+
+// Flat AST: nodes in pre-order in one array, children follow their parent
+// and `next` is the index one past the end of the subtree, so the children
+// of node i are visited with:
+//     for(c = i + 1; c < nodes[i].next; c = nodes[c].next)
+#define MO_FLAT_NONE 0xffffffffu
+
+typedef struct {
+	unsigned char  kind;    // MO_Node_Kind
+	unsigned short op;      // operator, declarator type, sizeof type flag or vararg flag
+	unsigned int   slot;    // child slot in the parent, as in mop_ast_child, lists go past 255
+	unsigned int   token;   // index into tokens or MO_FLAT_NONE
+	unsigned int   payload; // index into the kind side table or MO_FLAT_NONE (end token for lazy bodies)
+	unsigned int   next;    // one past the last node of this subtree
+} MO_Flat_Node;
+
+// side table for MO_AST_TYPE_INFO nodes
+typedef struct {
+	unsigned char kind;          // MO_Type_Kind
+	unsigned char qualifiers;    // MO_Type_Qualifier flags
+	unsigned char storage_class; // Storage_Class flags
+	unsigned char primitive[8];  // count of each MO_Type_Primitive
+} MO_Flat_Type_Info;
+
+typedef struct {
+	MO_Flat_Node*      nodes;
+	int                count;
+	MO_Flat_Type_Info* type_infos;
+	int                type_info_count;
+	MO_Token*          tokens;
+	MO_Allocator*      allocator; // 0 for the c runtime, set before the first mop_ast_flatten
+} MO_Flat_Ast;
+
+// Thread safe cache of parsed expressions and type names, keyed by the input bytes.
+typedef struct MO_Parse_Cache_t       MO_Parse_Cache;
+typedef struct MO_Parse_Cache_Entry_t MO_Parse_Cache_Entry;
+
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long evictions;
+	unsigned long long entries;
+	size_t             bytes; // held by the entries in the cache
+} MO_Parse_Cache_Stats;
+
+typedef struct {
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long stores;
+	unsigned long long entries; // in the file, from every run
+	size_t             bytes;   // of trees in the file
+} MO_Decl_Cache_Stats;
+
+// Expressions parsed by mop_parse_expression_batch, the inputs are copied so they do
+// not have to outlive the batch.
+typedef struct {
+	int               count;
+	char*             text;        // the inputs, nul separated, the tokens point into it
+	size_t            text_length;
+	MO_Token*         tokens;      // of every input, each one ends with its own EOF token
+	int*              matching;    // for every token the index of its paired ( ) [ ] { }, or -1
+	int*              first_token; // per input, index of its first token
+	struct MO_Ast_t** roots;       // per input, a tree in arena, 0 when it failed
+	unsigned char*    statuses;    // per input, MO_Parser_Status
+	MO_Arena*         arena;       // every node of the batch
+
+	MO_Allocator*     allocator;   // 0 for the c runtime, set before parsing
+	MO_Typedef_Table* typedefs;    // names that parse as types in casts, optional
+} MO_Expression_Batch;
+
+// Push parser for input that arrives in pieces, see mop_stream_begin.
+typedef struct MO_Stream_t MO_Stream;
+
+// Gets every top-level declaration and function definition of a stream as soon as its
+// last byte was fed. The tokens the node points to are only valid until the callback
+// returns, lazy bodies have to be forced with mop_ast_force in there.
+typedef void (*MO_Stream_Callback)(MO_Lexer* lexer, struct MO_Ast_t* node, void* user);
+
+// Expressions compiled to bytecode by mop_program_compile and run by mop_program_eval.
+typedef struct MO_Program_t MO_Program;
+
+typedef enum {
+	MO_VALUE_INT = 0,     // long long
+	MO_VALUE_FLOAT,       // double
+	MO_VALUE_INT_ARRAY,   // long long elements, only usable with []
+	MO_VALUE_FLOAT_ARRAY, // double elements, only usable with []
+} MO_Value_Type;
+
+typedef union {
+	long long i;
+	double    f;
+	struct {
+		const void* data;
+		long long   count;
+	} array;
+} MO_Value;
+
+// A name expressions may refer to, an identifier or a member path like "ev.size",
+// which matches both ev.size and ev->size.
+typedef struct {
+	const char*   name;
+	MO_Value_Type type;
+} MO_Binding;
+
+typedef enum {
+	MO_EVAL_OK = 0,
+	MO_EVAL_DIVISION_BY_ZERO, // integer / or % by 0
+	MO_EVAL_INDEX_OUT_OF_RANGE,
+} MO_Eval_Status;
+
 MO_Token*        mop_lexer_cstr(MO_Lexer* lexer, char* str, int length);
+// Index of the token paired with the delimiter at index, -1 if none
+int              mop_lexer_match(MO_Lexer* lexer, int index);
+// Comments in lexer->comments, 0 without MO_PARSER_FLAG_COMMENTS
+int              mop_lexer_comment_count(MO_Lexer* lexer);
 MO_Parser_Result mop_parse_expression(MO_Lexer* lexer);
 MO_Parser_Result mop_parse_expression_cstr(const char* str);
+// Parses n expressions into one token array and one arena, replacing what the batch
+// held. lens may be 0, and entries of it -1, for nul terminated strings. An input fails
+// when it is not exactly one expression. thread_count is the number of parsing threads,
+// 0 for one per cpu. Returns the number of inputs that failed.
+int              mop_parse_expression_batch(MO_Expression_Batch* batch, const char** strs, const int* lens, int n, int thread_count);
+void             mop_expression_batch_free(MO_Expression_Batch* batch); // keeps allocator and typedefs
 MO_Parser_Result mop_parse_typename(MO_Lexer* lexer);
 MO_Parser_Result mop_parse_typename_cstr(const char* str);
+MO_Parser_Result mop_parse_translation_unit(MO_Lexer* lexer);
+
+// Sums the reports of every parse with lexer->memory set so far, peaks are the
+// highest of any one parse. Not synchronized with parses running on other threads.
+void             mop_memory_process(MO_Memory_Report* report);
+// Prints report to stderr, with the bytes each node kind uses of its node.
+void             mop_memory_dump(const MO_Memory_Report* report);
+
+// The least recently used entries are evicted while the cache holds more than
+// byte_budget bytes. Every reference has to be released before mop_parse_cache_free.
+MO_Parse_Cache*      mop_parse_cache_new(size_t byte_budget, MO_Allocator* allocator);
+void                 mop_parse_cache_free(MO_Parse_Cache* cache);
+// Like mop_parse_expression_cstr and mop_parse_typename_cstr (length -1 for strlen), but a
+// string parsed before is answered from the cache. The result is shared and must not be
+// modified, it stays valid until *ref is given to mop_parse_cache_release.
+MO_Parser_Result     mop_parse_cache_expression(MO_Parse_Cache* cache, const char* str, int length, MO_Parse_Cache_Entry** ref);
+MO_Parser_Result     mop_parse_cache_typename(MO_Parse_Cache* cache, const char* str, int length, MO_Parse_Cache_Entry** ref);
+void                 mop_parse_cache_release(MO_Parse_Cache* cache, MO_Parse_Cache_Entry* ref);
+MO_Parse_Cache_Stats mop_parse_cache_stats(MO_Parse_Cache* cache);
+// Opens or creates the file at path that keeps the trees of top-level declarations from
+// one run to the next, mop_parse_translation_unit takes a declaration from there when
+// its tokens and the typedef names among them are the same as before. max_entries (0
+// for 65536) sizes a new file, it is cleared when three quarters full or when trees
+// stored over take half of it. Returns 0 when the file cannot be mapped or another
+// process has it open, and always on Windows. The cache's own memory comes from
+// allocator, 0 for the c runtime.
+// A cache serves one parse at a time, the trees are not used with MO_PARSER_FLAG_COMMENTS.
+MO_Decl_Cache*       mop_decl_cache_open(const char* path, int max_entries, MO_Allocator* allocator);
+void                 mop_decl_cache_close(MO_Decl_Cache* cache);
+MO_Decl_Cache_Stats  mop_decl_cache_stats(MO_Decl_Cache* cache);
+// Splits the tokens at top-level declaration boundaries and parses them on thread_count
+// threads (0 for one per cpu). Typedef names are collected by a sequential pre-scan, the
+// nodes end up in lexer->arena, which is created when the lexer has none. Every thread
+// gets the whole node budget, the total is checked once they are done.
+MO_Parser_Result mop_parse_translation_unit_parallel(MO_Lexer* lexer, int thread_count);
+// Parses a translation unit fed in pieces that may split tokens, comments and literals
+// anywhere. lexer supplies the allocator, arena, typedefs, memo, flags and file name,
+// its tokens belong to the stream until mop_stream_end. mop_stream_feed returns the
+// first syntax error and every later call repeats it. mop_stream_end parses what is
+// left and frees the stream. Each call that parses gets the limits of the lexer anew,
+// max_bytes also bounds the text held back for an unfinished declaration.
+MO_Stream*       mop_stream_begin(MO_Lexer* lexer, MO_Stream_Callback callback, void* user);
+MO_Parser_Result mop_stream_feed(MO_Stream* stream, const char* bytes, int length);
+MO_Parser_Result mop_stream_end(MO_Stream* stream);
+
+// Compiles an expression against bindings, the value of bindings[i] is values[i] in
+// mop_program_eval. Arithmetic is C's on long long and double, with wrapping integer
+// overflow and shift counts taken modulo 64, casts to integer types cut the value to
+// their width. Returns 0 and sets error_message (when not 0) for what cannot be
+// evaluated: unbound names, assignments, calls, pointers, strings and sizeof.
+MO_Program*      mop_program_compile(struct MO_Ast_t* expr, const MO_Binding* bindings, int binding_count, MO_Allocator* allocator, const char** error_message);
+void             mop_program_free(MO_Program* program);
+MO_Value_Type    mop_program_result_type(const MO_Program* program);
+// Programs are not modified by evaluation, several threads may run one at once.
+MO_Eval_Status   mop_program_eval(const MO_Program* program, const MO_Value* values, MO_Value* result);
+// Compiles program to x86-64 machine code that mop_program_eval runs from then on. Only
+// done on Linux x86-64, returns 0 when the program stays interpreted. Must not race
+// with evaluations of the program.
+int              mop_program_jit(MO_Program* program);
+// Evaluates program for row_count rows at once. columns[i] holds the rows of bindings[i]:
+// row_count long longs or doubles for scalars, for arrays one MO_Value shared by all rows.
+// result gets row_count values of mop_program_result_type. Stops at the first row that
+// fails, the rows before it may or may not have their results.
+MO_Eval_Status   mop_program_eval_columns(const MO_Program* program, const void* const* columns, long long row_count, void* result);
+
+MO_Arena*         mop_arena_new(size_t block_size, MO_Allocator* allocator); // 0 for the default block size
+void              mop_arena_free(MO_Arena* arena);
+MO_Typedef_Table* mop_typedef_table_new(MO_Allocator* allocator);
+void              mop_typedef_table_free(MO_Typedef_Table* table);
+void              mop_typedef_table_add(MO_Typedef_Table* table, const char* name, int length); // length -1 for strlen
+// Caches the results of the rules in rules (MO_Memo_Rules) by token position in at most
+// max_entries slots (0 for the default), so no cached rule runs twice at the same token.
+MO_Memo*          mop_memo_new(unsigned int rules, int max_entries, MO_Allocator* allocator);
+void              mop_memo_free(MO_Memo* memo);
 void             mop_print_ast(struct MO_Ast_t* ast);
 
+// Per-rule calls, failures, tokens consumed and cycles, nodes allocated per kind
+// and parser event counts of all threads, printed to stderr. Only collected when
+// the library is built with -DMOP_INSTRUMENT.
+void             mop_stats_dump();
+void             mop_stats_reset();
+
+// Chrome trace_event timeline (chrome://tracing, Perfetto) of the lex, parse and print
+// entry points on every thread. mop_trace_start turns recording on and writes the trace
+// to filename at exit, mop_trace_write writes it now and must not race with parses.
+void               mop_trace_start(const char* filename);
+int                mop_trace_write(const char* filename);
+// Spans for the caller's own phases. name must stay valid until the trace is written,
+// detail is copied and may be 0. mop_trace_begin returns 0 while tracing is off.
+unsigned long long mop_trace_begin();
+void               mop_trace_end(const char* name, const char* detail, unsigned long long begin);
+
+// Parses the body of a struct, union or enum MO_AST_TYPE_INFO node that was left as a
+// MO_AST_LAZY_BODY, lexer must be the one the node was parsed with. Does nothing on
+// nodes that are already expanded.
+MO_Parser_Result mop_ast_force(MO_Lexer* lexer, struct MO_Ast_t* type_info);
+
+// Iterative pre/post order traversal, pre or post may be 0.
+// Returns MO_WALK_STOP if any callback stopped the walk.
+MO_Walk_Action   mop_ast_walk(struct MO_Ast_t* root, MO_Walk_Callback pre, MO_Walk_Callback post, void* user);
+int              mop_ast_child_count(struct MO_Ast_t* node);
+struct MO_Ast_t* mop_ast_child(struct MO_Ast_t* node, int slot);
+
+// Appends the tree to a zero initialized or previously used flat ast, tokens is the
+// token array the tree was parsed from. Returns the index of the root node.
+int              mop_ast_flatten(MO_Flat_Ast* flat, MO_Token* tokens, struct MO_Ast_t* root);
+void             mop_flat_free(MO_Flat_Ast* flat);
+
+// Answers parse requests on a unix domain socket until a client sends "quit", keeping
+// every file it was asked about lexed and parsed until it changes on disk. The
+// protocol is described in server.c. Returns -1 when the socket cannot be set up.
+int              mop_server_run(const char* socket_path);
+
 #endif // H_MOPARSER
\ No newline at end of file
@@ -0,0 +1,263 @@
+// Shared cache of parsed expressions and type names, see MO_Parse_Cache.
+//
+// An entry owns everything its result points to: a copy of the source, the
+// tokens and an arena with the tree, so it can be handed to several threads
+// and dropped as a whole. The lists inside the tree come from the lexer's
+// allocator rather than the arena, so while parsing the entry's lexer gets an
+// allocator that takes its memory from the entry's arena as well. Entries are
+// reference counted, the cache holds one reference while an entry is in the
+// table and every lookup hands out another. Eviction takes the least recently
+// used entries out of the table until the cache is back under its byte
+// budget; an entry that is still referenced is freed by its last
+// mop_parse_cache_release.
+//
+// Lookups and the bookkeeping share one mutex, parsing on a miss happens
+// outside of it. Two threads missing on the same string both parse it, the
+// second one to finish uses the entry of the first.
+
+#define PARSE_CACHE_ARENA_BLOCK 1024
+
+typedef enum {
+	PARSE_CACHE_EXPRESSION = 0,
+	PARSE_CACHE_TYPENAME,
+} Parse_Cache_Kind;
+
+struct MO_Parse_Cache_Entry_t {
+	u64                            hash;
+	Parse_Cache_Kind               kind;
+	s32                            length;
+	char*                          source; // nul terminated copy of the input
+	MO_Lexer                       lexer;  // tokens and arena of the tree
+	MO_Allocator                   tree_allocator; // on top of lexer.arena
+	MO_Parser_Result               result; // error_message is owned by the entry
+	size_t                         bytes;
+	s32                            refs;
+	struct MO_Parse_Cache_Entry_t* prev;   // lru list, most recent first
+	struct MO_Parse_Cache_Entry_t* next;
+	struct MO_Parse_Cache_Entry_t* chain;  // hash bucket
+};
+typedef struct MO_Parse_Cache_Entry_t Parse_Cache_Entry;
+
+struct MO_Parse_Cache_t {
+	Mutex               lock;
+	MO_Allocator*       allocator;
+	Parse_Cache_Entry** buckets;
+	s32                 bucket_count; // power of two
+	Parse_Cache_Entry*  lru_first;
+	Parse_Cache_Entry*  lru_last;
+	size_t              budget;
+	MO_Parse_Cache_Stats stats;
+};
+
+static void*
+parse_cache_tree_alloc(void* user, size_t size) {
+	return arena_alloc((MO_Arena*)user, size);
+}
+
+static void*
+parse_cache_tree_realloc(void* user, void* ptr, size_t old_size, size_t new_size) {
+	void* result = arena_alloc((MO_Arena*)user, new_size);
+	memcpy(result, ptr, MIN(old_size, new_size));
+	return result;
+}
+
+static void
+parse_cache_tree_free(void* user, void* ptr, size_t size) {
+	// released with the arena
+}
+
+static void
+parse_cache_entry_free(MO_Allocator* allocator, Parse_Cache_Entry* e) {
+	if(e->result.error_message)
+		mem_free(allocator, (void*)e->result.error_message, strlen(e->result.error_message) + 1);
+	if(e->lexer.tokens) array_free(e->lexer.tokens);
+	if(e->lexer.matching) array_free(e->lexer.matching);
+	mop_arena_free(e->lexer.arena);
+	mem_free(allocator, e->source, e->length + 1);
+	mem_free(allocator, e, sizeof(Parse_Cache_Entry));
+}
+
+static Parse_Cache_Entry*
+parse_cache_entry_new(MO_Allocator* allocator, Parse_Cache_Kind kind, const char* str, s32 length, u64 hash) {
+	Parse_Cache_Entry* e = mem_alloc(allocator, sizeof(Parse_Cache_Entry));
+	e->hash = hash;
+	e->kind = kind;
+	e->length = length;
+	e->source = mem_alloc(allocator, length + 1);
+	memcpy(e->source, str, length);
+
+	e->lexer.allocator = allocator;
+	lexer_cstr(&e->lexer, e->source, length, 0);
+	e->lexer.arena = mop_arena_new(PARSE_CACHE_ARENA_BLOCK, allocator);
+	e->tree_allocator = (MO_Allocator){ parse_cache_tree_alloc, parse_cache_tree_realloc, parse_cache_tree_free, e->lexer.arena };
+	e->lexer.allocator = &e->tree_allocator;
+	e->result = (kind == PARSE_CACHE_EXPRESSION) ? parse_expression(&e->lexer) : parse_type_name(&e->lexer);
+	// the error buffer belongs to this thread, keep a copy
+	if(e->result.error_message) e->result.error_message = mem_strdup(allocator, e->result.error_message);
+	e->lexer.allocator = allocator;
+
+	e->bytes = sizeof(Parse_Cache_Entry) + length + 1 + arena_bytes(e->lexer.arena) +
+		array_capacity(e->lexer.tokens) * sizeof(Token) + array_capacity(e->lexer.matching) * sizeof(s32);
+	if(e->result.error_message) e->bytes += strlen(e->result.error_message) + 1;
+	return e;
+}
+
+static Parse_Cache_Entry**
+parse_cache_find(MO_Parse_Cache* cache, Parse_Cache_Kind kind, const char* str, s32 length, u64 hash) {
+	Parse_Cache_Entry** e = &cache->buckets[hash & (cache->bucket_count - 1)];
+	for(; *e; e = &(*e)->chain) {
+		if((*e)->hash == hash && (*e)->kind == kind && (*e)->length == length && memcmp((*e)->source, str, length) == 0)
+			break;
+	}
+	return e;
+}
+
+static void
+parse_cache_lru_unlink(MO_Parse_Cache* cache, Parse_Cache_Entry* e) {
+	if(e->prev) e->prev->next = e->next; else cache->lru_first = e->next;
+	if(e->next) e->next->prev = e->prev; else cache->lru_last = e->prev;
+	e->prev = e->next = 0;
+}
+
+static void
+parse_cache_lru_push(MO_Parse_Cache* cache, Parse_Cache_Entry* e) {
+	e->prev = 0;
+	e->next = cache->lru_first;
+	if(cache->lru_first) cache->lru_first->prev = e; else cache->lru_last = e;
+	cache->lru_first = e;
+}
+
+// Drops one reference, the lock has to be held.
+static void
+parse_cache_unref(MO_Parse_Cache* cache, Parse_Cache_Entry* e) {
+	if(--e->refs == 0) parse_cache_entry_free(cache->allocator, e);
+}
+
+static void
+parse_cache_evict(MO_Parse_Cache* cache) {
+	while(cache->stats.bytes > cache->budget && cache->lru_last) {
+		Parse_Cache_Entry* e = cache->lru_last;
+		parse_cache_lru_unlink(cache, e);
+		Parse_Cache_Entry** slot = parse_cache_find(cache, e->kind, e->source, e->length, e->hash);
+		*slot = e->chain;
+		cache->stats.bytes -= e->bytes;
+		cache->stats.entries--;
+		cache->stats.evictions++;
+		parse_cache_unref(cache, e);
+	}
+}
+
+static void
+parse_cache_grow(MO_Parse_Cache* cache) {
+	s32 old_count = cache->bucket_count;
+	Parse_Cache_Entry** old = cache->buckets;
+	cache->bucket_count = old_count * 2;
+	cache->buckets = mem_alloc(cache->allocator, cache->bucket_count * sizeof(Parse_Cache_Entry*));
+	for(s32 i = 0; i < old_count; ++i) {
+		Parse_Cache_Entry* e = old[i];
+		while(e) {
+			Parse_Cache_Entry* next = e->chain;
+			Parse_Cache_Entry** bucket = &cache->buckets[e->hash & (cache->bucket_count - 1)];
+			e->chain = *bucket;
+			*bucket = e;
+			e = next;
+		}
+	}
+	mem_free(cache->allocator, old, old_count * sizeof(Parse_Cache_Entry*));
+}
+
+static MO_Parser_Result
+parse_cache_get(MO_Parse_Cache* cache, Parse_Cache_Kind kind, const char* str, int length, MO_Parse_Cache_Entry** ref) {
+	if(length < 0) length = (int)strlen(str);
+	u64 hash = typedef_name_hash((const u8*)str, length) ^ (u64)kind;
+
+	mutex_lock(&cache->lock);
+	Parse_Cache_Entry* e = *parse_cache_find(cache, kind, str, length, hash);
+	if(e) {
+		cache->stats.hits++;
+		parse_cache_lru_unlink(cache, e);
+		parse_cache_lru_push(cache, e);
+		e->refs++;
+		mutex_unlock(&cache->lock);
+		*ref = e;
+		return e->result;
+	}
+	cache->stats.misses++;
+	mutex_unlock(&cache->lock);
+
+	Parse_Cache_Entry* parsed = parse_cache_entry_new(cache->allocator, kind, str, length, hash);
+
+	mutex_lock(&cache->lock);
+	Parse_Cache_Entry** slot = parse_cache_find(cache, kind, str, length, hash);
+	if(*slot) {
+		// another thread got there first
+		parse_cache_entry_free(cache->allocator, parsed);
+		e = *slot;
+		parse_cache_lru_unlink(cache, e);
+	} else {
+		e = parsed;
+		e->refs = 1; // the table's
+		*slot = e;
+		cache->stats.bytes += e->bytes;
+		cache->stats.entries++;
+	}
+	parse_cache_lru_push(cache, e);
+	e->refs++;
+	parse_cache_evict(cache);
+	if(cache->stats.entries > cache->bucket_count) parse_cache_grow(cache);
+	mutex_unlock(&cache->lock);
+
+	*ref = e;
+	return e->result;
+}
+
+MO_Parse_Cache*
+mop_parse_cache_new(size_t byte_budget, MO_Allocator* allocator) {
+	MO_Parse_Cache* cache = mem_alloc(allocator, sizeof(MO_Parse_Cache));
+	mutex_init(&cache->lock);
+	cache->allocator = allocator;
+	cache->budget = byte_budget;
+	cache->bucket_count = 256;
+	cache->buckets = mem_alloc(allocator, cache->bucket_count * sizeof(Parse_Cache_Entry*));
+	return cache;
+}
+
+void
+mop_parse_cache_free(MO_Parse_Cache* cache) {
+	if(!cache) return;
+	Parse_Cache_Entry* e = cache->lru_first;
+	while(e) {
+		Parse_Cache_Entry* next = e->next;
+		parse_cache_unref(cache, e);
+		e = next;
+	}
+	mem_free(cache->allocator, cache->buckets, cache->bucket_count * sizeof(Parse_Cache_Entry*));
+	mutex_destroy(&cache->lock);
+	mem_free(cache->allocator, cache, sizeof(MO_Parse_Cache));
+}
+
+MO_Parser_Result
+mop_parse_cache_expression(MO_Parse_Cache* cache, const char* str, int length, MO_Parse_Cache_Entry** ref) {
+	return parse_cache_get(cache, PARSE_CACHE_EXPRESSION, str, length, ref);
+}
+
+MO_Parser_Result
+mop_parse_cache_typename(MO_Parse_Cache* cache, const char* str, int length, MO_Parse_Cache_Entry** ref) {
+	return parse_cache_get(cache, PARSE_CACHE_TYPENAME, str, length, ref);
+}
+
+void
+mop_parse_cache_release(MO_Parse_Cache* cache, MO_Parse_Cache_Entry* ref) {
+	if(!ref) return;
+	mutex_lock(&cache->lock);
+	parse_cache_unref(cache, ref);
+	mutex_unlock(&cache->lock);
+}
+
+MO_Parse_Cache_Stats
+mop_parse_cache_stats(MO_Parse_Cache* cache) {
+	mutex_lock(&cache->lock);
+	MO_Parse_Cache_Stats stats = cache->stats;
+	mutex_unlock(&cache->lock);
+	return stats;
+}
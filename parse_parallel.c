@@ -0,0 +1,289 @@
+// Parallel parsing of top-level declarations.
+//
+// After lexing, the token array is split at top-level declaration
+// boundaries: a ';' outside of any group, or the '}' that closes a
+// function body. Typedef names are the only state a declaration leaks into
+// the ones after it, so a cheap sequential pre-scan collects them first and
+// the chunks are then parsed independently, each worker into its own arena.
+
+typedef struct {
+	s32 begin;
+	s32 end; // one past the last token
+} Decl_Chunk;
+
+static Decl_Chunk*
+split_top_level_declarations(Lexer* lexer, s32 begin) {
+	Decl_Chunk* chunks = array_new_with(Decl_Chunk, lexer->allocator);
+	Token* tokens = lexer->tokens;
+
+	s32 start = begin;
+	s32 i = begin;
+	while(tokens[i].type != MO_TOKEN_EOF) {
+		switch(tokens[i].type) {
+			case '(': case '[': case '{': {
+				s32 close = lexer_match_delimiter(lexer, i);
+				if(close == -1) {
+					// unbalanced, everything left goes to the parser which reports the error
+					while(tokens[i].type != MO_TOKEN_EOF) ++i;
+					continue;
+				}
+				if(tokens[i].type == '{' && i > start && tokens[i - 1].type == ')') {
+					// function body
+					Decl_Chunk c = { start, close + 1 };
+					array_push(chunks, c);
+					start = close + 1;
+				}
+				i = close + 1;
+			} break;
+			case ';': {
+				if(i > start) {
+					Decl_Chunk c = { start, i + 1 };
+					array_push(chunks, c);
+				}
+				start = i + 1;
+				++i;
+			} break;
+			default: ++i; break;
+		}
+	}
+	if(i > start) {
+		Decl_Chunk c = { start, i };
+		array_push(chunks, c);
+	}
+
+	return chunks;
+}
+
+// Adds the names declared by a typedef chunk to the table without parsing it.
+static void
+prescan_typedef_names(Lexer* lexer, Decl_Chunk chunk, MO_Typedef_Table* table) {
+	Token* tokens = lexer->tokens;
+	bool is_typedef = false;
+	bool has_type = false;
+
+	// declaration-specifiers
+	s32 i = chunk.begin;
+	while(i < chunk.end) {
+		Token* t = &tokens[i];
+		if(t->type == MO_TOKEN_KEYWORD_TYPEDEF) {
+			is_typedef = true;
+			++i;
+		} else if(t->type == MO_TOKEN_KEYWORD_STRUCT || t->type == MO_TOKEN_KEYWORD_UNION || t->type == MO_TOKEN_KEYWORD_ENUM) {
+			has_type = true;
+			++i;
+			if(tokens[i].type == MO_TOKEN_IDENTIFIER) ++i;
+			if(tokens[i].type == '{') {
+				s32 close = lexer_match_delimiter(lexer, i);
+				if(close == -1) return;
+				i = close + 1;
+			}
+		} else if(t->flags & MO_TOKEN_FLAG_KEYWORD) {
+			if(t->flags & MO_TOKEN_FLAG_TYPE_KEYWORD) has_type = true;
+			++i;
+		} else if(t->type == MO_TOKEN_IDENTIFIER && !has_type && typedef_table_contains(table, t->data, t->length)) {
+			has_type = true;
+			++i;
+		} else {
+			break;
+		}
+	}
+	if(!is_typedef) return;
+
+	// declarators, the name is the first identifier of each one that is not
+	// inside of a parameter list or an array size
+	bool named = false;
+	for(; i < chunk.end; ++i) {
+		Token* t = &tokens[i];
+		switch(t->type) {
+			case '(': {
+				MO_Token_Type prev = tokens[i - 1].type;
+				if(named || prev == MO_TOKEN_IDENTIFIER || prev == ')' || prev == ']') {
+					s32 close = lexer_match_delimiter(lexer, i);
+					if(close == -1) return;
+					i = close;
+				}
+			} break;
+			case '[':
+			case '{': {
+				s32 close = lexer_match_delimiter(lexer, i);
+				if(close == -1) return;
+				i = close;
+			} break;
+			case ',': named = false; break;
+			case ';': return;
+			case MO_TOKEN_IDENTIFIER: {
+				if(!named) typedef_table_add(table, t->data, t->length);
+				named = true;
+			} break;
+			default: break;
+		}
+	}
+}
+
+typedef struct {
+	Lexer             lexer;  // private copy sharing the tokens
+	Decl_Chunk*       chunks;
+	MO_Ast**          nodes;  // one per chunk
+	MO_Parser_Result* errors; // one per chunk
+	volatile s32*     next_batch;
+	s32               batch_size;
+	MO_Memory_Report  memory; // nodes the worker made, with lexer->memory set
+} Parse_Worker;
+
+static void
+parse_worker_proc(void* arg) {
+	Parse_Worker* w = (Parse_Worker*)arg;
+	s32 chunk_count = (s32)array_length(w->chunks);
+	u64 trace = mop_trace_begin();
+
+	while(true) {
+		s32 first = atomic_add_s32(w->next_batch, w->batch_size);
+		if(first >= chunk_count) break;
+		s32 last = MIN(first + w->batch_size, chunk_count);
+
+		for(s32 c = first; c < last; ++c) {
+			Decl_Chunk chunk = w->chunks[c];
+			w->lexer.index = chunk.begin;
+			if(w->lexer.tokens[chunk.begin].type == ';') continue; // stray ;
+
+			MO_Parser_Result r = parse_declaration(&w->lexer);
+			if(r.status == MO_PARSER_STATUS_OK && w->lexer.index != chunk.end) {
+				// the declaration ended before the chunk did
+				Token* t = lexer_peek(&w->lexer);
+				r.status = MO_PARSER_STATUS_FATAL;
+				sprintf(parser_error_buffer,
+					"%s:%d:%d: Syntax error: unexpected '%.*s' after declaration\n",
+					w->lexer.filename, t->line, t->column, t->length, t->data);
+				r.error_message = parser_error_buffer;
+			}
+			if(r.status == MO_PARSER_STATUS_FATAL) {
+				// past the depth limit the whole parse stops, as it does for the other limits
+				if(w->lexer.parser_flags & PARSER_FLAG_DEPTH_EXCEEDED)
+					parse_limit_hit(&w->lexer, MO_LIMIT_DEPTH);
+				// the error buffer belongs to this thread, keep a copy
+				if(r.error_message) r.error_message = mem_strdup(w->lexer.allocator, r.error_message);
+				w->errors[c] = r;
+				continue;
+			}
+			w->nodes[c] = r.node;
+		}
+	}
+	mop_trace_end("parse worker", w->lexer.filename, trace);
+}
+
+static MO_Parser_Result
+parse_translation_unit_parallel(Lexer* lexer, s32 thread_count) {
+	MO_Parser_Result res = {0};
+	if(thread_count <= 0) thread_count = platform_cpu_count();
+
+	Decl_Chunk* chunks = split_top_level_declarations(lexer, lexer->index);
+	s32 chunk_count = (s32)array_length(chunks);
+
+	if(!lexer->typedefs) lexer->typedefs = typedef_table_new(lexer->allocator);
+	for(s32 c = 0; c < chunk_count; ++c)
+		prescan_typedef_names(lexer, chunks[c], lexer->typedefs);
+
+	if(!lexer->arena) lexer->arena = mop_arena_new(0, lexer->allocator);
+
+	MO_Allocator* allocator = lexer->allocator;
+	size_t slot_count = MAX(chunk_count, 1);
+	MO_Ast** nodes = mem_alloc(allocator, slot_count * sizeof(MO_Ast*));
+	MO_Parser_Result* errors = mem_alloc(allocator, slot_count * sizeof(MO_Parser_Result));
+
+	thread_count = MAX(1, MIN(thread_count, chunk_count));
+	Thread* threads = mem_alloc(allocator, thread_count * sizeof(Thread));
+	Parse_Worker* workers = mem_alloc(allocator, thread_count * sizeof(Parse_Worker));
+	volatile s32 next_batch = 0;
+
+	for(s32 t = 0; t < thread_count; ++t) {
+		Parse_Worker* w = &workers[t];
+		w->lexer = *lexer;
+		w->lexer.arena = mop_arena_new(0, allocator);
+		w->lexer.parser_flags |= PARSER_FLAG_TYPEDEFS_FROZEN;
+		w->lexer.memo = 0; // the table is not shared between threads
+		w->lexer.memory = (lexer->memory) ? &w->memory : 0;
+		w->chunks = chunks;
+		w->nodes = nodes;
+		w->errors = errors;
+		w->next_batch = &next_batch;
+		w->batch_size = MAX(1, chunk_count / (thread_count * 8));
+	}
+
+	// the calling thread is worker 0
+	for(s32 t = 1; t < thread_count; ++t) {
+		if(!thread_start(&threads[t], parse_worker_proc, &workers[t])) {
+			threads[t].proc = 0;
+		}
+	}
+	parse_worker_proc(&workers[0]);
+	for(s32 t = 1; t < thread_count; ++t) {
+		if(threads[t].proc) thread_join(&threads[t]);
+	}
+
+	// a budget that ran out in one worker stops the whole parse, every worker had
+	// all of the node budget, so the total is checked here
+	for(s32 t = 0; t < thread_count; ++t) {
+		Lexer* w = &workers[t].lexer;
+		if(w->parser_flags & PARSER_FLAG_LIMIT_EXCEEDED) parse_limit_hit(lexer, w->limit);
+		lexer->node_count += w->node_count;
+		if(lexer->memory) memory_nodes_add(lexer->memory, &workers[t].memory);
+	}
+	if((u32)lexer->node_count > (u32)lexer->node_limit - 1) parse_limits_node(lexer);
+	// parse_end fails an input cut by an open /* comment, the nodes are not
+	// merged as the mark would not get them back
+	bool stopped = (lexer->parser_flags & PARSER_FLAG_LIMIT_EXCEEDED) != 0 || parse_unterminated(lexer);
+
+	for(s32 t = 0; t < thread_count; ++t) {
+		if(stopped) {
+			parse_release_nodes(workers[t].lexer.arena, (Arena_Mark){0});
+			mop_arena_free(workers[t].lexer.arena);
+		} else {
+			arena_merge(lexer->arena, workers[t].lexer.arena);
+		}
+	}
+
+	// stitch in source order, the first error in the source wins
+	MO_Ast** list = array_new_with(MO_Ast*, allocator);
+	for(s32 c = 0; c < chunk_count; ++c) {
+		if(errors[c].status == MO_PARSER_STATUS_FATAL) {
+			if(res.status != MO_PARSER_STATUS_FATAL) {
+				res = errors[c];
+				if(errors[c].error_message) {
+					snprintf(parser_error_buffer, sizeof(parser_error_buffer), "%s", errors[c].error_message);
+					res.error_message = parser_error_buffer;
+				}
+			}
+			if(errors[c].error_message)
+				mem_free(allocator, (void*)errors[c].error_message, strlen(errors[c].error_message) + 1);
+			continue;
+		}
+		if(nodes[c]) array_push(list, nodes[c]);
+	}
+
+	if(res.status == MO_PARSER_STATUS_FATAL || stopped) {
+		array_free(list);
+		res.node = 0;
+	} else {
+		res.node = allocate_node(lexer, MO_AST_TRANSLATION_UNIT);
+		res.node->translation_unit.list = list;
+	}
+	lexer->index = (chunk_count > 0) ? chunks[chunk_count - 1].end : lexer->index;
+
+	mem_free(allocator, workers, thread_count * sizeof(Parse_Worker));
+	mem_free(allocator, threads, thread_count * sizeof(Thread));
+	mem_free(allocator, errors, slot_count * sizeof(MO_Parser_Result));
+	mem_free(allocator, nodes, slot_count * sizeof(MO_Ast*));
+	array_free(chunks);
+
+	return res;
+}
+
+MO_Parser_Result
+mop_parse_translation_unit_parallel(MO_Lexer* lexer, int thread_count) {
+	u64 trace = mop_trace_begin();
+	Parse_Mark mark = parse_begin((Lexer*)lexer);
+	MO_Parser_Result res = parse_translation_unit_parallel((Lexer*)lexer, thread_count);
+	res = parse_end((Lexer*)lexer, &mark, res);
+	mop_trace_end("parse translation unit", lexer->filename, trace);
+	return res;
+}
@@ -0,0 +1,248 @@
+// Explicit parse stack for the expression and declarator rules.
+//
+// Those rules nest into each other for every parenthesis, cast, unary
+// operator, ternary and nested declarator, a dozen calls per level, so deep
+// generated expressions used to run out of c stack. They are written as steps
+// instead: a step runs its rule until it needs another rule, then pushes a
+// Parse_Frame for it with parse_call and returns, and parse_stack_run calls
+// the step of whatever frame is on top. When a rule returns, the frame below
+// resumes at the state it saved with the result in stack->ret. Everything a
+// rule keeps across a call lives in its frame.
+//
+// Calls through the stack behave like calls through the rule wrappers: they
+// consult the memo table, are counted by the statistics and store their result
+// back. The rule the stack was started for is the exception, its wrapper does
+// all of that already.
+//
+// Calls that open a new level of nesting take one level of lexer->depth. Past
+// the limit the whole run unwinds and fails, which keeps the stack, and the
+// heap behind it, bounded for any input. Struct and enum bodies and braced
+// initializers still recurse on the c stack, see parser_enter.
+
+#define PARSER_DEFAULT_MAX_DEPTH 65536
+// The share of the depth limit one level of c recursion takes, a level costs
+// one to two kilobytes of c stack, the default limit allows 64 of them, what
+// c requires for nested struct definitions.
+#define PARSER_RECURSION_DEPTH 1024
+// frames kept on the c stack before the parse stack moves to the heap, an
+// expression is 17 frames deep at its primary, so one level of parentheses fits
+#define PARSE_STACK_LOCAL 32
+
+// kept out of the steps, so that what they do inline stays small
+#if defined(_MSC_VER)
+#define PARSE_COLD __declspec(noinline)
+#else
+#define PARSE_COLD __attribute__((noinline))
+#endif
+
+typedef enum {
+	PARSE_FRAME_REQUIRE_NAME = FLAG(0), // the declarator must declare a name
+	PARSE_FRAME_NESTED       = FLAG(1), // took a level of lexer->depth
+	PARSE_FRAME_ENTRY        = FLAG(2), // the rule parse_stack_run was called for
+} Parse_Frame_Flags;
+
+typedef struct {
+	MO_Parser_Result res;   // the rule's result so far
+	MO_Ast*          left;  // nodes kept across a call: left operand, condition...
+	MO_Ast*          right;
+	Token*           op;
+	s32              start; // token index the rule started at, the memo key
+	u8               rule;  // Parser_Rule
+	u8               state; // where the step resumes once the rule it called returns
+	u8               flags; // Parse_Frame_Flags
+#if defined(MOP_INSTRUMENT)
+	Rule_Frame       stats;
+#endif
+} Parse_Frame;
+
+typedef struct {
+	Lexer*           lexer;
+	Parse_Frame*     frames;
+	s32              count;
+	s32              capacity;
+	bool             aborted;
+	MO_Parser_Result ret;   // result of the last rule that returned
+	Parse_Frame      local[PARSE_STACK_LOCAL];
+} Parse_Stack;
+
+// Calls RULE and leaves the step, which resumes at RESUME with the result in
+// stack->ret. The frame passed to the step is stale once anything was pushed.
+#define PARSE_CALL(RULE, RESUME, FLAGS) do { parse_call(stack, RULE_##RULE, (RESUME), (FLAGS)); return; } while(0)
+#define PARSE_RETURN(RESULT) do { stack->ret = (RESULT); parse_return(stack); return; } while(0)
+
+#define MOP_STEP(NAME) NAME##_step
+
+#define RULE_MEMO(NAME, PARAMS, ARGS, MEMO) MEMO,
+static const u32 parser_rule_memo[] = { PARSER_RULES(RULE_MEMO) };
+#undef RULE_MEMO
+
+static s32
+parser_max_depth(Lexer* lexer) {
+	return (lexer->max_depth > 0) ? lexer->max_depth : PARSER_DEFAULT_MAX_DEPTH;
+}
+
+static MO_Parser_Result
+parser_depth_error(Lexer* lexer) {
+	MO_Parser_Result res = {0};
+	Token* t = lexer_peek(lexer);
+	res.status = MO_PARSER_STATUS_FATAL;
+	sprintf(parser_error_buffer,
+		"%s:%d:%d: Syntax error: nesting deeper than the limit of %d\n",
+		lexer->filename, t->line, t->column, parser_max_depth(lexer));
+	res.error_message = parser_error_buffer;
+	return res;
+}
+
+// Takes levels of depth, fails with the error in res past the limit. Every
+// successful enter needs a leave.
+static bool
+parser_enter(Lexer* lexer, s32 levels, MO_Parser_Result* res) {
+	if((lexer->parser_flags & PARSER_FLAG_DEPTH_EXCEEDED) || lexer->depth + levels > parser_max_depth(lexer)) {
+		lexer->parser_flags |= PARSER_FLAG_DEPTH_EXCEEDED;
+		*res = parser_depth_error(lexer);
+		return false;
+	}
+	lexer->depth += levels;
+	return true;
+}
+
+static void
+parser_leave(Lexer* lexer, s32 levels) {
+	lexer->depth -= levels;
+}
+
+static PARSE_COLD void
+parse_grow(Parse_Stack* stack) {
+	Lexer* lexer = stack->lexer;
+	s32 capacity = stack->capacity * 2;
+	Parse_Frame* frames = mem_alloc(lexer->allocator, capacity * sizeof(Parse_Frame));
+	memcpy(frames, stack->frames, stack->count * sizeof(Parse_Frame));
+	if(stack->frames != stack->local)
+		mem_free(lexer->allocator, stack->frames, stack->capacity * sizeof(Parse_Frame));
+	stack->frames = frames;
+	stack->capacity = capacity;
+}
+
+static Parse_Frame*
+parse_push(Parse_Stack* stack, Parser_Rule rule, u8 flags) {
+	if(stack->count == stack->capacity)
+		parse_grow(stack);
+	Parse_Frame* f = &stack->frames[stack->count++];
+	f->res = (MO_Parser_Result){0};
+	// a frame that stood at this height before left its nodes here
+	f->left = 0;
+	f->right = 0;
+	f->op = 0;
+	f->rule = (u8)rule;
+	f->state = 0;
+	f->flags = flags;
+	f->start = stack->lexer->index;
+	return f;
+}
+
+static PARSE_COLD void
+parse_call_rule(Parse_Stack* stack, Parser_Rule rule, u8 flags) {
+	Lexer* lexer = stack->lexer;
+	u32 memo = parser_rule_memo[rule];
+	if(memo && lexer->memo && memo_lookup(lexer, rule, memo, &stack->ret))
+		return;
+	if((flags & PARSE_FRAME_NESTED) && !parser_enter(lexer, 1, &stack->ret))
+		return;
+	Parse_Frame* f = parse_push(stack, rule, flags);
+	(void)f; // only read by the instrumented build
+	RULE_STATS_ENTER_AT(&f->stats, lexer);
+}
+
+// Every step makes its calls through here, the common case of a plain push is
+// kept small enough to be inlined into them.
+static void
+parse_call(Parse_Stack* stack, Parser_Rule rule, u8 resume, u8 flags) {
+	stack->frames[stack->count - 1].state = resume;
+#if !defined(MOP_INSTRUMENT)
+	if(!flags && !stack->lexer->memo && stack->count < stack->capacity) {
+		Parse_Frame* f = &stack->frames[stack->count++];
+		f->res = (MO_Parser_Result){0};
+		f->left = 0;
+		f->right = 0;
+		f->op = 0;
+		f->rule = (u8)rule;
+		f->state = 0;
+		f->flags = 0;
+		f->start = stack->lexer->index;
+		return;
+	}
+#endif
+	parse_call_rule(stack, rule, flags);
+}
+
+static PARSE_COLD void
+parse_return_rule(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+	if(!(f->flags & PARSE_FRAME_ENTRY)) {
+		RULE_STATS_EXIT_AT(&f->stats, lexer, f->rule, stack->ret.status);
+		u32 memo = parser_rule_memo[f->rule];
+		if(memo && lexer->memo) memo_store(lexer, f->rule, memo, f->start, &stack->ret);
+	}
+	if(f->flags & PARSE_FRAME_NESTED) parser_leave(lexer, 1);
+}
+
+// Pops the top frame, its result is in stack->ret
+static void
+parse_return(Parse_Stack* stack) {
+	Parse_Frame* f = &stack->frames[--stack->count];
+#if !defined(MOP_INSTRUMENT)
+	if(!f->flags && !stack->lexer->memo)
+		return;
+#endif
+	parse_return_rule(stack, f);
+}
+
+#define STEP_DECLARE(NAME, PARAMS, REQUIRE_NAME, STEP) static void STEP(Parse_Stack* stack, Parse_Frame* f);
+PARSER_STEP_RULES(STEP_DECLARE)
+#undef STEP_DECLARE
+
+static MO_Parser_Result
+parse_stack_run(Lexer* lexer, Parser_Rule rule, bool require_name) {
+	Parse_Stack stack;
+	stack.lexer = lexer;
+	stack.frames = stack.local;
+	stack.count = 0;
+	stack.capacity = PARSE_STACK_LOCAL;
+	stack.aborted = false;
+	stack.ret = (MO_Parser_Result){0};
+	parse_push(&stack, rule, PARSE_FRAME_ENTRY | (require_name ? PARSE_FRAME_REQUIRE_NAME : 0));
+
+	while(stack.count > 0) {
+		Parse_Frame* f = &stack.frames[stack.count - 1];
+		if(!stack.aborted && (lexer->parser_flags & (PARSER_FLAG_DEPTH_EXCEEDED | PARSER_FLAG_LIMIT_EXCEEDED))) {
+			// a limit was hit here or further down on the c stack
+			stack.aborted = true;
+			stack.ret = (lexer->parser_flags & PARSER_FLAG_LIMIT_EXCEEDED) ? parse_limit_error(lexer) : parser_depth_error(lexer);
+		}
+		if(stack.aborted) {
+			// the error is the result of every rule still open
+			if(!(f->flags & PARSE_FRAME_ENTRY))
+				RULE_STATS_EXIT_AT(&f->stats, lexer, f->rule, MO_PARSER_STATUS_FATAL);
+			if(f->flags & PARSE_FRAME_NESTED) parser_leave(lexer, 1);
+			stack.count--;
+			continue;
+		}
+		// a direct call per rule, so every step can be inlined into this loop
+		switch(f->rule) {
+			#define STEP_CASE(NAME, PARAMS, REQUIRE_NAME, STEP) case RULE_##NAME: STEP(&stack, f); break;
+			PARSER_STEP_RULES(STEP_CASE)
+			#undef STEP_CASE
+			default: assert(0); break;
+		}
+	}
+
+	if(stack.frames != stack.local)
+		mem_free(lexer->allocator, stack.frames, stack.capacity * sizeof(Parse_Frame));
+	return stack.ret;
+}
+
+// The bodies the rule wrappers call, each one runs its rule on a new stack
+#define STEP_RULE(NAME, PARAMS, REQUIRE_NAME, STEP) \
+	static MO_Parser_Result NAME##_rule PARAMS { return parse_stack_run(lexer, RULE_##NAME, (REQUIRE_NAME)); }
+PARSER_STEP_RULES(STEP_RULE)
+#undef STEP_RULE
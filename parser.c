@@ -1,12 +1,18 @@
 #define _CRT_SECURE_NO_WARNINGS
 #include "common.h"
+#include "moparser.h"
+#define LIGHT_ARRAY_ALLOCATOR MO_Allocator
 #include "light_array.h"
 #include <stdlib.h>
 #include <assert.h>
 #include <stdarg.h>
-#include "moparser.h"
 
 #include "lexer.c"
+#include "platform.c"
+#include "allocator.c"
+#include "arena.c"
+#include "typedef_table.c"
+#include "trace.c"
 
 typedef struct {
     char* buffer;
@@ -40,13 +46,132 @@ static MO_Parser_Result parse_pointer(Lexer* lexer);
 static MO_Parser_Result parse_abstract_declarator(Lexer* lexer, bool require_name);
 static MO_Parser_Result parse_struct_declaration_list(Lexer* lexer);
 static MO_Parser_Result parse_constant_expression(Lexer* lexer);
+static MO_Parser_Result parse_declaration(Lexer* lexer);
+static MO_Parser_Result parse_initializer(Lexer* lexer);
+static MO_Parser_Result parse_lazy_body(Lexer* lexer);
+
+// Every grammar rule with its parameters, the arguments to forward them and the
+// MO_Memo_Rules flag that lets it be memoized. Rules that fill in a node they are
+// given or that have effects besides consuming tokens are never memoized.
+#define PARSER_RULES(RULE) \
+	RULE(parse_enumerator, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_enumerator_list, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_lazy_body, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_type_specifier, (Lexer* lexer, MO_Ast* type), (lexer, type), 0) \
+	RULE(parse_type_qualifier, (Lexer* lexer, MO_Ast* type), (lexer, type), 0) \
+	RULE(parse_specifier_qualifier_list, (Lexer* lexer), (lexer), MO_MEMO_SPECIFIERS) \
+	RULE(parse_type_qualifier_list, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_constant_expression, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_struct_declarator, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_struct_declarator_list, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_struct_declaration, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_struct_declaration_list, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_declaration_specifiers, (Lexer* lexer), (lexer), MO_MEMO_SPECIFIERS) \
+	RULE(parse_parameter_declaration, (Lexer* lexer, bool require_name), (lexer, require_name), 0) \
+	RULE(parse_parameter_list, (Lexer* lexer, bool require_name), (lexer, require_name), 0) \
+	RULE(parse_parameter_type_list, (Lexer* lexer, bool require_name), (lexer, require_name), 0) \
+	RULE(parse_direct_abstract_declarator, (Lexer* lexer, bool require_name), (lexer, require_name), 0) \
+	RULE(parse_pointer, (Lexer* lexer), (lexer), MO_MEMO_TYPE_NAME) \
+	RULE(parse_abstract_declarator, (Lexer* lexer, bool require_name), (lexer, require_name), 0) \
+	RULE(parse_type_name, (Lexer* lexer), (lexer), MO_MEMO_TYPE_NAME) \
+	RULE(parse_initializer, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_declaration, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_translation_unit, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_postfix_expression, (Lexer* lexer), (lexer), MO_MEMO_UNARY_EXPRESSION) \
+	RULE(parse_argument_expression_list, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_unary_expression, (Lexer* lexer), (lexer), MO_MEMO_UNARY_EXPRESSION) \
+	RULE(parse_cast_expression, (Lexer* lexer), (lexer), MO_MEMO_CAST_EXPRESSION) \
+	RULE(parse_multiplicative_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_additive_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_shift_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_relational_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_equality_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_and_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_exclusive_or_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_inclusive_or_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_logical_and_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_logical_or_expression, (Lexer* lexer), (lexer), MO_MEMO_BINARY_EXPRESSION) \
+	RULE(parse_conditional_expression, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_assignment_expression, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_primary_expression, (Lexer* lexer), (lexer), MO_MEMO_UNARY_EXPRESSION) \
+	RULE(parse_expression, (Lexer* lexer), (lexer), MO_MEMO_EXPRESSION) \
+	RULE(parse_identifier, (Lexer* lexer), (lexer), 0) \
+	RULE(parse_constant, (Lexer* lexer), (lexer), 0)
+
+// Rules written as steps of the parse stack instead of c functions, so nesting
+// costs no c stack, with what their require_name starts as and their step, see
+// parse_stack.c. The binary operator levels share one step.
+#define PARSER_STEP_RULES(STEP) \
+	STEP(parse_constant_expression, (Lexer* lexer), false, MOP_STEP(parse_constant_expression)) \
+	STEP(parse_parameter_declaration, (Lexer* lexer, bool require_name), require_name, MOP_STEP(parse_parameter_declaration)) \
+	STEP(parse_parameter_list, (Lexer* lexer, bool require_name), require_name, MOP_STEP(parse_parameter_list)) \
+	STEP(parse_parameter_type_list, (Lexer* lexer, bool require_name), require_name, MOP_STEP(parse_parameter_type_list)) \
+	STEP(parse_direct_abstract_declarator, (Lexer* lexer, bool require_name), require_name, MOP_STEP(parse_direct_abstract_declarator)) \
+	STEP(parse_abstract_declarator, (Lexer* lexer, bool require_name), require_name, MOP_STEP(parse_abstract_declarator)) \
+	STEP(parse_type_name, (Lexer* lexer), false, MOP_STEP(parse_type_name)) \
+	STEP(parse_postfix_expression, (Lexer* lexer), false, MOP_STEP(parse_postfix_expression)) \
+	STEP(parse_argument_expression_list, (Lexer* lexer), false, MOP_STEP(parse_argument_expression_list)) \
+	STEP(parse_unary_expression, (Lexer* lexer), false, MOP_STEP(parse_unary_expression)) \
+	STEP(parse_cast_expression, (Lexer* lexer), false, MOP_STEP(parse_cast_expression)) \
+	STEP(parse_multiplicative_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_additive_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_shift_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_relational_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_equality_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_and_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_exclusive_or_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_inclusive_or_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_logical_and_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_logical_or_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_conditional_expression, (Lexer* lexer), false, MOP_STEP(parse_conditional_expression)) \
+	STEP(parse_assignment_expression, (Lexer* lexer), false, parse_binary_step) \
+	STEP(parse_primary_expression, (Lexer* lexer), false, MOP_STEP(parse_primary_expression)) \
+	STEP(parse_expression, (Lexer* lexer), false, MOP_STEP(parse_expression))
 
 // Declarations
 // https://docs.microsoft.com/en-us/cpp/c-language/summary-of-declarations?view=vs-2017
 
 // https://docs.microsoft.com/en-us/cpp/c-language/c-floating-point-constants?view=vs-2017
 
-static char parser_error_buffer[1024];
+// per thread so parses running in parallel do not overwrite each other's errors
+static THREAD_LOCAL char parser_error_buffer[1024];
+
+#define RULE_ID(NAME, PARAMS, ARGS, MEMO) RULE_##NAME,
+typedef enum {
+	PARSER_RULES(RULE_ID)
+	RULE_COUNT
+} Parser_Rule;
+#undef RULE_ID
+
+#include "stats.c"
+#include "memo.c"
+#include "limits.c"
+#include "memory.c"
+#include "comments.c"
+
+// Rule bodies are compiled as MOP_RULE(name), callers go through a wrapper under
+// the rule's own name that consults the memo table and collects statistics. With
+// neither in use the wrapper is a plain call, and a test that the parse has not
+// run out of budget.
+#define MOP_RULE(NAME) NAME##_rule
+
+#define RULE_WRAPPER(NAME, PARAMS, ARGS, MEMO) \
+	static MO_Parser_Result NAME##_rule PARAMS; \
+	static MO_Parser_Result NAME PARAMS { \
+		MO_Parser_Result r; \
+		if(lexer->parser_flags & PARSER_FLAG_LIMIT_EXCEEDED) return parse_limit_error(lexer); \
+		s32 start = lexer->index; \
+		if((MEMO) && memo_lookup(lexer, RULE_##NAME, (MEMO), &r)) return r; \
+		RULE_STATS_ENTER(lexer); \
+		r = NAME##_rule ARGS; \
+		RULE_STATS_EXIT(lexer, RULE_##NAME, r.status); \
+		if(MEMO) memo_store(lexer, RULE_##NAME, (MEMO), start, &r); \
+		return r; \
+	}
+PARSER_RULES(RULE_WRAPPER)
+#undef RULE_WRAPPER
+
+#include "parse_stack.c"
 
 // unary-operator: one of
 // & * + - ~ !
@@ -54,11 +179,17 @@ static char parser_error_buffer[1024];
 // assignment-operator: one of
 // = *= /= %= += -= <<= >>= &= ^= |=
 
+// Set on worker lexers of a parallel parse, the typedef table is shared and was
+// filled by the pre-scan, so declarations do not add to it.
+#define PARSER_FLAG_TYPEDEFS_FROZEN (1u << 31)
+
 static bool
-is_type_name(Token* t) {
-	// TODO(psv): We only handle this for typenames that are always types.
-	// Typedefs are still unhandled and will return false.
+is_type_name(Lexer* lexer, Token* t) {
+	// Typedef names are only known at file scope, from the declarations seen so far
+	// or from a table filled before parsing.
 	switch(t->type) {
+		case MO_TOKEN_IDENTIFIER:
+			return typedef_table_contains(lexer->typedefs, t->data, t->length);
 		case MO_TOKEN_KEYWORD_INT:
 		case MO_TOKEN_KEYWORD_VOID:
 		case MO_TOKEN_KEYWORD_CHAR:
@@ -71,6 +202,8 @@ is_type_name(Token* t) {
 		case MO_TOKEN_KEYWORD_STRUCT:
 		case MO_TOKEN_KEYWORD_UNION:
 		case MO_TOKEN_KEYWORD_ENUM:
+		case MO_TOKEN_KEYWORD_CONST:
+		case MO_TOKEN_KEYWORD_VOLATILE:
 			return true;
 		default: return false;
 	}
@@ -82,14 +215,66 @@ is_assignment_operator(Token* t) {
 	return t->flags & MO_TOKEN_FLAG_ASSIGNMENT_OPERATOR;
 }
 
-static void*
-allocate_node() {
-	return calloc(1, sizeof(MO_Ast));
+static MO_Ast*
+allocate_node(Lexer* lexer, MO_Node_Kind kind) {
+	MO_Ast* node = (lexer->arena) ? arena_alloc(lexer->arena, sizeof(MO_Ast)) : mem_alloc(lexer->allocator, sizeof(MO_Ast));
+	node->kind = kind;
+	MOP_COUNT_NODE(kind);
+	if(lexer->memory) memory_node(lexer, kind);
+	// node_limit is 0 without a budget, which never trips
+	if((u32)++lexer->node_count > (u32)lexer->node_limit - 1) parse_limits_node(lexer);
+	return node;
 }
 
 static void
-free_node(MO_Ast* node) {
-	free(node);
+free_node(Lexer* lexer, MO_Ast* node) {
+	// arena nodes are released with the whole arena
+	if(!lexer->arena)
+		mem_free(lexer->allocator, node, sizeof(MO_Ast));
+}
+
+static bool
+is_associative_operator(MO_Binary_Operator bo) {
+	switch((s32)bo) {
+		case '+': case '*': case '&': case '|': case '^':
+		case MO_TOKEN_LOGIC_AND: case MO_TOKEN_LOGIC_OR:
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Joins left and right under a binary operator node. With
+// MO_PARSER_FLAG_FLATTEN_CHAINS a third operand of the same associative operator
+// turns the node into an MO_AST_EXPRESSION_CHAIN and later ones are appended to it.
+// own is the node the caller built in its previous step, the only one that may
+// change: left can also come from parentheses or from the memo.
+static MO_Ast*
+join_binary(Lexer* lexer, MO_Node_Kind kind, MO_Binary_Operator bo, MO_Ast* left, MO_Ast* right, MO_Ast* own) {
+	if(own && left == own && (lexer->parser_flags & MO_PARSER_FLAG_FLATTEN_CHAINS) && is_associative_operator(bo)) {
+		if(own->kind == MO_AST_EXPRESSION_CHAIN && own->expression_chain.bo == bo) {
+			array_push(own->expression_chain.operands, right);
+			return own;
+		}
+		if(own->kind == kind && own->expression_binary.bo == bo) {
+			MO_Ast** operands = array_new_with(MO_Ast*, lexer->allocator);
+			array_push(operands, own->expression_binary.left);
+			array_push(operands, own->expression_binary.right);
+			array_push(operands, right);
+			own->kind = MO_AST_EXPRESSION_CHAIN;
+			own->expression_chain.operator_kind = kind;
+			own->expression_chain.bo = bo;
+			own->expression_chain.operands = operands;
+			MOP_COUNT_NODE(MO_AST_EXPRESSION_CHAIN);
+			return own;
+		}
+	}
+
+	MO_Ast* node = allocate_node(lexer, kind);
+	node->expression_binary.bo = bo;
+	node->expression_binary.left = left;
+	node->expression_binary.right = right;
+	return node;
 }
 
 static const char*
@@ -101,7 +286,9 @@ static MO_Parser_Result
 require_token(Lexer* lexer, MO_Token_Type tt) {
 	MO_Parser_Result result = { 0 };
 	Token* n = lexer_next(lexer);
+	MOP_COUNT(COUNTER_REQUIRE_TOKEN);
 	if (n->type != tt) {
+		MOP_COUNT(COUNTER_REQUIRE_TOKEN_FAILED);
 		result.status = MO_PARSER_STATUS_FATAL;
 		sprintf(parser_error_buffer, 
 			"%s:%d:%d: Syntax error: Required '%s', but got '%s'\n", 
@@ -145,13 +332,11 @@ primitive_from_token(Token* t) {
 }
 
 static MO_Ast* 
-parser_type_primitive_get_info(MO_Type_Primitive p) {
-	MO_Ast* node = allocate_node();
+parser_type_primitive_get_info(Lexer* lexer, MO_Type_Primitive p) {
+	MO_Ast* node = allocate_node(lexer, MO_AST_TYPE_INFO);
 
-	node = allocate_node();
-	node->kind = MO_AST_TYPE_INFO;
 	node->specifier_qualifier.primitive[p] = 1;
-	node->specifier_qualifier.kind = p;
+	node->specifier_qualifier.kind = MO_TYPE_PRIMITIVE;
 
 	return node;
 }
@@ -160,8 +345,9 @@ parser_type_primitive_get_info(MO_Type_Primitive p) {
 //     enumeration-constant
 //     enumeration-constant = constant-expression
 static MO_Parser_Result
-parse_enumerator(Lexer* lexer) {
+MOP_RULE(parse_enumerator)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
+	s32 start = lexer->index;
 
 	Token* enum_const = lexer_next(lexer);
 	if(enum_const->type != MO_TOKEN_IDENTIFIER) {
@@ -176,10 +362,14 @@ parse_enumerator(Lexer* lexer) {
 		const_expr = parse_constant_expression(lexer);
 	}
 
-	res.node = allocate_node();
-	res.node->kind = MO_AST_ENUMERATOR;
+	res.node = allocate_node(lexer, MO_AST_ENUMERATOR);
 	res.node->enumerator.const_expr = const_expr.node;
 	res.node->enumerator.enum_constant = enum_const;
+	if(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS) {
+		// the , belongs to the list, a comment after it is still this one's
+		s32 end = lexer->index + (lexer_peek(lexer)->type == ',');
+		parse_doc(lexer, &res.node->enumerator.doc, start, end);
+	}
 
 	return res;
 }
@@ -188,7 +378,7 @@ parse_enumerator(Lexer* lexer) {
 //     enumerator
 //     enumerator-list , enumerator
 static MO_Parser_Result
-parse_enumerator_list(Lexer* lexer) {
+MOP_RULE(parse_enumerator_list)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
 
 	MO_Parser_Result enumerator = parse_enumerator(lexer);
@@ -196,7 +386,7 @@ parse_enumerator_list(Lexer* lexer) {
 		return res;
 	MO_Ast_Enumerator* node = (MO_Ast_Enumerator*)enumerator.node;
 
-	MO_Ast_Enumerator** list = array_new(MO_Ast*);
+	MO_Ast_Enumerator** list = array_new_with(MO_Ast*, lexer->allocator);
 	array_push(list, node);
 	
 	while(lexer_peek(lexer)->type == ',') {
@@ -208,13 +398,36 @@ parse_enumerator_list(Lexer* lexer) {
 		array_push(list, en);
 	}
 
-	res.node = allocate_node();
-	res.node->kind = MO_AST_ENUMERATOR_LIST;
+	res.node = allocate_node(lexer, MO_AST_ENUMERATOR_LIST);
 	res.node->enumerator_list.list = (struct MO_Ast_Enumerator**)list;
 
 	return res;
 }
 
+// Skips a { } body recording only its token range, used for MO_PARSER_FLAG_LAZY_BODIES.
+// The body is parsed later by mop_ast_force.
+static MO_Parser_Result
+MOP_RULE(parse_lazy_body)(Lexer* lexer) {
+	MO_Parser_Result res = {0};
+	s32 open = lexer->index;
+
+	if(!lexer_skip_group(lexer)) {
+		Token* t = lexer_peek(lexer);
+		res.status = MO_PARSER_STATUS_FATAL;
+		sprintf(parser_error_buffer,
+			"%s:%d:%d: Syntax error: '{' is never closed\n",
+			lexer->filename, t->line, t->column);
+		res.error_message = parser_error_buffer;
+		return res;
+	}
+
+	res.node = allocate_node(lexer, MO_AST_LAZY_BODY);
+	res.node->lazy_body.begin = open + 1;
+	res.node->lazy_body.end = lexer->index - 1;
+
+	return res;
+}
+
 // type-specifier:
 //     void
 //     char
@@ -229,7 +442,7 @@ parse_enumerator_list(Lexer* lexer) {
 //     enum-specifier
 //     typedef-name
 static MO_Parser_Result
-parse_type_specifier(Lexer* lexer, MO_Ast* type) {
+MOP_RULE(parse_type_specifier)(Lexer* lexer, MO_Ast* type) {
 	MO_Parser_Result res = {0};
 	Token* s = lexer_peek(lexer);
 	MO_Ast* node = 0;
@@ -239,8 +452,7 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 	switch(s->type) {
 		case MO_TOKEN_KEYWORD_VOID:
 			lexer_next(lexer);
-			node = allocate_node();
-			node->kind = MO_AST_TYPE_INFO;
+			node = allocate_node(lexer, MO_AST_TYPE_INFO);
 			node->specifier_qualifier.kind = MO_TYPE_VOID;
 			break;
 
@@ -259,8 +471,7 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 				node = type;
 				node->specifier_qualifier.primitive[primitive]++;
 			} else {
-				node = allocate_node();
-				node->kind = MO_AST_TYPE_INFO;
+				node = allocate_node(lexer, MO_AST_TYPE_INFO);
 				node->specifier_qualifier.primitive[primitive] = 1;
 			}
 			node->specifier_qualifier.kind = MO_TYPE_PRIMITIVE;
@@ -272,8 +483,7 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 			if(type) {
 				node = type;
 			} else {
-				node = allocate_node();
-				node->kind = MO_AST_TYPE_INFO;
+				node = allocate_node(lexer, MO_AST_TYPE_INFO);
 			}
 			if(node->specifier_qualifier.kind != MO_TYPE_NONE){
 				// TODO(psv): raise error, type specifier together with struct specifier
@@ -290,20 +500,30 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 				id = 0;
 			}
 			if(lexer_peek(lexer)->type == '{') {
-				lexer_next(lexer);
+				if(lexer->parser_flags & MO_PARSER_FLAG_LAZY_BODIES) {
+					MO_Parser_Result body = parse_lazy_body(lexer);
+					if(body.status == MO_PARSER_STATUS_FATAL)
+						return body;
+					node->specifier_qualifier.struct_desc = body.node;
+				} else {
+					lexer_next(lexer);
+					if(!parser_enter(lexer, PARSER_RECURSION_DEPTH, &res))
+						return res;
 
-				// struct-declaration-list
-				MO_Parser_Result decl_list = parse_struct_declaration_list(lexer);
-				if(decl_list.status == MO_PARSER_STATUS_FATAL)
-					return decl_list;
+					// struct-declaration-list
+					MO_Parser_Result decl_list = parse_struct_declaration_list(lexer);
+					parser_leave(lexer, PARSER_RECURSION_DEPTH);
+					if(decl_list.status == MO_PARSER_STATUS_FATAL)
+						return decl_list;
 
-				MO_Parser_Result r = require_token(lexer, '}');
-				if(r.status == MO_PARSER_STATUS_FATAL)
-					return r;
+					MO_Parser_Result r = require_token(lexer, '}');
+					if(r.status == MO_PARSER_STATUS_FATAL)
+						return r;
 
-				node->specifier_qualifier.struct_desc = decl_list.node;
-				node->specifier_qualifier.struct_name = id;
+					node->specifier_qualifier.struct_desc = decl_list.node;
+				}
 			}
+			node->specifier_qualifier.struct_name = id;
 			if(s_or_u->type == MO_TOKEN_KEYWORD_STRUCT) {
 				node->specifier_qualifier.kind = MO_TYPE_STRUCT;
 			} else if(s_or_u->type == MO_TOKEN_KEYWORD_UNION) {
@@ -324,9 +544,16 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 			}
 			
 			MO_Parser_Result enum_list = {0};
-			if(lexer_peek(lexer)->type == '{') {
+			if(lexer_peek(lexer)->type == '{' && (lexer->parser_flags & MO_PARSER_FLAG_LAZY_BODIES)) {
+				enum_list = parse_lazy_body(lexer);
+				if(enum_list.status == MO_PARSER_STATUS_FATAL)
+					return enum_list;
+			} else if(lexer_peek(lexer)->type == '{') {
 				lexer_next(lexer);
+				if(!parser_enter(lexer, PARSER_RECURSION_DEPTH, &res))
+					return res;
 				enum_list = parse_enumerator_list(lexer);
+				parser_leave(lexer, PARSER_RECURSION_DEPTH);
 				if(enum_list.status == MO_PARSER_STATUS_FATAL)
 					return enum_list;
 				MO_Parser_Result r = require_token(lexer, '}');
@@ -334,18 +561,16 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 					return r;
 			}
 
-			node = allocate_node();
-			node->kind = MO_AST_TYPE_INFO;
+			node = allocate_node(lexer, MO_AST_TYPE_INFO);
 			node->specifier_qualifier.kind = MO_TYPE_ENUM;
 			node->specifier_qualifier.enumerator_list = enum_list.node;
 			node->specifier_qualifier.enum_name = id;
 		} break;
 		case MO_TOKEN_IDENTIFIER:{
-		    // typedef-name
-			if(is_type_name(s)) {
+		    // typedef-name, only when no other type specifier was seen, otherwise it is the declarator
+			if(is_type_name(lexer, s) && !(type && type->specifier_qualifier.kind != MO_TYPE_NONE)) {
 				lexer_next(lexer);
-				node = allocate_node();
-				node->kind = MO_AST_TYPE_INFO;
+				node = allocate_node(lexer, MO_AST_TYPE_INFO);
 				node->specifier_qualifier.kind = MO_TYPE_ALIAS;
 				node->specifier_qualifier.alias = s;
 			} else {
@@ -369,7 +594,7 @@ parse_type_specifier(Lexer* lexer, MO_Ast* type) {
 //     const
 //     volatile
 static MO_Parser_Result
-parse_type_qualifier(Lexer* lexer, MO_Ast* type) {
+MOP_RULE(parse_type_qualifier)(Lexer* lexer, MO_Ast* type) {
 	MO_Parser_Result res = {0};
 	Token* q = lexer_peek(lexer);
 
@@ -380,8 +605,7 @@ parse_type_qualifier(Lexer* lexer, MO_Ast* type) {
 				type->specifier_qualifier.qualifiers |= MO_TYPE_QUALIFIER_CONST;
 				res.node = type;
 			} else {
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_TYPE_INFO;
+				MO_Ast* node = allocate_node(lexer, MO_AST_TYPE_INFO);
 				node->specifier_qualifier.kind = MO_TYPE_NONE;
 				node->specifier_qualifier.qualifiers = MO_TYPE_QUALIFIER_CONST;
 				res.node = node;
@@ -393,8 +617,7 @@ parse_type_qualifier(Lexer* lexer, MO_Ast* type) {
 				type->specifier_qualifier.qualifiers |= MO_TYPE_QUALIFIER_VOLATILE;
 				res.node = type;
 			} else {
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_TYPE_INFO;
+				MO_Ast* node = allocate_node(lexer, MO_AST_TYPE_INFO);
 				node->specifier_qualifier.kind = MO_TYPE_NONE;
 				node->specifier_qualifier.qualifiers = MO_TYPE_QUALIFIER_VOLATILE;
 				res.node = node;
@@ -412,10 +635,11 @@ parse_type_qualifier(Lexer* lexer, MO_Ast* type) {
 // 	type-specifier specifier-qualifier-list_opt
 // 	type-qualifier specifier-qualifier-list_opt
 static MO_Parser_Result 
-parse_specifier_qualifier_list(Lexer* lexer) {
+MOP_RULE(parse_specifier_qualifier_list)(Lexer* lexer) {
 	MO_Parser_Result res = parse_type_qualifier(lexer, 0);
 	if(res.status == MO_PARSER_STATUS_FATAL) {
 		// try specifier
+		MOP_COUNT(COUNTER_SPECIFIER_RETRY);
 		res = parse_type_specifier(lexer, 0);
 	}
 
@@ -428,6 +652,7 @@ parse_specifier_qualifier_list(Lexer* lexer) {
 		MO_Parser_Result next = parse_type_qualifier(lexer, res.node);
 		if(next.status == MO_PARSER_STATUS_FATAL) {
 			// try specifier
+			MOP_COUNT(COUNTER_SPECIFIER_RETRY);
 			next = parse_type_specifier(lexer, res.node);
 		}
 
@@ -445,7 +670,7 @@ parse_specifier_qualifier_list(Lexer* lexer) {
 //     type-qualifier
 //     type-qualifier-list type-qualifier
 static MO_Parser_Result
-parse_type_qualifier_list(Lexer* lexer) {
+MOP_RULE(parse_type_qualifier_list)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
 
 	res = parse_type_qualifier(lexer, 0);
@@ -459,16 +684,18 @@ parse_type_qualifier_list(Lexer* lexer) {
 	return res;
 }
 
-static MO_Parser_Result
-parse_constant_expression(Lexer* lexer) {
-	return parse_conditional_expression(lexer);
+static void
+MOP_STEP(parse_constant_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	if(f->state == 0)
+		PARSE_CALL(parse_conditional_expression, 1, 0);
+	PARSE_RETURN(stack->ret);
 }
 
 // struct-declarator:
 //     declarator
 //     declarator_opt : constant-expression
 static MO_Parser_Result
-parse_struct_declarator(Lexer* lexer) {
+MOP_RULE(parse_struct_declarator)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
 
 	MO_Parser_Result decl = {0};
@@ -490,13 +717,12 @@ parse_struct_declarator(Lexer* lexer) {
 			return const_expr;
 	}
 	
-	res.node = allocate_node();
 	if(is_bitfield) {
-		res.node->kind = MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD;
+		res.node = allocate_node(lexer, MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD);
 		res.node->struct_declarator_bitfield.const_expr = const_expr.node;
 		res.node->struct_declarator_bitfield.declarator = decl.node;
 	} else {
-		res.node->kind = MO_AST_TYPE_STRUCT_DECLARATOR;
+		res.node = allocate_node(lexer, MO_AST_TYPE_STRUCT_DECLARATOR);
 		res.node->struct_declarator.declarator = decl.node;
 	}
 
@@ -508,31 +734,33 @@ parse_struct_declarator(Lexer* lexer) {
 //     struct-declarator 
 //     struct-declarator-list , struct-declarator
 static MO_Parser_Result
-parse_struct_declarator_list(Lexer* lexer) {
+MOP_RULE(parse_struct_declarator_list)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
 
 	MO_Ast** list = 0;
 
 	while(true) {
 		MO_Parser_Result r = parse_struct_declarator(lexer);
-		if(r.status == MO_PARSER_STATUS_FATAL)
+		if(r.status == MO_PARSER_STATUS_FATAL) {
+			if(list) array_free(list);
 			return r;
+		}
 
-		if(!list) list = array_new(MO_Ast*);
+		if(!list) list = array_new_with(MO_Ast*, lexer->allocator);
 		array_push(list, r.node);
 
 		if(lexer_peek(lexer)->type != ',') break;
 	}
 
-	res.node = allocate_node();
-	res.node->kind = MO_AST_TYPE_STRUCT_DECLARATOR_LIST;
+	res.node = allocate_node(lexer, MO_AST_TYPE_STRUCT_DECLARATOR_LIST);
 	res.node->struct_declarator_list.list = list;
 
 	return res;
 }
 
 static MO_Parser_Result
-parse_struct_declaration(Lexer* lexer) {
+MOP_RULE(parse_struct_declaration)(Lexer* lexer) {
+	s32 start = lexer->index;
 	MO_Parser_Result spec_qual = parse_specifier_qualifier_list(lexer);
 	if(spec_qual.status == MO_PARSER_STATUS_FATAL)
 		return spec_qual;
@@ -544,10 +772,11 @@ parse_struct_declaration(Lexer* lexer) {
 		return n;
 	
 	MO_Parser_Result res = {0};
-	res.node = allocate_node();
-	res.node->kind = MO_AST_STRUCT_DECLARATION;
+	res.node = allocate_node(lexer, MO_AST_STRUCT_DECLARATION);
 	res.node->struct_declaration.spec_qual = spec_qual.node;
 	res.node->struct_declaration.struct_decl_list = struct_decl_list.node;
+	if(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS)
+		parse_doc(lexer, &res.node->struct_declaration.doc, start, lexer->index);
 
 	return res;
 }
@@ -559,13 +788,13 @@ parse_struct_declaration(Lexer* lexer) {
 // struct-declaration:
 //     specifier-qualifier-list struct-declarator-list ;
 static MO_Parser_Result
-parse_struct_declaration_list(Lexer* lexer) {
+MOP_RULE(parse_struct_declaration_list)(Lexer* lexer) {
 
 	MO_Parser_Result r = parse_struct_declaration(lexer);
 	if(r.status == MO_PARSER_STATUS_FATAL)
 		return r;
 
-	MO_Ast** list = array_new(MO_Ast*);
+	MO_Ast** list = array_new_with(MO_Ast*, lexer->allocator);
 	array_push(list, r.node);
 
 	while(true) {
@@ -575,8 +804,7 @@ parse_struct_declaration_list(Lexer* lexer) {
 	}
 	
 	MO_Parser_Result res = {0};
-	res.node = allocate_node();
-	res.node->kind = MO_AST_STRUCT_DECLARATION_LIST;
+	res.node = allocate_node(lexer, MO_AST_STRUCT_DECLARATION_LIST);
 	res.node->struct_declaration_list.list = list;
 
 	return res;
@@ -616,7 +844,7 @@ parse_storage_class_specifier(Lexer* lexer) {
 //     type-specifier declaration-specifiers_opt
 //     type-qualifier declaration-specifiers_opt
 static MO_Parser_Result
-parse_declaration_specifiers(Lexer* lexer) {
+MOP_RULE(parse_declaration_specifiers)(Lexer* lexer) {
 	MO_Parser_Result res = {0};
 
 	MO_Ast* type = 0;
@@ -631,6 +859,7 @@ parse_declaration_specifiers(Lexer* lexer) {
 				// it was a type specifier
 				type = type_spec.node;
 			} else {
+				MOP_COUNT(COUNTER_SPECIFIER_RETRY);
 				MO_Parser_Result type_qual = parse_type_qualifier(lexer, type);
 				if(type_qual.status != MO_PARSER_STATUS_FATAL) {
 					// it was a type qualifier
@@ -643,7 +872,7 @@ parse_declaration_specifiers(Lexer* lexer) {
 	}
 
 	if(!type){
-		type = parser_type_primitive_get_info(MO_TYPE_PRIMITIVE_INT);
+		type = parser_type_primitive_get_info(lexer, MO_TYPE_PRIMITIVE_INT);
 	} else if(type->specifier_qualifier.kind == MO_TYPE_NONE) {
 		type->specifier_qualifier.kind = MO_TYPE_PRIMITIVE;
 		type->specifier_qualifier.primitive[MO_TYPE_PRIMITIVE_INT] = 1;
@@ -668,128 +897,116 @@ parse_declaration_specifiers(Lexer* lexer) {
 // parameter-declaration:
 //     declaration-specifiers declarator /* Named declarator */
 //     declaration-specifiers abstract-declarator_opt /* Anonymous declarator */
-static MO_Parser_Result
-parse_parameter_declaration(Lexer* lexer, bool require_name) {
-	MO_Parser_Result res = {0};
-
-	MO_Parser_Result decl_spec = parse_declaration_specifiers(lexer);
-	if(decl_spec.status == MO_PARSER_STATUS_FATAL)
-		return decl_spec;
-
-	MO_Parser_Result declarator = parse_abstract_declarator(lexer, require_name);
-	if(res.status == MO_PARSER_STATUS_FATAL)
-		return res;
+static void
+MOP_STEP(parse_parameter_declaration)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+
+	if(f->state == 0) {
+		MO_Parser_Result decl_spec = parse_declaration_specifiers(lexer);
+		if(decl_spec.status == MO_PARSER_STATUS_FATAL)
+			PARSE_RETURN(decl_spec);
+		f->left = decl_spec.node;
+		PARSE_CALL(parse_abstract_declarator, 1, f->flags & PARSE_FRAME_REQUIRE_NAME);
+	}
 
-	res.node = allocate_node();
-	res.node->kind = MO_AST_PARAMETER_DECLARATION;
-	res.node->parameter_decl.decl_specifiers = decl_spec.node;
-	res.node->parameter_decl.declarator = declarator.node;
+	MO_Parser_Result res = {0};
+	res.node = allocate_node(lexer, MO_AST_PARAMETER_DECLARATION);
+	res.node->parameter_decl.decl_specifiers = f->left;
+	res.node->parameter_decl.declarator = stack->ret.node;
 
-	return res;
+	PARSE_RETURN(res);
 }
 
 // parameter-list:
 //     parameter-declaration
 //     parameter-list , parameter-declaration
-static MO_Parser_Result
-parse_parameter_list(Lexer* lexer, bool require_name) {
-	MO_Parser_Result list = { 0 };
-
-	while (true) {
-		if(lexer_peek(lexer)->type == '.')
-			break;
+static void
+MOP_STEP(parse_parameter_list)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 
-		MO_Parser_Result res = parse_parameter_declaration(lexer, require_name);
+	if(f->state == 1) {
+		MO_Parser_Result res = stack->ret;
 		if (res.status == MO_PARSER_STATUS_FATAL)
-			break;
+			PARSE_RETURN(f->res);
 
-		if (!list.node) {
-			list.node = allocate_node();
-			list.node->kind = MO_AST_PARAMETER_LIST;
-			list.node->parameter_list.param_decl = array_new(struct Ast_t*);
-			list.node->parameter_list.is_vararg = false;
+		if (!f->res.node) {
+			f->res.node = allocate_node(lexer, MO_AST_PARAMETER_LIST);
+			f->res.node->parameter_list.param_decl = array_new_with(struct Ast_t*, lexer->allocator);
+			f->res.node->parameter_list.is_vararg = false;
 		}
-		array_push(list.node->parameter_list.param_decl, res.node);
+		array_push(f->res.node->parameter_list.param_decl, res.node);
 
 		Token* next = lexer_peek(lexer);
-		if (next->type != ',') {
-			break;
-		}
+		if (next->type != ',')
+			PARSE_RETURN(f->res);
 		lexer_next(lexer); // eat ','
 	}
 
-	return list;
+	if(lexer_peek(lexer)->type == '.')
+		PARSE_RETURN(f->res);
+	PARSE_CALL(parse_parameter_declaration, 1, f->flags & PARSE_FRAME_REQUIRE_NAME);
 }
 
 // parameter-type-list:            /* The parameter list */
 //     parameter-list
 //     parameter-list , ...
 // 
-static MO_Parser_Result
-parse_parameter_type_list(Lexer* lexer, bool require_name) {
-	MO_Parser_Result res = {0};
+static void
+MOP_STEP(parse_parameter_type_list)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 
-	res = parse_parameter_list(lexer, require_name);
-	if (res.status == MO_PARSER_STATUS_FATAL) {
-		return res;
-	}
+	if(f->state == 0)
+		PARSE_CALL(parse_parameter_list, 1, f->flags & PARSE_FRAME_REQUIRE_NAME);
+
+	MO_Parser_Result res = stack->ret;
+	if (res.status == MO_PARSER_STATUS_FATAL)
+		PARSE_RETURN(res);
 
 	if (lexer_peek(lexer)->type == '.') {
 		// Require three '.'
 		lexer_next(lexer);
 		MO_Parser_Result status = require_token(lexer, '.');
 		if (status.status == MO_PARSER_STATUS_FATAL)
-			return status;
+			PARSE_RETURN(status);
 		status = require_token(lexer, '.');
 		if (status.status == MO_PARSER_STATUS_FATAL)
-			return status;
+			PARSE_RETURN(status);
 
 		if (res.node) {
 			res.node->parameter_list.is_vararg = true;
 		} else {
-			res.node = allocate_node();
+			res.node = allocate_node(lexer, MO_AST_PARAMETER_LIST);
 			res.node->parameter_list.is_vararg = true;
 		}
 	}
 
-	return res;
+	PARSE_RETURN(res);
 }
 
 // direct-abstract-declarator:
 //     ( abstract-declarator )
 //     direct-abstract-declarator_opt [ constant-expression_opt ]
 //     direct-abstract-declarator_opt ( parameter-type-list_opt )
-static MO_Parser_Result
-parse_direct_abstract_declarator(Lexer* lexer, bool require_name) {
-	MO_Parser_Result res = {0};
-	MO_Ast* node = 0;
-
-	while (true) {
-		Token* name = 0;
-		Token* next = lexer_peek(lexer);
-		if (next->type == MO_TOKEN_IDENTIFIER) {
-			name = lexer_next(lexer);
-		} else {
-			if(require_name) {
-				// TODO(psv): raise error here, name required
-				res.status = MO_PARSER_STATUS_FATAL;
-				return res;
-			}
-		}
-		if (next->type == '[') {
-			// direct-abstract-declarator_opt is empty
-			lexer_next(lexer);
-			MO_Parser_Result const_expr = parse_constant_expression(lexer);
+//
+// The declarator built so far is f->res.node.
+static void
+MOP_STEP(parse_direct_abstract_declarator)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+	bool require_name = f->flags & PARSE_FRAME_REQUIRE_NAME;
+	MO_Ast* node = f->res.node;
+
+	switch(f->state) {
+		case 1: {
+			// [ constant-expression_opt ]
+			MO_Parser_Result const_expr = stack->ret;
 			MO_Parser_Result cbracket = require_token(lexer, ']');
 			if (cbracket.status == MO_PARSER_STATUS_FATAL) {
 				// TODO(psv): raise error
-				return cbracket;
+				PARSE_RETURN(cbracket);
 			}
-			MO_Ast* new_node = allocate_node();
-			new_node->kind = MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR;
+			MO_Ast* new_node = allocate_node(lexer, MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR);
 			new_node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_ARRAY;
 			new_node->direct_abstract_decl.right_opt = const_expr.node;
-			new_node->direct_abstract_decl.name = name;
 
 			if (!node) {
 				node = new_node;
@@ -797,93 +1014,116 @@ parse_direct_abstract_declarator(Lexer* lexer, bool require_name) {
 				new_node->direct_abstract_decl.left_opt = node;
 				node = new_node;
 			}
+		} break;
+		case 2: {
+			// ( abstract-declarator )
+			MO_Parser_Result abst_decl = stack->ret;
+			if (abst_decl.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(abst_decl);
+			MO_Parser_Result r = require_token(lexer, ')');
+			if (r.status == MO_PARSER_STATUS_FATAL) {
+				// TODO(psv): raise error
+				PARSE_RETURN(r);
+			}
+
+			MO_Ast* new_node = allocate_node(lexer, MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR);
+			new_node->direct_abstract_decl.left_opt = abst_decl.node;
+			new_node->direct_abstract_decl.right_opt = 0;
+			new_node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_NONE;
+
+			if (!node) {
+				node = new_node;
+			} else {
+				node->direct_abstract_decl.left_opt = new_node;
+				node = new_node;
+			}
+		} break;
+		case 3: {
+			// ( parameter-type-list_opt )
+			MO_Parser_Result params = stack->ret;
+			MO_Parser_Result r = require_token(lexer, ')'); // end of parameter list
+			if (r.status == MO_PARSER_STATUS_FATAL) {
+				// TODO(psv): raise error
+				PARSE_RETURN(r);
+			}
+
+			MO_Ast* new_node = allocate_node(lexer, MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR);
+			new_node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_FUNCTION;
+			new_node->direct_abstract_decl.right_opt = params.node;
+
+			if (!node) {
+				node = new_node;
+			} else {
+				new_node->direct_abstract_decl.left_opt = node;
+				node = new_node;
+			}
+		} break;
+	}
+
+	while (true) {
+		f->res.node = node;
+		Token* next = lexer_peek(lexer);
+		if (next->type == MO_TOKEN_IDENTIFIER && !node) {
+			// the declared name is innermost, array and function suffixes apply to it
+			lexer_next(lexer);
+			node = allocate_node(lexer, MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR);
+			node->direct_abstract_decl.name = next;
+			node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_NAME;
+			continue;
+		}
+		if(require_name && !node && next->type != '(') {
+			// TODO(psv): raise error here, name required
+			MO_Parser_Result res = {0};
+			res.status = MO_PARSER_STATUS_FATAL;
+			PARSE_RETURN(res);
+		}
+		if (next->type == '[') {
+			// direct-abstract-declarator_opt is empty
+			lexer_next(lexer);
+			PARSE_CALL(parse_constant_expression, 1, PARSE_FRAME_NESTED);
 		} else if (next->type == '(') {
 			lexer_next(lexer);
 			// could be a parameter-list_opt or another abstract-declarator
 			next = lexer_peek(lexer);
-			if (next->type == '*' || next->type == '(' || next->type == '[') {
-				// it is another abstract-declarator
-				MO_Parser_Result abst_decl = parse_abstract_declarator(lexer, false);
-				MO_Parser_Result r = require_token(lexer, ')');
-				if (r.status == MO_PARSER_STATUS_FATAL) {
-					// TODO(psv): raise error
-					return r;
-				}
-
-				MO_Ast* new_node = allocate_node();
-				new_node->kind = MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR;
-				new_node->direct_abstract_decl.left_opt = abst_decl.node;
-				new_node->direct_abstract_decl.right_opt = 0;
-				new_node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_NONE;
-				new_node->direct_abstract_decl.name = name;
-
-				if (!node) {
-					node = new_node;
-				} else {
-					node->direct_abstract_decl.left_opt = new_node;
-					node = new_node;
-				}
+			bool needs_name = require_name && !node;
+			if (next->type == '*' || next->type == '(' || next->type == '[' || 
+				(needs_name && next->type == MO_TOKEN_IDENTIFIER))
+			{
+				// it is another abstract-declarator, the name is inside of it when required
+				PARSE_CALL(parse_abstract_declarator, 2, PARSE_FRAME_NESTED | (needs_name ? PARSE_FRAME_REQUIRE_NAME : 0));
 			} else {
 				// it is a parameter-type-list_opt
-				MO_Parser_Result params = parse_parameter_type_list(lexer, false);
-				MO_Parser_Result r = require_token(lexer, ')'); // end of parameter list
-				if (r.status == MO_PARSER_STATUS_FATAL) {
-					// TODO(psv): raise error
-					return r;
-				}
-
-				MO_Ast* new_node = allocate_node();
-				new_node->kind = MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR;
-				new_node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_FUNCTION;
-				new_node->direct_abstract_decl.right_opt = params.node;
-				new_node->direct_abstract_decl.name = name;
-
-				if (!node) {
-					node = new_node;
-				} else {
-					new_node->direct_abstract_decl.left_opt = node;
-					node = new_node;
-				}
+				PARSE_CALL(parse_parameter_type_list, 3, PARSE_FRAME_NESTED);
 			}
 		} else {
-			if(name) {
-				node = allocate_node();
-				node->kind = MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR;
-				node->direct_abstract_decl.name = name;
-				node->direct_abstract_decl.type = MO_DIRECT_ABSTRACT_DECL_NAME;
-			}
-			break;
+			PARSE_RETURN(f->res);
 		}
 	}
-
-	res.node = node;
-
-	return res;
 }
 
 // pointer:
 //     * type-qualifier-list_opt
 //     * type-qualifier-list_opt pointer
 static MO_Parser_Result
-parse_pointer(Lexer* lexer) {
+MOP_RULE(parse_pointer)(Lexer* lexer) {
 	MO_Parser_Result res = require_token(lexer, '*');
 	if(res.status == MO_PARSER_STATUS_FATAL)
 		return res;
 
-	MO_Parser_Result type_qual_list = parse_type_qualifier_list(lexer);
+	MO_Ast* last = 0;
+	while(true) {
+		MO_Parser_Result type_qual_list = parse_type_qualifier_list(lexer);
 
-	MO_Ast* node = allocate_node();
-	node->kind = MO_AST_TYPE_POINTER;
-	node->pointer.qualifiers = type_qual_list.node;
+		MO_Ast* node = allocate_node(lexer, MO_AST_TYPE_POINTER);
+		node->pointer.qualifiers = type_qual_list.node;
 
-	if(lexer_peek(lexer)->type == '*') {
-		MO_Parser_Result ptr = parse_pointer(lexer);
-		if(ptr.status == MO_PARSER_STATUS_FATAL)
-			return ptr;
-		node->pointer.next = ptr.node;
-	}
+		if(last) last->pointer.next = node;
+		else res.node = node;
+		last = node;
 
-	res.node = node;
+		if(lexer_peek(lexer)->type != '*') break;
+		lexer_next(lexer);
+	}
 
 	return res;
 }
@@ -891,50 +1131,261 @@ parse_pointer(Lexer* lexer) {
 // abstract-declarator: /* Used with anonymous declarators */
 //    pointer
 //    pointer_opt direct-abstract-declarator
-static MO_Parser_Result
-parse_abstract_declarator(Lexer* lexer, bool require_name) {
-	MO_Parser_Result res = {0};
+static void
+MOP_STEP(parse_abstract_declarator)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+
+	if(f->state == 0) {
+		if(lexer_peek(lexer)->type == '*') {
+			f->res = parse_pointer(lexer);
+		}
 
-	if(lexer_peek(lexer)->type == '*') {
-		res = parse_pointer(lexer);
+		// direct-abstract-declarator
+		PARSE_CALL(parse_direct_abstract_declarator, 1, f->flags & PARSE_FRAME_REQUIRE_NAME);
 	}
 
-	// direct-abstract-declarator
-	MO_Parser_Result dabstd = parse_direct_abstract_declarator(lexer, require_name);
+	MO_Parser_Result dabstd = stack->ret;
 	if (dabstd.status == MO_PARSER_STATUS_FATAL)
-		return dabstd;
+		PARSE_RETURN(dabstd);
 
-	MO_Ast* node = allocate_node();
-	node->kind = MO_AST_TYPE_ABSTRACT_DECLARATOR;
-	node->abstract_type_decl.pointer = res.node;
+	MO_Ast* node = allocate_node(lexer, MO_AST_TYPE_ABSTRACT_DECLARATOR);
+	node->abstract_type_decl.pointer = f->res.node;
 	node->abstract_type_decl.direct_abstract_decl = dabstd.node;
 
-	res.node = node;
+	f->res.node = node;
 
-	return res;
+	PARSE_RETURN(f->res);
 }
 
 // type-name:
 //    specifier-qualifier-list abstract-declarator_opt
-static MO_Parser_Result 
-parse_type_name(Lexer* lexer) {
-	MO_Parser_Result spec_qual = parse_specifier_qualifier_list(lexer);
-	if(spec_qual.status == MO_PARSER_STATUS_FATAL)
-		return spec_qual;
-	
-	MO_Parser_Result abst_decl = parse_abstract_declarator(lexer, false);
+static void
+MOP_STEP(parse_type_name)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+
+	if(f->state == 0) {
+		MO_Parser_Result spec_qual = parse_specifier_qualifier_list(lexer);
+		if(spec_qual.status == MO_PARSER_STATUS_FATAL)
+			PARSE_RETURN(spec_qual);
+		f->left = spec_qual.node;
+		PARSE_CALL(parse_abstract_declarator, 1, 0);
+	}
+
+	MO_Parser_Result abst_decl = stack->ret;
 	if(abst_decl.status == MO_PARSER_STATUS_FATAL)
-		return abst_decl;
+		PARSE_RETURN(abst_decl);
 
 	MO_Parser_Result res = {0};
-	res.node = allocate_node();
-	res.node->kind = MO_AST_TYPE_NAME;
-	res.node->type_name.qualifiers_specifiers = spec_qual.node;
+	res.node = allocate_node(lexer, MO_AST_TYPE_NAME);
+	res.node->type_name.qualifiers_specifiers = f->left;
 	res.node->type_name.abstract_declarator = abst_decl.node;
 
+	PARSE_RETURN(res);
+}
+
+// Finds the declared name inside a declarator, 0 for abstract declarators
+static Token*
+declarator_name(MO_Ast* declarator) {
+	MO_Ast* node = declarator;
+	while(node) {
+		if(node->kind == MO_AST_TYPE_ABSTRACT_DECLARATOR) {
+			node = node->abstract_type_decl.direct_abstract_decl;
+		} else if(node->kind == MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR) {
+			if(node->direct_abstract_decl.type == MO_DIRECT_ABSTRACT_DECL_NAME)
+				return node->direct_abstract_decl.name;
+			node = node->direct_abstract_decl.left_opt;
+		} else {
+			break;
+		}
+	}
+	return 0;
+}
+
+// initializer:
+//     assignment-expression
+//     { initializer-list }
+//     { initializer-list , }
+// initializer-list:
+//     initializer
+//     initializer-list , initializer
+static MO_Parser_Result
+MOP_RULE(parse_initializer)(Lexer* lexer) {
+	if(lexer_peek(lexer)->type != '{')
+		return parse_assignment_expression(lexer);
+
+	lexer_next(lexer); // eat {
+	MO_Parser_Result res = {0};
+	if(!parser_enter(lexer, PARSER_RECURSION_DEPTH, &res))
+		return res;
+	MO_Ast** list = array_new_with(MO_Ast*, lexer->allocator);
+
+	while(lexer_peek(lexer)->type != '}') {
+		MO_Parser_Result init = parse_initializer(lexer);
+		if(init.status == MO_PARSER_STATUS_FATAL) {
+			parser_leave(lexer, PARSER_RECURSION_DEPTH);
+			array_free(list);
+			return init;
+		}
+		array_push(list, init.node);
+
+		if(lexer_peek(lexer)->type != ',') break;
+		lexer_next(lexer); // eat ,
+	}
+	parser_leave(lexer, PARSER_RECURSION_DEPTH);
+
+	MO_Parser_Result r = require_token(lexer, '}');
+	if(r.status == MO_PARSER_STATUS_FATAL) {
+		array_free(list);
+		return r;
+	}
+
+	res.node = allocate_node(lexer, MO_AST_INITIALIZER_LIST);
+	res.node->initializer_list.list = list;
+
+	return res;
+}
+
+// Adds the names a typedef declaration declares to lexer->typedefs
+static void
+declaration_add_typedefs(Lexer* lexer, MO_Ast* decl) {
+	MO_Ast** list = decl->declaration.init_declarators;
+	if(!list || !(decl->declaration.decl_specifiers->specifier_qualifier.storage_class & STORAGE_CLASS_TYPEDEF) ||
+		(lexer->parser_flags & PARSER_FLAG_TYPEDEFS_FROZEN))
+		return;
+
+	if(!lexer->typedefs) lexer->typedefs = typedef_table_new(lexer->allocator);
+	for(u64 i = 0; i < array_length(list); ++i) {
+		Token* name = declarator_name(list[i]->init_declarator.declarator);
+		if(name) typedef_table_add(lexer->typedefs, name->data, name->length);
+	}
+}
+
+// declaration:
+//     declaration-specifiers init-declarator-list_opt ;
+// init-declarator-list:
+//     init-declarator
+//     init-declarator-list , init-declarator
+// init-declarator:
+//     declarator
+//     declarator = initializer
+// function-definition:
+//     declaration-specifiers declarator compound-statement
+static MO_Parser_Result
+MOP_RULE(parse_declaration)(Lexer* lexer) {
+	MO_Parser_Result res = {0};
+	s32 start = lexer->index;
+
+	MO_Parser_Result decl_spec = parse_declaration_specifiers(lexer);
+	if(decl_spec.status == MO_PARSER_STATUS_FATAL)
+		return decl_spec;
+	if(lexer->index == start) {
+		Token* t = lexer_peek(lexer);
+		res.status = MO_PARSER_STATUS_FATAL;
+		sprintf(parser_error_buffer,
+			"%s:%d:%d: Syntax error: expected declaration, but got '%.*s'\n",
+			lexer->filename, t->line, t->column, t->length, t->data);
+		res.error_message = parser_error_buffer;
+		return res;
+	}
+
+	MO_Ast** list = 0;
+	while(lexer_peek(lexer)->type != ';') {
+		MO_Parser_Result declarator = parse_abstract_declarator(lexer, true);
+		if(declarator.status == MO_PARSER_STATUS_FATAL) {
+			if(list) array_free(list);
+			return declarator;
+		}
+
+		if(!list && lexer_peek(lexer)->type == '{') {
+			// function-definition, statements are outside of the grammar handled here,
+			// so the body is kept as a token range
+			MO_Parser_Result body = parse_lazy_body(lexer);
+			if(body.status == MO_PARSER_STATUS_FATAL)
+				return body;
+
+			res.node = allocate_node(lexer, MO_AST_FUNCTION_DEFINITION);
+			res.node->function_definition.decl_specifiers = decl_spec.node;
+			res.node->function_definition.declarator = declarator.node;
+			res.node->function_definition.body = body.node;
+			if(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS)
+				parse_doc(lexer, &res.node->function_definition.doc, start, lexer->index);
+			return res;
+		}
+
+		MO_Parser_Result initializer = {0};
+		if(lexer_peek(lexer)->type == '=') {
+			lexer_next(lexer);
+			initializer = parse_initializer(lexer);
+			if(initializer.status == MO_PARSER_STATUS_FATAL) {
+				if(list) array_free(list);
+				return initializer;
+			}
+		}
+
+		MO_Ast* init_decl = allocate_node(lexer, MO_AST_INIT_DECLARATOR);
+		init_decl->init_declarator.declarator = declarator.node;
+		init_decl->init_declarator.initializer = initializer.node;
+
+		if(!list) list = array_new_with(MO_Ast*, lexer->allocator);
+		array_push(list, init_decl);
+
+		if(lexer_peek(lexer)->type != ',') break;
+		lexer_next(lexer); // eat ,
+	}
+
+	MO_Parser_Result r = require_token(lexer, ';');
+	if(r.status == MO_PARSER_STATUS_FATAL) {
+		if(list) array_free(list);
+		return r;
+	}
+
+	res.node = allocate_node(lexer, MO_AST_DECLARATION);
+	res.node->declaration.decl_specifiers = decl_spec.node;
+	res.node->declaration.init_declarators = list;
+	declaration_add_typedefs(lexer, res.node);
+	if(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS)
+		parse_doc(lexer, &res.node->declaration.doc, start, lexer->index);
+
+	return res;
+}
+
+// translation-unit:
+//     external-declaration
+//     translation-unit external-declaration
+static MO_Parser_Result
+MOP_RULE(parse_translation_unit)(Lexer* lexer) {
+	MO_Ast** list = array_new_with(MO_Ast*, lexer->allocator);
+
+	while(lexer_peek(lexer)->type != MO_TOKEN_EOF) {
+		if(lexer_peek(lexer)->type == ';') {
+			// stray ; at file scope
+			lexer_next(lexer);
+			continue;
+		}
+		MO_Parser_Result decl = parse_declaration(lexer);
+		if(decl.status == MO_PARSER_STATUS_FATAL) {
+			array_free(list);
+			return decl;
+		}
+		array_push(list, decl.node);
+	}
+
+	MO_Parser_Result res = {0};
+	res.node = allocate_node(lexer, MO_AST_TRANSLATION_UNIT);
+	res.node->translation_unit.list = list;
+
 	return res;
 }
 
+static MO_Ast*
+postfix_binary_node(Lexer* lexer, MO_Ast* left, MO_Ast* right, MO_Postfix_Operator po) {
+	MO_Ast* node = allocate_node(lexer, MO_AST_EXPRESSION_POSTFIX_BINARY);
+	node->expression_postfix_binary.left = left;
+	node->expression_postfix_binary.right = right;
+	node->expression_postfix_binary.po = po;
+	return node;
+}
+
 // postfix-expression:
 // primary-expression
 // postfix-expression [ expression ]
@@ -943,130 +1394,129 @@ parse_type_name(Lexer* lexer) {
 // postfix-expression -> identifier
 // postfix-expression ++
 // postfix-expression --
-static MO_Parser_Result 
-parse_postfix_expression(Lexer* lexer) {
+static void
+MOP_STEP(parse_postfix_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 	MO_Parser_Result res = { 0 };
 
-	res = parse_primary_expression(lexer);
-
-	bool finding = true;
-	while (finding) {
-		Token* next = lexer_peek(lexer);
-		MO_Ast* left = res.node;
-
-		switch (next->type) {
-		case '[': {
-			lexer_next(lexer);
-			res = parse_expression(lexer);
+	switch(f->state) {
+		case 0:
+			PARSE_CALL(parse_primary_expression, 1, 0);
+		case 1:
+			f->res = stack->ret;
+			break;
+		case 2: {
+			// [ expression ]
+			res = stack->ret;
 			MO_Ast* right = res.node;
 			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
+				PARSE_RETURN(res);
 			res = require_token(lexer, ']');
 			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_BINARY;
-			node->expression_postfix_binary.left = left;
-			node->expression_postfix_binary.right = right;
-			node->expression_postfix_binary.po = MO_POSTFIX_ARRAY_ACCESS;
-			res.node = node;
+				PARSE_RETURN(res);
+			res.node = postfix_binary_node(lexer, f->left, right, MO_POSTFIX_ARRAY_ACCESS);
+			f->res = res;
 		} break;
-		case '(': {
-			lexer_next(lexer);
-			MO_Ast* right = 0;
-			if (lexer_peek(lexer)->type != ')') {
-				res = parse_argument_expression_list(lexer);
-				right = res.node;
-			}
+		case 3: {
+			// ( argument-expression-list )
+			MO_Ast* right = stack->ret.node;
 			res = require_token(lexer, ')');
 			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_BINARY;
-			node->expression_postfix_binary.left = left;
-			node->expression_postfix_binary.right = right;
-			node->expression_postfix_binary.po = MO_POSTFIX_PROC_CALL;
-			res.node = node;
+				PARSE_RETURN(res);
+			res.node = postfix_binary_node(lexer, f->left, right, MO_POSTFIX_PROC_CALL);
+			f->res = res;
 		} break;
-		case '.': {
+	}
+
+	while (true) {
+		Token* next = lexer_peek(lexer);
+		MO_Ast* left = f->res.node;
+		f->left = left;
+
+		switch (next->type) {
+		case '[': {
+			lexer_next(lexer);
+			PARSE_CALL(parse_expression, 2, PARSE_FRAME_NESTED);
+		} break;
+		case '(': {
+			lexer_next(lexer);
+			if (lexer_peek(lexer)->type != ')')
+				PARSE_CALL(parse_argument_expression_list, 3, PARSE_FRAME_NESTED);
+			res = require_token(lexer, ')');
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
+			res.node = postfix_binary_node(lexer, left, 0, MO_POSTFIX_PROC_CALL);
+			f->res = res;
+		} break;
+		case '.': {
 			lexer_next(lexer);
 			res = parse_identifier(lexer);
 			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
-
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_BINARY;
-			node->expression_postfix_binary.left = left;
-			node->expression_postfix_binary.right = res.node;
-			node->expression_postfix_binary.po = MO_POSTFIX_DOT;
-			res.node = node;
+				PARSE_RETURN(res);
+			res.node = postfix_binary_node(lexer, left, res.node, MO_POSTFIX_DOT);
+			f->res = res;
 		} break;
 		case MO_TOKEN_ARROW: {
 			lexer_next(lexer);
 			res = parse_identifier(lexer);
 			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_BINARY;
-			node->expression_postfix_binary.left = left;
-			node->expression_postfix_binary.right = res.node;
-			node->expression_postfix_binary.po = MO_POSTFIX_ARROW;
-			res.node = node;
+				PARSE_RETURN(res);
+			res.node = postfix_binary_node(lexer, left, res.node, MO_POSTFIX_ARROW);
+			f->res = res;
 		} break;
 		case MO_TOKEN_PLUS_PLUS: {
 			lexer_next(lexer);
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_UNARY;
+			MO_Ast* node = allocate_node(lexer, MO_AST_EXPRESSION_POSTFIX_UNARY);
 			node->expression_postfix_unary.expr = left;
 			node->expression_postfix_unary.po = MO_POSTFIX_PLUS_PLUS;
-			res.node = node;
+			f->res.node = node;
 		} break;
 		case MO_TOKEN_MINUS_MINUS: {
 			lexer_next(lexer);
-			MO_Ast* node = allocate_node();
-			node->kind = MO_AST_EXPRESSION_POSTFIX_UNARY;
+			MO_Ast* node = allocate_node(lexer, MO_AST_EXPRESSION_POSTFIX_UNARY);
 			node->expression_postfix_unary.expr = left;
 			node->expression_postfix_unary.po = MO_POSTFIX_MINUS_MINUS;
-			res.node = node;
+			f->res.node = node;
 		} break;
 		default:
-			finding = false;
-			break;
+			PARSE_RETURN(f->res);
 		}
 	}
-
-	return res;
 }
 
 // argument-expression-list:
 // assignment-expression
 // argument-expression-list , assignment-expression
-static MO_Parser_Result 
-parse_argument_expression_list(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-	MO_Ast* last_node = 0;
-
-	res = parse_assignment_expression(lexer);
-	if (res.status == MO_PARSER_STATUS_FATAL)
-		return res;
-
-	MO_Ast* left = res.node;
-
-	while(lexer_peek(lexer)->type == ',')
-	{
-		lexer_next(lexer);
-
-		MO_Parser_Result right = parse_assignment_expression(lexer);
-
-		MO_Ast* node = allocate_node();
-		node->kind = MO_AST_EXPRESSION_ARGUMENT_LIST;
-		node->expression_argument_list.next = right.node;
-		node->expression_argument_list.expr = left;
-		left = node;
-		res.node = node;
+//
+// f->left is the list so far.
+static void
+MOP_STEP(parse_argument_expression_list)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+
+	switch(f->state) {
+		case 0:
+			PARSE_CALL(parse_assignment_expression, 1, 0);
+		case 1:
+			f->res = stack->ret;
+			if (f->res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(f->res);
+			f->left = f->res.node;
+			break;
+		case 2: {
+			MO_Parser_Result right = stack->ret;
+
+			MO_Ast* node = allocate_node(lexer, MO_AST_EXPRESSION_ARGUMENT_LIST);
+			node->expression_argument_list.next = right.node;
+			node->expression_argument_list.expr = f->left;
+			f->left = node;
+			f->res.node = node;
+		} break;
 	}
 
-	return res;
+	if(lexer_peek(lexer)->type != ',')
+		PARSE_RETURN(f->res);
+	lexer_next(lexer);
+	PARSE_CALL(parse_assignment_expression, 2, 0);
 }
 
 // unary-expression:
@@ -1077,118 +1527,144 @@ parse_argument_expression_list(Lexer* lexer) {
 // cast-expression 
 // sizeof unary-expression
 // sizeof ( type-name )
-static MO_Parser_Result 
-parse_unary_expression(Lexer* lexer) {
+//
+// f->op is the operator.
+static void
+MOP_STEP(parse_unary_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 	MO_Parser_Result res = { 0 };
 
-	Token* next = lexer_peek(lexer);
-
-	switch(next->type) {
-		case MO_TOKEN_PLUS_PLUS:{
-			lexer_next(lexer);
-			MO_Parser_Result expr = parse_unary_expression(lexer);
-			if(expr.status == MO_PARSER_STATUS_FATAL)
-				return res;
-
-			res.node = allocate_node();
-			res.node->kind = MO_AST_EXPRESSION_UNARY;
-			res.node->expression_unary.expr = expr.node;
-			res.node->expression_unary.uo = MO_UNOP_PLUS_PLUS;
-		}break;
-		case MO_TOKEN_MINUS_MINUS: {
-			lexer_next(lexer);
-			MO_Parser_Result expr = parse_unary_expression(lexer);
+	switch(f->state) {
+		case 0: {
+			Token* next = lexer_peek(lexer);
+			f->op = next;
+
+			switch(next->type) {
+				case MO_TOKEN_PLUS_PLUS:
+				case MO_TOKEN_MINUS_MINUS:
+					lexer_next(lexer);
+					PARSE_CALL(parse_unary_expression, 1, PARSE_FRAME_NESTED);
+				// & * + - ~ !
+				case '&': 
+				case '*':
+				case '+':
+				case '-':
+				case '~':
+				case '!':
+					lexer_next(lexer);
+					PARSE_CALL(parse_cast_expression, 2, PARSE_FRAME_NESTED);
+				case MO_TOKEN_KEYWORD_SIZEOF: {
+					lexer_next(lexer);
+					Token* next = lexer_peek(lexer);
+					if(next->type == '(') MOP_COUNT(COUNTER_TYPE_NAME_PEEK);
+					if(next->type == '(' && is_type_name(lexer, lexer_peek_n(lexer, 1))) {
+						MOP_COUNT(COUNTER_TYPE_NAME_PEEK_HIT);
+						lexer_next(lexer); // eat (
+						PARSE_CALL(parse_type_name, 3, PARSE_FRAME_NESTED);
+					}
+					PARSE_CALL(parse_unary_expression, 4, PARSE_FRAME_NESTED);
+				}
+				default:
+					PARSE_CALL(parse_postfix_expression, 5, 0);
+			}
+		} break;
+		case 1: {
+			// ++ or -- unary-expression
+			MO_Parser_Result expr = stack->ret;
 			if(expr.status == MO_PARSER_STATUS_FATAL)
-				return res;
+				PARSE_RETURN(res);
 
-			res.node = allocate_node();
-			res.node->kind = MO_AST_EXPRESSION_UNARY;
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_UNARY);
 			res.node->expression_unary.expr = expr.node;
-			res.node->expression_unary.uo = MO_UNOP_MINUS_MINUS;
+			res.node->expression_unary.uo = (f->op->type == MO_TOKEN_PLUS_PLUS) ? MO_UNOP_PLUS_PLUS : MO_UNOP_MINUS_MINUS;
 		} break;
-		// & * + - ~ !
-		case '&': 
-		case '*':
-		case '+':
-		case '-':
-		case '~':
-		case '!': {
-			lexer_next(lexer);
-			MO_Parser_Result expr = parse_cast_expression(lexer);
+		case 2: {
+			// unary-operator cast-expression
+			MO_Parser_Result expr = stack->ret;
 			if(expr.status == MO_PARSER_STATUS_FATAL)
-				return expr;
+				PARSE_RETURN(expr);
 
-			res.node = allocate_node();
-			res.node->kind = MO_AST_EXPRESSION_UNARY;
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_UNARY);
 			res.node->expression_unary.expr = expr.node;
-			res.node->expression_unary.uo = (MO_Unary_Operator)next->type;
+			res.node->expression_unary.uo = (MO_Unary_Operator)f->op->type;
 		} break;
-
-		case MO_TOKEN_KEYWORD_SIZEOF: {
-			lexer_next(lexer);
-			Token* next = lexer_peek(lexer);
-			if(next->type == '(') {
-				lexer_next(lexer); // eat (
-				MO_Parser_Result r = parse_type_name(lexer);
-				if(r.status == MO_PARSER_STATUS_FATAL)
-					return r;
+		case 3: {
+			// sizeof ( type-name )
+			MO_Parser_Result r = stack->ret;
+			if(r.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(r);
+			
+			MO_Parser_Result n = require_token(lexer, ')');
+			if(n.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(n);
 				
-				MO_Parser_Result n = require_token(lexer, ')');
-				if(n.status == MO_PARSER_STATUS_FATAL)
-					return n;
-					
-				res.node = allocate_node();
-				res.node->kind = MO_AST_EXPRESSION_SIZEOF;
-				res.node->expression_sizeof.is_type_name = true;
-				res.node->expression_sizeof.type = r.node;
-			} else {
-				MO_Parser_Result r = parse_unary_expression(lexer);
-				if(r.status == MO_PARSER_STATUS_FATAL)
-					return r;
-				res.node = allocate_node();
-				res.node->kind = MO_AST_EXPRESSION_SIZEOF;
-				res.node->expression_sizeof.is_type_name = false;
-				res.node->expression_sizeof.expr;
-			}
-		}break;
-		default:
-			res = parse_postfix_expression(lexer);
-		break;
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_SIZEOF);
+			res.node->expression_sizeof.is_type_name = true;
+			res.node->expression_sizeof.type = r.node;
+		} break;
+		case 4: {
+			// sizeof unary-expression
+			MO_Parser_Result r = stack->ret;
+			if(r.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(r);
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_SIZEOF);
+			res.node->expression_sizeof.is_type_name = false;
+			res.node->expression_sizeof.expr = r.node;
+		} break;
+		case 5:
+			res = stack->ret;
+			break;
 	}
 
-	return res;
+	PARSE_RETURN(res);
 }
 
 // cast-expression:
 // unary-expression
 // ( type-name ) cast-expression
-static MO_Parser_Result 
-parse_cast_expression(Lexer* lexer) {
+//
+// f->left is the type-name.
+static void
+MOP_STEP(parse_cast_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 	MO_Parser_Result res = { 0 };
 
-	Token* next = lexer_peek(lexer);
-	if(next->type == '(' && is_type_name(lexer_peek_n(lexer, 1))) {
-		lexer_next(lexer); // eat '('
-		MO_Parser_Result type_name = parse_type_name(lexer);
-		if(type_name.status == MO_PARSER_STATUS_FATAL)
-			return res;
-		res = require_token(lexer, ')');
-		if (res.status == MO_PARSER_STATUS_FATAL)
-			return res;
-
-		MO_Parser_Result expr = parse_cast_expression(lexer);
-		if(expr.status == MO_PARSER_STATUS_FATAL)
-			return res;
+	switch(f->state) {
+		case 0: {
+			Token* next = lexer_peek(lexer);
+			if(next->type == '(') MOP_COUNT(COUNTER_TYPE_NAME_PEEK);
+			if(next->type == '(' && is_type_name(lexer, lexer_peek_n(lexer, 1))) {
+				MOP_COUNT(COUNTER_TYPE_NAME_PEEK_HIT);
+				lexer_next(lexer); // eat '('
+				PARSE_CALL(parse_type_name, 1, PARSE_FRAME_NESTED);
+			}
+			PARSE_CALL(parse_unary_expression, 3, 0);
+		}
+		case 1: {
+			MO_Parser_Result type_name = stack->ret;
+			if(type_name.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
+			f->left = type_name.node;
+			res = require_token(lexer, ')');
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
+			PARSE_CALL(parse_cast_expression, 2, PARSE_FRAME_NESTED);
+		}
+		case 2: {
+			MO_Parser_Result expr = stack->ret;
+			if(expr.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
 
-		res.node = allocate_node();
-		res.node->kind = MO_AST_EXPRESSION_CAST;
-		res.node->expression_cast.expression = expr.node;
-		res.node->expression_cast.type_name = type_name.node;
-	} else {
-		res = parse_unary_expression(lexer);
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_CAST);
+			res.node->expression_cast.expression = expr.node;
+			res.node->expression_cast.type_name = f->left;
+		} break;
+		case 3:
+			res = stack->ret;
+			break;
 	}
 
-	return res;
+	PARSE_RETURN(res);
 }
 
 // multiplicative-expression:
@@ -1196,395 +1672,191 @@ parse_cast_expression(Lexer* lexer) {
 // multiplicative-expression * cast-expression
 // multiplicative-expression / cast-expression
 // multiplicative-expression % cast-expression
-static MO_Parser_Result
-parse_multiplicative_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_cast_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '*' || op->type == '/' || op->type == '%') {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_cast_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_MULTIPLICATIVE;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // additive-expression:
 // multiplicative-expression
 // additive-expression + multiplicative-expression
 // additive-expression - multiplicative-expression
-static MO_Parser_Result 
-parse_additive_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_multiplicative_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '+' || op->type == '-') {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_multiplicative_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_ADDITIVE;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // shift-expression:
 // additive-expression
 // shift-expression << additive-expression
 // shift-expression >> additive-expression
-static MO_Parser_Result 
-parse_shift_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_additive_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == MO_TOKEN_BITSHIFT_LEFT || op->type == MO_TOKEN_BITSHIFT_RIGHT) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_additive_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_SHIFT;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // relational-expression:
 // shift-expression
 // relational-expression < shift-expression
 // relational-expression > shift-expression
 // relational-expression <= shift-expression
 // relational-expression >= shift-expression
-static MO_Parser_Result 
-parse_relational_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_shift_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '<' || op->type == '>' || op->type == MO_TOKEN_LESS_EQUAL || op->type == MO_TOKEN_GREATER_EQUAL) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_shift_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_RELATIONAL;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-	return res;
-}
-
+//
 // equality-expression:
 // relational-expression
 // equality-expression == relational-expression
 // equality-expression != relational-expression
-static MO_Parser_Result 
-parse_equality_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_relational_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == MO_TOKEN_EQUAL_EQUAL || op->type == MO_TOKEN_NOT_EQUAL) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_relational_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_EQUALITY;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // AND-expression:
 // equality-expression
 // AND-expression & equality-expression
-static MO_Parser_Result 
-parse_and_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_equality_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '&') {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_equality_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_AND;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // exclusive-OR-expression:
 // AND-expression
 // exclusive-OR-expression ^ AND-expression
-static MO_Parser_Result 
-parse_exclusive_or_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_and_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '^') {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_and_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_EXCLUSIVE_OR;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // inclusive-OR-expression:
 // exclusive-OR-expression
 // inclusive-OR-expression | exclusive-OR-expression
-static MO_Parser_Result parse_inclusive_or_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_exclusive_or_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == '|') {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_exclusive_or_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_INCLUSIVE_OR;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // logical-AND-expression:
 // inclusive-OR-expression
 // logical-AND-expression && inclusive-OR-expression
-static MO_Parser_Result 
-parse_logical_and_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_inclusive_or_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == MO_TOKEN_LOGIC_AND) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_inclusive_or_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_LOGICAL_AND;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-
-	return res;
-}
-
+//
 // logical-OR-expression:
 // logical-AND-expression
 // logical-OR-expression || logical-AND-expression
-static MO_Parser_Result parse_logical_or_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
+//
+// assignment-expression:
+// conditional-expression (unary-expression is a more specific conditional-expression)
+// unary-expression assignment-operator assignment-expression
+typedef struct {
+	Parser_Rule  operand;
+	MO_Node_Kind kind;
+} Binary_Rule;
+
+static const Binary_Rule binary_rules[RULE_COUNT] = {
+	[RULE_parse_multiplicative_expression] = { RULE_parse_cast_expression, MO_AST_EXPRESSION_MULTIPLICATIVE },
+	[RULE_parse_additive_expression] = { RULE_parse_multiplicative_expression, MO_AST_EXPRESSION_ADDITIVE },
+	[RULE_parse_shift_expression] = { RULE_parse_additive_expression, MO_AST_EXPRESSION_SHIFT },
+	[RULE_parse_relational_expression] = { RULE_parse_shift_expression, MO_AST_EXPRESSION_RELATIONAL },
+	[RULE_parse_equality_expression] = { RULE_parse_relational_expression, MO_AST_EXPRESSION_EQUALITY },
+	[RULE_parse_and_expression] = { RULE_parse_equality_expression, MO_AST_EXPRESSION_AND },
+	[RULE_parse_exclusive_or_expression] = { RULE_parse_and_expression, MO_AST_EXPRESSION_EXCLUSIVE_OR },
+	[RULE_parse_inclusive_or_expression] = { RULE_parse_exclusive_or_expression, MO_AST_EXPRESSION_INCLUSIVE_OR },
+	[RULE_parse_logical_and_expression] = { RULE_parse_inclusive_or_expression, MO_AST_EXPRESSION_LOGICAL_AND },
+	[RULE_parse_logical_or_expression] = { RULE_parse_logical_and_expression, MO_AST_EXPRESSION_LOGICAL_OR },
+	[RULE_parse_assignment_expression] = { RULE_parse_conditional_expression, MO_AST_EXPRESSION_ASSIGNMENT },
+};
 
-	res = parse_logical_and_expression(lexer);
+static bool
+is_binary_operator(Parser_Rule rule, Token* op) {
+	switch(rule) {
+		case RULE_parse_multiplicative_expression: return op->type == '*' || op->type == '/' || op->type == '%';
+		case RULE_parse_additive_expression:       return op->type == '+' || op->type == '-';
+		case RULE_parse_shift_expression:          return op->type == MO_TOKEN_BITSHIFT_LEFT || op->type == MO_TOKEN_BITSHIFT_RIGHT;
+		case RULE_parse_relational_expression:     return op->type == '<' || op->type == '>' || op->type == MO_TOKEN_LESS_EQUAL || op->type == MO_TOKEN_GREATER_EQUAL;
+		case RULE_parse_equality_expression:       return op->type == MO_TOKEN_EQUAL_EQUAL || op->type == MO_TOKEN_NOT_EQUAL;
+		case RULE_parse_and_expression:            return op->type == '&';
+		case RULE_parse_exclusive_or_expression:   return op->type == '^';
+		case RULE_parse_inclusive_or_expression:   return op->type == '|';
+		case RULE_parse_logical_and_expression:    return op->type == MO_TOKEN_LOGIC_AND;
+		case RULE_parse_logical_or_expression:     return op->type == MO_TOKEN_LOGIC_OR;
+		case RULE_parse_assignment_expression:     return is_assignment_operator(op);
+		default: return false;
+	}
+}
 
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (op->type == MO_TOKEN_LOGIC_OR) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_logical_and_expression(lexer);
+// Every binary level, and assignment, which the grammar makes right
+// associative but is parsed as a left associative chain. f->right is the node
+// the previous round built, f->op the operator of the pending right operand.
+//
+// An expression passes through all eleven levels on the way to its operand and
+// back, so the step stays in its loop while the frame on top is a binary level
+// instead of going through parse_stack_run for each of them.
+static void
+parse_binary_step(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+
+	for(;;) {
+		const Binary_Rule* rule = &binary_rules[f->rule];
+
+		switch(f->state) {
+			case 0:
+				parse_call(stack, rule->operand, 1, 0);
+				goto next_frame;
+			case 1:
+				f->res = stack->ret;
+				if (f->res.status != MO_PARSER_STATUS_OK) {
+					stack->ret = f->res;
+					parse_return(stack);
+					goto next_frame;
+				}
+				break;
+			case 2: {
+				MO_Parser_Result right = stack->ret;
 
 				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_LOGICAL_OR;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
+				f->res.node = f->right = join_binary(lexer, rule->kind, (MO_Binary_Operator)f->op->type, f->res.node, right.node, f->right);
+			} break;
 		}
-	}
 
-	return res;
+		Token* op = lexer_peek(lexer);
+		if (is_binary_operator(f->rule, op)) {
+			lexer_next(lexer);
+			f->op = op;
+			parse_call(stack, rule->operand, 2, 0);
+		} else {
+			stack->ret = f->res;
+			parse_return(stack);
+		}
+
+	next_frame:
+		// binary_rules has no operand for the other rules, none of them is rule 0
+		if (stack->count == 0 || (lexer->parser_flags & PARSER_FLAG_DEPTH_EXCEEDED))
+			return;
+		f = &stack->frames[stack->count - 1];
+		if (!binary_rules[f->rule].operand)
+			return;
+	}
 }
 
 // conditional-expression:
 // logical-OR-expression
 // logical-OR-expression ? expression : conditional-expression
-static MO_Parser_Result 
-parse_conditional_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
+//
+// f->left is the condition, f->right the true case.
+static void
+MOP_STEP(parse_conditional_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
+	MO_Parser_Result res = stack->ret;
 
-	res = parse_logical_or_expression(lexer);
-	MO_Ast* condition = res.node;
+	switch(f->state) {
+		case 0:
+			PARSE_CALL(parse_logical_or_expression, 1, 0);
+		case 1: {
+			f->left = res.node;
 
-	if (res.status == MO_PARSER_STATUS_FATAL)
-		return res;
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
 
-	// ternary operator
-	Token* next = lexer_peek(lexer);
-	if (next->type == '?') {
-		lexer_next(lexer);
-		res = parse_expression(lexer);
-		MO_Ast* case_true = res.node;
-		if (res.status == MO_PARSER_STATUS_FATAL)
-			return res;
-		res = require_token(lexer, ':');
-		if (res.status == MO_PARSER_STATUS_FATAL)
-			return res;
-		res = parse_conditional_expression(lexer);
-		MO_Ast* case_false = res.node;
-		if (res.status == MO_PARSER_STATUS_FATAL)
-			return res;
+			// ternary operator
+			Token* next = lexer_peek(lexer);
+			if (next->type != '?')
+				PARSE_RETURN(res);
+			lexer_next(lexer);
+			PARSE_CALL(parse_expression, 2, PARSE_FRAME_NESTED);
+		}
+		case 2:
+			f->right = res.node;
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
+			res = require_token(lexer, ':');
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
+			PARSE_CALL(parse_conditional_expression, 3, PARSE_FRAME_NESTED);
+		case 3: {
+			MO_Ast* case_false = res.node;
+			if (res.status == MO_PARSER_STATUS_FATAL)
+				PARSE_RETURN(res);
 
-		MO_Ast* node = allocate_node();
-		node->kind = MO_AST_EXPRESSION_TERNARY;
-		node->expression_ternary.condition = condition;
-		node->expression_ternary.case_true = case_true;
-		node->expression_ternary.case_false = case_false;
-		res.node = node;
+			MO_Ast* node = allocate_node(lexer, MO_AST_EXPRESSION_TERNARY);
+			node->expression_ternary.condition = f->left;
+			node->expression_ternary.case_true = f->right;
+			node->expression_ternary.case_false = case_false;
+			res.node = node;
+		} break;
 	}
 
-	return res;
-}
-
-// assignment-expression:
-// conditional-expression (unary-expression is a more specific conditional-expression)
-// unary-expression assignment-operator assignment-expression
-static MO_Parser_Result 
-parse_assignment_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	res = parse_conditional_expression(lexer);
-
-	if (res.status == MO_PARSER_STATUS_OK) {
-		while(true) {
-			Token* op = lexer_peek(lexer);
-			if (is_assignment_operator(op)) {
-				lexer_next(lexer);
-				MO_Parser_Result right = parse_conditional_expression(lexer);
-
-				// Construct the node
-				MO_Ast* node = allocate_node();
-				node->kind = MO_AST_EXPRESSION_ASSIGNMENT;
-				node->expression_binary.bo = (MO_Binary_Operator)op->type;
-				node->expression_binary.left = res.node;
-				node->expression_binary.right = right.node;
-				res.node = node;
-			} else {
-				break;
-			}
-		}
-	}
-	return res;
+	PARSE_RETURN(res);
 }
 
 // primary-expression:
@@ -1592,60 +1864,63 @@ parse_assignment_expression(Lexer* lexer) {
 // constant
 // string-literal
 // ( expression )
-static MO_Parser_Result 
-parse_primary_expression(Lexer* lexer) {
+static void
+MOP_STEP(parse_primary_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	Lexer* lexer = stack->lexer;
 	MO_Parser_Result res = { 0 };
 
+	if(f->state == 1) {
+		// ( expression )
+		res = stack->ret;
+		if (res.status == MO_PARSER_STATUS_FATAL)
+			PARSE_RETURN(res);
+		MO_Parser_Result endexpr = require_token(lexer, ')');
+		if(endexpr.status == MO_PARSER_STATUS_FATAL) {
+			PARSE_RETURN(endexpr);
+		}
+		PARSE_RETURN(res);
+	}
+
 	Token* next = lexer_peek(lexer);
 
 	switch (next->type) {
 		case MO_TOKEN_IDENTIFIER: {
 			lexer_next(lexer);
-			res.node = allocate_node();
-			res.node->kind = MO_AST_EXPRESSION_PRIMARY_IDENTIFIER;
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_PRIMARY_IDENTIFIER);
 			res.node->expression_primary.data = next;
 		}break;
 		case MO_TOKEN_STRING_LITERAL: {
 			lexer_next(lexer);
-			res.node = allocate_node();
-			res.node->kind = MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL;
+			res.node = allocate_node(lexer, MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL);
 			res.node->expression_primary.data = next;
 		}break;
 		case '(': {
 			lexer_next(lexer);
-			res = parse_expression(lexer);
-			if (res.status == MO_PARSER_STATUS_FATAL)
-				return res;
-			MO_Parser_Result endexpr = require_token(lexer, ')');
-			if(endexpr.status == MO_PARSER_STATUS_FATAL) {
-				return endexpr;
-			}
-		}break;
+			PARSE_CALL(parse_expression, 1, PARSE_FRAME_NESTED);
+		}
 		default: {
 			res = parse_constant(lexer);
 		}break;
 	}
 
-	return res;
+	PARSE_RETURN(res);
 }
 
 // expression:
 // assignment-expression
 // expression , assignment-expression
-static MO_Parser_Result 
-parse_expression(Lexer* lexer) {
-	MO_Parser_Result res = { 0 };
-
-	s32 start = lexer->index;
-	res = parse_assignment_expression(lexer);
+static void
+MOP_STEP(parse_expression)(Parse_Stack* stack, Parse_Frame* f) {
+	if(f->state == 0)
+		PARSE_CALL(parse_assignment_expression, 1, 0);
 
 	// TODO3(psv): maybe implement , operator
 
-	return res;
+	PARSE_RETURN(stack->ret);
 }
 
 static MO_Parser_Result
-parse_identifier(Lexer* lexer) {
+MOP_RULE(parse_identifier)(Lexer* lexer) {
 	MO_Parser_Result res = { 0 };
 	Token* t = lexer_next(lexer);
 	if (t->type != MO_TOKEN_IDENTIFIER) {
@@ -1654,8 +1929,7 @@ parse_identifier(Lexer* lexer) {
 		return res;
 	}
 
-	res.node = allocate_node();
-	res.node->kind = MO_AST_EXPRESSION_PRIMARY_IDENTIFIER;
+	res.node = allocate_node(lexer, MO_AST_EXPRESSION_PRIMARY_IDENTIFIER);
 	res.node->expression_primary.data = t;
 
 	return res;
@@ -1667,18 +1941,16 @@ parse_identifier(Lexer* lexer) {
 // enumeration-constant (identifier)
 // character-constant
 static MO_Parser_Result
-parse_constant(Lexer* lexer) {
+MOP_RULE(parse_constant)(Lexer* lexer) {
 	MO_Parser_Result result = { 0 };
 
-	MO_Ast* node = allocate_node();
-	result.node = node;
-
+	MO_Node_Kind kind;
 	Token* n = lexer_next(lexer);
 	switch (n->type) {
-		case MO_TOKEN_FLOAT_LITERAL: {
-			node->kind = MO_AST_CONSTANT_FLOATING_POINT;
-			node->expression_primary.data = n;
-		} break;
+		case MO_TOKEN_FLOAT_LITERAL:
+		case MO_TOKEN_DOUBLE_LITERAL:
+		case MO_TOKEN_LONG_DOUBLE_LITERAL:
+			kind = MO_AST_CONSTANT_FLOATING_POINT; break;
 		case MO_TOKEN_INT_HEX_LITERAL:
 		case MO_TOKEN_INT_BIN_LITERAL:
 		case MO_TOKEN_INT_OCT_LITERAL:
@@ -1687,28 +1959,24 @@ parse_constant(Lexer* lexer) {
 		case MO_TOKEN_INT_ULL_LITERAL:
 		case MO_TOKEN_INT_LITERAL:
 		case MO_TOKEN_INT_L_LITERAL:
-		case MO_TOKEN_INT_LL_LITERAL: {
-			node->kind = MO_AST_CONSTANT_INTEGER;
-			node->expression_primary.data = n;
-		} break;
-		case MO_TOKEN_IDENTIFIER: {
+		case MO_TOKEN_INT_LL_LITERAL:
+			kind = MO_AST_CONSTANT_INTEGER; break;
+		case MO_TOKEN_IDENTIFIER:
 			// enumeration-constant
-			node->kind = MO_AST_CONSTANT_ENUMARATION;
-			node->expression_primary.data = n;
-		} break;
-		case MO_TOKEN_CHAR_LITERAL: {
+			kind = MO_AST_CONSTANT_ENUMARATION; break;
+		case MO_TOKEN_CHAR_LITERAL:
 			// character-constant
-			node->kind = MO_AST_CONSTANT_CHARACTER;
-			node->expression_primary.data = n;
-		}break;
+			kind = MO_AST_CONSTANT_CHARACTER; break;
 		default: {
 			result.status = MO_PARSER_STATUS_FATAL;
 			result.error_message = parser_error_message(lexer, "Syntax Error: expected constant, but got '%s'\n", token_to_str(n));
-			result.node = 0;
-			free_node(node);
-		}break;
+			return result;
+		}
 	}
 
+	result.node = allocate_node(lexer, kind);
+	result.node->expression_primary.data = n;
+
 	return result;
 }
 
@@ -1947,24 +2215,19 @@ parser_print_specifiers_qualifiers(HBuffer* out, MO_Ast* sq) {
 				}
 			}
 		}break;
-		case MO_TYPE_STRUCT: {
-			hprint(out, "struct ");
-			if(sq->specifier_qualifier.struct_name)
-				parser_print_token(out, sq->specifier_qualifier.struct_name);
-			if(sq->specifier_qualifier.struct_desc) {
-				hprint(out, " { ");
-				parser_print_struct_description(out, sq->specifier_qualifier.struct_desc);
-				hprint(out, " } ");
-			}
-		}break;
+		case MO_TYPE_STRUCT:
 		case MO_TYPE_UNION: {
-			hprint(out, "union ");
+			hprint(out, (sq->specifier_qualifier.kind == MO_TYPE_STRUCT) ? "struct " : "union ");
 			if(sq->specifier_qualifier.struct_name)
 				parser_print_token(out, sq->specifier_qualifier.struct_name);
-			if(sq->specifier_qualifier.enumerator_list) {
-				hprint(out, " { ");
-				parser_print_enumerator_list(out, sq->specifier_qualifier.enumerator_list);
-				hprint(out, " } ");
+			if(sq->specifier_qualifier.struct_desc) {
+				if(sq->specifier_qualifier.struct_desc->kind == MO_AST_LAZY_BODY) {
+					hprint(out, " { ... } ");
+				} else {
+					hprint(out, " { ");
+					parser_print_struct_description(out, sq->specifier_qualifier.struct_desc);
+					hprint(out, " } ");
+				}
 			}
 		}break;
 		case MO_TYPE_ALIAS: {
@@ -1975,9 +2238,14 @@ parser_print_specifiers_qualifiers(HBuffer* out, MO_Ast* sq) {
 			if(sq->specifier_qualifier.enum_name)
 				parser_print_token(out, sq->specifier_qualifier.enum_name);
 
-			hprint(out, "{");
-			parser_print_enumerator_list(out, sq->specifier_qualifier.enumerator_list);
-			hprint(out, "}");
+			if(!sq->specifier_qualifier.enumerator_list) break;
+			if(sq->specifier_qualifier.enumerator_list->kind == MO_AST_LAZY_BODY) {
+				hprint(out, "{ ... }");
+			} else {
+				hprint(out, "{");
+				parser_print_enumerator_list(out, sq->specifier_qualifier.enumerator_list);
+				hprint(out, "}");
+			}
 		}break;
 		default: hprint(out, "<invalid type specifier or qualifier>"); break;
 	}
@@ -2129,6 +2397,21 @@ parser_print_ast(HBuffer* out, MO_Ast* ast) {
 			parser_print_ast(out, ast->expression_binary.right);
 			hprint(out, ")");
 		}break;
+		case MO_AST_EXPRESSION_CHAIN: {
+			MO_Ast** operands = ast->expression_chain.operands;
+			hprint(out, "(");
+			for(u64 i = 0; i < array_length(operands); ++i) {
+				if(i > 0) {
+					switch((s32)ast->expression_chain.bo) {
+						case MO_TOKEN_LOGIC_AND: hprint(out, " && "); break;
+						case MO_TOKEN_LOGIC_OR: hprint(out, " || "); break;
+						default: hprint(out, " %c ", ast->expression_chain.bo); break;
+					}
+				}
+				parser_print_ast(out, operands[i]);
+			}
+			hprint(out, ")");
+		} break;
 		case MO_AST_EXPRESSION_SIZEOF: {
 			hprint(out, "sizeof (");
 			if(ast->expression_sizeof.is_type_name) {
@@ -2207,6 +2490,47 @@ parser_print_ast(HBuffer* out, MO_Ast* ast) {
 		case MO_AST_PARAMETER_LIST:
 			break;
 
+		case MO_AST_TYPE_INFO:
+			parser_print_specifiers_qualifiers(out, ast);
+			break;
+		case MO_AST_INIT_DECLARATOR: {
+			parser_print_abstract_declarator(out, ast->init_declarator.declarator);
+			if(ast->init_declarator.initializer) {
+				hprint(out, " = ");
+				parser_print_ast(out, ast->init_declarator.initializer);
+			}
+		} break;
+		case MO_AST_INITIALIZER_LIST: {
+			hprint(out, "{");
+			for(u64 i = 0; i < array_length(ast->initializer_list.list); ++i) {
+				if(i > 0) hprint(out, ", ");
+				parser_print_ast(out, ast->initializer_list.list[i]);
+			}
+			hprint(out, "}");
+		} break;
+		case MO_AST_DECLARATION: {
+			parser_print_specifiers_qualifiers(out, ast->declaration.decl_specifiers);
+			if(ast->declaration.init_declarators) {
+				for(u64 i = 0; i < array_length(ast->declaration.init_declarators); ++i) {
+					hprint(out, (i > 0) ? ", " : " ");
+					parser_print_ast(out, ast->declaration.init_declarators[i]);
+				}
+			}
+			hprint(out, ";");
+		} break;
+		case MO_AST_FUNCTION_DEFINITION: {
+			parser_print_specifiers_qualifiers(out, ast->function_definition.decl_specifiers);
+			hprint(out, " ");
+			parser_print_abstract_declarator(out, ast->function_definition.declarator);
+			hprint(out, " { ... }");
+		} break;
+		case MO_AST_TRANSLATION_UNIT: {
+			for(u64 i = 0; i < array_length(ast->translation_unit.list); ++i) {
+				parser_print_ast(out, ast->translation_unit.list[i]);
+				hprint(out, "\n");
+			}
+		} break;
+
 		default: {
 			hprint(out, "<unknown ast node>");
 		}break;
@@ -2215,14 +2539,60 @@ parser_print_ast(HBuffer* out, MO_Ast* ast) {
 
 void 
 mop_print_ast(struct MO_Ast_t* ast) {
+	u64 trace = mop_trace_begin();
 	HBuffer buffer = hbuffer_new();
 	parser_print_ast(&buffer, ast);
 	fprintf(stdout, "%s", buffer.buffer);
+	mop_trace_end("print", 0, trace);
+}
+
+// Every public parse runs between these two, for its budgets and its report
+static Parse_Mark
+parse_begin(Lexer* lexer) {
+	Parse_Mark mark = parse_limits_begin(lexer);
+	if(lexer->memory) memory_begin(lexer, &mark);
+	return mark;
+}
+
+// Whether the input ended inside a /* comment, the lexer took the rest of it
+// for the comment, see lexer_eat_whitespace.
+static bool
+parse_unterminated(Lexer* lexer) {
+	s32 count = lexer->tokens ? (s32)array_length(lexer->tokens) : 0;
+	return count > 0 && (lexer->tokens[count - 1].flags & MO_TOKEN_FLAG_UNTERMINATED);
+}
+
+// A parse that went fine still fails if parse_unterminated.
+static MO_Parser_Result
+parse_unterminated_end(Lexer* lexer, Parse_Mark* mark, MO_Parser_Result res) {
+	if(!parse_unterminated(lexer))
+		return res;
+
+	Token* eof = &lexer->tokens[array_length(lexer->tokens) - 1];
+	res.status = MO_PARSER_STATUS_FATAL;
+	res.node = 0;
+	sprintf(parser_error_buffer, "%s:%d:%d: Syntax error: unterminated comment\n", lexer->filename, eof->line, eof->column);
+	res.error_message = parser_error_buffer;
+	if(mark->release) parse_release_since(lexer, mark);
+	return res;
+}
+
+static MO_Parser_Result
+parse_end(Lexer* lexer, Parse_Mark* mark, MO_Parser_Result res) {
+	res = parse_limits_end(lexer, mark, res);
+	if(res.status == MO_PARSER_STATUS_OK) res = parse_unterminated_end(lexer, mark, res);
+	if(lexer->memory) memory_end(lexer, mark, res);
+	return res;
 }
 
 MO_Parser_Result
 mop_parse_expression(MO_Lexer* lexer) {
-	return parse_expression((Lexer*)lexer);
+	u64 trace = mop_trace_begin();
+	Parse_Mark mark = parse_begin((Lexer*)lexer);
+	MO_Parser_Result res = parse_expression((Lexer*)lexer);
+	res = parse_end((Lexer*)lexer, &mark, res);
+	mop_trace_end("parse expression", lexer->filename, trace);
+	return res;
 }
 
 MO_Parser_Result
@@ -2234,7 +2604,12 @@ mop_parse_expression_cstr(const char* str) {
 
 MO_Parser_Result
 mop_parse_typename(MO_Lexer* lexer) {
-	return parse_type_name((Lexer*)lexer);
+	u64 trace = mop_trace_begin();
+	Parse_Mark mark = parse_begin((Lexer*)lexer);
+	MO_Parser_Result res = parse_type_name((Lexer*)lexer);
+	res = parse_end((Lexer*)lexer, &mark, res);
+	mop_trace_end("parse typename", lexer->filename, trace);
+	return res;
 }
 
 MO_Parser_Result 
@@ -2242,4 +2617,76 @@ mop_parse_typename_cstr(const char* str) {
 	Lexer lexer = {0};
 	MO_Token* tokens = mop_lexer_cstr(&lexer, (char*)str, strlen(str));
 	return mop_parse_typename(&lexer);
-}
\ No newline at end of file
+}
+
+static MO_Parser_Result parse_translation_unit_cached(Lexer* lexer);
+
+MO_Parser_Result
+mop_parse_translation_unit(MO_Lexer* lexer) {
+	u64 trace = mop_trace_begin();
+	Parse_Mark mark = parse_begin((Lexer*)lexer);
+	// the cached trees carry no comments
+	MO_Parser_Result res = (lexer->decl_cache && !(lexer->parser_flags & MO_PARSER_FLAG_COMMENTS)) ?
+		parse_translation_unit_cached((Lexer*)lexer) : parse_translation_unit((Lexer*)lexer);
+	res = parse_end((Lexer*)lexer, &mark, res);
+	mop_trace_end("parse translation unit", lexer->filename, trace);
+	return res;
+}
+
+MO_Parser_Result
+mop_ast_force(MO_Lexer* lexer, struct MO_Ast_t* type_info) {
+	MO_Parser_Result res = {0};
+	res.node = type_info;
+
+	if(!type_info || type_info->kind != MO_AST_TYPE_INFO)
+		return res;
+
+	MO_Ast** body = 0;
+	switch(type_info->specifier_qualifier.kind) {
+		case MO_TYPE_STRUCT:
+		case MO_TYPE_UNION: body = &type_info->specifier_qualifier.struct_desc; break;
+		case MO_TYPE_ENUM:  body = &type_info->specifier_qualifier.enumerator_list; break;
+		default: return res;
+	}
+	if(!*body || (*body)->kind != MO_AST_LAZY_BODY)
+		return res;
+
+	s32 saved_index = lexer->index;
+	lexer->index = (*body)->lazy_body.begin;
+
+	Parse_Mark mark = parse_begin((Lexer*)lexer);
+	MO_Parser_Result list = {0};
+	if(type_info->specifier_qualifier.kind == MO_TYPE_ENUM) {
+		list = parse_enumerator_list((Lexer*)lexer);
+	} else {
+		list = parse_struct_declaration_list((Lexer*)lexer);
+	}
+	if(list.status != MO_PARSER_STATUS_FATAL) {
+		MO_Parser_Result r = require_token((Lexer*)lexer, '}');
+		if(r.status == MO_PARSER_STATUS_FATAL)
+			list = r;
+	}
+	list = parse_end((Lexer*)lexer, &mark, list);
+
+	lexer->index = saved_index;
+	if(list.status != MO_PARSER_STATUS_OK)
+		return list;
+
+	// a body is expanded only once, the lazy node is replaced by the parsed list
+	free_node((Lexer*)lexer, *body);
+	*body = list.node;
+
+	return res;
+}
+
+#include "ast_walk.c"
+#include "ast_flat.c"
+#include "parse_parallel.c"
+#include "batch.c"
+#include "stream.c"
+#include "parse_cache.c"
+#include "decl_cache.c"
+#include "vm.c"
+#include "jit.c"
+#include "columns.c"
+#include "server.c"
@@ -0,0 +1,222 @@
+// Minimal threading layer used by the parallel parsing entry points.
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#endif
+#include <locale.h>
+
+typedef void (*Thread_Proc)(void* arg);
+
+typedef struct {
+	Thread_Proc proc;
+	void*       arg;
+#if defined(_WIN32)
+	HANDLE      handle;
+#else
+	pthread_t   handle;
+#endif
+} Thread;
+
+#if defined(_WIN32)
+static DWORD WINAPI
+thread_entry(LPVOID param) {
+	Thread* t = (Thread*)param;
+	t->proc(t->arg);
+	return 0;
+}
+#else
+static void*
+thread_entry(void* param) {
+	Thread* t = (Thread*)param;
+	t->proc(t->arg);
+	return 0;
+}
+#endif
+
+// t must stay at the same address until thread_join returns
+static bool
+thread_start(Thread* t, Thread_Proc proc, void* arg) {
+	t->proc = proc;
+	t->arg = arg;
+#if defined(_WIN32)
+	t->handle = CreateThread(0, 0, thread_entry, t, 0, 0);
+	return t->handle != 0;
+#else
+	return pthread_create(&t->handle, 0, thread_entry, t) == 0;
+#endif
+}
+
+static void
+thread_join(Thread* t) {
+#if defined(_WIN32)
+	WaitForSingleObject(t->handle, INFINITE);
+	CloseHandle(t->handle);
+#else
+	pthread_join(t->handle, 0);
+#endif
+}
+
+typedef struct {
+#if defined(_WIN32)
+	SRWLOCK         lock;
+#else
+	pthread_mutex_t lock;
+#endif
+} Mutex;
+
+static void
+mutex_init(Mutex* m) {
+#if defined(_WIN32)
+	InitializeSRWLock(&m->lock);
+#else
+	pthread_mutex_init(&m->lock, 0);
+#endif
+}
+
+static void
+mutex_destroy(Mutex* m) {
+#if !defined(_WIN32)
+	pthread_mutex_destroy(&m->lock);
+#endif
+}
+
+static void
+mutex_lock(Mutex* m) {
+#if defined(_WIN32)
+	AcquireSRWLockExclusive(&m->lock);
+#else
+	pthread_mutex_lock(&m->lock);
+#endif
+}
+
+static void
+mutex_unlock(Mutex* m) {
+#if defined(_WIN32)
+	ReleaseSRWLockExclusive(&m->lock);
+#else
+	pthread_mutex_unlock(&m->lock);
+#endif
+}
+
+static s32
+atomic_add_s32(volatile s32* value, s32 addend) {
+#if defined(_WIN32)
+	return InterlockedExchangeAdd((volatile LONG*)value, addend);
+#else
+	return __sync_fetch_and_add(value, addend);
+#endif
+}
+
+static s32
+platform_cpu_count() {
+#if defined(_WIN32)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (s32)info.dwNumberOfProcessors;
+#else
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	return (count > 0) ? (s32)count : 1;
+#endif
+}
+
+static void
+memory_barrier() {
+#if defined(_WIN32)
+	MemoryBarrier();
+#else
+	__sync_synchronize();
+#endif
+}
+
+// true if *value was expected and is now desired
+static bool
+atomic_cas_ptr(void* volatile* value, void* expected, void* desired) {
+#if defined(_WIN32)
+	return InterlockedCompareExchangePointer(value, desired, expected) == expected;
+#else
+	return __sync_bool_compare_and_swap(value, expected, desired);
+#endif
+}
+
+// strtod of the C locale, a host program that set another one does not turn
+// the decimal point of a literal into the end of it
+static double
+platform_strtod(const char* str) {
+#if defined(_WIN32)
+	static _locale_t c_locale;
+	if(!c_locale) {
+		_locale_t l = _create_locale(LC_NUMERIC, "C");
+		if(!atomic_cas_ptr((void* volatile*)&c_locale, 0, l)) _free_locale(l);
+	}
+	return _strtod_l(str, 0, c_locale);
+#else
+	static locale_t c_locale;
+	if(!c_locale) {
+		locale_t l = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+		if(l && !atomic_cas_ptr((void* volatile*)&c_locale, 0, l)) freelocale(l);
+		if(!c_locale) return strtod(str, 0);
+	}
+	// only this thread's locale changes, and only for the call
+	locale_t previous = uselocale(c_locale);
+	double d = strtod(str, 0);
+	uselocale(previous);
+	return d;
+#endif
+}
+
+// monotonic, only meaningful as a difference
+static u64
+platform_time_ns() {
+#if defined(_WIN32)
+	LARGE_INTEGER frequency, now;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&now);
+	return (u64)((double)now.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
+
+// Copies machine code to new pages that can be executed but not written, 0 on failure
+static void*
+platform_code_new(const void* code, size_t size) {
+#if defined(_WIN32)
+	void* pages = VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if(!pages) return 0;
+	memcpy(pages, code, size);
+	DWORD old;
+	if(!VirtualProtect(pages, size, PAGE_EXECUTE_READ, &old)) {
+		VirtualFree(pages, 0, MEM_RELEASE);
+		return 0;
+	}
+	FlushInstructionCache(GetCurrentProcess(), pages, size);
+	return pages;
+#else
+	void* pages = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(pages == MAP_FAILED) return 0;
+	memcpy(pages, code, size);
+	if(mprotect(pages, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(pages, size);
+		return 0;
+	}
+	return pages;
+#endif
+}
+
+static void
+platform_code_free(void* pages, size_t size) {
+	if(!pages) return;
+#if defined(_WIN32)
+	VirtualFree(pages, 0, MEM_RELEASE);
+#else
+	munmap(pages, size);
+#endif
+}
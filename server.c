@@ -0,0 +1,559 @@
+// Parse server over a Unix domain socket, see mop_server_run.
+//
+// Every request is one header line followed by a payload:
+//
+//     <source> <rule> <format> <length>\n<length bytes>
+//
+// source is "path" (the payload is a file name) or "text" (the payload is the
+// source itself), rule is "unit", "expression" or "typename" and format is
+// "ast" (the printed tree) or "status" (nothing but the outcome). A "quit"
+// line stops the server. Every answer is
+//
+//     <ok|error> <length>\n<length bytes>
+//
+// where the payload of an error is the parser's message. Files are kept with
+// their tokens, typedef names, trees and printed trees until their size or
+// modification time changes, so a repeated question is answered without
+// touching the parser. When they hold more than SERVER_CACHE_BYTES, the files
+// asked about least recently are dropped. Inline text is parsed on every
+// request. Every connection may send any number of requests. All of them are
+// watched with poll and a request is answered once all of its bytes are in,
+// so a client that stops sending holds up no one. Requests are answered one
+// at a time, a parse that takes longer than SERVER_PARSE_MILLISECONDS is
+// stopped and answered with an error.
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <signal.h>
+#include <errno.h>
+
+// no single request holds up the connections waiting behind it for longer
+#define SERVER_PARSE_MILLISECONDS 10000
+// largest payload a request may announce
+#define SERVER_REQUEST_BYTES (64 << 20)
+// longest header line
+#define SERVER_LINE_BYTES 256
+// a client that does not take its answer is dropped after this long
+#define SERVER_SEND_MILLISECONDS 10000
+// more connections wait in the listen backlog
+#define SERVER_CONNECTIONS 256
+// what the files kept between requests may hold, the one asked about last is always kept
+#define SERVER_CACHE_BYTES (256 << 20)
+
+typedef enum {
+	SERVER_RULE_UNIT = 0,
+	SERVER_RULE_EXPRESSION,
+	SERVER_RULE_TYPENAME,
+	SERVER_RULE_COUNT,
+} Server_Rule;
+
+typedef enum {
+	SERVER_FORMAT_AST = 0,
+	SERVER_FORMAT_STATUS,
+} Server_Format;
+
+typedef struct {
+	bool    parsed;
+	bool    ok;
+	MO_Ast* node;
+	char*   error;      // copy of the parser's message
+	char*   ast;        // printed tree, rendered on the first request for it
+	s32     ast_length;
+} Server_Result;
+
+typedef struct Server_File_t {
+	char*         path;
+	u64           hash;
+	s64           size;
+	s64           mtime_ns;
+	char*         source;
+	MO_Lexer      lexer; // tokens, arena and typedef names of the file
+	Server_Result results[SERVER_RULE_COUNT];
+	size_t        bytes; // as counted in Server_Cache
+	struct Server_File_t* prev; // lru list, most recent first
+	struct Server_File_t* next;
+} Server_File;
+
+typedef struct {
+	Server_File** slots; // open addressing, 0 for an empty slot
+	s32           slot_count;
+	s32           count;
+	Server_File*  lru_first;
+	Server_File*  lru_last;
+	size_t        bytes;
+} Server_Cache;
+
+typedef struct {
+	int   fd;
+	s32   begin;    // of the request not answered yet
+	s32   end;
+	s32   capacity; // grows to hold the whole request being read
+	char* buffer;
+} Server_Conn;
+
+typedef enum {
+	SERVER_CONN_OPEN = 0,
+	SERVER_CONN_CLOSE,
+	SERVER_CONN_QUIT,
+} Server_Conn_State;
+
+static void
+server_result_free(Server_Result* r) {
+	free(r->error);
+	if(r->ast) array_free(r->ast);
+	memset(r, 0, sizeof(*r));
+}
+
+static void
+server_lexer_free(MO_Lexer* lexer) {
+	if(lexer->tokens) array_free(lexer->tokens);
+	if(lexer->matching) array_free(lexer->matching);
+	// nothing but nodes goes into the arena, their lists are outside of it
+	if(lexer->arena) parse_release_nodes(lexer->arena, (Arena_Mark){0});
+	mop_arena_free(lexer->arena);
+	mop_typedef_table_free(lexer->typedefs);
+	memset(lexer, 0, sizeof(*lexer));
+}
+
+static void
+server_file_free(Server_File* f) {
+	for(s32 i = 0; i < SERVER_RULE_COUNT; ++i) server_result_free(&f->results[i]);
+	server_lexer_free(&f->lexer);
+	free(f->source);
+	free(f->path);
+	free(f);
+}
+
+static Server_File**
+server_cache_slot(Server_Cache* cache, const char* path, u64 hash) {
+	u32 mask = (u32)cache->slot_count - 1;
+	for(u32 i = (u32)hash & mask;; i = (i + 1) & mask) {
+		Server_File* f = cache->slots[i];
+		if(!f || (f->hash == hash && strcmp(f->path, path) == 0)) return &cache->slots[i];
+	}
+}
+
+static void
+server_cache_lru_unlink(Server_Cache* cache, Server_File* f) {
+	if(f->prev) f->prev->next = f->next; else cache->lru_first = f->next;
+	if(f->next) f->next->prev = f->prev; else cache->lru_last = f->prev;
+	f->prev = f->next = 0;
+}
+
+static void
+server_cache_lru_push(Server_Cache* cache, Server_File* f) {
+	f->prev = 0;
+	f->next = cache->lru_first;
+	if(cache->lru_first) cache->lru_first->prev = f; else cache->lru_last = f;
+	cache->lru_first = f;
+}
+
+// Counts what f holds now, its trees and printed trees come with the requests.
+static void
+server_cache_account(Server_Cache* cache, Server_File* f) {
+	size_t bytes = sizeof(Server_File) + strlen(f->path) + 1 + (size_t)f->size + 1;
+	if(f->lexer.tokens) bytes += array_capacity(f->lexer.tokens) * sizeof(MO_Token);
+	if(f->lexer.matching) bytes += array_capacity(f->lexer.matching) * sizeof(s32);
+	if(f->lexer.arena) bytes += arena_bytes(f->lexer.arena);
+	for(s32 i = 0; i < SERVER_RULE_COUNT; ++i) {
+		if(f->results[i].error) bytes += strlen(f->results[i].error) + 1;
+		bytes += (size_t)f->results[i].ast_length;
+	}
+	cache->bytes = cache->bytes - f->bytes + bytes;
+	f->bytes = bytes;
+}
+
+// Takes f out of the table, the entries after it in its run move up so every
+// lookup still finds them.
+static void
+server_cache_remove(Server_Cache* cache, Server_File* f) {
+	u32 mask = (u32)cache->slot_count - 1;
+	u32 i = (u32)f->hash & mask;
+	while(cache->slots[i] != f) i = (i + 1) & mask;
+	cache->slots[i] = 0;
+	for(i = (i + 1) & mask; cache->slots[i]; i = (i + 1) & mask) {
+		Server_File* moved = cache->slots[i];
+		cache->slots[i] = 0;
+		*server_cache_slot(cache, moved->path, moved->hash) = moved;
+	}
+	cache->count--;
+	cache->bytes -= f->bytes;
+	server_cache_lru_unlink(cache, f);
+	server_file_free(f);
+}
+
+static void
+server_cache_evict(Server_Cache* cache) {
+	while(cache->bytes > SERVER_CACHE_BYTES && cache->lru_last != cache->lru_first)
+		server_cache_remove(cache, cache->lru_last);
+}
+
+static void
+server_cache_grow(Server_Cache* cache) {
+	Server_File** old = cache->slots;
+	s32 old_count = cache->slot_count;
+	cache->slot_count = (old_count) ? old_count * 2 : 256;
+	cache->slots = calloc(cache->slot_count, sizeof(Server_File*));
+	for(s32 i = 0; i < old_count; ++i) {
+		if(old[i]) *server_cache_slot(cache, old[i]->path, old[i]->hash) = old[i];
+	}
+	free(old);
+}
+
+static char*
+server_read_file(const char* path, s64 size) {
+	FILE* f = fopen(path, "rb");
+	if(!f) return 0;
+	char* data = calloc(1, size + 1);
+	s64 read = (s64)fread(data, 1, size, f);
+	fclose(f);
+	if(read != size) {
+		free(data);
+		return 0;
+	}
+	return data;
+}
+
+// The cached file for path, reloaded when it changed on disk. Fills error when
+// the file cannot be read.
+static Server_File*
+server_cache_get(Server_Cache* cache, const char* path, char* error, s32 error_size) {
+	struct stat st;
+	if(stat(path, &st) != 0) {
+		snprintf(error, error_size, "%s: %s\n", path, strerror(errno));
+		return 0;
+	}
+#if defined(__APPLE__)
+	s64 mtime_ns = (s64)st.st_mtimespec.tv_sec * 1000000000ll + st.st_mtimespec.tv_nsec;
+#else
+	s64 mtime_ns = (s64)st.st_mtim.tv_sec * 1000000000ll + st.st_mtim.tv_nsec;
+#endif
+
+	if((cache->count + 1) * 4 > cache->slot_count * 3) server_cache_grow(cache);
+
+	u64 hash = typedef_name_hash((const u8*)path, (s32)strlen(path));
+	Server_File** slot = server_cache_slot(cache, path, hash);
+	Server_File* f = *slot;
+	if(f) server_cache_lru_unlink(cache, f);
+	if(f && f->size == (s64)st.st_size && f->mtime_ns == mtime_ns) {
+		server_cache_lru_push(cache, f);
+		return f;
+	}
+
+	char* source = server_read_file(path, (s64)st.st_size);
+	if(!source) {
+		snprintf(error, error_size, "%s: could not read the file\n", path);
+		if(f) server_cache_lru_push(cache, f);
+		return 0;
+	}
+
+	if(f) {
+		// changed on disk, everything derived from the old text goes
+		for(s32 i = 0; i < SERVER_RULE_COUNT; ++i) server_result_free(&f->results[i]);
+		server_lexer_free(&f->lexer);
+		free(f->source);
+	} else {
+		f = calloc(1, sizeof(Server_File));
+		f->path = strdup(path);
+		f->hash = hash;
+		*slot = f;
+		cache->count++;
+	}
+	f->size = (s64)st.st_size;
+	f->mtime_ns = mtime_ns;
+	f->source = source;
+	f->lexer.filename = f->path;
+	mop_lexer_cstr(&f->lexer, f->source, (int)f->size);
+	f->lexer.arena = mop_arena_new(0, 0);
+	server_cache_lru_push(cache, f);
+	server_cache_account(cache, f);
+	return f;
+}
+
+static void
+server_parse(MO_Lexer* lexer, Server_Rule rule, Server_Result* out) {
+	lexer->index = 0;
+	lexer->max_milliseconds = SERVER_PARSE_MILLISECONDS;
+	MO_Parser_Result r = {0};
+	switch(rule) {
+		case SERVER_RULE_UNIT:       r = mop_parse_translation_unit(lexer); break;
+		case SERVER_RULE_EXPRESSION: r = mop_parse_expression(lexer); break;
+		case SERVER_RULE_TYPENAME:   r = mop_parse_typename(lexer); break;
+		default: break;
+	}
+	out->parsed = true;
+	out->ok = (r.status == MO_PARSER_STATUS_OK);
+	out->node = r.node;
+	if(!out->ok) out->error = strdup((r.error_message) ? r.error_message : "Syntax error\n");
+}
+
+static void
+server_render(Server_Result* r) {
+	if(r->ast || !r->ok) return;
+	HBuffer buffer = hbuffer_new();
+	parser_print_ast(&buffer, r->node);
+	r->ast = buffer.buffer;
+	r->ast_length = (s32)strlen(buffer.buffer);
+}
+
+static bool
+server_write(int fd, const char* data, s64 length) {
+	while(length > 0) {
+		ssize_t written = send(fd, data, length, 0);
+		if(written < 0 && errno == EINTR) continue;
+		if(written <= 0) return false;
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+static bool
+server_answer(int fd, bool ok, const char* payload, s32 length) {
+	char header[64];
+	s32 header_length = snprintf(header, sizeof(header), "%s %d\n", (ok) ? "ok" : "error", length);
+	return server_write(fd, header, header_length) && server_write(fd, payload, length);
+}
+
+static bool
+server_error(int fd, const char* message) {
+	return server_answer(fd, false, message, (s32)strlen(message));
+}
+
+// Answers one request, false when the answer could not be sent.
+static bool
+server_request(Server_Cache* cache, int fd, const char* source, const char* rule_name, const char* format_name,
+	char* payload, s64 length)
+{
+	Server_Rule rule = SERVER_RULE_COUNT;
+	if(strcmp(rule_name, "unit") == 0) rule = SERVER_RULE_UNIT;
+	else if(strcmp(rule_name, "expression") == 0) rule = SERVER_RULE_EXPRESSION;
+	else if(strcmp(rule_name, "typename") == 0) rule = SERVER_RULE_TYPENAME;
+	Server_Format format = (strcmp(format_name, "status") == 0) ? SERVER_FORMAT_STATUS : SERVER_FORMAT_AST;
+
+	char error[1024];
+	bool sent = true;
+	if(rule == SERVER_RULE_COUNT || (strcmp(source, "path") != 0 && strcmp(source, "text") != 0)) {
+		snprintf(error, sizeof(error), "unknown request '%s %s'\n", source, rule_name);
+		sent = server_error(fd, error);
+	} else if(strcmp(source, "path") == 0) {
+		Server_File* f = server_cache_get(cache, payload, error, sizeof(error));
+		if(!f) {
+			sent = server_error(fd, error);
+		} else {
+			Server_Result* r = &f->results[rule];
+			if(!r->parsed) server_parse(&f->lexer, rule, r);
+			if(!r->ok) {
+				sent = server_error(fd, r->error);
+				// running out of time says more about the load than about the file
+				if(f->lexer.limit == MO_LIMIT_TIME) server_result_free(r);
+			} else if(format == SERVER_FORMAT_STATUS) {
+				sent = server_answer(fd, true, "", 0);
+			} else {
+				server_render(r);
+				sent = server_answer(fd, true, r->ast, r->ast_length);
+			}
+			server_cache_account(cache, f);
+			server_cache_evict(cache);
+		}
+	} else {
+		MO_Lexer lexer = {0};
+		lexer.filename = (char*)"<text>";
+		mop_lexer_cstr(&lexer, payload, (int)length);
+		lexer.arena = mop_arena_new(0, 0);
+		Server_Result r = {0};
+		server_parse(&lexer, rule, &r);
+		if(!r.ok) {
+			sent = server_error(fd, r.error);
+		} else if(format == SERVER_FORMAT_STATUS) {
+			sent = server_answer(fd, true, "", 0);
+		} else {
+			server_render(&r);
+			sent = server_answer(fd, true, r.ast, r.ast_length);
+		}
+		server_result_free(&r);
+		server_lexer_free(&lexer);
+	}
+	return sent;
+}
+
+// Answers the requests of c that are complete. The bytes of a request that is
+// not are kept, with room made for the rest of it.
+static Server_Conn_State
+server_conn_serve(Server_Cache* cache, Server_Conn* c) {
+	while(c->begin < c->end) {
+		char* at = c->buffer + c->begin;
+		s32 available = c->end - c->begin;
+		char* nl = memchr(at, '\n', MIN(available, SERVER_LINE_BYTES));
+		if(!nl) {
+			if(available < SERVER_LINE_BYTES) break;
+			server_error(c->fd, "malformed request\n");
+			return SERVER_CONN_CLOSE;
+		}
+
+		char line[SERVER_LINE_BYTES];
+		s32 line_length = (s32)(nl - at);
+		memcpy(line, at, line_length);
+		line[line_length] = 0;
+		if(strcmp(line, "quit") == 0)
+			return SERVER_CONN_QUIT;
+
+		char source[16], rule_name[16], format_name[16];
+		long long length = 0;
+		if(sscanf(line, "%15s %15s %15s %lld", source, rule_name, format_name, &length) != 4 || length < 0) {
+			server_error(c->fd, "malformed request\n");
+			return SERVER_CONN_CLOSE;
+		}
+		// the payload is not read, the connection cannot go on after it
+		if(length > SERVER_REQUEST_BYTES) {
+			server_error(c->fd, "request too large\n");
+			return SERVER_CONN_CLOSE;
+		}
+
+		s32 size = line_length + 1 + (s32)length;
+		if(available < size) {
+			if(size > c->capacity) {
+				char* buffer = malloc(size);
+				if(!buffer) {
+					server_error(c->fd, "request too large\n");
+					return SERVER_CONN_CLOSE;
+				}
+				memcpy(buffer, at, available);
+				free(c->buffer);
+				c->buffer = buffer;
+				c->capacity = size;
+				c->begin = 0;
+				c->end = available;
+			}
+			break;
+		}
+
+		// the lexer wants the text nul terminated
+		char* payload = malloc(length + 1);
+		if(!payload) {
+			server_error(c->fd, "request too large\n");
+			return SERVER_CONN_CLOSE;
+		}
+		memcpy(payload, nl + 1, length);
+		payload[length] = 0;
+		c->begin += size;
+		bool sent = server_request(cache, c->fd, source, rule_name, format_name, payload, length);
+		free(payload);
+		if(!sent) return SERVER_CONN_CLOSE;
+	}
+	return SERVER_CONN_OPEN;
+}
+
+// Takes what the client sent since the last poll and answers what it completes.
+static Server_Conn_State
+server_conn_read(Server_Cache* cache, Server_Conn* c) {
+	if(c->begin > 0) {
+		memmove(c->buffer, c->buffer + c->begin, c->end - c->begin);
+		c->end -= c->begin;
+		c->begin = 0;
+	}
+	// server_conn_serve grows the buffer for any request that does not fit
+	ssize_t n = recv(c->fd, c->buffer + c->end, c->capacity - c->end, MSG_DONTWAIT);
+	if(n < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+		return SERVER_CONN_OPEN;
+	if(n <= 0)
+		return SERVER_CONN_CLOSE;
+	c->end += (s32)n;
+	return server_conn_serve(cache, c);
+}
+
+static void
+server_conn_free(Server_Conn* c) {
+	close(c->fd);
+	free(c->buffer);
+	free(c);
+}
+
+int
+mop_server_run(const char* socket_path) {
+	struct sockaddr_un addr = {0};
+	if(strlen(socket_path) >= sizeof(addr.sun_path)) return -1;
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(listener < 0) return -1;
+	unlink(socket_path);
+	if(bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+		close(listener);
+		return -1;
+	}
+	// a client that goes away mid answer must not take the server with it
+	signal(SIGPIPE, SIG_IGN);
+
+	Server_Cache cache = {0};
+	server_cache_grow(&cache);
+
+	Server_Conn** conns = array_new(Server_Conn*);
+	struct pollfd* fds = array_new(struct pollfd);
+	bool running = true;
+	while(running) {
+		// the listener comes first, it is left out while there are enough connections
+		array_clear(fds);
+		struct pollfd listen_fd = { listener, POLLIN, 0 };
+		if(array_length(conns) < SERVER_CONNECTIONS) array_push(fds, listen_fd);
+		s32 first_conn = (s32)array_length(fds);
+		for(u64 i = 0; i < array_length(conns); ++i) {
+			struct pollfd conn_fd = { conns[i]->fd, POLLIN, 0 };
+			array_push(fds, conn_fd);
+		}
+		if(poll(fds, array_length(fds), -1) < 0) {
+			if(errno == EINTR) continue;
+			break;
+		}
+
+		// backwards, a closed connection is replaced by the last one
+		for(s32 i = (s32)array_length(conns) - 1; i >= 0 && running; --i) {
+			if(!fds[first_conn + i].revents) continue;
+			Server_Conn_State state = server_conn_read(&cache, conns[i]);
+			if(state == SERVER_CONN_OPEN) continue;
+			running = (state != SERVER_CONN_QUIT);
+			server_conn_free(conns[i]);
+			conns[i] = conns[array_length(conns) - 1];
+			array_length(conns)--;
+		}
+
+		if(running && first_conn > 0 && fds[0].revents) {
+			int fd = accept(listener, 0, 0);
+			if(fd < 0) {
+				if(errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE) continue;
+				break;
+			}
+			struct timeval timeout = { SERVER_SEND_MILLISECONDS / 1000, 0 };
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+			Server_Conn* c = calloc(1, sizeof(Server_Conn));
+			c->fd = fd;
+			c->capacity = 4096;
+			c->buffer = malloc(c->capacity);
+			array_push(conns, c);
+		}
+	}
+
+	for(u64 i = 0; i < array_length(conns); ++i) server_conn_free(conns[i]);
+	array_free(conns);
+	array_free(fds);
+	close(listener);
+	unlink(socket_path);
+	for(s32 i = 0; i < cache.slot_count; ++i) {
+		if(cache.slots[i]) server_file_free(cache.slots[i]);
+	}
+	free(cache.slots);
+	return 0;
+}
+
+#else
+
+int
+mop_server_run(const char* socket_path) {
+	return -1; // no unix domain sockets
+}
+
+#endif
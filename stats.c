@@ -0,0 +1,244 @@
+// Parser instrumentation, compiled in with -DMOP_INSTRUMENT.
+//
+// The rule wrappers generated from PARSER_RULES count calls, failures, tokens
+// consumed and cycles of every rule (memo hits are not calls). Nodes are
+// counted per kind by allocate_node and a few parser decisions have named
+// counters, see MOP_COUNT. Each thread collects into its own block,
+// mop_stats_dump sums them. Without MOP_INSTRUMENT all of it expands to
+// nothing.
+
+// also printed by mop_memory_dump, which is always compiled in
+static const char* node_kind_names[MO_AST_KIND_COUNT] = {
+	[MO_AST_EXPRESSION_PRIMARY_IDENTIFIER] = "EXPRESSION_PRIMARY_IDENTIFIER",
+	[MO_AST_EXPRESSION_PRIMARY_CONSTANT] = "EXPRESSION_PRIMARY_CONSTANT",
+	[MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL] = "EXPRESSION_PRIMARY_STRING_LITERAL",
+	[MO_AST_EXPRESSION_CONDITIONAL] = "EXPRESSION_CONDITIONAL",
+	[MO_AST_EXPRESSION_ASSIGNMENT] = "EXPRESSION_ASSIGNMENT",
+	[MO_AST_EXPRESSION_ARGUMENT_LIST] = "EXPRESSION_ARGUMENT_LIST",
+	[MO_AST_EXPRESSION_UNARY] = "EXPRESSION_UNARY",
+	[MO_AST_EXPRESSION_CAST] = "EXPRESSION_CAST",
+	[MO_AST_EXPRESSION_MULTIPLICATIVE] = "EXPRESSION_MULTIPLICATIVE",
+	[MO_AST_EXPRESSION_ADDITIVE] = "EXPRESSION_ADDITIVE",
+	[MO_AST_EXPRESSION_SHIFT] = "EXPRESSION_SHIFT",
+	[MO_AST_EXPRESSION_RELATIONAL] = "EXPRESSION_RELATIONAL",
+	[MO_AST_EXPRESSION_EQUALITY] = "EXPRESSION_EQUALITY",
+	[MO_AST_EXPRESSION_AND] = "EXPRESSION_AND",
+	[MO_AST_EXPRESSION_EXCLUSIVE_OR] = "EXPRESSION_EXCLUSIVE_OR",
+	[MO_AST_EXPRESSION_INCLUSIVE_OR] = "EXPRESSION_INCLUSIVE_OR",
+	[MO_AST_EXPRESSION_LOGICAL_AND] = "EXPRESSION_LOGICAL_AND",
+	[MO_AST_EXPRESSION_LOGICAL_OR] = "EXPRESSION_LOGICAL_OR",
+	[MO_AST_EXPRESSION_POSTFIX_UNARY] = "EXPRESSION_POSTFIX_UNARY",
+	[MO_AST_EXPRESSION_POSTFIX_BINARY] = "EXPRESSION_POSTFIX_BINARY",
+	[MO_AST_EXPRESSION_TERNARY] = "EXPRESSION_TERNARY",
+	[MO_AST_EXPRESSION_SIZEOF] = "EXPRESSION_SIZEOF",
+	[MO_AST_CONSTANT_FLOATING_POINT] = "CONSTANT_FLOATING_POINT",
+	[MO_AST_CONSTANT_INTEGER] = "CONSTANT_INTEGER",
+	[MO_AST_CONSTANT_ENUMARATION] = "CONSTANT_ENUMARATION",
+	[MO_AST_CONSTANT_CHARACTER] = "CONSTANT_CHARACTER",
+	[MO_AST_TYPE_NAME] = "TYPE_NAME",
+	[MO_AST_TYPE_INFO] = "TYPE_INFO",
+	[MO_AST_TYPE_POINTER] = "TYPE_POINTER",
+	[MO_AST_TYPE_ABSTRACT_DECLARATOR] = "TYPE_ABSTRACT_DECLARATOR",
+	[MO_AST_TYPE_DIRECT_ABSTRACT_DECLARATOR] = "TYPE_DIRECT_ABSTRACT_DECLARATOR",
+	[MO_AST_TYPE_STRUCT_DECLARATOR] = "TYPE_STRUCT_DECLARATOR",
+	[MO_AST_TYPE_STRUCT_DECLARATOR_BITFIELD] = "TYPE_STRUCT_DECLARATOR_BITFIELD",
+	[MO_AST_TYPE_STRUCT_DECLARATOR_LIST] = "TYPE_STRUCT_DECLARATOR_LIST",
+	[MO_AST_ENUMERATOR] = "ENUMERATOR",
+	[MO_AST_ENUMERATOR_LIST] = "ENUMERATOR_LIST",
+	[MO_AST_PARAMETER_LIST] = "PARAMETER_LIST",
+	[MO_AST_PARAMETER_DECLARATION] = "PARAMETER_DECLARATION",
+	[MO_AST_DIRECT_DECLARATOR] = "DIRECT_DECLARATOR",
+	[MO_AST_STRUCT_DECLARATION] = "STRUCT_DECLARATION",
+	[MO_AST_STRUCT_DECLARATION_LIST] = "STRUCT_DECLARATION_LIST",
+	[MO_AST_DECLARATION] = "DECLARATION",
+	[MO_AST_INIT_DECLARATOR] = "INIT_DECLARATOR",
+	[MO_AST_INITIALIZER_LIST] = "INITIALIZER_LIST",
+	[MO_AST_FUNCTION_DEFINITION] = "FUNCTION_DEFINITION",
+	[MO_AST_TRANSLATION_UNIT] = "TRANSLATION_UNIT",
+	[MO_AST_LAZY_BODY] = "LAZY_BODY",
+	[MO_AST_EXPRESSION_CHAIN] = "EXPRESSION_CHAIN",
+};
+
+#if defined(MOP_INSTRUMENT)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define MOP_COUNT(COUNTER) (stats_get()->counters[COUNTER]++)
+#define MOP_COUNT_NODE(KIND) (stats_get()->nodes[(KIND) < STATS_NODE_KINDS ? (KIND) : STATS_NODE_KINDS - 1]++)
+
+#define PARSER_COUNTERS(COUNTER) \
+	COUNTER(COUNTER_TYPE_NAME_PEEK, "( type-name ) lookahead") \
+	COUNTER(COUNTER_TYPE_NAME_PEEK_HIT, "( type-name ) lookahead taken") \
+	COUNTER(COUNTER_SPECIFIER_RETRY, "specifier/qualifier retry") \
+	COUNTER(COUNTER_REQUIRE_TOKEN, "require_token") \
+	COUNTER(COUNTER_REQUIRE_TOKEN_FAILED, "require_token failed") \
+	COUNTER(COUNTER_MEMO_HIT, "memo hit") \
+	COUNTER(COUNTER_MEMO_MISS, "memo miss") \
+	COUNTER(COUNTER_MEMO_EVICT, "memo eviction")
+
+#define COUNTER_ID(ID, DESC) ID,
+typedef enum {
+	PARSER_COUNTERS(COUNTER_ID)
+	COUNTER_COUNT
+} Parser_Counter;
+#undef COUNTER_ID
+
+#define STATS_NODE_KINDS 64
+
+typedef struct Parser_Stats_t {
+	u64 calls[RULE_COUNT];
+	u64 failures[RULE_COUNT];
+	s64 tokens[RULE_COUNT];      // inclusive of nested rules
+	u64 cycles[RULE_COUNT];      // inclusive of nested rules
+	u64 self_cycles[RULE_COUNT];
+	u64 nodes[STATS_NODE_KINDS];
+	u64 counters[COUNTER_COUNT];
+
+	u64 child_cycles; // spent in rules called by the running one
+	struct Parser_Stats_t* next;
+} Parser_Stats;
+
+static Parser_Stats* volatile stats_list;
+static THREAD_LOCAL Parser_Stats* stats_thread;
+
+// Blocks are never freed so the totals survive the threads that made them.
+static Parser_Stats*
+stats_get() {
+	if(stats_thread) return stats_thread;
+	Parser_Stats* s = calloc(1, sizeof(Parser_Stats));
+	do {
+		s->next = stats_list;
+	} while(!atomic_cas_ptr((void* volatile*)&stats_list, s->next, s));
+	stats_thread = s;
+	return s;
+}
+
+static u64
+stats_cycles() {
+#if defined(_MSC_VER) || defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (u64)ts.tv_sec * 1000000000ull + (u64)ts.tv_nsec;
+#endif
+}
+
+typedef struct {
+	Parser_Stats* stats;
+	u64           start;
+	u64           parent_child_cycles;
+	s32           index;
+} Rule_Frame;
+
+static void
+rule_enter(Rule_Frame* frame, Lexer* lexer) {
+	frame->stats = stats_get();
+	frame->parent_child_cycles = frame->stats->child_cycles;
+	frame->stats->child_cycles = 0;
+	frame->index = lexer->index;
+	frame->start = stats_cycles();
+}
+
+static void
+rule_exit(Rule_Frame* frame, Lexer* lexer, Parser_Rule rule, MO_Parser_Status status) {
+	u64 elapsed = stats_cycles() - frame->start;
+	Parser_Stats* s = frame->stats;
+	s->calls[rule]++;
+	if(status == MO_PARSER_STATUS_FATAL) s->failures[rule]++;
+	s->tokens[rule] += lexer->index - frame->index;
+	s->cycles[rule] += elapsed;
+	s->self_cycles[rule] += elapsed - MIN(elapsed, s->child_cycles);
+	s->child_cycles = frame->parent_child_cycles + elapsed;
+}
+
+#define RULE_STATS_ENTER(LEXER) Rule_Frame frame; rule_enter(&frame, (LEXER))
+#define RULE_STATS_EXIT(LEXER, RULE, STATUS) rule_exit(&frame, (LEXER), (RULE), (STATUS))
+// for rules run from the parse stack, whose frame lives in their Parse_Frame
+#define RULE_STATS_ENTER_AT(FRAME, LEXER) rule_enter((FRAME), (LEXER))
+#define RULE_STATS_EXIT_AT(FRAME, LEXER, RULE, STATUS) rule_exit((FRAME), (LEXER), (RULE), (STATUS))
+
+#define RULE_NAME(NAME, PARAMS, ARGS, MEMO) #NAME,
+static const char* rule_names[] = { PARSER_RULES(RULE_NAME) };
+#undef RULE_NAME
+
+#define COUNTER_NAME(ID, DESC) DESC,
+static const char* counter_names[] = { PARSER_COUNTERS(COUNTER_NAME) };
+#undef COUNTER_NAME
+
+void
+mop_stats_dump() {
+	Parser_Stats total = {0};
+	for(Parser_Stats* s = stats_list; s; s = s->next) {
+		for(s32 i = 0; i < RULE_COUNT; ++i) {
+			total.calls[i] += s->calls[i];
+			total.failures[i] += s->failures[i];
+			total.tokens[i] += s->tokens[i];
+			total.cycles[i] += s->cycles[i];
+			total.self_cycles[i] += s->self_cycles[i];
+		}
+		for(s32 i = 0; i < STATS_NODE_KINDS; ++i) total.nodes[i] += s->nodes[i];
+		for(s32 i = 0; i < COUNTER_COUNT; ++i) total.counters[i] += s->counters[i];
+	}
+
+	u64 result_copies = 0;
+	fprintf(stderr, "%-36s %10s %10s %12s %14s %14s\n", "rule", "calls", "failed", "tokens", "cycles", "self cycles");
+	for(s32 i = 0; i < RULE_COUNT; ++i) {
+		if(total.calls[i] == 0) continue;
+		result_copies += total.calls[i];
+		fprintf(stderr, "%-36s %10llu %10llu %12lld %14llu %14llu\n", rule_names[i],
+			total.calls[i], total.failures[i], total.tokens[i], total.cycles[i], total.self_cycles[i]);
+	}
+
+	fprintf(stderr, "\n%-36s %10s\n", "node kind", "allocated");
+	for(s32 i = 0; i < STATS_NODE_KINDS; ++i) {
+		if(total.nodes[i] == 0) continue;
+		if(i < MO_AST_KIND_COUNT && node_kind_names[i])
+			fprintf(stderr, "%-36s %10llu\n", node_kind_names[i], total.nodes[i]);
+		else
+			fprintf(stderr, "kind %-31d %10llu\n", i, total.nodes[i]);
+	}
+
+	fprintf(stderr, "\n%-36s %10s\n", "event", "count");
+	for(s32 i = 0; i < COUNTER_COUNT; ++i)
+		fprintf(stderr, "%-36s %10llu\n", counter_names[i], total.counters[i]);
+	// every rule returns its MO_Parser_Result by value
+	fprintf(stderr, "%-36s %10llu (%llu bytes)\n", "result copies", result_copies,
+		result_copies * (u64)sizeof(MO_Parser_Result));
+}
+
+// Not synchronized with parses running on other threads.
+void
+mop_stats_reset() {
+	for(Parser_Stats* s = stats_list; s; s = s->next) {
+		Parser_Stats* next = s->next;
+		memset(s, 0, sizeof(*s));
+		s->next = next;
+	}
+}
+
+#else
+
+#define MOP_COUNT(COUNTER)
+#define MOP_COUNT_NODE(KIND)
+#define RULE_STATS_ENTER(LEXER)
+#define RULE_STATS_EXIT(LEXER, RULE, STATUS)
+#define RULE_STATS_ENTER_AT(FRAME, LEXER)
+#define RULE_STATS_EXIT_AT(FRAME, LEXER, RULE, STATUS)
+
+void
+mop_stats_dump() {
+	fprintf(stderr, "moparser: statistics need a build with -DMOP_INSTRUMENT\n");
+}
+
+void
+mop_stats_reset() {
+}
+
+#endif
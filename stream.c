@@ -0,0 +1,323 @@
+// Push parsing of input that arrives in pieces, see mop_stream_begin.
+//
+// The bytes fed in are first only scanned for where top-level declarations
+// end: a ';' outside of any group, or the '}' that closes a function body,
+// the cuts mop_parse_translation_unit_parallel makes on tokens. The scan keeps
+// its state, open comments, literals and groups, from one piece to the next,
+// so tokens, comments and literals may be split anywhere. Whenever a piece
+// completes declarations, the text up to the last cut is lexed and parsed and
+// each declaration goes to the callback, then that text and its tokens are
+// dropped. Only the unfinished tail stays buffered, so a long stream needs no
+// more memory than its longest declaration.
+
+// initial size of the buffer for the unfinished tail
+#define STREAM_TEXT_SIZE 4096
+
+typedef enum {
+	STREAM_CODE = 0,
+	STREAM_SLASH,         // after a '/' that may start a comment
+	STREAM_LINE_COMMENT,
+	STREAM_BLOCK_COMMENT,
+	STREAM_BLOCK_STAR,    // after a '*' that may end the comment
+	STREAM_LITERAL,       // string or character literal, quote is its delimiter
+	STREAM_ESCAPE,        // after a '\' in a literal
+} Stream_Scan;
+
+struct MO_Stream_t {
+	Lexer*             lexer;
+	MO_Stream_Callback callback;
+	void*              user;
+
+	u8*   text;     // the bytes after the last cut, one spare byte for the nul
+	s32   length;
+	s32   capacity;
+	s32   scanned;  // bytes of text the scan has seen
+	s32   cut;      // one past the last complete declaration in text, 0 for none
+	s32   pending;  // a cut that waits for the end of its line, see stream_cut
+	s32   comment;  // where the open block comment started
+
+	u8    scan;     // Stream_Scan
+	u8    quote;
+	u8    last;     // last character of code, comments and blanks are skipped
+	bool  body;     // the group open at depth 0 is a function body
+	s32   depth;    // open ( [ {
+
+	s32*             open_groups; // scratch space of the lexer
+	MO_Parser_Result failure;     // the first error with a copy of its message, every later call returns it
+	Parse_Mark       start;       // where the memory report of the whole stream began, with lexer->memory set
+};
+
+static void
+stream_cut(MO_Stream* stream, s32 at) {
+	// with MO_PARSER_FLAG_COMMENTS a comment after the declaration on the same
+	// line goes with it, as its trailing doc
+	if(stream->lexer->parser_flags & MO_PARSER_FLAG_COMMENTS) stream->pending = at;
+	else stream->cut = at;
+}
+
+static void
+stream_scan(MO_Stream* stream) {
+	for(s32 i = stream->scanned; i < stream->length; ++i) {
+		u8 c = stream->text[i];
+		switch(stream->scan) {
+			case STREAM_CODE: break;
+			case STREAM_SLASH:
+				if(c == '/') {
+					stream->scan = STREAM_LINE_COMMENT;
+					continue;
+				}
+				if(c == '*') {
+					stream->scan = STREAM_BLOCK_COMMENT;
+					stream->comment = i - 1;
+					continue;
+				}
+				// a division, c is code again
+				stream->scan = STREAM_CODE;
+				stream->last = '/';
+				break;
+			case STREAM_LINE_COMMENT:
+				if(c != '\n') continue;
+				// the newline is code again
+				stream->scan = STREAM_CODE;
+				break;
+			case STREAM_BLOCK_COMMENT:
+				if(c == '*') stream->scan = STREAM_BLOCK_STAR;
+				continue;
+			case STREAM_BLOCK_STAR:
+				if(c == '/') stream->scan = STREAM_CODE;
+				else if(c != '*') stream->scan = STREAM_BLOCK_COMMENT;
+				continue;
+			case STREAM_LITERAL:
+				if(c == '\\') {
+					stream->scan = STREAM_ESCAPE;
+				} else if(c == stream->quote) {
+					stream->scan = STREAM_CODE;
+					stream->last = c;
+				}
+				continue;
+			case STREAM_ESCAPE:
+				stream->scan = STREAM_LITERAL;
+				continue;
+		}
+
+		if(stream->pending && c != '/' && c != '\n' && !(char_class[c] & CHAR_SPACE)) {
+			// more code on the line of the cut
+			stream->cut = stream->pending;
+			stream->pending = 0;
+		}
+		switch(c) {
+			case '/':
+				stream->scan = STREAM_SLASH;
+				continue;
+			case '"': case '\'':
+				stream->scan = STREAM_LITERAL;
+				stream->quote = c;
+				continue;
+			case '{':
+				if(stream->depth == 0) stream->body = (stream->last == ')');
+				stream->depth++;
+				break;
+			case '(': case '[':
+				stream->depth++;
+				break;
+			case '}':
+				// unbalanced closers are left to the parser
+				if(stream->depth > 0) stream->depth--;
+				if(stream->depth == 0 && stream->body) {
+					stream->body = false;
+					stream_cut(stream, i + 1);
+				}
+				break;
+			case ')': case ']':
+				if(stream->depth > 0) stream->depth--;
+				break;
+			case ';':
+				if(stream->depth == 0) stream_cut(stream, i + 1);
+				break;
+			case '\n':
+				if(stream->pending) {
+					stream->cut = i + 1;
+					stream->pending = 0;
+				}
+				continue;
+			default:
+				if(char_class[c] & CHAR_SPACE) continue;
+				break;
+		}
+		stream->last = c;
+	}
+	stream->scanned = stream->length;
+}
+
+static MO_Parser_Result
+stream_fail(MO_Stream* stream, MO_Parser_Result res) {
+	stream->failure.status = res.status;
+	if(res.error_message)
+		stream->failure.error_message = mem_strdup(stream->lexer->allocator, res.error_message);
+	return stream->failure;
+}
+
+// Lexes and parses the first end bytes of text, which hold whole declarations
+// unless the stream ends, and moves the rest to the front.
+static MO_Parser_Result
+stream_parse(MO_Stream* stream, s32 end) {
+	Lexer* lexer = stream->lexer;
+	MO_Parser_Result res = {0};
+	u64 trace = mop_trace_begin();
+
+	// the token indices start over, nothing the memo holds is valid anymore
+	if(lexer->tokens) {
+		array_clear(lexer->tokens);
+		array_clear(lexer->matching);
+	}
+	if(lexer->comments) array_clear(lexer->comments);
+	if(lexer->memo) memo_clear(lexer->memo);
+
+	u8 saved = stream->text[end];
+	stream->text[end] = 0;
+	lexer_continue(lexer, (char*)stream->text, end, &stream->open_groups);
+	stream->text[end] = saved;
+	// unless the stream ends, errors at the EOF token are where the text was cut
+	Token* eof = &lexer->tokens[array_length(lexer->tokens) - 1];
+	eof->line = lexer->line;
+	eof->column = lexer->column;
+	if(lexer->memory) memory_tokens(lexer);
+
+	Parse_Mark mark = parse_limits_begin(lexer);
+	while(lexer_peek(lexer)->type != MO_TOKEN_EOF) {
+		if(lexer_peek(lexer)->type == ';') {
+			// stray ; at file scope
+			lexer_next(lexer);
+			continue;
+		}
+		// what went to the callback stays when the budget runs out
+		if(mark.release) {
+			mark.arena = arena_mark(lexer->arena);
+			if(lexer->memory) mark.node_bytes = lexer->memory->parts[MO_MEMORY_NODES].used;
+		}
+		MO_Parser_Result decl = parse_limits_end(lexer, &mark, parse_declaration(lexer));
+		if(decl.status != MO_PARSER_STATUS_OK) {
+			res = stream_fail(stream, decl);
+			break;
+		}
+		// before the callback may take the declaration apart
+		if(lexer->memory) memory_lists(lexer, decl.node);
+		stream->callback((MO_Lexer*)lexer, decl.node, stream->user);
+	}
+
+	memmove(stream->text, stream->text + end, stream->length - end);
+	stream->length -= end;
+	stream->scanned -= end;
+	stream->comment -= end;
+	if(stream->pending) stream->pending -= end;
+	stream->cut = 0;
+
+	mop_trace_end("parse stream", lexer->filename, trace);
+	return res;
+}
+
+static void
+stream_free(MO_Stream* stream) {
+	Lexer* lexer = stream->lexer;
+	MO_Allocator* allocator = lexer->allocator;
+
+	// the tokens were the stream's, the nodes stay where the lexer put them
+	if(lexer->tokens) array_free(lexer->tokens);
+	if(lexer->matching) array_free(lexer->matching);
+	if(lexer->comments) array_free(lexer->comments);
+	lexer->tokens = 0;
+	lexer->matching = 0;
+	lexer->comments = 0;
+	lexer->index = 0;
+
+	array_free(stream->open_groups);
+	mem_free(allocator, stream->text, stream->capacity);
+	if(stream->failure.error_message)
+		mem_free(allocator, (void*)stream->failure.error_message, strlen(stream->failure.error_message) + 1);
+	mem_free(allocator, stream, sizeof(MO_Stream));
+}
+
+MO_Stream*
+mop_stream_begin(MO_Lexer* lexer, MO_Stream_Callback callback, void* user) {
+	MO_Stream* stream = mem_alloc(lexer->allocator, sizeof(MO_Stream));
+	stream->lexer = (Lexer*)lexer;
+	stream->callback = callback;
+	stream->user = user;
+	stream->capacity = STREAM_TEXT_SIZE;
+	stream->text = mem_alloc(lexer->allocator, stream->capacity);
+	stream->open_groups = array_new_with(s32, lexer->allocator);
+
+	lexer->tokens = 0;
+	lexer->matching = 0;
+	lexer->comments = 0;
+	lexer->index = 0;
+	lexer->line = 0;
+	lexer->column = 0;
+	// one report for the whole stream, the tokens are those of the latest piece
+	if(lexer->memory) memory_begin((Lexer*)lexer, &stream->start);
+	return stream;
+}
+
+MO_Parser_Result
+mop_stream_feed(MO_Stream* stream, const char* bytes, int length) {
+	MO_Parser_Result res = {0};
+	if(stream->failure.status != MO_PARSER_STATUS_OK)
+		return stream->failure;
+	if(length <= 0)
+		return res;
+
+	Lexer* lexer = stream->lexer;
+	if(stream->length + length + 1 > stream->capacity) {
+		s32 capacity = stream->capacity;
+		while(stream->length + length + 1 > capacity) capacity *= 2;
+		u8* text = mem_alloc(lexer->allocator, capacity);
+		memcpy(text, stream->text, stream->length);
+		mem_free(lexer->allocator, stream->text, stream->capacity);
+		stream->text = text;
+		stream->capacity = capacity;
+	}
+	memcpy(stream->text + stream->length, bytes, length);
+	stream->length += length;
+
+	stream_scan(stream);
+	if(stream->cut > 0)
+		res = stream_parse(stream, stream->cut);
+	if(res.status == MO_PARSER_STATUS_OK && lexer->max_bytes > 0 && (size_t)stream->length > lexer->max_bytes) {
+		// a declaration that does not end within the budget
+		parse_limit_hit(lexer, MO_LIMIT_BYTES);
+		res = parse_limit_error(lexer);
+		res.status = MO_PARSER_STATUS_LIMIT;
+		res = stream_fail(stream, res);
+	}
+	return res;
+}
+
+MO_Parser_Result
+mop_stream_end(MO_Stream* stream) {
+	Lexer* lexer = stream->lexer;
+	MO_Parser_Result res = {0};
+
+	if(stream->failure.status != MO_PARSER_STATUS_OK) {
+		res = stream->failure;
+	} else if(stream->scan == STREAM_BLOCK_COMMENT || stream->scan == STREAM_BLOCK_STAR) {
+		// the lexer needs comments closed, what comes before the comment still has to parse
+		res = stream_parse(stream, stream->comment);
+		if(res.status == MO_PARSER_STATUS_OK) {
+			res.status = MO_PARSER_STATUS_FATAL;
+			sprintf(parser_error_buffer, "%s:%d:%d: Syntax error: unterminated comment\n",
+				lexer->filename, lexer->line, lexer->column);
+			res.error_message = parser_error_buffer;
+		}
+	} else {
+		res = stream_parse(stream, stream->length);
+	}
+
+	// the message has to outlive the stream
+	if(res.error_message && res.error_message != parser_error_buffer) {
+		snprintf(parser_error_buffer, sizeof(parser_error_buffer), "%s", res.error_message);
+		res.error_message = parser_error_buffer;
+	}
+	if(lexer->memory) memory_finish(lexer, &stream->start, res);
+	stream_free(stream);
+	return res;
+}
@@ -0,0 +1,126 @@
+// Chrome trace_event timeline of the lex, parse and print phases.
+//
+// mop_trace_start turns recording on. Each thread records complete ("X")
+// events into its own ring buffer, only the owning thread writes to it so no
+// locks are taken; when a buffer is full the oldest events are overwritten.
+// The JSON opens in chrome://tracing and Perfetto, one track per thread.
+
+#define TRACE_RING_SIZE     8192 // events per thread, power of two
+#define TRACE_DETAIL_LENGTH 56
+
+typedef struct {
+	const char* name;
+	u64         begin; // ns since mop_trace_start
+	u64         end;
+	char        detail[TRACE_DETAIL_LENGTH];
+} Trace_Event;
+
+typedef struct Trace_Buffer_t {
+	Trace_Event            events[TRACE_RING_SIZE];
+	volatile u64           count; // events ever recorded, bumped after the event is written
+	s32                    thread_id;
+	struct Trace_Buffer_t* next;
+} Trace_Buffer;
+
+static volatile bool         trace_enabled;
+static u64                   trace_epoch;
+static char                  trace_filename[512];
+static Trace_Buffer* volatile trace_buffers;
+static volatile s32          trace_thread_count;
+static THREAD_LOCAL Trace_Buffer* trace_thread;
+
+// Buffers are never freed so that threads that already exited still show up.
+static Trace_Buffer*
+trace_buffer_get() {
+	if(trace_thread) return trace_thread;
+	Trace_Buffer* b = calloc(1, sizeof(Trace_Buffer));
+	if(!b) return 0;
+	b->thread_id = atomic_add_s32(&trace_thread_count, 1) + 1;
+	do {
+		b->next = trace_buffers;
+	} while(!atomic_cas_ptr((void* volatile*)&trace_buffers, b->next, b));
+	trace_thread = b;
+	return b;
+}
+
+static void
+trace_write_string(FILE* out, const char* str) {
+	fputc('"', out);
+	for(; *str; ++str) {
+		u8 c = (u8)*str;
+		if(c == '"' || c == '\\') fprintf(out, "\\%c", c);
+		else if(c < 0x20) fprintf(out, "\\u%04x", c);
+		else fputc(c, out);
+	}
+	fputc('"', out);
+}
+
+static void
+trace_atexit() {
+	mop_trace_write(trace_filename);
+}
+
+void
+mop_trace_start(const char* filename) {
+	if(trace_enabled) return;
+	snprintf(trace_filename, sizeof(trace_filename), "%s", filename);
+	trace_epoch = platform_time_ns();
+	trace_enabled = true;
+	atexit(trace_atexit);
+}
+
+unsigned long long
+mop_trace_begin() {
+	if(!trace_enabled) return 0;
+	return platform_time_ns() - trace_epoch + 1; // 0 is reserved for off
+}
+
+void
+mop_trace_end(const char* name, const char* detail, unsigned long long begin) {
+	if(!begin) return;
+	u64 end = platform_time_ns() - trace_epoch + 1;
+	Trace_Buffer* b = trace_buffer_get();
+	if(!b) return;
+
+	Trace_Event* e = &b->events[b->count & (TRACE_RING_SIZE - 1)];
+	e->name = name;
+	e->begin = begin;
+	e->end = end;
+	snprintf(e->detail, sizeof(e->detail), "%s", (detail) ? detail : "");
+	memory_barrier(); // the writer only reads events below count
+	b->count++;
+}
+
+int
+mop_trace_write(const char* filename) {
+	FILE* out = fopen(filename, "wb");
+	if(!out) return -1;
+
+	fprintf(out, "{\"traceEvents\":[\n");
+	bool first = true;
+	for(Trace_Buffer* b = trace_buffers; b; b = b->next) {
+		fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+			(first) ? "" : ",\n", b->thread_id, b->thread_id);
+		first = false;
+
+		u64 count = b->count;
+		u64 i = (count > TRACE_RING_SIZE) ? count - TRACE_RING_SIZE : 0;
+		for(; i < count; ++i) {
+			Trace_Event* e = &b->events[i & (TRACE_RING_SIZE - 1)];
+			// timestamps are in microseconds
+			fprintf(out, ",\n{\"name\":");
+			trace_write_string(out, e->name);
+			fprintf(out, ",\"cat\":\"moparser\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+				b->thread_id, (double)e->begin / 1000.0, (double)(e->end - e->begin) / 1000.0);
+			if(e->detail[0]) {
+				fprintf(out, ",\"args\":{\"detail\":");
+				trace_write_string(out, e->detail);
+				fputc('}', out);
+			}
+			fputc('}', out);
+		}
+	}
+	fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+	fclose(out);
+	return 0;
+}
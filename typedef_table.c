@@ -0,0 +1,116 @@
+// Set of typedef names visible to the parser.
+//
+// Names are copied into the table so it can outlive the source text it was
+// filled from (streams, caches). Lookups use open addressing over a power of
+// two slot array that holds name index + 1, 0 marks an empty slot.
+
+struct MO_Typedef_Table_t {
+	char** names;
+	s32*   lengths;
+	u64*   hashes;
+	s32*   slots;
+	s32    slot_count;
+
+	MO_Allocator* allocator;
+};
+
+static u64
+typedef_name_hash(const u8* data, s32 length) {
+	// FNV-1a
+	u64 hash = 14695981039346656037ULL;
+	for(s32 i = 0; i < length; ++i) {
+		hash ^= data[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+static MO_Typedef_Table*
+typedef_table_new(MO_Allocator* allocator) {
+	MO_Typedef_Table* table = mem_alloc(allocator, sizeof(MO_Typedef_Table));
+	table->allocator = allocator;
+	table->names = array_new_with(char*, allocator);
+	table->lengths = array_new_with(s32, allocator);
+	table->hashes = array_new_with(u64, allocator);
+	table->slot_count = 64;
+	table->slots = mem_alloc(allocator, table->slot_count * sizeof(s32));
+	return table;
+}
+
+static void
+typedef_table_free(MO_Typedef_Table* table) {
+	if(!table) return;
+	for(u64 i = 0; i < array_length(table->names); ++i)
+		mem_free(table->allocator, table->names[i], table->lengths[i] + 1);
+	array_free(table->names);
+	array_free(table->lengths);
+	array_free(table->hashes);
+	mem_free(table->allocator, table->slots, table->slot_count * sizeof(s32));
+	mem_free(table->allocator, table, sizeof(MO_Typedef_Table));
+}
+
+// Returns the slot where the name is or should be inserted
+static s32
+typedef_table_find(MO_Typedef_Table* table, const u8* data, s32 length, u64 hash) {
+	s32 mask = table->slot_count - 1;
+	s32 slot = (s32)(hash & mask);
+	while(table->slots[slot]) {
+		s32 index = table->slots[slot] - 1;
+		if(table->hashes[index] == hash && table->lengths[index] == length &&
+			memcmp(table->names[index], data, length) == 0)
+		{
+			return slot;
+		}
+		slot = (slot + 1) & mask;
+	}
+	return slot;
+}
+
+static bool
+typedef_table_contains(MO_Typedef_Table* table, const u8* data, s32 length) {
+	if(!table) return false;
+	u64 hash = typedef_name_hash(data, length);
+	return table->slots[typedef_table_find(table, data, length, hash)] != 0;
+}
+
+static void
+typedef_table_add(MO_Typedef_Table* table, const u8* data, s32 length) {
+	u64 hash = typedef_name_hash(data, length);
+	s32 slot = typedef_table_find(table, data, length, hash);
+	if(table->slots[slot]) return;
+
+	char* name = mem_alloc(table->allocator, length + 1);
+	memcpy(name, data, length);
+	array_push(table->names, name);
+	array_push(table->lengths, length);
+	array_push(table->hashes, hash);
+	table->slots[slot] = (s32)array_length(table->names);
+
+	// keep the load factor under 1/2
+	if(array_length(table->names) * 2 > (u64)table->slot_count) {
+		mem_free(table->allocator, table->slots, table->slot_count * sizeof(s32));
+		table->slot_count *= 2;
+		table->slots = mem_alloc(table->allocator, table->slot_count * sizeof(s32));
+		s32 mask = table->slot_count - 1;
+		for(u64 i = 0; i < array_length(table->names); ++i) {
+			s32 s = (s32)(table->hashes[i] & mask);
+			while(table->slots[s]) s = (s + 1) & mask;
+			table->slots[s] = (s32)i + 1;
+		}
+	}
+}
+
+MO_Typedef_Table*
+mop_typedef_table_new(MO_Allocator* allocator) {
+	return typedef_table_new(allocator);
+}
+
+void
+mop_typedef_table_free(MO_Typedef_Table* table) {
+	typedef_table_free(table);
+}
+
+void
+mop_typedef_table_add(MO_Typedef_Table* table, const char* name, int length) {
+	typedef_table_add(table, (const u8*)name, (length < 0) ? (s32)strlen(name) : length);
+}
@@ -0,0 +1,988 @@
+// Bytecode compiler and register VM for expressions, see mop_program_compile.
+//
+// Types are resolved at compile time from the bindings, every value is either
+// a long long or a double, so each instruction works on one type and the VM
+// never looks at a tag. Registers are untyped 8 byte slots.
+//
+// The compiler hands registers out like a stack: a subtree leaves its result
+// in the first register that was free when it started and everything above
+// it is free again afterwards. Subtrees whose operands are all constants are
+// folded with the same operator definitions the VM uses, constant right
+// operands are encoded in the instruction (the K forms), && || and ?: jump
+// over the code of the operand they do not evaluate.
+
+#define VM_MAX_REGISTERS 256
+
+typedef union {
+	s64 i;
+	r64 f;
+} Vm_Register;
+
+typedef struct {
+	u8  op;
+	u8  dst;
+	u8  a;
+	u8  b;
+	s32 imm; // constant, binding, jump target or cast width
+} Vm_Instruction;
+
+// Operators on two long longs, overflow wraps and shift counts are taken modulo 64.
+#define VM_INT_OPS \
+	INT_OP(ADD, (s64)((u64)x + (u64)y)) \
+	INT_OP(SUB, (s64)((u64)x - (u64)y)) \
+	INT_OP(MUL, (s64)((u64)x * (u64)y)) \
+	INT_OP(SHL, (s64)((u64)x << (y & 63))) \
+	INT_OP(SHR, x >> (y & 63)) \
+	INT_OP(AND, x & y) \
+	INT_OP(OR,  x | y) \
+	INT_OP(XOR, x ^ y) \
+	INT_OP(LT,  x < y) \
+	INT_OP(LE,  x <= y) \
+	INT_OP(GT,  x > y) \
+	INT_OP(GE,  x >= y) \
+	INT_OP(EQ,  x == y) \
+	INT_OP(NE,  x != y)
+
+// Operators on two doubles with a double result
+#define VM_FLOAT_OPS \
+	FLOAT_OP(ADD, x + y) \
+	FLOAT_OP(SUB, x - y) \
+	FLOAT_OP(MUL, x * y) \
+	FLOAT_OP(DIV, x / y)
+
+// Operators on two doubles with a long long result
+#define VM_FLOAT_COMPARE_OPS \
+	FLOAT_COMPARE_OP(LT, x < y) \
+	FLOAT_COMPARE_OP(LE, x <= y) \
+	FLOAT_COMPARE_OP(GT, x > y) \
+	FLOAT_COMPARE_OP(GE, x >= y) \
+	FLOAT_COMPARE_OP(EQ, x == y) \
+	FLOAT_COMPARE_OP(NE, x != y)
+
+// Everything else. Binary operators come in pairs, the register form is followed
+// by the K form which takes its right operand from the constants.
+#define VM_OPS \
+	OP(MOV)   /* dst = a */ \
+	OP(CONST) /* dst = constants[imm] */ \
+	OP(LOAD)  /* dst = values[imm] */ \
+	OP(INDEX) /* dst = values[imm].array[a], fails out of range */ \
+	OP(I2F) \
+	OP(F2I) \
+	OP(TRUNC) /* dst = a cut to imm bits, zero extended when b is set */ \
+	OP(NEG_I) \
+	OP(NEG_F) \
+	OP(NOT_I) /* ~ */ \
+	OP(LNOT_I) \
+	OP(LNOT_F) \
+	OP(BOOL_I) \
+	OP(BOOL_F) \
+	OP(DIV_I) OP(DIV_IK) \
+	OP(MOD_I) OP(MOD_IK) \
+	OP(JMP)   /* to imm */ \
+	OP(JZ)    /* to imm when a is 0 */ \
+	OP(JNZ) \
+	OP(RET)
+
+typedef enum {
+#define OP(NAME) VM_##NAME,
+	VM_OPS
+#undef OP
+#define INT_OP(NAME, EXPR) VM_##NAME##_I, VM_##NAME##_IK,
+	VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) VM_##NAME##_F, VM_##NAME##_FK,
+	VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) VM_##NAME##_F, VM_##NAME##_FK,
+	VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+	VM_OP_COUNT,
+} Vm_Op;
+
+// Machine code made by mop_program_jit
+typedef MO_Eval_Status (*Vm_Native)(const MO_Value* values, MO_Value* result, const Vm_Register* constants);
+
+struct MO_Program_t {
+	MO_Allocator*   allocator;
+	Vm_Native       native;      // runs instead of the bytecode when set
+	size_t          native_size;
+	Vm_Instruction* code;
+	s32             code_length;
+	Vm_Register*    constants;
+	s32             constant_count;
+	s32             register_count;
+	s32             binding_count;
+	MO_Value_Type   result_type;
+};
+
+// Compiler
+
+typedef enum {
+	VM_OPERAND_REGISTER = 0,
+	VM_OPERAND_CONSTANT,
+} Vm_Operand_Kind;
+
+typedef struct {
+	Vm_Operand_Kind kind;
+	MO_Value_Type   type;    // MO_VALUE_INT or MO_VALUE_FLOAT
+	bool            is_bool; // known to be 0 or 1
+	s32             index;   // register
+	Vm_Register     value;   // constant
+} Vm_Operand;
+
+typedef struct {
+	Vm_Instruction*   code;      // light_array
+	Vm_Register*      constants; // light_array
+	const MO_Binding* bindings;
+	s32               binding_count;
+	s32               top;       // first free register
+	s32               register_count;
+	bool              failed;    // the message is in parser_error_buffer
+} Vm_Compiler;
+
+static void
+vm_error(Vm_Compiler* c, const char* fmt, ...) {
+	if(c->failed) return; // keep the first error
+	c->failed = true;
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(parser_error_buffer, sizeof(parser_error_buffer), fmt, args);
+	va_end(args);
+}
+
+static s32
+vm_emit(Vm_Compiler* c, Vm_Op op, s32 dst, s32 a, s32 b, s32 imm) {
+	Vm_Instruction in = { (u8)op, (u8)dst, (u8)a, (u8)b, imm };
+	array_push(c->code, in);
+	return (s32)array_length(c->code) - 1;
+}
+
+static s32
+vm_constant(Vm_Compiler* c, Vm_Register value) {
+	for(s32 i = 0; i < array_length(c->constants); ++i) {
+		if(c->constants[i].i == value.i) return i;
+	}
+	array_push(c->constants, value);
+	return (s32)array_length(c->constants) - 1;
+}
+
+static s32
+vm_register(Vm_Compiler* c) {
+	if(c->top >= VM_MAX_REGISTERS) {
+		vm_error(c, "expression needs more than %d registers", VM_MAX_REGISTERS);
+		return 0;
+	}
+	s32 r = c->top++;
+	c->register_count = MAX(c->register_count, c->top);
+	return r;
+}
+
+static Vm_Operand
+vm_int_constant(s64 value) {
+	Vm_Operand o = { VM_OPERAND_CONSTANT, MO_VALUE_INT };
+	o.value.i = value;
+	o.is_bool = (value == 0 || value == 1);
+	return o;
+}
+
+static Vm_Operand
+vm_float_constant(r64 value) {
+	Vm_Operand o = { VM_OPERAND_CONSTANT, MO_VALUE_FLOAT };
+	o.value.f = value;
+	return o;
+}
+
+// Puts the operand in register dst.
+static void
+vm_to_register(Vm_Compiler* c, Vm_Operand* o, s32 dst) {
+	if(o->kind == VM_OPERAND_CONSTANT) {
+		vm_emit(c, VM_CONST, dst, 0, 0, vm_constant(c, o->value));
+	} else if(o->index != dst) {
+		vm_emit(c, VM_MOV, dst, o->index, 0, 0);
+	}
+	o->kind = VM_OPERAND_REGISTER;
+	o->index = dst;
+}
+
+static void
+vm_convert(Vm_Compiler* c, Vm_Operand* o, MO_Value_Type type) {
+	if(o->type == type) return;
+	if(o->kind == VM_OPERAND_CONSTANT) {
+		if(type == MO_VALUE_FLOAT) o->value.f = (r64)o->value.i;
+		else o->value.i = (s64)o->value.f;
+	} else {
+		vm_emit(c, (type == MO_VALUE_FLOAT) ? VM_I2F : VM_F2I, o->index, o->index, 0, 0);
+	}
+	o->type = type;
+	o->is_bool = false;
+}
+
+// Puts 0 or 1 in register dst.
+static void
+vm_to_bool(Vm_Compiler* c, Vm_Operand* o, s32 dst) {
+	if(o->kind == VM_OPERAND_CONSTANT) {
+		*o = vm_int_constant((o->type == MO_VALUE_FLOAT) ? (o->value.f != 0.0) : (o->value.i != 0));
+		vm_to_register(c, o, dst);
+		return;
+	}
+	if(o->is_bool) {
+		vm_to_register(c, o, dst);
+		return;
+	}
+	vm_emit(c, (o->type == MO_VALUE_FLOAT) ? VM_BOOL_F : VM_BOOL_I, dst, o->index, 0, 0);
+	o->index = dst;
+	o->type = MO_VALUE_INT;
+	o->is_bool = true;
+}
+
+// Whether the right operand of op is a constant
+static bool
+vm_k_form(Vm_Op op) {
+	switch(op) {
+		case VM_DIV_IK:
+		case VM_MOD_IK:
+#define INT_OP(NAME, EXPR) case VM_##NAME##_IK:
+		VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) case VM_##NAME##_FK:
+		VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) case VM_##NAME##_FK:
+		VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+			return true;
+		default:
+			return false;
+	}
+}
+
+// Evaluates a binary operator on constants, false when it has to be left to the VM
+static bool
+vm_fold(Vm_Op op, Vm_Register x_value, Vm_Register y_value, Vm_Register* result) {
+	switch(op) {
+#define INT_OP(NAME, EXPR) case VM_##NAME##_I: { s64 x = x_value.i, y = y_value.i; result->i = EXPR; } return true;
+		VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) case VM_##NAME##_F: { r64 x = x_value.f, y = y_value.f; result->f = EXPR; } return true;
+		VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) case VM_##NAME##_F: { r64 x = x_value.f, y = y_value.f; result->i = EXPR; } return true;
+		VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+		case VM_DIV_I:
+			if(y_value.i == 0) return false; // reported when evaluated
+			result->i = (y_value.i == -1) ? (s64)(0 - (u64)x_value.i) : x_value.i / y_value.i;
+			return true;
+		case VM_MOD_I:
+			if(y_value.i == 0) return false;
+			result->i = (y_value.i == -1) ? 0 : x_value.i % y_value.i;
+			return true;
+		default: return false;
+	}
+}
+
+static bool
+vm_is_compare(Vm_Op op) {
+	switch(op) {
+		case VM_LT_I: case VM_LE_I: case VM_GT_I: case VM_GE_I: case VM_EQ_I: case VM_NE_I:
+		case VM_LT_F: case VM_LE_F: case VM_GT_F: case VM_GE_F: case VM_EQ_F: case VM_NE_F:
+			return true;
+		default: return false;
+	}
+}
+
+// The operator that gives the same result with the operands swapped, or -1
+static s32
+vm_swapped(Vm_Op op) {
+	switch(op) {
+		case VM_ADD_I: case VM_MUL_I: case VM_AND_I: case VM_OR_I: case VM_XOR_I:
+		case VM_EQ_I: case VM_NE_I: case VM_ADD_F: case VM_MUL_F: case VM_EQ_F: case VM_NE_F:
+			return op;
+		case VM_LT_I: return VM_GT_I;
+		case VM_LE_I: return VM_GE_I;
+		case VM_GT_I: return VM_LT_I;
+		case VM_GE_I: return VM_LE_I;
+		case VM_LT_F: return VM_GT_F;
+		case VM_LE_F: return VM_GE_F;
+		case VM_GT_F: return VM_LT_F;
+		case VM_GE_F: return VM_LE_F;
+		default: return -1;
+	}
+}
+
+// Register form of the operator, or -1 when it does not apply to the type
+static s32
+vm_binary_op(MO_Binary_Operator bo, MO_Value_Type type) {
+	bool f = (type == MO_VALUE_FLOAT);
+	switch((s32)bo) {
+		case '+': return f ? VM_ADD_F : VM_ADD_I;
+		case '-': return f ? VM_SUB_F : VM_SUB_I;
+		case '*': return f ? VM_MUL_F : VM_MUL_I;
+		case '/': return f ? VM_DIV_F : VM_DIV_I;
+		case '<': return f ? VM_LT_F : VM_LT_I;
+		case '>': return f ? VM_GT_F : VM_GT_I;
+		case MO_TOKEN_LESS_EQUAL:    return f ? VM_LE_F : VM_LE_I;
+		case MO_TOKEN_GREATER_EQUAL: return f ? VM_GE_F : VM_GE_I;
+		case MO_TOKEN_EQUAL_EQUAL:   return f ? VM_EQ_F : VM_EQ_I;
+		case MO_TOKEN_NOT_EQUAL:     return f ? VM_NE_F : VM_NE_I;
+		case '%': return f ? -1 : VM_MOD_I;
+		case '&': return f ? -1 : VM_AND_I;
+		case '|': return f ? -1 : VM_OR_I;
+		case '^': return f ? -1 : VM_XOR_I;
+		case MO_TOKEN_BITSHIFT_LEFT:  return f ? -1 : VM_SHL_I;
+		case MO_TOKEN_BITSHIFT_RIGHT: return f ? -1 : VM_SHR_I;
+		default: return -1;
+	}
+}
+
+// Writes the member path of an identifier, x.y or x->y chain as "x.y" into
+// buffer, false when node is something else.
+static bool
+vm_path(MO_Ast* node, char* buffer, s32 size, s32* length) {
+	MO_Token* name;
+	if(node->kind == MO_AST_EXPRESSION_POSTFIX_BINARY &&
+		(node->expression_postfix_binary.po == MO_POSTFIX_DOT || node->expression_postfix_binary.po == MO_POSTFIX_ARROW))
+	{
+		if(!vm_path(node->expression_postfix_binary.left, buffer, size, length)) return false;
+		if(*length + 1 >= size) return false;
+		buffer[(*length)++] = '.';
+		name = node->expression_postfix_binary.right->expression_primary.data;
+	} else if(node->kind == MO_AST_EXPRESSION_PRIMARY_IDENTIFIER || node->kind == MO_AST_CONSTANT_ENUMARATION) {
+		name = node->expression_primary.data;
+	} else {
+		return false;
+	}
+	if(*length + name->length >= size) return false;
+	memcpy(buffer + *length, name->data, name->length);
+	*length += name->length;
+	buffer[*length] = 0;
+	return true;
+}
+
+// Binding names may spell members with -> as well as .
+static bool
+vm_path_equal(const char* binding, const char* path) {
+	while(*path) {
+		if(*path == '.' && binding[0] == '-' && binding[1] == '>') {
+			binding += 2;
+			path++;
+		} else if(*binding++ != *path++) {
+			return false;
+		}
+	}
+	return *binding == 0;
+}
+
+// Slot of the binding an identifier or member path refers to, -1 if none
+static s32
+vm_binding(Vm_Compiler* c, MO_Ast* node, char* path, s32 path_size) {
+	s32 length = 0;
+	if(!vm_path(node, path, path_size, &length)) return -1;
+	for(s32 i = 0; i < c->binding_count; ++i) {
+		if(vm_path_equal(c->bindings[i].name, path)) return i;
+	}
+	vm_error(c, "'%s' is not bound", path);
+	return -1;
+}
+
+// Type of the value of a cast, false for casts to anything but arithmetic types.
+// bits is the width integers are cut to.
+static bool
+vm_cast_type(MO_Ast* type_name, MO_Value_Type* type, s32* bits, bool* is_unsigned) {
+	MO_Ast* sq = type_name->type_name.qualifiers_specifiers;
+	MO_Ast* decl = type_name->type_name.abstract_declarator;
+	if(decl && decl->abstract_type_decl.pointer) return false;
+	if(decl && decl->abstract_type_decl.direct_abstract_decl) {
+		MO_Ast* direct = decl->abstract_type_decl.direct_abstract_decl;
+		if(direct->direct_abstract_decl.type != MO_DIRECT_ABSTRACT_DECL_NONE || direct->direct_abstract_decl.left_opt)
+			return false;
+	}
+	if(!sq) return false;
+	if(sq->specifier_qualifier.kind != MO_TYPE_PRIMITIVE) return false;
+
+	MO_Type_Primitive* p = sq->specifier_qualifier.primitive;
+	*is_unsigned = p[MO_TYPE_PRIMITIVE_UNSIGNED] > 0;
+	if(p[MO_TYPE_PRIMITIVE_FLOAT] || p[MO_TYPE_PRIMITIVE_DOUBLE]) {
+		*type = MO_VALUE_FLOAT;
+		*bits = 64;
+	} else {
+		*type = MO_VALUE_INT;
+		if(p[MO_TYPE_PRIMITIVE_CHAR]) *bits = 8;
+		else if(p[MO_TYPE_PRIMITIVE_SHORT]) *bits = 16;
+		else if(p[MO_TYPE_PRIMITIVE_LONG]) *bits = 64;
+		else *bits = 32;
+	}
+	return true;
+}
+
+// Value of a character constant, the lexer does not decode them
+static s64
+vm_char_value(MO_Token* t) {
+	const u8* at = t->data + 1;
+	const u8* end = t->data + t->length - 1;
+	if(at >= end) return 0;
+	if(*at != '\\') return (s8)*at;
+
+	++at;
+	s64 value = 0;
+	switch(*at) {
+		case 'n': return '\n';
+		case 't': return '\t';
+		case 'r': return '\r';
+		case 'a': return '\a';
+		case 'b': return '\b';
+		case 'f': return '\f';
+		case 'v': return '\v';
+		case 'x':
+			for(++at; at < end; ++at) {
+				u8 d = (*at <= '9') ? (*at - '0') : ((*at | 0x20) - 'a' + 10);
+				value = value * 16 + d;
+			}
+			return (s8)value;
+		default:
+			if(*at < '0' || *at > '7') return *at; // \\ \' \" \?
+			for(; at < end && *at >= '0' && *at <= '7'; ++at)
+				value = value * 8 + (*at - '0');
+			return (s8)value;
+	}
+}
+
+static s64
+vm_truncate(s64 value, s32 bits, bool is_unsigned) {
+	if(bits >= 64) return value;
+	u64 mask = (1ull << bits) - 1;
+	u64 v = (u64)value & mask;
+	if(!is_unsigned && (v >> (bits - 1))) v |= ~mask;
+	return (s64)v;
+}
+
+// Type of the value of an expression without compiling it, errors are left to vm_compile
+static MO_Value_Type
+vm_type(Vm_Compiler* c, MO_Ast* node) {
+	switch(node->kind) {
+		case MO_AST_CONSTANT_FLOATING_POINT:
+			return MO_VALUE_FLOAT;
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_EXPRESSION_POSTFIX_BINARY: {
+			char path[256];
+			s32 length = 0;
+			MO_Ast* target = node;
+			if(node->kind == MO_AST_EXPRESSION_POSTFIX_BINARY && node->expression_postfix_binary.po == MO_POSTFIX_ARRAY_ACCESS)
+				target = node->expression_postfix_binary.left;
+			if(!vm_path(target, path, sizeof(path), &length)) return MO_VALUE_INT;
+			for(s32 i = 0; i < c->binding_count; ++i) {
+				if(!vm_path_equal(c->bindings[i].name, path)) continue;
+				MO_Value_Type t = c->bindings[i].type;
+				return (t == MO_VALUE_FLOAT || t == MO_VALUE_FLOAT_ARRAY) ? MO_VALUE_FLOAT : MO_VALUE_INT;
+			}
+			return MO_VALUE_INT;
+		}
+		case MO_AST_EXPRESSION_UNARY:
+			if(node->expression_unary.uo == MO_UNOP_PLUS || node->expression_unary.uo == MO_UNOP_MINUS)
+				return vm_type(c, node->expression_unary.expr);
+			return MO_VALUE_INT;
+		case MO_AST_EXPRESSION_CAST: {
+			MO_Value_Type type = MO_VALUE_INT;
+			s32 bits;
+			bool is_unsigned;
+			vm_cast_type(node->expression_cast.type_name, &type, &bits, &is_unsigned);
+			return type;
+		}
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE: {
+			MO_Value_Type l = vm_type(c, node->expression_binary.left);
+			MO_Value_Type r = vm_type(c, node->expression_binary.right);
+			return (l == MO_VALUE_FLOAT || r == MO_VALUE_FLOAT) ? MO_VALUE_FLOAT : MO_VALUE_INT;
+		}
+		case MO_AST_EXPRESSION_CHAIN: {
+			if(node->expression_chain.operator_kind != MO_AST_EXPRESSION_ADDITIVE && node->expression_chain.operator_kind != MO_AST_EXPRESSION_MULTIPLICATIVE)
+				return MO_VALUE_INT;
+			MO_Ast** operands = node->expression_chain.operands;
+			for(u64 i = 0; i < array_length(operands); ++i) {
+				if(vm_type(c, operands[i]) == MO_VALUE_FLOAT) return MO_VALUE_FLOAT;
+			}
+			return MO_VALUE_INT;
+		}
+		case MO_AST_EXPRESSION_TERNARY: {
+			MO_Value_Type t = vm_type(c, node->expression_ternary.case_true);
+			MO_Value_Type f = vm_type(c, node->expression_ternary.case_false);
+			return (t == MO_VALUE_FLOAT || f == MO_VALUE_FLOAT) ? MO_VALUE_FLOAT : MO_VALUE_INT;
+		}
+		default:
+			return MO_VALUE_INT;
+	}
+}
+
+static Vm_Operand vm_compile(Vm_Compiler* c, MO_Ast* node);
+
+// Compiles node only to report its errors, && || and ?: still check the
+// operand they fold away.
+static void
+vm_compile_discard(Vm_Compiler* c, MO_Ast* node) {
+	u64 length = array_length(c->code);
+	s32 top = c->top;
+	vm_compile(c, node);
+	array_length(c->code) = length;
+	c->top = top;
+}
+
+static Vm_Operand
+vm_compile_binary(Vm_Compiler* c, MO_Binary_Operator bo, Vm_Operand l, MO_Ast* right, s32 base) {
+	Vm_Operand r = vm_compile(c, right);
+	if(c->failed) return l;
+
+	MO_Value_Type type = (l.type == MO_VALUE_FLOAT || r.type == MO_VALUE_FLOAT) ? MO_VALUE_FLOAT : MO_VALUE_INT;
+	s32 op = vm_binary_op(bo, type);
+	if(op < 0) {
+		vm_error(c, "operator needs integer operands");
+		return l;
+	}
+	vm_convert(c, &l, type);
+	vm_convert(c, &r, type);
+	MO_Value_Type result_type = vm_is_compare(op) ? MO_VALUE_INT : type;
+
+	if(l.kind == VM_OPERAND_CONSTANT && r.kind == VM_OPERAND_CONSTANT) {
+		Vm_Register value;
+		if(vm_fold(op, l.value, r.value, &value)) {
+			if(result_type == MO_VALUE_FLOAT) return vm_float_constant(value.f);
+			Vm_Operand o = vm_int_constant(value.i);
+			return o;
+		}
+	}
+	if(l.kind == VM_OPERAND_CONSTANT && r.kind == VM_OPERAND_REGISTER && vm_swapped(op) >= 0) {
+		Vm_Operand t = l;
+		l = r;
+		r = t;
+		op = vm_swapped(op);
+	}
+	if(l.kind == VM_OPERAND_CONSTANT) {
+		// a right operand in a register is in base
+		vm_to_register(c, &l, (r.kind == VM_OPERAND_REGISTER) ? vm_register(c) : base);
+	}
+
+	if(r.kind == VM_OPERAND_CONSTANT) {
+		vm_emit(c, op + 1, base, l.index, 0, vm_constant(c, r.value));
+	} else {
+		vm_emit(c, op, base, l.index, r.index, 0);
+	}
+	Vm_Operand o = { VM_OPERAND_REGISTER, result_type };
+	o.index = base;
+	o.is_bool = vm_is_compare(op);
+	return o;
+}
+
+// a && b is 0 when a is 0 and b is not evaluated, otherwise it is b != 0
+static Vm_Operand
+vm_compile_logical(Vm_Compiler* c, Vm_Operand l, MO_Ast* right, s32 base, bool is_and) {
+	if(l.kind == VM_OPERAND_CONSTANT) {
+		bool value = (l.type == MO_VALUE_FLOAT) ? (l.value.f != 0.0) : (l.value.i != 0);
+		if(value != is_and) {
+			// 0 && b, 1 || b
+			vm_compile_discard(c, right);
+			return vm_int_constant(value);
+		}
+		Vm_Operand r = vm_compile(c, right);
+		if(c->failed) return r;
+		if(r.kind == VM_OPERAND_CONSTANT) {
+			return vm_int_constant((r.type == MO_VALUE_FLOAT) ? (r.value.f != 0.0) : (r.value.i != 0));
+		}
+		vm_to_bool(c, &r, base);
+		return r;
+	}
+
+	vm_to_bool(c, &l, base);
+	s32 jump = vm_emit(c, is_and ? VM_JZ : VM_JNZ, 0, base, 0, 0);
+	// l is not needed past the jump
+	c->top = base;
+	Vm_Operand r = vm_compile(c, right);
+	if(c->failed) return r;
+	vm_to_bool(c, &r, base);
+	c->code[jump].imm = (s32)array_length(c->code);
+	return r;
+}
+
+// Folds the operands left to right like the binary nodes the chain stands for,
+// without recursing once per operand.
+static Vm_Operand
+vm_compile_chain(Vm_Compiler* c, MO_Ast* node, s32 base) {
+	MO_Ast** operands = node->expression_chain.operands;
+	MO_Node_Kind kind = node->expression_chain.operator_kind;
+	Vm_Operand result = vm_compile(c, operands[0]);
+	for(u64 i = 1; i < array_length(operands) && !c->failed; ++i) {
+		// what was folded so far is in base when it is in a register
+		c->top = base + (result.kind == VM_OPERAND_REGISTER);
+		if(kind == MO_AST_EXPRESSION_LOGICAL_AND || kind == MO_AST_EXPRESSION_LOGICAL_OR)
+			result = vm_compile_logical(c, result, operands[i], base, kind == MO_AST_EXPRESSION_LOGICAL_AND);
+		else
+			result = vm_compile_binary(c, node->expression_chain.bo, result, operands[i], base);
+	}
+	return result;
+}
+
+static Vm_Operand
+vm_compile_ternary(Vm_Compiler* c, MO_Ast* node, s32 base) {
+	MO_Ast* t = node->expression_ternary.case_true;
+	MO_Ast* f = node->expression_ternary.case_false;
+	MO_Value_Type type = vm_type(c, node);
+
+	Vm_Operand cond = vm_compile(c, node->expression_ternary.condition);
+	if(c->failed) return cond;
+
+	if(cond.kind == VM_OPERAND_CONSTANT) {
+		bool value = (cond.type == MO_VALUE_FLOAT) ? (cond.value.f != 0.0) : (cond.value.i != 0);
+		c->top = base;
+		vm_compile_discard(c, value ? f : t);
+		Vm_Operand o = vm_compile(c, value ? t : f);
+		vm_convert(c, &o, type);
+		return o;
+	}
+
+	// an integer is its own truth value
+	if(cond.type == MO_VALUE_FLOAT) vm_to_bool(c, &cond, base);
+	s32 to_false = vm_emit(c, VM_JZ, 0, cond.index, 0, 0);
+
+	c->top = base;
+	Vm_Operand o = vm_compile(c, t);
+	if(c->failed) return o;
+	vm_to_register(c, &o, base);
+	vm_convert(c, &o, type);
+	bool is_bool = o.is_bool;
+	s32 to_end = vm_emit(c, VM_JMP, 0, 0, 0, 0);
+	c->code[to_false].imm = (s32)array_length(c->code);
+
+	c->top = base;
+	o = vm_compile(c, f);
+	if(c->failed) return o;
+	vm_to_register(c, &o, base);
+	vm_convert(c, &o, type);
+	c->code[to_end].imm = (s32)array_length(c->code);
+
+	o.is_bool = o.is_bool && is_bool;
+	return o;
+}
+
+// Compiles node with its result in register c->top (which stays taken) or as a
+// constant. The first operand of a node is compiled into the node's own register.
+static Vm_Operand
+vm_compile(Vm_Compiler* c, MO_Ast* node) {
+	s32 base = c->top;
+	Vm_Operand result = { VM_OPERAND_REGISTER, MO_VALUE_INT };
+	result.index = base;
+	if(base >= VM_MAX_REGISTERS) vm_error(c, "expression needs more than %d registers", VM_MAX_REGISTERS);
+	if(c->failed) return result;
+
+	switch(node->kind) {
+		case MO_AST_CONSTANT_INTEGER:
+			result = vm_int_constant((s64)node->expression_primary.data->int_value);
+			break;
+		case MO_AST_CONSTANT_CHARACTER:
+			result = vm_int_constant(vm_char_value(node->expression_primary.data));
+			break;
+		case MO_AST_CONSTANT_FLOATING_POINT:
+			result = vm_float_constant(node->expression_primary.data->float_value);
+			break;
+
+		case MO_AST_EXPRESSION_PRIMARY_IDENTIFIER:
+		case MO_AST_CONSTANT_ENUMARATION:
+		case MO_AST_EXPRESSION_POSTFIX_BINARY: {
+			char path[256];
+			bool is_index = (node->kind == MO_AST_EXPRESSION_POSTFIX_BINARY &&
+				node->expression_postfix_binary.po == MO_POSTFIX_ARRAY_ACCESS);
+			MO_Ast* target = is_index ? node->expression_postfix_binary.left : node;
+			if(node->kind == MO_AST_EXPRESSION_POSTFIX_BINARY && node->expression_postfix_binary.po == MO_POSTFIX_PROC_CALL) {
+				vm_error(c, "function calls cannot be evaluated");
+				break;
+			}
+			s32 slot = vm_binding(c, target, path, sizeof(path));
+			if(slot < 0) {
+				vm_error(c, "only bound names, their members and [] of them can be evaluated");
+				break;
+			}
+			MO_Value_Type type = c->bindings[slot].type;
+			bool is_array = (type == MO_VALUE_INT_ARRAY || type == MO_VALUE_FLOAT_ARRAY);
+			if(is_array != is_index) {
+				vm_error(c, is_array ? "'%s' is an array and has to be indexed" : "'%s' is not an array", path);
+				break;
+			}
+			if(is_index) {
+				Vm_Operand index = vm_compile(c, node->expression_postfix_binary.right);
+				if(c->failed) break;
+				if(index.type != MO_VALUE_INT) {
+					vm_error(c, "array index of '%s' is not an integer", path);
+					break;
+				}
+				if(index.kind == VM_OPERAND_CONSTANT) vm_to_register(c, &index, base);
+				vm_emit(c, VM_INDEX, base, index.index, 0, slot);
+				result.type = (type == MO_VALUE_FLOAT_ARRAY) ? MO_VALUE_FLOAT : MO_VALUE_INT;
+			} else {
+				vm_emit(c, VM_LOAD, base, 0, 0, slot);
+				result.type = type;
+			}
+		} break;
+
+		case MO_AST_EXPRESSION_UNARY: {
+			MO_Unary_Operator uo = node->expression_unary.uo;
+			if(uo != MO_UNOP_PLUS && uo != MO_UNOP_MINUS && uo != MO_UNOP_NOT_BITWISE && uo != MO_UNOP_NOT_LOGICAL) {
+				vm_error(c, "pointers, ++ and -- cannot be evaluated");
+				break;
+			}
+			Vm_Operand o = vm_compile(c, node->expression_unary.expr);
+			if(c->failed) break;
+			bool f = (o.type == MO_VALUE_FLOAT);
+			if(uo == MO_UNOP_NOT_BITWISE && f) {
+				vm_error(c, "operator ~ needs an integer operand");
+				break;
+			}
+			if(uo == MO_UNOP_PLUS) {
+				result = o;
+				result.is_bool = false;
+			} else if(o.kind == VM_OPERAND_CONSTANT) {
+				switch(uo) {
+					case MO_UNOP_MINUS:       result = f ? vm_float_constant(-o.value.f) : vm_int_constant((s64)(0 - (u64)o.value.i)); break;
+					case MO_UNOP_NOT_BITWISE: result = vm_int_constant(~o.value.i); break;
+					default:                  result = vm_int_constant(f ? (o.value.f == 0.0) : (o.value.i == 0)); break;
+				}
+			} else {
+				Vm_Op op;
+				switch(uo) {
+					case MO_UNOP_MINUS:       op = f ? VM_NEG_F : VM_NEG_I; break;
+					case MO_UNOP_NOT_BITWISE: op = VM_NOT_I; break;
+					default:                  op = f ? VM_LNOT_F : VM_LNOT_I; break;
+				}
+				vm_emit(c, op, base, o.index, 0, 0);
+				result.type = (uo == MO_UNOP_NOT_LOGICAL) ? MO_VALUE_INT : o.type;
+				result.is_bool = (uo == MO_UNOP_NOT_LOGICAL);
+			}
+		} break;
+
+		case MO_AST_EXPRESSION_CAST: {
+			MO_Value_Type type;
+			s32 bits;
+			bool is_unsigned;
+			if(!vm_cast_type(node->expression_cast.type_name, &type, &bits, &is_unsigned)) {
+				vm_error(c, "only casts to arithmetic types can be evaluated");
+				break;
+			}
+			Vm_Operand o = vm_compile(c, node->expression_cast.expression);
+			if(c->failed) break;
+			vm_convert(c, &o, type);
+			if(type == MO_VALUE_INT && bits < 64) {
+				if(o.kind == VM_OPERAND_CONSTANT) {
+					o = vm_int_constant(vm_truncate(o.value.i, bits, is_unsigned));
+				} else {
+					vm_emit(c, VM_TRUNC, o.index, o.index, is_unsigned, bits);
+					o.is_bool = false;
+				}
+			}
+			result = o;
+		} break;
+
+		case MO_AST_EXPRESSION_MULTIPLICATIVE:
+		case MO_AST_EXPRESSION_ADDITIVE:
+		case MO_AST_EXPRESSION_SHIFT:
+		case MO_AST_EXPRESSION_RELATIONAL:
+		case MO_AST_EXPRESSION_EQUALITY:
+		case MO_AST_EXPRESSION_AND:
+		case MO_AST_EXPRESSION_EXCLUSIVE_OR:
+		case MO_AST_EXPRESSION_INCLUSIVE_OR:
+			result = vm_compile(c, node->expression_binary.left);
+			if(!c->failed) result = vm_compile_binary(c, node->expression_binary.bo, result, node->expression_binary.right, base);
+			break;
+		case MO_AST_EXPRESSION_LOGICAL_AND:
+		case MO_AST_EXPRESSION_LOGICAL_OR:
+			result = vm_compile(c, node->expression_binary.left);
+			if(!c->failed) result = vm_compile_logical(c, result, node->expression_binary.right, base, node->kind == MO_AST_EXPRESSION_LOGICAL_AND);
+			break;
+		case MO_AST_EXPRESSION_CHAIN:
+			result = vm_compile_chain(c, node, base);
+			break;
+		case MO_AST_EXPRESSION_TERNARY:
+			result = vm_compile_ternary(c, node, base);
+			break;
+
+		case MO_AST_EXPRESSION_ASSIGNMENT:
+		case MO_AST_EXPRESSION_POSTFIX_UNARY:
+			vm_error(c, "assignments, ++ and -- cannot be evaluated");
+			break;
+		case MO_AST_EXPRESSION_PRIMARY_STRING_LITERAL:
+			vm_error(c, "string literals cannot be evaluated");
+			break;
+		default:
+			vm_error(c, "sizeof and comma expressions cannot be evaluated");
+			break;
+	}
+
+	// everything the subtree used above base is free again
+	c->top = base;
+	if(result.kind == VM_OPERAND_REGISTER && !c->failed) {
+		vm_to_register(c, &result, base);
+		c->top = base + 1;
+		c->register_count = MAX(c->register_count, c->top);
+	}
+	return result;
+}
+
+MO_Program*
+mop_program_compile(MO_Ast* expr, const MO_Binding* bindings, int binding_count, MO_Allocator* allocator, const char** error_message) {
+	Vm_Compiler c = {0};
+	c.code = array_new_with(Vm_Instruction, allocator);
+	c.constants = array_new_with(Vm_Register, allocator);
+	c.bindings = bindings;
+	c.binding_count = binding_count;
+
+	if(!expr) vm_error(&c, "no expression");
+	Vm_Operand result = { VM_OPERAND_REGISTER, MO_VALUE_INT };
+	if(!c.failed) result = vm_compile(&c, expr);
+	if(!c.failed) {
+		vm_to_register(&c, &result, 0);
+		vm_emit(&c, VM_RET, 0, 0, 0, 0);
+	}
+
+	MO_Program* program = 0;
+	if(!c.failed) {
+		program = mem_alloc(allocator, sizeof(MO_Program));
+		program->allocator = allocator;
+		program->code_length = (s32)array_length(c.code);
+		program->code = mem_alloc(allocator, program->code_length * sizeof(Vm_Instruction));
+		memcpy(program->code, c.code, program->code_length * sizeof(Vm_Instruction));
+		program->constant_count = (s32)array_length(c.constants);
+		program->constants = mem_alloc(allocator, MAX(1, program->constant_count) * sizeof(Vm_Register));
+		memcpy(program->constants, c.constants, program->constant_count * sizeof(Vm_Register));
+		program->register_count = MAX(1, c.register_count);
+		program->binding_count = binding_count;
+		program->result_type = result.type;
+	}
+	if(error_message) *error_message = c.failed ? parser_error_buffer : 0;
+
+	array_free(c.code);
+	array_free(c.constants);
+	return program;
+}
+
+void
+mop_program_free(MO_Program* program) {
+	if(!program) return;
+	MO_Allocator* allocator = program->allocator;
+	platform_code_free((void*)program->native, program->native_size);
+	mem_free(allocator, program->code, program->code_length * sizeof(Vm_Instruction));
+	mem_free(allocator, program->constants, MAX(1, program->constant_count) * sizeof(Vm_Register));
+	mem_free(allocator, program, sizeof(MO_Program));
+}
+
+MO_Value_Type
+mop_program_result_type(const MO_Program* program) {
+	return program->result_type;
+}
+
+// VM
+
+// Threaded dispatch where the compiler has computed gotos, a switch elsewhere.
+#if defined(__GNUC__)
+#define VM_CASE(NAME) L_##NAME:
+#define VM_NEXT       goto *labels[(++ip)->op]
+#define VM_JUMP(TO)   { ip = code + (TO); goto *labels[ip->op]; }
+#else
+#define VM_CASE(NAME) case NAME:
+#define VM_NEXT       ++ip; continue
+#define VM_JUMP(TO)   { ip = code + (TO); continue; }
+#endif
+
+MO_Eval_Status
+mop_program_eval(const MO_Program* program, const MO_Value* values, MO_Value* result) {
+	if(program->native) return program->native(values, result, program->constants);
+
+	Vm_Register r[VM_MAX_REGISTERS];
+	const Vm_Instruction* code = program->code;
+	const Vm_Register* k = program->constants;
+	const Vm_Instruction* ip = code;
+
+#if defined(__GNUC__)
+	static void* labels[VM_OP_COUNT] = {
+#define OP(NAME) [VM_##NAME] = &&L_VM_##NAME,
+		VM_OPS
+#undef OP
+#define INT_OP(NAME, EXPR) [VM_##NAME##_I] = &&L_VM_##NAME##_I, [VM_##NAME##_IK] = &&L_VM_##NAME##_IK,
+		VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) [VM_##NAME##_F] = &&L_VM_##NAME##_F, [VM_##NAME##_FK] = &&L_VM_##NAME##_FK,
+		VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) [VM_##NAME##_F] = &&L_VM_##NAME##_F, [VM_##NAME##_FK] = &&L_VM_##NAME##_FK,
+		VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+	};
+	goto *labels[ip->op];
+#else
+	for(;;) switch(ip->op) {
+#endif
+
+	VM_CASE(VM_MOV)   r[ip->dst] = r[ip->a]; VM_NEXT;
+	VM_CASE(VM_CONST) r[ip->dst] = k[ip->imm]; VM_NEXT;
+	VM_CASE(VM_LOAD)  r[ip->dst].i = values[ip->imm].i; VM_NEXT;
+	VM_CASE(VM_INDEX) {
+		const MO_Value* v = &values[ip->imm];
+		u64 i = (u64)r[ip->a].i;
+		if(i >= (u64)v->array.count) return MO_EVAL_INDEX_OUT_OF_RANGE;
+		r[ip->dst] = ((const Vm_Register*)v->array.data)[i];
+	} VM_NEXT;
+	VM_CASE(VM_I2F)    r[ip->dst].f = (r64)r[ip->a].i; VM_NEXT;
+	VM_CASE(VM_F2I)    r[ip->dst].i = (s64)r[ip->a].f; VM_NEXT;
+	VM_CASE(VM_TRUNC)  r[ip->dst].i = vm_truncate(r[ip->a].i, ip->imm, ip->b); VM_NEXT;
+	VM_CASE(VM_NEG_I)  r[ip->dst].i = (s64)(0 - (u64)r[ip->a].i); VM_NEXT;
+	VM_CASE(VM_NEG_F)  r[ip->dst].f = -r[ip->a].f; VM_NEXT;
+	VM_CASE(VM_NOT_I)  r[ip->dst].i = ~r[ip->a].i; VM_NEXT;
+	VM_CASE(VM_LNOT_I) r[ip->dst].i = (r[ip->a].i == 0); VM_NEXT;
+	VM_CASE(VM_LNOT_F) r[ip->dst].i = (r[ip->a].f == 0.0); VM_NEXT;
+	VM_CASE(VM_BOOL_I) r[ip->dst].i = (r[ip->a].i != 0); VM_NEXT;
+	VM_CASE(VM_BOOL_F) r[ip->dst].i = (r[ip->a].f != 0.0); VM_NEXT;
+	VM_CASE(VM_DIV_I) {
+		s64 x = r[ip->a].i, y = r[ip->b].i;
+		if(y == 0) return MO_EVAL_DIVISION_BY_ZERO;
+		r[ip->dst].i = (y == -1) ? (s64)(0 - (u64)x) : x / y;
+	} VM_NEXT;
+	VM_CASE(VM_DIV_IK) {
+		s64 x = r[ip->a].i, y = k[ip->imm].i;
+		if(y == 0) return MO_EVAL_DIVISION_BY_ZERO;
+		r[ip->dst].i = (y == -1) ? (s64)(0 - (u64)x) : x / y;
+	} VM_NEXT;
+	VM_CASE(VM_MOD_I) {
+		s64 x = r[ip->a].i, y = r[ip->b].i;
+		if(y == 0) return MO_EVAL_DIVISION_BY_ZERO;
+		r[ip->dst].i = (y == -1) ? 0 : x % y;
+	} VM_NEXT;
+	VM_CASE(VM_MOD_IK) {
+		s64 x = r[ip->a].i, y = k[ip->imm].i;
+		if(y == 0) return MO_EVAL_DIVISION_BY_ZERO;
+		r[ip->dst].i = (y == -1) ? 0 : x % y;
+	} VM_NEXT;
+	VM_CASE(VM_JMP) VM_JUMP(ip->imm);
+	VM_CASE(VM_JZ)  if(r[ip->a].i == 0) VM_JUMP(ip->imm); VM_NEXT;
+	VM_CASE(VM_JNZ) if(r[ip->a].i != 0) VM_JUMP(ip->imm); VM_NEXT;
+	VM_CASE(VM_RET) result->i = r[ip->a].i; return MO_EVAL_OK;
+
+#define INT_OP(NAME, EXPR) \
+	VM_CASE(VM_##NAME##_I)  { s64 x = r[ip->a].i, y = r[ip->b].i; r[ip->dst].i = EXPR; } VM_NEXT; \
+	VM_CASE(VM_##NAME##_IK) { s64 x = r[ip->a].i, y = k[ip->imm].i; r[ip->dst].i = EXPR; } VM_NEXT;
+	VM_INT_OPS
+#undef INT_OP
+#define FLOAT_OP(NAME, EXPR) \
+	VM_CASE(VM_##NAME##_F)  { r64 x = r[ip->a].f, y = r[ip->b].f; r[ip->dst].f = EXPR; } VM_NEXT; \
+	VM_CASE(VM_##NAME##_FK) { r64 x = r[ip->a].f, y = k[ip->imm].f; r[ip->dst].f = EXPR; } VM_NEXT;
+	VM_FLOAT_OPS
+#undef FLOAT_OP
+#define FLOAT_COMPARE_OP(NAME, EXPR) \
+	VM_CASE(VM_##NAME##_F)  { r64 x = r[ip->a].f, y = r[ip->b].f; r[ip->dst].i = EXPR; } VM_NEXT; \
+	VM_CASE(VM_##NAME##_FK) { r64 x = r[ip->a].f, y = k[ip->imm].f; r[ip->dst].i = EXPR; } VM_NEXT;
+	VM_FLOAT_COMPARE_OPS
+#undef FLOAT_COMPARE_OP
+
+#if !defined(__GNUC__)
+	default: return MO_EVAL_OK;
+	}
+#endif
+}
+
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_JUMP